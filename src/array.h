@@ -2,6 +2,7 @@
 #define ARRAY_H
 
 #include <stdlib.h>
+#include <string.h>
 #include <initializer_list>
 #include <assert.h>
 
@@ -43,6 +44,14 @@ public:
         return &data[count - 1];
     }
 
+    void append(T *elements, size_t num_elements) {
+        if (count + num_elements > capacity) {
+            grow(num_elements);
+        }
+        memcpy(data + count, elements, num_elements * sizeof(T));
+        count += num_elements;
+    }
+
     T &operator[](size_t index) {
         assert(index < count);
         return data[index];
@@ -86,7 +95,7 @@ public:
     }
 
     void swap(Array<T> &x) {
-        Array<T> temp(this);
+        Array<T> temp(*this);
         data = x.data;
         count = x.count;
         capacity = x.capacity;
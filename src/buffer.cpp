@@ -1,12 +1,52 @@
 #include "buffer.h"
 #include "types.h"
 #include "platform.h"
+#include "regex.h"
+#include "utf8.h"
+#include "thread_pool.h"
+#include "simple_math.h"
+#include "index_cache.h"
+#include "journal.h"
+#include "compress.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
-#define DEFAULT_GAP_SIZE 1024
+#define INDEX_BLOCK_SIZE (4LL * 1024 * 1024)
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#include <emmintrin.h>
+#define BUFFER_SSE2 1
+#endif
+
+// Line starts found by the indexer job in one block of the file
+struct Index_Block {
+    Line_Index line_starts;
+    Array<int64> utf8_lines;
+    int64 end; // scanning stopped here, a line break pair can run one byte past the block
+    uint8 high_bits; // of the line still open at end
+    volatile int64 done;
+};
+
+// The job scans the blocks in order and the main thread merges the finished
+// prefix into the buffer's line index. Everything before end is merged.
+struct Line_Indexer {
+    Buffer *buffer;
+    int64 version;
+    int64 size;
+    Index_Block *blocks;
+    int64 block_count;
+    int64 published;
+    int64 start;
+    int64 end;
+    int64 line;
+    uint8 high_bits;
+    File_Attributes attributes; // for the index cache
+    bool extendable;
+    volatile int64 cancelled;
+    volatile int64 finished;
+};
 
 #define PTR_IN_GAP(Ptr, Buffer) (Ptr >= Buffer->text + Buffer->gap_start && Ptr < Buffer->text + Buffer->gap_end)
 #define GAP_SIZE(Buffer) (Buffer->gap_end - Buffer->gap_start)
@@ -14,6 +54,46 @@
 
 void buffer_update_line_starts(Buffer *buffer);
 
+// Main thread only. Readers that started against the old version are waited
+// out, readers that start later see the new version and back off.
+void buffer_begin_edit(Buffer *buffer) {
+    if (buffer->compressed) buffer_decompress(buffer);
+    atomic_add64(&buffer->version, 1);
+    while (buffer->readers > 0) {
+        yield_thread();
+    }
+    // The indexer assumes the file text never moves
+    if (buffer->indexer) buffer_index_finish(buffer);
+}
+
+void buffer_add_listener(Buffer *buffer, Lines_Changed_Proc proc, void *data) {
+    Buffer_Listener listener = { proc, data };
+    buffer->listeners.push(listener);
+}
+
+void buffer_remove_listener(Buffer *buffer, void *data) {
+    for (size_t i = 0; i < buffer->listeners.count; i++) {
+        if (buffer->listeners[i].data == data) {
+            buffer->listeners[i] = buffer->listeners.back();
+            buffer->listeners.pop();
+            return;
+        }
+    }
+}
+
+bool buffer_begin_read(Buffer *buffer, int64 version) {
+    atomic_add64(&buffer->readers, 1);
+    if (buffer->version != version) {
+        atomic_add64(&buffer->readers, -1);
+        return false;
+    }
+    return true;
+}
+
+void buffer_end_read(Buffer *buffer) {
+    atomic_add64(&buffer->readers, -1);
+}
+
 String buffer_to_string(Buffer *buffer) {
     int64 buffer_length = buffer_get_length(buffer);
     String result{};
@@ -30,12 +110,10 @@ String buffer_to_string_span(Buffer *buffer, Span span) {
     int64 span_length = span.end - span.start;
     assert(span.start >= 0 && span.end >= 0);
     assert(span_length >= 0);
-    if (span.end < buffer_get_length(buffer)) {
+    if (span.end <= buffer_get_length(buffer)) {
         result.data = (char *)malloc(span_length + 1);
         result.data[span_length] = 0;
-        for (int64 i = 0; i < span_length; i++) {
-            result.data[i] = buffer_at(buffer, span.start + i);
-        }
+        buffer_copy_span(buffer, span, result.data);
     }
     result.count = span_length;
     return result;
@@ -50,7 +128,6 @@ String buffer_to_string_apply_line_endings(Buffer *buffer) {
     char *dest = buffer_string.data;
     for (int64 position = 0; position < buffer_length; position++) {
         char c = buffer_at(buffer, position);
-        assert(c >= 0 && c <= 127);
         if (c == '\n') {
             switch (buffer->line_ending) {
             case LINE_ENDING_LF:
@@ -133,6 +210,8 @@ Line_Ending detect_line_ending(String string) {
     return LINE_ENDING_LF;
 }
 
+static void buffer_index_start(Buffer *buffer, File_Attributes attributes, bool extendable);
+
 Buffer *make_buffer(const char *file_name) {
     Buffer *buffer = new Buffer();
     buffer->file_name = file_name;
@@ -143,20 +222,40 @@ Buffer *make_buffer(const char *file_name) {
     buffer_update_line_starts(buffer);
     buffer->post_self_insert_hook = nullptr;
     buffer->line_ending = LINE_ENDING_LF;
+    buffer->encoding = TEXT_ENCODING_UTF8;
     return buffer;
 }
 
+// Turns the bytes of a file into text the way buffers hold it, UTF-8 with LF
+// line breaks. The result is data itself when nothing had to change.
+String text_from_file_data(char *data, int64 count, Text_Encoding *out_encoding, Line_Ending *out_line_ending) {
+    String text = { data, count };
+    Text_Encoding encoding = detect_encoding(data, count);
+    if (encoding != TEXT_ENCODING_UTF8) {
+        text = decode_text(encoding, data, count);
+    }
+    Line_Ending line_ending = detect_line_ending(text);
+    if (line_ending != LINE_ENDING_LF) {
+        String adjusted{};
+        remove_crlf(text.data, text.count, &adjusted.data, &adjusted.count);
+        if (text.data != data) free(text.data);
+        text = adjusted;
+    }
+    if (out_encoding) *out_encoding = encoding;
+    if (out_line_ending) *out_line_ending = line_ending;
+    return text;
+}
+
 Buffer *make_buffer_from_file(const char *file_name) {
     Read_File file = open_entire_file(file_name);
     assert(file.data);
-    String buffer_string = { (char *)file.data, file.count };
-    Line_Ending line_ending = detect_line_ending(buffer_string);
-    if (line_ending != LINE_ENDING_LF) {
-        String adjusted{};
-        remove_crlf(buffer_string.data, buffer_string.count, &adjusted.data, &adjusted.count);
-        free(file.data);
-        buffer_string = adjusted;
+    Text_Encoding encoding;
+    Line_Ending line_ending;
+    String buffer_string = text_from_file_data((char *)file.data, file.count, &encoding, &line_ending);
+    if (encoding != TEXT_ENCODING_UTF8) {
+        printf("%s: decoding from %s\n", file_name, encoding_name(encoding));
     }
+    if (buffer_string.data != file.data) free(file.data);
 
     Buffer *buffer = new Buffer();
     buffer->file_name = file_name;
@@ -165,9 +264,26 @@ Buffer *make_buffer_from_file(const char *file_name) {
     buffer->gap_end = 0;
     buffer->size = buffer_string.count;
     buffer->line_ending = line_ending;
-    buffer_update_line_starts(buffer);
+    buffer->encoding = encoding;
+    buffer->file_size = file.count;
     File_Attributes attribs = get_file_attributes(file_name);
+    if (buffer->size >= LARGE_FILE_SIZE) {
+        // Only untranslated text can have appended bytes indexed separately
+        bool extendable = encoding == TEXT_ENCODING_UTF8 && line_ending == LINE_ENDING_LF;
+        int64 cached = index_cache_load(buffer, attribs, extendable);
+        if (cached < 0) {
+            buffer->line_starts.reset_count();
+            buffer->line_starts.push(0);
+            buffer->utf8_lines.reset_count();
+        }
+        if (cached < buffer->size) {
+            buffer_index_start(buffer, attribs, extendable);
+        }
+    } else {
+        buffer_update_line_starts(buffer);
+    }
     buffer->last_write_time = attribs.last_write_time;
+    buffer->saved_version = buffer->version;
     buffer->post_self_insert_hook = nullptr;
     return buffer;
 }
@@ -191,11 +307,236 @@ char buffer_at(Buffer *buffer, int64 position) {
     return c;
 }
 
-void buffer_update_line_starts(Buffer *buffer) {
-    buffer->line_starts.reset_count();
-    buffer->line_starts.push(0);
-    
-    char *text = buffer->text;
+uint32 buffer_codepoint_at(Buffer *buffer, int64 position, int *length) {
+    char bytes[4];
+    int64 count = buffer_get_length(buffer) - position;
+    if (count > 4) count = 4;
+    for (int64 i = 0; i < count; i++) {
+        bytes[i] = buffer_at(buffer, position + i);
+    }
+    uint32 codepoint = 0;
+    int result = count > 0 ? utf8_decode(bytes, count, &codepoint) : 0;
+    if (length) *length = result;
+    return codepoint;
+}
+
+int64 buffer_next_codepoint(Buffer *buffer, int64 position) {
+    int length = 0;
+    buffer_codepoint_at(buffer, position, &length);
+    return position + length;
+}
+
+int64 buffer_prev_codepoint(Buffer *buffer, int64 position) {
+    if (position <= 0) return 0;
+    int64 start = position - 1;
+    int64 limit = position > 4 ? position - 4 : 0;
+    while (start > limit && utf8_is_continuation(buffer_at(buffer, start))) start--;
+    // A lead byte only counts when its sequence ends exactly here
+    int length = 0;
+    buffer_codepoint_at(buffer, start, &length);
+    if (start + length == position) return start;
+    return position - 1;
+}
+
+bool buffer_line_is_ascii(Buffer *buffer, int64 line) {
+    int64 lo = 0;
+    int64 hi = (int64)buffer->utf8_lines.count;
+    while (lo < hi) {
+        int64 mid = lo + (hi - lo) / 2;
+        if (buffer->utf8_lines.data[mid] < line) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo == (int64)buffer->utf8_lines.count || buffer->utf8_lines.data[lo] != line;
+}
+
+// Decodes in place on either side of the gap. Counts the codepoints that
+// start before end, or stops early once limit of them are counted, and
+// returns where the last one counted ends.
+static int64 buffer_walk_codepoints(Buffer *buffer, int64 start, int64 end, int64 limit, int64 *count) {
+    int64 position = start;
+    int64 result = 0;
+    while (position < end && result < limit) {
+        bool before_gap = position < buffer->gap_start;
+        char *text = buffer->text + (before_gap ? position : position + GAP_SIZE(buffer));
+        int64 available = (before_gap ? buffer->gap_start : BUFFER_SIZE(buffer)) - position;
+        int64 ascii = utf8_ascii_prefix(text, MIN(MIN(available, end - position), limit - result));
+        result += ascii;
+        position += ascii;
+        if (position >= end || result >= limit || ascii == available) continue;
+        // A sequence may run into the gap, those few bytes are read one at a time
+        int length;
+        if (available - ascii >= 4) {
+            uint32 codepoint;
+            length = utf8_decode(text + ascii, available - ascii, &codepoint);
+        } else {
+            buffer_codepoint_at(buffer, position, &length);
+        }
+        position += length;
+        result++;
+    }
+    *count = result;
+    return position;
+}
+
+// The line's checkpoints, taken over from the index used longest ago when it has none
+static Column_Index *buffer_column_index(Buffer *buffer, int64 line) {
+    Column_Index *result = &buffer->column_indexes[0];
+    for (int i = 0; i < BUFFER_COLUMN_INDEXES; i++) {
+        Column_Index *index = &buffer->column_indexes[i];
+        if (index->line == line) {
+            result = index;
+            break;
+        }
+        if (index->last_used < result->last_used) result = index;
+    }
+    if (result->line != line) {
+        result->line = line;
+        result->start = buffer->line_starts[line];
+        result->checkpoints.reset_count();
+        result->checkpoints.push({ 0, 0 });
+    }
+    result->last_used = ++buffer->column_clock;
+    return result;
+}
+
+// Adds checkpoints until the last one is within a checkpoint's distance
+// before offset or past column, or the line ends
+static void buffer_column_index_extend(Buffer *buffer, Column_Index *index, int64 length, int64 offset, int64 column) {
+    for (;;) {
+        Column_Checkpoint last = index->checkpoints.back();
+        if (last.offset > offset - BUFFER_COLUMN_CHECKPOINT || last.column > column || last.offset + BUFFER_COLUMN_CHECKPOINT >= length) break;
+        int64 count;
+        int64 end = buffer_walk_codepoints(buffer, index->start + last.offset, index->start + last.offset + BUFFER_COLUMN_CHECKPOINT, INT64_MAX, &count);
+        index->checkpoints.push({ end - index->start, last.column + count });
+    }
+}
+
+// Checkpoints before position survive an edit, the text before them is
+// unchanged. Lines from line on were rescanned, only the one holding the
+// edit keeps its index, and without a known edit position none of them do.
+static void buffer_columns_edited(Buffer *buffer, int64 line, int64 position) {
+    for (int i = 0; i < BUFFER_COLUMN_INDEXES; i++) {
+        Column_Index *index = &buffer->column_indexes[i];
+        if (index->line < line) continue;
+        size_t kept = 0;
+        if (position >= index->start && index->line < buffer_get_line_count(buffer) && buffer->line_starts[index->line] == index->start) {
+            while (kept < index->checkpoints.count && index->start + index->checkpoints[kept].offset <= position) {
+                kept++;
+            }
+        }
+        index->checkpoints.count = kept;
+        if (kept == 0) index->line = -1;
+    }
+}
+
+// Codepoint column of position, which must be on line
+int64 buffer_get_column(Buffer *buffer, int64 line, int64 position) {
+    int64 start = buffer->line_starts[line];
+    if (buffer_line_is_ascii(buffer, line)) return position - start;
+    int64 column;
+    if (position - start <= BUFFER_COLUMN_CHECKPOINT) {
+        buffer_walk_codepoints(buffer, start, position, INT64_MAX, &column);
+        return column;
+    }
+    Column_Index *index = buffer_column_index(buffer, line);
+    buffer_column_index_extend(buffer, index, buffer_get_line_length(buffer, line), position - start, INT64_MAX);
+    size_t lo = 0;
+    size_t hi = index->checkpoints.count - 1;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo + 1) / 2;
+        if (start + index->checkpoints[mid].offset <= position) {
+            lo = mid;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    Column_Checkpoint checkpoint = index->checkpoints[lo];
+    buffer_walk_codepoints(buffer, start + checkpoint.offset, position, INT64_MAX, &column);
+    return checkpoint.column + column;
+}
+
+// Position of the codepoint column on line, clamped to the end of the line
+int64 buffer_get_position_from_column(Buffer *buffer, int64 line, int64 column) {
+    int64 start = buffer->line_starts[line];
+    int64 length = buffer_get_line_length(buffer, line);
+    if (buffer_line_is_ascii(buffer, line)) return start + (column < length ? column : length);
+    int64 count;
+    if (length <= BUFFER_COLUMN_CHECKPOINT) return buffer_walk_codepoints(buffer, start, start + length, column, &count);
+    Column_Index *index = buffer_column_index(buffer, line);
+    buffer_column_index_extend(buffer, index, length, INT64_MAX, column);
+    size_t lo = 0;
+    size_t hi = index->checkpoints.count - 1;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo + 1) / 2;
+        if (index->checkpoints[mid].column <= column) {
+            lo = mid;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    Column_Checkpoint checkpoint = index->checkpoints[lo];
+    return buffer_walk_codepoints(buffer, start + checkpoint.offset, start + length, column - checkpoint.column, &count);
+}
+
+// Returns the text on either side of the gap, at most two chunks
+int buffer_get_chunks(Buffer *buffer, Buffer_Chunk *chunks) {
+    int count = 0;
+    if (buffer->gap_start > 0) {
+        chunks[count++] = { buffer->text, buffer->gap_start, 0 };
+    }
+    if (buffer->size - buffer->gap_end > 0) {
+        chunks[count++] = { buffer->text + buffer->gap_end, buffer->size - buffer->gap_end, buffer->gap_start };
+    }
+    return count;
+}
+
+static void buffer_notify_listeners(Buffer *buffer, int64 first_line, int64 end_line, int64 line_delta) {
+    for (size_t i = 0; i < buffer->listeners.count; i++) {
+        buffer->listeners[i].proc(buffer, first_line, end_line, line_delta, buffer->listeners[i].data);
+    }
+}
+
+// First entry of utf8_lines at or after line
+static size_t buffer_utf8_lines_lower_bound(Buffer *buffer, int64 line) {
+    size_t lo = 0;
+    size_t hi = buffer->utf8_lines.count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (buffer->utf8_lines.data[mid] < line) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+// Lines before line are unaffected by the edit, so only the rest is rescanned.
+// When the edit is known (new_count bytes at position replaced old_count bytes)
+// the rescan stops at the first line start past it that the old index also
+// has, everything after that only moved by the change in size.
+static void buffer_rescan_line_starts(Buffer *buffer, int64 line, int64 position, int64 old_count, int64 new_count) {
+    Line_Index *index = &buffer->line_starts;
+    if (line <= 0 || index->count < 2) {
+        line = 0;
+    } else if (line > (int64)index->count - 2) {
+        line = index->count - 2;
+    }
+    bool can_resync = position >= 0 && index->count >= 2;
+    int64 old_line_count = index->count > 0 ? index->count - 1 : 0;
+    int64 edit_end = position + new_count;
+    int64 shift = new_count - old_count;
+
+    Array<int64> starts; // after line
+    Array<int64> utf8_found;
+    int64 resync_line = -1;
+    uint8 high_bits = 0;
+
+    int64 start = index->count > 0 ? (*index)[line] : 0;
+    char *text = buffer->text + (start < buffer->gap_start ? start : start + GAP_SIZE(buffer));
     for (;;) {
         if (text >= buffer->text + buffer->size) break;
         if (PTR_IN_GAP(text, buffer)) {
@@ -206,62 +547,309 @@ void buffer_update_line_starts(Buffer *buffer) {
         bool newline = false;
         switch (*text) {
         default:
+            high_bits |= (uint8)*text;
             text++;
             break;
         case '\r':
             text++;
-            if (!PTR_IN_GAP(text, buffer) && (text < buffer->text + buffer->size)) {
-                if (*text == '\n') text++;
-            }
+            if (PTR_IN_GAP(text, buffer)) text = buffer->text + buffer->gap_end;
+            if (text < buffer->text + buffer->size && *text == '\n') text++;
             newline = true;
             break;
         case '\n':
             text++;
-            if (!PTR_IN_GAP(text, buffer) && (text < buffer->text + buffer->size)) {
-                if (*text == '\r') text++;
-            }
+            if (PTR_IN_GAP(text, buffer)) text = buffer->text + buffer->gap_end;
+            if (text < buffer->text + buffer->size && *text == '\r') text++;
             newline = true;
             break;
         }
         if (newline) {
-            int64 position = text - buffer->text;
-            position = buffer_position_logical(buffer, position);
-            buffer->line_starts.push(position);
+            if (high_bits & 0x80) utf8_found.push(line + starts.count);
+            high_bits = 0;
+            int64 line_start = text - buffer->text;
+            line_start = buffer_position_logical(buffer, line_start);
+            if (can_resync && line_start >= edit_end) {
+                int64 old_line = index->find(line_start - shift);
+                if (old_line > line && (*index)[old_line] == line_start - shift) {
+                    resync_line = old_line;
+                    break;
+                }
+            }
+            starts.push(line_start);
         }
     }
-    buffer->line_starts.push(BUFFER_SIZE(buffer) + 1);
+    if (resync_line < 0 && (high_bits & 0x80)) utf8_found.push(line + starts.count);
+
+    Line_Index tail;
+    size_t tail_from = 0;
+    Array<int64> utf8_tail;
+    int64 line_shift = line + 1 + (int64)starts.count - resync_line;
+    if (resync_line >= 0) {
+        tail_from = index->copy_tail(resync_line, &tail);
+        size_t first = buffer_utf8_lines_lower_bound(buffer, resync_line);
+        utf8_tail.append(buffer->utf8_lines.data + first, buffer->utf8_lines.count - first);
+    }
+
+    if (index->count == 0) {
+        index->push(0);
+    } else {
+        index->truncate(line + 1);
+    }
+    for (size_t i = 0; i < starts.count; i++) {
+        index->push(starts.data[i]);
+    }
+    buffer->utf8_lines.count = buffer_utf8_lines_lower_bound(buffer, line);
+    buffer->utf8_lines.append(utf8_found.data, utf8_found.count);
+    if (resync_line >= 0) {
+        index->append(&tail, tail_from, shift);
+        for (size_t i = 0; i < utf8_tail.count; i++) {
+            buffer->utf8_lines.push(utf8_tail.data[i] + line_shift);
+        }
+    } else {
+        index->push(BUFFER_SIZE(buffer) + 1);
+    }
+    tail.clear();
+    starts.clear();
+    utf8_found.clear();
+    utf8_tail.clear();
+
+    buffer_columns_edited(buffer, line, position);
+    if (resync_line >= 0) {
+        buffer_notify_listeners(buffer, line, resync_line + line_shift, line_shift);
+    } else {
+        buffer_notify_listeners(buffer, line, buffer_get_line_count(buffer), buffer_get_line_count(buffer) - old_line_count);
+    }
+}
+
+void buffer_update_line_starts_from(Buffer *buffer, int64 line) {
+    buffer_rescan_line_starts(buffer, line, -1, 0, 0);
+}
+
+static void buffer_update_line_starts_for_edit(Buffer *buffer, int64 position, int64 old_count, int64 new_count) {
+    int64 line = get_line_from_position(buffer, position) - 1;
+    buffer_rescan_line_starts(buffer, line, position, old_count, new_count);
 }
 
+void buffer_update_line_starts(Buffer *buffer) {
+    buffer_update_line_starts_from(buffer, 0);
+}
+
+// Scans text without a gap from start until at least end, line is the number
+// of the line open at start. Returns where scanning stopped.
+static int64 scan_line_starts(const char *text, int64 size, int64 start, int64 end, int64 *line, uint8 *high_bits, Line_Index *line_starts, Array<int64> *utf8_lines) {
+    int64 i = start;
+    while (i < end) {
+#ifdef BUFFER_SSE2
+        // Skip 16 bytes at a time when none of them ends a line
+        if (i + 16 <= end) {
+            __m128i block = _mm_loadu_si128((const __m128i *)(text + i));
+            __m128i breaks = _mm_or_si128(_mm_cmpeq_epi8(block, _mm_set1_epi8('\n')), _mm_cmpeq_epi8(block, _mm_set1_epi8('\r')));
+            if (_mm_movemask_epi8(breaks) == 0) {
+                if (_mm_movemask_epi8(block)) *high_bits |= 0x80;
+                i += 16;
+                continue;
+            }
+        }
+#endif
+        char c = text[i++];
+        if (c != '\n' && c != '\r') {
+            *high_bits |= (uint8)c;
+            continue;
+        }
+        char pair = c == '\n' ? '\r' : '\n';
+        if (i < size && text[i] == pair) i++;
+        if (*high_bits & 0x80) utf8_lines->push(*line);
+        *high_bits = 0;
+        (*line)++;
+        line_starts->push(i);
+    }
+    return i;
+}
+
+static void line_indexer_job(void *data) {
+    Line_Indexer *indexer = (Line_Indexer *)data;
+    Buffer *buffer = indexer->buffer;
+    int64 position = indexer->end;
+    int64 line = indexer->line;
+    uint8 high_bits = indexer->high_bits;
+    for (int64 i = 0; i < indexer->block_count; i++) {
+        if (indexer->cancelled) break;
+        if (!buffer_begin_read(buffer, indexer->version)) break;
+        Index_Block *block = &indexer->blocks[i];
+        int64 end = MIN(indexer->start + (i + 1) * INDEX_BLOCK_SIZE, indexer->size);
+        position = scan_line_starts(buffer->text, indexer->size, position, end, &line, &high_bits, &block->line_starts, &block->utf8_lines);
+        buffer_end_read(buffer);
+        block->end = position;
+        block->high_bits = high_bits;
+        atomic_add64(&block->done, 1);
+    }
+    atomic_add64(&indexer->finished, 1);
+}
+
+// Continues the index from the start of its last line, which has no sentinel
+// yet. The first block is indexed now so the top of the file shows right away.
+static void buffer_index_start(Buffer *buffer, File_Attributes attributes, bool extendable) {
+    int64 line = buffer->line_starts.count - 1;
+    int64 start = buffer->line_starts[line];
+    uint8 high_bits = 0;
+    int64 end = scan_line_starts(buffer->text, buffer->size, start, MIN(start + INDEX_BLOCK_SIZE, buffer->size), &line, &high_bits, &buffer->line_starts, &buffer->utf8_lines);
+    if (end >= buffer->size) {
+        if (high_bits & 0x80) buffer->utf8_lines.push(line);
+        buffer->line_starts.push(buffer->size + 1);
+        index_cache_save(buffer, attributes, extendable);
+        return;
+    }
+    buffer->line_starts.push(end + 1);
+
+    Line_Indexer *indexer = new Line_Indexer();
+    indexer->buffer = buffer;
+    indexer->version = buffer->version;
+    indexer->size = buffer->size;
+    indexer->start = end;
+    indexer->end = end;
+    indexer->line = line;
+    indexer->high_bits = high_bits;
+    indexer->attributes = attributes;
+    indexer->extendable = extendable;
+    indexer->block_count = (buffer->size - end + INDEX_BLOCK_SIZE - 1) / INDEX_BLOCK_SIZE;
+    indexer->blocks = new Index_Block[indexer->block_count]();
+    buffer->indexer = indexer;
+    thread_pool_push(line_indexer_job, indexer);
+}
+
+static void buffer_index_free(Buffer *buffer) {
+    Line_Indexer *indexer = buffer->indexer;
+    for (int64 i = 0; i < indexer->block_count; i++) {
+        indexer->blocks[i].line_starts.clear();
+        indexer->blocks[i].utf8_lines.clear();
+    }
+    delete[] indexer->blocks;
+    delete indexer;
+    buffer->indexer = nullptr;
+}
+
+// Closes the last line once the indexer reaches the end of the file
+static void buffer_index_close(Buffer *buffer) {
+    Line_Indexer *indexer = buffer->indexer;
+    if (indexer->high_bits & 0x80) buffer->utf8_lines.push(indexer->line);
+    buffer->line_starts.pop();
+    buffer->line_starts.push(buffer->size + 1);
+    while (!indexer->finished) {
+        yield_thread();
+    }
+    // An edit finishes the index itself, by then the text no longer matches the file
+    if (buffer->version == indexer->version) {
+        index_cache_save(buffer, indexer->attributes, indexer->extendable);
+    }
+    buffer_index_free(buffer);
+}
+
+// Merges the blocks the job has finished, called once a frame
+void buffer_index_update(Buffer *buffer) {
+    Line_Indexer *indexer = buffer->indexer;
+    if (!indexer) return;
+    int64 first_line = indexer->line;
+    int64 old_line_count = buffer_get_line_count(buffer);
+    bool changed = false;
+    while (indexer->published < indexer->block_count && indexer->blocks[indexer->published].done) {
+        Index_Block *block = &indexer->blocks[indexer->published];
+        buffer->line_starts.pop();
+        buffer->line_starts.append(&block->line_starts);
+        buffer->line_starts.push(block->end + 1);
+        buffer->utf8_lines.append(block->utf8_lines.data, block->utf8_lines.count);
+        indexer->line += block->line_starts.count;
+        indexer->end = block->end;
+        indexer->high_bits = block->high_bits;
+        block->line_starts.clear();
+        block->utf8_lines.clear();
+        indexer->published++;
+        changed = true;
+    }
+    if (indexer->published == indexer->block_count) {
+        buffer_index_close(buffer);
+    }
+    if (changed) buffer_notify_listeners(buffer, first_line, buffer_get_line_count(buffer), buffer_get_line_count(buffer) - old_line_count);
+}
+
+// Stops the job and indexes whatever is left on this thread
+void buffer_index_finish(Buffer *buffer) {
+    Line_Indexer *indexer = buffer->indexer;
+    if (!indexer) return;
+    atomic_add64(&indexer->cancelled, 1);
+    while (!indexer->finished) {
+        yield_thread();
+    }
+    buffer_index_update(buffer);
+    indexer = buffer->indexer;
+    if (!indexer) return;
+
+    int64 first_line = indexer->line;
+    int64 old_line_count = buffer_get_line_count(buffer);
+    buffer->line_starts.pop();
+    int64 end = scan_line_starts(buffer->text, indexer->size, indexer->end, indexer->size, &indexer->line, &indexer->high_bits, &buffer->line_starts, &buffer->utf8_lines);
+    buffer->line_starts.push(end + 1);
+    buffer_index_close(buffer);
+    buffer_notify_listeners(buffer, first_line, buffer_get_line_count(buffer), buffer_get_line_count(buffer) - old_line_count);
+}
+
+float buffer_index_progress(Buffer *buffer) {
+    if (!buffer->indexer) return 1.0f;
+    return (float)buffer->indexer->end / (float)buffer->indexer->size;
+}
+
+// Bytes covered by the line index, lines past this aren't known yet
+int64 buffer_indexed_length(Buffer *buffer) {
+    if (!buffer->indexer) return buffer_get_length(buffer);
+    return buffer->indexer->end;
+}
+
+int64 buffer_next_line_start(Buffer *buffer, int64 position) {
+    int64 length = buffer_get_length(buffer);
+    while (position < length) {
+        char c = buffer_at(buffer, position++);
+        if (c == '\n' || c == '\r') {
+            char pair = c == '\n' ? '\r' : '\n';
+            if (position < length && buffer_at(buffer, position) == pair) position++;
+            break;
+        }
+    }
+    return position;
+}
+
+// Exact for indexed lines, past those the average line length so far is
+// used to guess a byte offset, which is then moved to the next line start
+int64 buffer_estimate_position_from_line(Buffer *buffer, int64 line) {
+    int64 known_lines = buffer->line_starts.count - 2;
+    if (!buffer->indexer || line <= known_lines) {
+        line = CLAMP(line, 0, buffer_get_line_count(buffer) - 1);
+        return buffer->line_starts[line];
+    }
+    int64 indexed = buffer_indexed_length(buffer);
+    float bytes_per_line = known_lines > 0 ? (float)indexed / (float)known_lines : 80.0f;
+    int64 position = indexed + (int64)((line - known_lines) * bytes_per_line);
+    if (position >= buffer_get_length(buffer)) return buffer_get_length(buffer);
+    return buffer_next_line_start(buffer, position);
+}
+
+// Grows by at least an eighth of the text, so a run of inserts into a big
+// buffer doesn't move all of it every time
 void buffer_grow(Buffer *buffer, int64 gap_size) {
-    int64 size1 = buffer->gap_start;
-    int64 size2 = buffer->size - buffer->gap_end;
-    char *data = (char *)calloc(buffer->size + gap_size, 1);
-    memcpy(data, buffer->text, buffer->gap_start);
-    memset(data + size1, '_', gap_size);
-    memcpy(data + buffer->gap_start + gap_size, buffer->text + buffer->gap_end, buffer->size - buffer->gap_end);
-    free(buffer->text);
-    buffer->text = data;
+    gap_size = MAX(gap_size, BUFFER_SIZE(buffer) / 8);
+    int64 after_gap = buffer->size - buffer->gap_end;
+    buffer->text = (char *)realloc(buffer->text, buffer->size + gap_size);
+    memmove(buffer->text + buffer->gap_end + gap_size, buffer->text + buffer->gap_end, after_gap);
     buffer->gap_end += gap_size;
     buffer->size += gap_size;
 }
 
+// Only the text between the old and the new gap moves
 void buffer_shift_gap(Buffer *buffer, int64 new_gap) {
-    char *temp = (char *)malloc(buffer->size);
-    int64 gap_start = buffer->gap_start;
-    int64 gap_end = buffer->gap_end;
-    int64 gap_size = gap_end - gap_start;
-    int64 size = buffer->size;
-    if (new_gap > gap_start) {
-        memcpy(temp, buffer->text, new_gap);
-        memcpy(temp + gap_start, buffer->text + gap_end, new_gap - gap_start);
-        memcpy(temp + new_gap + gap_size, buffer->text + new_gap + gap_size, size - (new_gap + gap_size));
+    int64 gap_size = GAP_SIZE(buffer);
+    if (new_gap > buffer->gap_start) {
+        memmove(buffer->text + buffer->gap_start, buffer->text + buffer->gap_end, new_gap - buffer->gap_start);
     } else {
-        memcpy(temp, buffer->text, new_gap);
-        memcpy(temp + new_gap + gap_size, buffer->text + new_gap, gap_start - new_gap);
-        memcpy(temp + new_gap + gap_size + (gap_start - new_gap), buffer->text + gap_end, size - gap_end);
+        memmove(buffer->text + new_gap + gap_size, buffer->text + new_gap, buffer->gap_start - new_gap);
     }
-    free(buffer->text);
-    buffer->text = temp;
     buffer->gap_start = new_gap;
     buffer->gap_end = new_gap + gap_size;
 }
@@ -274,11 +862,13 @@ void buffer_ensure_gap(Buffer *buffer) {
 
 void buffer_delete_region(Buffer *buffer, int64 start, int64 end) {
     assert(start < end);
+    buffer_begin_edit(buffer);
+    if (buffer->journal) journal_record(buffer->journal, start, end - start, nullptr, 0);
     if (buffer->gap_start != start) {
         buffer_shift_gap(buffer, start);
     }
     buffer->gap_end += (end - start);
-    buffer_update_line_starts(buffer);
+    buffer_update_line_starts_for_edit(buffer, start, end - start, 0);
 }
 
 void buffer_delete_single(Buffer *buffer, int64 position) {
@@ -286,22 +876,29 @@ void buffer_delete_single(Buffer *buffer, int64 position) {
 }
 
 void buffer_insert_single(Buffer *buffer, int64 position, char c) {
+    buffer_begin_edit(buffer);
     buffer_ensure_gap(buffer);
     if (buffer->gap_start != position) {
         buffer_shift_gap(buffer, position);
     }
     buffer->text[position] = c;
     buffer->gap_start++;
-    buffer_update_line_starts(buffer);
+    if (buffer->journal) journal_record(buffer->journal, position, 0, &c, 1);
+    buffer_update_line_starts_for_edit(buffer, position, 0, 1);
 }
 
 void buffer_insert_text(Buffer *buffer, int64 position, String string) {
+    buffer_begin_edit(buffer);
     if (GAP_SIZE(buffer) < string.count) {
         buffer_grow(buffer, string.count);
     }
+    if (buffer->gap_start != position) {
+        buffer_shift_gap(buffer, position);
+    }
     memcpy(buffer->text + buffer->gap_start, string.data, string.count);
     buffer->gap_start += string.count;
-    buffer_update_line_starts(buffer);
+    if (buffer->journal) journal_record(buffer->journal, position, 0, string.data, string.count);
+    buffer_update_line_starts_for_edit(buffer, position, 0, string.count);
 }
 
 void buffer_replace_region(Buffer *buffer, String string, int64 start, int64 end) {
@@ -312,25 +909,248 @@ void buffer_replace_region(Buffer *buffer, String string, int64 start, int64 end
     }
     memcpy(buffer->text + buffer->gap_start, string.data, string.count);
     buffer->gap_start += string.count;
-    buffer_update_line_starts(buffer);
+    if (buffer->journal) journal_record(buffer->journal, start, 0, string.data, string.count);
+    buffer_update_line_starts_for_edit(buffer, start, 0, string.count);
 }
 
 void buffer_clear(Buffer *buffer) {
+    buffer_begin_edit(buffer);
+    if (buffer->journal && BUFFER_SIZE(buffer) > 0) journal_record(buffer->journal, 0, BUFFER_SIZE(buffer), nullptr, 0);
     buffer->gap_start = 0;
     buffer->gap_end = buffer->size;
+    buffer_update_line_starts(buffer);
 }
 
-Cursor get_cursor_from_position(Buffer *buffer, int64 position) {
-    Cursor cursor = {};
-    for (int line = 0; line < buffer->line_starts.count - 1; line++) {
-        int64 start = buffer->line_starts[line];
-        int64 end = buffer->line_starts[line + 1];
-        if (start <= position && position < end) {
-            cursor.line = line;
-            cursor.col = position - start;
-            break;
+// Puts the file's text in place of the buffer's, for when the buffer's own
+// copy is lost. Unsaved edits go with it and the undo history no longer fits.
+void buffer_read_file_again(Buffer *buffer) {
+    if (buffer->version != buffer->saved_version) {
+        printf("%s: unsaved edits were lost\n", buffer->file_name);
+    }
+    Read_File file = open_entire_file(buffer->file_name);
+    String text = {};
+    if (file.data) {
+        text = text_from_file_data((char *)file.data, file.count, &buffer->encoding, &buffer->line_ending);
+        if (text.data != file.data) free(file.data);
+    } else {
+        printf("%s: can't be read, the buffer is left empty\n", buffer->file_name);
+        text.data = (char *)malloc(DEFAULT_GAP_SIZE);
+    }
+    File_Attributes attributes = get_file_attributes(buffer->file_name);
+
+    atomic_add64(&buffer->version, 1);
+    while (buffer->readers > 0) {
+        yield_thread();
+    }
+    free(buffer->text);
+    buffer->text = text.data;
+    buffer->gap_start = buffer->gap_end = 0;
+    buffer->size = text.count;
+    buffer->file_size = file.data ? file.count : 0;
+    buffer->last_write_time = attributes.last_write_time;
+    buffer_update_line_starts(buffer);
+    buffer_clear_history(buffer);
+    buffer->saved_version = buffer->version;
+    if (buffer->journal) journal_saved(buffer->journal);
+}
+
+// The jobs that still hold the buffer are waited for, callers that can't wait check jobs first
+void buffer_free(Buffer *buffer) {
+    buffer_compress_discard(buffer);
+    // Nothing will read the rest of the index, so it isn't finished
+    if (buffer->indexer) {
+        atomic_add64(&buffer->indexer->cancelled, 1);
+        while (!buffer->indexer->finished) {
+            yield_thread();
         }
+        buffer_index_free(buffer);
+    }
+    buffer_begin_edit(buffer);
+    while (buffer->jobs > 0) {
+        yield_thread();
     }
+    free(buffer->text);
+    buffer->line_starts.clear();
+    buffer->utf8_lines.clear();
+    for (int i = 0; i < BUFFER_COLUMN_INDEXES; i++) {
+        buffer->column_indexes[i].checkpoints.clear();
+    }
+    buffer->listeners.clear();
+    buffer_clear_history(buffer);
+    delete buffer;
+}
+
+// What the buffer holds on to, the text with its gap (or its packed blocks), the line index and the undo history
+int64 buffer_memory_size(Buffer *buffer) {
+    int64 result = (buffer->compressed ? buffer->compressed->memory : buffer->size) + buffer->line_starts.memory_size() + buffer->utf8_lines.capacity * sizeof(int64);
+    for (Edit_Record *edit = buffer->edit_history; edit; edit = edit->prev) {
+        result += sizeof(Edit_Record) + edit->text.count + edit->replacements.capacity * sizeof(Replacement);
+    }
+    return result;
+}
+
+void buffer_copy_span(Buffer *buffer, Span span, char *dest) {
+    int64 before_gap = span.end < buffer->gap_start ? span.end : buffer->gap_start;
+    if (span.start < before_gap) {
+        memcpy(dest, buffer->text + span.start, before_gap - span.start);
+        dest += before_gap - span.start;
+    }
+    int64 after_start = span.start > buffer->gap_start ? span.start : buffer->gap_start;
+    if (after_start < span.end) {
+        memcpy(dest, buffer->text + GAP_SIZE(buffer) + after_start, span.end - after_start);
+    }
+}
+
+void buffer_append_span(Array<char> *out, Buffer *buffer, Span span) {
+    int64 count = span.end - span.start;
+    if (count <= 0) return;
+    if (out->count + count > out->capacity) {
+        out->grow(count);
+    }
+    buffer_copy_span(buffer, span, out->data + out->count);
+    out->count += count;
+}
+
+void buffer_append_replacement(Array<char> *out, Buffer *buffer, Regex_Match *match, String replacement, bool expand_captures) {
+    if (!expand_captures) {
+        out->append(replacement.data, replacement.count);
+        return;
+    }
+    for (int64 i = 0; i < replacement.count; i++) {
+        char c = replacement.data[i];
+        if (c != '\\' || i + 1 == replacement.count) {
+            out->push(c);
+            continue;
+        }
+        c = replacement.data[++i];
+        if (c >= '0' && c <= '9') {
+            int index = c - '0';
+            if (index < match->capture_count && match->captures[index].start >= 0) {
+                buffer_append_span(out, buffer, match->captures[index]);
+            }
+        } else if (c == 'n') {
+            out->push('\n');
+        } else if (c == 't') {
+            out->push('\t');
+        } else {
+            out->push(c);
+        }
+    }
+}
+
+// Takes ownership of text and makes the remaining capacity the gap at the end
+void buffer_set_text(Buffer *buffer, Array<char> *text) {
+    buffer_begin_edit(buffer);
+    if (text->capacity - text->count < DEFAULT_GAP_SIZE) {
+        text->grow(DEFAULT_GAP_SIZE);
+    }
+    free(buffer->text);
+    buffer->text = text->data;
+    buffer->gap_start = text->count;
+    buffer->gap_end = text->capacity;
+    buffer->size = text->capacity;
+    text->data = nullptr;
+    text->count = text->capacity = 0;
+    buffer_update_line_starts(buffer);
+}
+
+// Replacing match by match would move the gap and rebuild the line index for
+// every match. Instead the new text is built in one pass, the line index is
+// rebuilt once, and the whole operation is one undo record.
+int64 buffer_replace_all(Buffer *buffer, Regex *regex, String replacement, bool expand_captures) {
+    int64 length = buffer_get_length(buffer);
+    Regex_Input input = regex_input_from_buffer(buffer, 0, length);
+
+    Array<char> out;
+    Edit_Record *edit = nullptr;
+    Array<char> old_text;
+    int64 copied = 0;
+
+    Regex_Match match;
+    while (input.start <= length && regex_search_input(regex, &input, &match)) {
+        if (!edit) {
+            edit = new Edit_Record();
+            edit->type = EDIT_RECORD_REPLACE_ALL;
+            out.reserve(length + length / 8 + DEFAULT_GAP_SIZE);
+        }
+
+        buffer_append_span(&out, buffer, { copied, match.span.start });
+
+        Replacement r;
+        r.position = out.count;
+        r.old_offset = old_text.count;
+        r.old_count = match.span.end - match.span.start;
+        buffer_append_span(&old_text, buffer, match.span);
+        buffer_append_replacement(&out, buffer, &match, replacement, expand_captures);
+        r.count = out.count - r.position;
+        edit->replacements.push(r);
+
+        copied = match.span.end;
+        input.start = match.span.end;
+        if (match.span.end == match.span.start) {
+            // Step over empty matches so the search moves forward
+            if (match.span.end == length) break;
+            input.start++;
+        }
+    }
+
+    if (!edit) return 0;
+
+    buffer_append_span(&out, buffer, { copied, length });
+    if (buffer->journal) {
+        // A record per match, each at its position after the ones before were replaced
+        for (size_t i = 0; i < edit->replacements.count; i++) {
+            Replacement *r = &edit->replacements[i];
+            journal_record(buffer->journal, r->position, r->old_count, out.data + r->position, r->count);
+        }
+    }
+    buffer_set_text(buffer, &out);
+
+    edit->text.data = old_text.data;
+    edit->text.count = old_text.count;
+    edit->span = { 0, buffer_get_length(buffer) };
+    edit->prev = buffer->edit_history;
+    buffer->edit_history = edit;
+    return (int64)edit->replacements.count;
+}
+
+// Puts the old text back with another single pass
+void buffer_undo_replace_all(Buffer *buffer, Edit_Record *edit) {
+    assert(edit->type == EDIT_RECORD_REPLACE_ALL);
+    int64 length = buffer_get_length(buffer);
+    int64 old_length = length;
+    for (size_t i = 0; i < edit->replacements.count; i++) {
+        old_length += edit->replacements[i].old_count - edit->replacements[i].count;
+    }
+
+    Array<char> out;
+    out.reserve(old_length + DEFAULT_GAP_SIZE);
+    int64 copied = 0;
+    for (size_t i = 0; i < edit->replacements.count; i++) {
+        Replacement *r = &edit->replacements[i];
+        buffer_append_span(&out, buffer, { copied, r->position });
+        if (buffer->journal) journal_record(buffer->journal, out.count, r->count, edit->text.data + r->old_offset, r->old_count);
+        out.append(edit->text.data + r->old_offset, r->old_count);
+        copied = r->position + r->count;
+    }
+    buffer_append_span(&out, buffer, { copied, length });
+    buffer_set_text(buffer, &out);
+
+    edit->replacements.clear();
+    free(edit->text.data);
+    edit->text = {};
+}
+
+int64 get_line_from_position(Buffer *buffer, int64 position) {
+    int64 line = buffer->line_starts.find(position);
+    int64 last_line = buffer_get_line_count(buffer) - 1;
+    return line < last_line ? line : MAX(last_line, 0);
+}
+
+Cursor get_cursor_from_position(Buffer *buffer, int64 position) {
+    Cursor cursor = {};
+    cursor.line = get_line_from_position(buffer, position);
+    cursor.col = position - buffer->line_starts[cursor.line];
     cursor.position = position;
     return cursor;
 }
@@ -346,6 +1166,20 @@ Cursor get_cursor_from_line(Buffer *buffer, int64 line) {
     return cursor;
 }
 
+void edit_record_free(Edit_Record *edit) {
+    free(edit->text.data);
+    edit->replacements.clear();
+    delete edit;
+}
+
+void buffer_clear_history(Buffer *buffer) {
+    while (buffer->edit_history) {
+        Edit_Record *edit = buffer->edit_history;
+        buffer->edit_history = edit->prev;
+        edit_record_free(edit);
+    }
+}
+
 void buffer_record_insert(Buffer *buffer, int64 position, String text) {
     Edit_Record *current = buffer->edit_history;
     if (current && current->type == EDIT_RECORD_INSERT && position == current->span.end) {
@@ -3,9 +3,17 @@
 #include "platform.h"
 #include "types.h"
 #include "array.h"
+#include "encoding.h"
+#include "line_index.h"
 
 struct Text_Input;
+struct Key_Map;
+struct Regex;
+struct Buffer;
+struct Compressed_Text;
+struct Text_Compression;
 typedef void (*Self_Insert_Hook)(Text_Input *);
+typedef void (*Lines_Changed_Proc)(Buffer *buffer, int64 first_line, int64 end_line, int64 line_delta, void *data);
 
 enum Line_Ending {
     LINE_ENDING_NONE,
@@ -18,15 +26,68 @@ enum Edit_Record_Type {
     EDIT_RECORD_INSERT,
     EDIT_RECORD_DELETE,
     EDIT_RECORD_REPLACE,
+    EDIT_RECORD_REPLACE_ALL,
+};
+
+// One match of a replace-all. position and count locate the new text, the old
+// text is old_count bytes at old_offset in the record's text.
+struct Replacement {
+    int64 position;
+    int64 count;
+    int64 old_offset;
+    int64 old_count;
 };
 
 struct Edit_Record {
     Edit_Record_Type type;
     Span span;
     String text;
+    Array<Replacement> replacements;
     Edit_Record *prev;
 };
 
+// Told after every edit which lines were rescanned, first_line up to
+// end_line, and how far the lines after them moved. Line end_line was line
+// end_line - line_delta before the edit.
+struct Buffer_Listener {
+    Lines_Changed_Proc proc;
+    void *data;
+};
+
+// Files at least this big open with only their first block indexed, the rest
+// of the line index is built by a background job and merged in each frame
+#define LARGE_FILE_SIZE (64LL * 1024 * 1024)
+
+#define DEFAULT_GAP_SIZE 1024
+
+// Columns of a non-ASCII line longer than this come from checkpoints taken
+// every this many bytes, so a lookup decodes at most that much of the line
+#define BUFFER_COLUMN_CHECKPOINT 4096
+#define BUFFER_COLUMN_INDEXES 4
+
+struct Line_Indexer;
+struct Journal;
+
+struct Buffer_Chunk {
+    char *data;
+    int64 count;
+    int64 position;
+};
+
+struct Column_Checkpoint {
+    int64 offset; // from the line start, always where a codepoint starts
+    int64 column;
+};
+
+// Checkpoints of one line, built as far as lookups have needed. They only
+// depend on the text before them, so an edit keeps the ones before it.
+struct Column_Index {
+    int64 line = -1;
+    int64 start;
+    int64 last_used;
+    Array<Column_Checkpoint> checkpoints;
+};
+
 struct Buffer {
     const char *file_name;
 
@@ -35,30 +96,78 @@ struct Buffer {
     int64 gap_end;
     int64 size;
 
-    Array<int64> line_starts;
+    Line_Index line_starts;
+    Array<int64> utf8_lines; // lines holding non-ASCII bytes, every other line has byte columns
+    Column_Index column_indexes[BUFFER_COLUMN_INDEXES]; // of the long non-ASCII lines used last
+    int64 column_clock = 0;
 
     Line_Ending line_ending;
+    Text_Encoding encoding;
+    int64 file_size; // bytes of the file the text came from
     int64 last_write_time;
+    int64 saved_version = 0; // version when the text last matched the file
     Self_Insert_Hook post_self_insert_hook;
+    Key_Map *key_map = nullptr; // overrides the view's key map
+    Array<Buffer_Listener> listeners;
 
     Edit_Record *edit_history = nullptr;
+    Line_Indexer *indexer = nullptr; // set until the whole file is indexed
+    Journal *journal = nullptr; // copies every edit when set
+    Compressed_Text *compressed = nullptr; // holds the text instead while the buffer is idle, text is null
+    Text_Compression *compression = nullptr; // the job packing it
+
+    // Worker threads read the text between buffer_begin_read and buffer_end_read.
+    // Every edit bumps version and waits for those readers to leave.
+    volatile int64 version = 0;
+    volatile int64 readers = 0;
+    volatile int64 jobs = 0; // queued jobs holding the pointer, the buffer can't be freed until they're done
 };
 
 Buffer *make_buffer(const char *file_name);
 Buffer *make_buffer_from_file(const char *file_name);
+void remove_crlf(char *data, int64 count, char **out_data, int64 *out_count);
+String text_from_file_data(char *data, int64 count, Text_Encoding *out_encoding, Line_Ending *out_line_ending);
 
 int64 buffer_get_line_length(Buffer *buffer, int64 line);
 int64 buffer_get_line_count(Buffer *buffer);
 int64 buffer_get_length(Buffer *buffer);
 
 char buffer_at(Buffer *buffer, int64 position);
+uint32 buffer_codepoint_at(Buffer *buffer, int64 position, int *length);
+int64 buffer_next_codepoint(Buffer *buffer, int64 position);
+int64 buffer_prev_codepoint(Buffer *buffer, int64 position);
+bool buffer_line_is_ascii(Buffer *buffer, int64 line);
+int64 buffer_get_column(Buffer *buffer, int64 line, int64 position);
+int64 buffer_get_position_from_column(Buffer *buffer, int64 line, int64 column);
+int buffer_get_chunks(Buffer *buffer, Buffer_Chunk *chunks);
 void buffer_insert_single(Buffer *buffer, int64 position, char c);
 void buffer_insert_text(Buffer *buffer, int64 position, String text);
 void buffer_delete_single(Buffer *buffer, int64 position);
 void buffer_replace_region(Buffer *buffer, String string, int64 start, int64 end);
 void buffer_delete_region(Buffer *buffer, int64 start, int64 end);
 void buffer_clear(Buffer *buffer);
+void buffer_read_file_again(Buffer *buffer);
+void buffer_free(Buffer *buffer);
+int64 buffer_memory_size(Buffer *buffer);
+void buffer_copy_span(Buffer *buffer, Span span, char *dest);
+
+void buffer_add_listener(Buffer *buffer, Lines_Changed_Proc proc, void *data);
+void buffer_remove_listener(Buffer *buffer, void *data);
+
+bool buffer_begin_read(Buffer *buffer, int64 version);
+void buffer_end_read(Buffer *buffer);
+
+void buffer_index_update(Buffer *buffer);
+void buffer_index_finish(Buffer *buffer);
+float buffer_index_progress(Buffer *buffer);
+int64 buffer_indexed_length(Buffer *buffer);
+int64 buffer_next_line_start(Buffer *buffer, int64 position);
+int64 buffer_estimate_position_from_line(Buffer *buffer, int64 line);
+
+int64 buffer_replace_all(Buffer *buffer, Regex *regex, String replacement, bool expand_captures);
+void buffer_undo_replace_all(Buffer *buffer, Edit_Record *edit);
 
+int64 get_line_from_position(Buffer *buffer, int64 position);
 Cursor get_cursor_from_position(Buffer *buffer, int64 position);
 int64 get_position_from_line(Buffer *buffer, int64 line);
 Cursor get_cursor_from_line(Buffer *buffer, int64 line);
@@ -68,4 +177,6 @@ String buffer_to_string_apply_line_endings(Buffer *buffer);
 String buffer_to_string_span(Buffer *buffer, Span span);
 
 void buffer_record_insert(Buffer *buffer, int64 position, String text);
+void edit_record_free(Edit_Record *edit);
+void buffer_clear_history(Buffer *buffer);
 void buffer_record_delete(Buffer *buffer, int64 start, int64 end);
@@ -0,0 +1,347 @@
+#include "compress.h"
+#include "platform.h"
+#include "thread_pool.h"
+#include "simple_math.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define LZ_MIN_MATCH 4
+#define LZ_HASH_BITS 16
+#define LZ_WINDOW 65535
+#define LZ_MAX_CHAIN 16
+
+// A job packs the text block by block as a reader, so an edit or the buffer
+// being shown again stops it after the block it's on
+struct Text_Compression {
+    Buffer *buffer;
+    int64 version;
+    Compressed_Text *result;
+    volatile int64 cancelled;
+    volatile int64 done;
+};
+
+// Blocks are claimed by the main thread and any idle workers alike. A helper
+// that starts once every block is claimed has nothing to wait for, so only
+// the ones working are waited on, and whoever lets go last frees it.
+struct Text_Decompression {
+    Compressed_Block *blocks;
+    int64 block_count;
+    char *text;
+    volatile int64 next_block;
+    volatile int64 failed;
+    volatile int64 working;
+    volatile int64 references;
+};
+
+static uint32 lz_read32(const uint8 *p) {
+    uint32 v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint32 lz_hash(uint32 v) {
+    return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+static uint8 *lz_write_length(uint8 *out, int64 length) {
+    while (length >= 255) {
+        *out++ = 255;
+        length -= 255;
+    }
+    *out++ = (uint8)length;
+    return out;
+}
+
+// A match length of 0 ends the block, with literals only
+static uint8 *lz_write_sequence(uint8 *out, const uint8 *literals, int64 literal_count, int64 offset, int64 match_length) {
+    int64 match_code = match_length - LZ_MIN_MATCH;
+    uint8 *token = out++;
+    *token = (uint8)(MIN(literal_count, 15) << 4);
+    if (literal_count >= 15) out = lz_write_length(out, literal_count - 15);
+    memcpy(out, literals, literal_count);
+    out += literal_count;
+    if (match_length > 0) {
+        *token |= (uint8)MIN(match_code, 15);
+        out[0] = (uint8)offset;
+        out[1] = (uint8)(offset >> 8);
+        out += 2;
+        if (match_code >= 15) out = lz_write_length(out, match_code - 15);
+    }
+    return out;
+}
+
+int64 lz_compress_bound(int64 count) {
+    return count + count / 255 + 16;
+}
+
+// Hash chains over the last 64K with a lazy step: a match is put off when the
+// next byte starts a longer one. Slower to pack than greedy LZ4, decodes the same.
+int64 lz_compress(const uint8 *src, int64 count, uint8 *dest) {
+    int32 *head = (int32 *)malloc(sizeof(int32) << LZ_HASH_BITS);
+    int32 *chain = (int32 *)malloc(sizeof(int32) * MAX(count, 1));
+    memset(head, 0xFF, sizeof(int32) << LZ_HASH_BITS);
+
+    uint8 *out = dest;
+    int64 anchor = 0;
+    int64 inserted = 0;
+    int64 limit = count - LZ_MIN_MATCH;
+    int64 i = 0;
+    while (i <= limit) {
+        int64 best_length[2] = {};
+        int64 best_offset[2] = {};
+        for (int step = 0; step < 2 && i + step <= limit; step++) {
+            int64 position = i + step;
+            for (; inserted <= position; inserted++) {
+                uint32 h = lz_hash(lz_read32(src + inserted));
+                chain[inserted] = head[h];
+                head[h] = (int32)inserted;
+            }
+            uint32 value = lz_read32(src + position);
+            int32 candidate = chain[position];
+            for (int tries = 0; tries < LZ_MAX_CHAIN && candidate >= 0 && position - candidate <= LZ_WINDOW; tries++) {
+                if (lz_read32(src + candidate) == value) {
+                    int64 length = LZ_MIN_MATCH;
+                    while (position + length < count && src[candidate + length] == src[position + length]) {
+                        length++;
+                    }
+                    if (length > best_length[step]) {
+                        best_length[step] = length;
+                        best_offset[step] = position - candidate;
+                    }
+                }
+                candidate = chain[candidate];
+            }
+            if (best_length[0] == 0) break;
+        }
+        if (best_length[0] == 0) {
+            i++;
+            continue;
+        }
+        int step = best_length[1] > best_length[0] ? 1 : 0;
+        i += step;
+        out = lz_write_sequence(out, src + anchor, i - anchor, best_offset[step], best_length[step]);
+        i += best_length[step];
+        anchor = i;
+    }
+    out = lz_write_sequence(out, src + anchor, count - anchor, 0, 0);
+
+    free(head);
+    free(chain);
+    return out - dest;
+}
+
+// Checks every length and offset, so a damaged block fails instead of writing out of bounds
+bool lz_decompress(const uint8 *src, int64 count, uint8 *dest, int64 dest_count) {
+    const uint8 *in = src;
+    const uint8 *in_end = src + count;
+    uint8 *out = dest;
+    uint8 *out_end = dest + dest_count;
+    while (in < in_end) {
+        uint8 token = *in++;
+        int64 literals = token >> 4;
+        if (literals == 15) {
+            uint8 b;
+            do {
+                if (in >= in_end) return false;
+                b = *in++;
+                literals += b;
+            } while (b == 255);
+        }
+        if (literals > in_end - in || literals > out_end - out) return false;
+        memcpy(out, in, literals);
+        in += literals;
+        out += literals;
+        if (in == in_end) break;
+
+        if (in_end - in < 2) return false;
+        int64 offset = in[0] | (in[1] << 8);
+        in += 2;
+        int64 length = token & 15;
+        if (length == 15) {
+            uint8 b;
+            do {
+                if (in >= in_end) return false;
+                b = *in++;
+                length += b;
+            } while (b == 255);
+        }
+        length += LZ_MIN_MATCH;
+        if (offset == 0 || offset > out - dest || length > out_end - out) return false;
+
+        // An overlapping match repeats the bytes before it, copied in pieces
+        // that double so a run of one byte isn't copied a byte at a time
+        const uint8 *match = out - offset;
+        while (length > 0) {
+            int64 piece = MIN(length, out - match);
+            memcpy(out, match, piece);
+            out += piece;
+            length -= piece;
+        }
+    }
+    return out == out_end;
+}
+
+static void compressed_text_free(Compressed_Text *compressed) {
+    if (!compressed) return;
+    for (int64 i = 0; i < compressed->block_count; i++) {
+        free(compressed->blocks[i].data);
+    }
+    free(compressed->blocks);
+    free(compressed);
+}
+
+static void text_compression_job(void *data) {
+    Text_Compression *compression = (Text_Compression *)data;
+    Buffer *buffer = compression->buffer;
+    Compressed_Text *compressed = compression->result;
+    uint8 *text = (uint8 *)malloc(COMPRESS_BLOCK_SIZE);
+    uint8 *packed = (uint8 *)malloc(lz_compress_bound(COMPRESS_BLOCK_SIZE));
+    for (int64 i = 0; i < compressed->block_count; i++) {
+        if (compression->cancelled || !buffer_begin_read(buffer, compression->version)) {
+            atomic_add64(&compression->cancelled, 1);
+            break;
+        }
+        int64 start = i * COMPRESS_BLOCK_SIZE;
+        int64 count = MIN(compressed->length - start, COMPRESS_BLOCK_SIZE);
+        buffer_copy_span(buffer, { start, start + count }, (char *)text);
+        buffer_end_read(buffer);
+
+        Compressed_Block *block = &compressed->blocks[i];
+        block->count = (int32)lz_compress(text, count, packed);
+        block->text_count = (int32)count;
+        block->data = (uint8 *)malloc(block->count);
+        memcpy(block->data, packed, block->count);
+        compressed->memory += block->count;
+    }
+    free(text);
+    free(packed);
+    atomic_add64(&compression->done, 1);
+    atomic_add64(&buffer->jobs, -1);
+}
+
+// Starts packing the text of a buffer that's gone idle. Text under a block
+// isn't worth the decode when the buffer is shown again.
+void buffer_compress(Buffer *buffer) {
+    if (buffer->compressed || buffer->compression || buffer->indexer) return;
+    if (buffer_get_length(buffer) < COMPRESS_BLOCK_SIZE) return;
+    Compressed_Text *compressed = (Compressed_Text *)calloc(1, sizeof(Compressed_Text));
+    compressed->length = buffer_get_length(buffer);
+    compressed->block_count = (compressed->length + COMPRESS_BLOCK_SIZE - 1) / COMPRESS_BLOCK_SIZE;
+    compressed->blocks = (Compressed_Block *)calloc(MAX(compressed->block_count, 1), sizeof(Compressed_Block));
+
+    Text_Compression *compression = (Text_Compression *)calloc(1, sizeof(Text_Compression));
+    compression->buffer = buffer;
+    compression->version = buffer->version;
+    compression->result = compressed;
+    buffer->compression = compression;
+    atomic_add64(&buffer->jobs, 1);
+    thread_pool_push(text_compression_job, compression);
+}
+
+// Called every frame, swaps the packed blocks in for the text once the job is
+// done. The result is dropped if it saved too little to be worth decoding.
+void buffer_compress_update(Buffer *buffer) {
+    Text_Compression *compression = buffer->compression;
+    if (!compression || !compression->done) return;
+    Compressed_Text *compressed = compression->result;
+    buffer->compression = nullptr;
+    bool keep = !compression->cancelled && buffer->version == compression->version && compressed->memory < buffer->size / 2;
+    free(compression);
+    if (!keep) {
+        compressed_text_free(compressed);
+        return;
+    }
+    free(buffer->text);
+    buffer->text = nullptr;
+    buffer->gap_start = buffer->gap_end = buffer->size = 0;
+    buffer->compressed = compressed;
+}
+
+// Stops a running job and drops packed text without decoding it, for a buffer about to be freed
+void buffer_compress_discard(Buffer *buffer) {
+    if (buffer->compression) {
+        atomic_add64(&buffer->compression->cancelled, 1);
+        while (!buffer->compression->done) {
+            yield_thread();
+        }
+        compressed_text_free(buffer->compression->result);
+        free(buffer->compression);
+        buffer->compression = nullptr;
+    }
+    compressed_text_free(buffer->compressed);
+    buffer->compressed = nullptr;
+}
+
+// Counted as working before it claims, so a block is never being decoded
+// while the main thread thinks they're all done
+static void text_decompression_run(Text_Decompression *decompression) {
+    atomic_add64(&decompression->working, 1);
+    while (!decompression->failed) {
+        int64 index = atomic_add64(&decompression->next_block, 1) - 1;
+        if (index >= decompression->block_count) break;
+        Compressed_Block *block = &decompression->blocks[index];
+        char *dest = decompression->text + index * COMPRESS_BLOCK_SIZE;
+        if (!lz_decompress(block->data, block->count, (uint8 *)dest, block->text_count)) {
+            atomic_add64(&decompression->failed, 1);
+        }
+    }
+    atomic_add64(&decompression->working, -1);
+}
+
+static void text_decompression_release(Text_Decompression *decompression) {
+    if (atomic_add64(&decompression->references, -1) == 0) free(decompression);
+}
+
+static void text_decompression_job(void *data) {
+    Text_Decompression *decompression = (Text_Decompression *)data;
+    text_decompression_run(decompression);
+    text_decompression_release(decompression);
+}
+
+// Brings the text back before the buffer is shown or edited. Blocks decode
+// on their own, so the workers take some while this thread does the rest.
+void buffer_decompress(Buffer *buffer) {
+    if (buffer->compression) {
+        atomic_add64(&buffer->compression->cancelled, 1);
+        while (!buffer->compression->done) {
+            yield_thread();
+        }
+        buffer_compress_update(buffer);
+    }
+    Compressed_Text *compressed = buffer->compressed;
+    if (!compressed) return;
+
+    Text_Decompression *decompression = (Text_Decompression *)calloc(1, sizeof(Text_Decompression));
+    decompression->blocks = compressed->blocks;
+    decompression->block_count = compressed->block_count;
+    char *text = (char *)malloc(compressed->length + DEFAULT_GAP_SIZE);
+    decompression->text = text;
+    int32 helpers = (int32)MIN((int64)thread_pool_worker_count(), compressed->block_count - 1);
+    decompression->references = helpers + 1;
+    for (int32 i = 0; i < helpers; i++) {
+        thread_pool_push(text_decompression_job, decompression, JOB_PRIORITY_INTERACTIVE);
+    }
+    text_decompression_run(decompression);
+    while (decompression->working > 0) {
+        yield_thread();
+    }
+    bool failed = decompression->failed != 0;
+    text_decompression_release(decompression);
+    int64 length = compressed->length;
+
+    buffer->compressed = nullptr;
+    compressed_text_free(compressed);
+    if (failed) {
+        // Only memory corruption gets here, the blocks never leave this process
+        printf("%s: compressed text is damaged, reading the file again\n", buffer->file_name);
+        free(text);
+        buffer_read_file_again(buffer);
+        return;
+    }
+
+    buffer->text = text;
+    buffer->gap_start = length;
+    buffer->gap_end = buffer->size = length + DEFAULT_GAP_SIZE;
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include "types.h"
+#include "buffer.h"
+
+// The text of a buffer nobody has looked at for a while, packed into blocks
+// that each decode on their own. The line index stays as it is, only the
+// bytes go. Blocks use the LZ4 block format: runs of literals and matches of
+// at least 4 bytes up to 64K back, which decodes at memory speed.
+#define COMPRESS_BLOCK_SIZE (256 * 1024)
+
+struct Compressed_Block {
+    uint8 *data;
+    int32 count;
+    int32 text_count;
+};
+
+struct Compressed_Text {
+    Compressed_Block *blocks;
+    int64 block_count;
+    int64 length; // of the text
+    int64 memory; // bytes the blocks take
+};
+
+struct Text_Compression;
+
+int64 lz_compress_bound(int64 count);
+int64 lz_compress(const uint8 *src, int64 count, uint8 *dest);
+bool lz_decompress(const uint8 *src, int64 count, uint8 *dest, int64 dest_count);
+
+void buffer_compress(Buffer *buffer);
+void buffer_compress_update(Buffer *buffer);
+void buffer_compress_discard(Buffer *buffer);
+void buffer_decompress(Buffer *buffer);
@@ -10,6 +10,7 @@
 
 #include "simple_math.h"
 #include "draw.h"
+#include "render.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -366,3 +367,22 @@ void d3d11_render(Render_Target *target) {
 
     d3d11_ctx->swap_chain->Present(1, 0);
 }
+
+static void *d3d11_backend_create_texture(Render_Backend *, uint8 *bitmap, int width, int height) {
+    return d3d11_create_face_texture(bitmap, width, height);
+}
+
+static void d3d11_backend_render(Render_Backend *, Render_Target *target) {
+    d3d11_render(target);
+}
+
+// The device is made here, on the editor's thread, and its immediate context
+// is only used by the render thread from then on
+Render_Backend *make_d3d11_backend(uint32 width, uint32 height, HWND window_handle) {
+    d3d11_initialize_devices(width, height, window_handle);
+    Render_Backend *backend = new Render_Backend();
+    backend->name = "d3d11";
+    backend->create_texture = d3d11_backend_create_texture;
+    backend->render = d3d11_backend_render;
+    return backend;
+}
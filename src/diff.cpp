@@ -0,0 +1,688 @@
+#include "diff.h"
+#include "platform.h"
+#include "simple_math.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#include <emmintrin.h>
+#define DIFF_SSE2 1
+#endif
+
+// Lines more common than this in the old side of a region never split it
+#define DIFF_MAX_CHAIN 64
+// Past this many edits Myers stops looking for the shortest path through a region
+#define DIFF_MAX_COST 256
+// Lines hashed before their table slots are looked at
+#define DIFF_HASH_BATCH 32
+
+#define DIFF_PRIME1 0x9E3779B185EBCA87ULL
+#define DIFF_PRIME2 0xC2B2AE3D27D4EB4FULL
+
+// One buffer's lines, with their starts decoded from the line index once
+struct Diff_Side {
+    Buffer *buffer;
+    Buffer_Chunk chunks[2];
+    int chunk_count;
+    int64 line_count;
+    int64 *starts; // line_count + 1, the last one past the end of the text
+    int32 *ids;
+    uint8 *changed;
+    Array<char> scratch;
+};
+
+struct Diff_Slot {
+    uint32 check; // high half of the hash
+    int32 id; // plus one, 0 if the slot is empty
+};
+
+struct Diff_Line_Ref {
+    int32 side;
+    int64 line;
+};
+
+struct Diff_Region {
+    int64 a0;
+    int64 a1;
+    int64 b0;
+    int64 b1;
+    bool myers;
+};
+
+struct Diff_Work {
+    int32 *a;
+    int32 *b;
+    uint8 *a_changed;
+    uint8 *b_changed;
+    int32 *counts; // per id, occurrences in the old side of the region being split
+    int64 *heads; // per id, its first old line in that region
+    int64 *next; // per old line, the next old line with the same id
+    int64 *forward;
+    int64 *backward;
+    Array<Diff_Region> stack;
+};
+
+// The line's text without its line break. Only the line split by the gap is copied.
+static const char *diff_line_text(Diff_Side *side, int64 line, int64 *count) {
+    int64 start = side->starts[line];
+    int64 end = side->starts[line + 1] - 1;
+    *count = end - start;
+    if (start == end) return "";
+    for (int i = 0; i < side->chunk_count; i++) {
+        Buffer_Chunk *chunk = &side->chunks[i];
+        if (start >= chunk->position && end <= chunk->position + chunk->count) {
+            return chunk->data + (start - chunk->position);
+        }
+    }
+    if (side->scratch.capacity < (size_t)*count) {
+        side->scratch.grow(*count - side->scratch.capacity);
+    }
+    buffer_copy_span(side->buffer, { start, end }, side->scratch.data);
+    return side->scratch.data;
+}
+
+static inline uint64 diff_rotl(uint64 x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64 diff_finish_hash(uint64 low, uint64 high, int64 count) {
+    uint64 h = diff_rotl(low, 17) ^ (high * DIFF_PRIME1) ^ ((uint64)count * DIFF_PRIME2);
+    h ^= h >> 33;
+    h *= DIFF_PRIME2;
+    h ^= h >> 29;
+    return h;
+}
+
+#ifdef DIFF_SSE2
+// SSE2 only multiplies 32 by 32 bits, so like XXH3 each 64-bit lane multiplies
+// its low half by its high half after a key is mixed in. The input is added
+// as well so a zero product loses nothing, and the shift makes order matter.
+static inline __m128i diff_accumulate(__m128i acc, __m128i v, __m128i key) {
+    __m128i mixed = _mm_xor_si128(v, key);
+    __m128i product = _mm_mul_epu32(mixed, _mm_shuffle_epi32(mixed, _MM_SHUFFLE(3, 3, 1, 1)));
+    acc = _mm_add_epi64(acc, _mm_add_epi64(product, _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2))));
+    return _mm_xor_si128(acc, _mm_srli_epi64(acc, 29));
+}
+
+// 16 bytes a step, the last partial step reloads the final 16 bytes instead
+static uint64 diff_hash(const char *data, int64 count) {
+    static const uint64 seed[2] = { DIFF_PRIME1, DIFF_PRIME2 };
+    static const uint64 secret[2] = { 0xBE4BA423396CFEB8ULL, 0x1CAD21F72C81017CULL };
+    __m128i acc = _mm_loadu_si128((const __m128i *)seed);
+    __m128i key = _mm_loadu_si128((const __m128i *)secret);
+    int64 i = 0;
+    for (; i + 16 <= count; i += 16) {
+        acc = diff_accumulate(acc, _mm_loadu_si128((const __m128i *)(data + i)), key);
+    }
+    if (i < count) {
+        __m128i v;
+        if (count >= 16) {
+            v = _mm_loadu_si128((const __m128i *)(data + count - 16));
+        } else {
+            char tail[16] = {};
+            memcpy(tail, data, count);
+            v = _mm_loadu_si128((const __m128i *)tail);
+        }
+        acc = diff_accumulate(acc, v, key);
+    }
+    uint64 lanes[2];
+    _mm_storeu_si128((__m128i *)lanes, acc);
+    return diff_finish_hash(lanes[0], lanes[1], count);
+}
+#else
+static uint64 diff_hash(const char *data, int64 count) {
+    uint64 low = DIFF_PRIME1;
+    uint64 high = DIFF_PRIME2;
+    int64 i = 0;
+    for (; i + 16 <= count; i += 16) {
+        uint64 x, y;
+        memcpy(&x, data + i, 8);
+        memcpy(&y, data + i + 8, 8);
+        low = diff_rotl(low + x * DIFF_PRIME2, 31) * DIFF_PRIME1;
+        high = diff_rotl(high + y * DIFF_PRIME2, 31) * DIFF_PRIME1;
+    }
+    for (; i < count; i++) {
+        low = diff_rotl(low ^ ((uint8)data[i] * DIFF_PRIME1), 11) * DIFF_PRIME2;
+    }
+    return diff_finish_hash(low, high, count);
+}
+#endif
+
+// Gives every line the id of the first line with the same text, in either
+// buffer. Hashes only find the candidates, the text is always compared. The
+// table is far bigger than the cache, so the slots of a whole batch of lines
+// are fetched before any of them is looked at.
+static int32 diff_assign_ids(Diff_Side *sides) {
+    int64 total = sides[0].line_count + sides[1].line_count;
+    size_t table_size = 1024;
+    while (table_size < (size_t)(total + total / 2)) table_size *= 2;
+    size_t mask = table_size - 1;
+    Diff_Slot *table = (Diff_Slot *)calloc(table_size, sizeof(Diff_Slot));
+    Array<Diff_Line_Ref> firsts;
+    uint64 hashes[DIFF_HASH_BATCH];
+
+    for (int32 s = 0; s < 2; s++) {
+        Diff_Side *side = &sides[s];
+        for (int64 batch = 0; batch < side->line_count; batch += DIFF_HASH_BATCH) {
+            int64 batch_count = MIN(side->line_count - batch, DIFF_HASH_BATCH);
+            for (int64 i = 0; i < batch_count; i++) {
+                int64 count;
+                const char *text = diff_line_text(side, batch + i, &count);
+                hashes[i] = diff_hash(text, count);
+#ifdef DIFF_SSE2
+                _mm_prefetch((const char *)&table[(size_t)hashes[i] & mask], _MM_HINT_T0);
+#endif
+            }
+
+            for (int64 i = 0; i < batch_count; i++) {
+                int64 line = batch + i;
+                int64 count;
+                const char *text = diff_line_text(side, line, &count);
+                uint32 check = (uint32)(hashes[i] >> 32);
+                size_t index = (size_t)hashes[i] & mask;
+                for (;;) {
+                    Diff_Slot *slot = &table[index];
+                    if (slot->id == 0) {
+                        Diff_Line_Ref first = { s, line };
+                        firsts.push(first);
+                        slot->check = check;
+                        slot->id = (int32)firsts.count;
+                        side->ids[line] = slot->id - 1;
+                        break;
+                    }
+                    if (slot->check == check) {
+                        Diff_Line_Ref *first = &firsts[slot->id - 1];
+                        int64 first_count;
+                        const char *first_text = diff_line_text(&sides[first->side], first->line, &first_count);
+                        if (first_count == count && memcmp(first_text, text, count) == 0) {
+                            side->ids[line] = slot->id - 1;
+                            break;
+                        }
+                    }
+                    index = (index + 1) & mask;
+                }
+            }
+        }
+    }
+
+    int32 id_count = (int32)firsts.count;
+    firsts.clear();
+    free(table);
+    return id_count;
+}
+
+static void diff_mark_region(Diff_Work *w, Diff_Region r) {
+    memset(w->a_changed + r.a0, 1, r.a1 - r.a0);
+    memset(w->b_changed + r.b0, 1, r.b1 - r.b0);
+}
+
+// Splits the region around its longest run of equal lines made of the lines
+// that are rarest in the old side. Returns false if the sides share no line.
+static bool diff_histogram_split(Diff_Work *w, Diff_Region r) {
+    for (int64 i = r.a1 - 1; i >= r.a0; i--) {
+        int32 id = w->a[i];
+        w->next[i] = w->counts[id] ? w->heads[id] : -1;
+        w->heads[id] = i;
+        w->counts[id]++;
+    }
+
+    bool common = false;
+    int64 best_count = DIFF_MAX_CHAIN + 1;
+    Diff_Region best = {};
+    for (int64 b = r.b0; b < r.b1;) {
+        int64 count = w->counts[w->b[b]];
+        int64 next_b = b + 1;
+        if (count > 0) common = true;
+        if (count == 0 || count > best_count) {
+            b = next_b;
+            continue;
+        }
+        for (int64 a = w->heads[w->b[b]]; a >= 0; a = w->next[a]) {
+            int64 as = a, bs = b, ae = a + 1, be = b + 1;
+            int64 rarest = count;
+            while (as > r.a0 && bs > r.b0 && w->a[as - 1] == w->b[bs - 1]) {
+                as--;
+                bs--;
+                rarest = MIN(rarest, w->counts[w->a[as]]);
+            }
+            while (ae < r.a1 && be < r.b1 && w->a[ae] == w->b[be]) {
+                rarest = MIN(rarest, w->counts[w->a[ae]]);
+                ae++;
+                be++;
+            }
+            if (be > next_b) next_b = be;
+            if (rarest < best_count || (rarest == best_count && be - bs > best.b1 - best.b0)) {
+                best = { as, ae, bs, be, false };
+                best_count = rarest;
+            }
+            // Later occurrences inside this run would only find it again
+            while (w->next[a] >= 0 && w->next[a] < ae) a = w->next[a];
+        }
+        b = next_b;
+    }
+
+    for (int64 i = r.a0; i < r.a1; i++) {
+        w->counts[w->a[i]] = 0;
+    }
+
+    if (best.a1 > best.a0) {
+        Diff_Region before = { r.a0, best.a0, r.b0, best.b0, false };
+        Diff_Region after = { best.a1, r.a1, best.b1, r.b1, false };
+        w->stack.push(after);
+        w->stack.push(before);
+        return true;
+    }
+    if (!common) return false;
+    r.myers = true;
+    w->stack.push(r);
+    return true;
+}
+
+// Splits the region where its shortest edit path crosses the middle, found by
+// searching from both ends at once as in Myers' linear space variant.
+// Returns false when the sides share no line.
+static bool diff_myers_split(Diff_Work *w, Diff_Region r) {
+    int32 *a = w->a + r.a0;
+    int32 *b = w->b + r.b0;
+    int64 n = r.a1 - r.a0;
+    int64 m = r.b1 - r.b0;
+    int64 max_d = MIN((n + m + 1) / 2, DIFF_MAX_COST);
+    int64 offset = max_d;
+    int64 length = 2 * max_d + 2;
+    int64 *v1 = w->forward;
+    int64 *v2 = w->backward;
+    for (int64 i = 0; i < length; i++) {
+        v1[i] = -1;
+        v2[i] = -1;
+    }
+    v1[offset + 1] = 0;
+    v2[offset + 1] = 0;
+    int64 delta = n - m;
+    // With an odd delta the forward search is the one that can overlap first
+    bool front = (delta & 1) != 0;
+    int64 k1_start = 0, k1_end = 0, k2_start = 0, k2_end = 0;
+    int64 split_x = -1, split_y = -1;
+
+    for (int64 d = 0; d < max_d && split_x < 0; d++) {
+        for (int64 k1 = -d + k1_start; k1 <= d - k1_end; k1 += 2) {
+            int64 k1_offset = offset + k1;
+            int64 x1;
+            if (k1 == -d || (k1 != d && v1[k1_offset - 1] < v1[k1_offset + 1])) {
+                x1 = v1[k1_offset + 1];
+            } else {
+                x1 = v1[k1_offset - 1] + 1;
+            }
+            int64 y1 = x1 - k1;
+            while (x1 < n && y1 < m && a[x1] == b[y1]) {
+                x1++;
+                y1++;
+            }
+            v1[k1_offset] = x1;
+            if (x1 > n) {
+                k1_end += 2;
+            } else if (y1 > m) {
+                k1_start += 2;
+            } else if (front) {
+                int64 k2_offset = offset + delta - k1;
+                if (k2_offset >= 0 && k2_offset < length && v2[k2_offset] != -1 && x1 >= n - v2[k2_offset]) {
+                    split_x = x1;
+                    split_y = y1;
+                    break;
+                }
+            }
+        }
+        if (split_x >= 0) break;
+
+        for (int64 k2 = -d + k2_start; k2 <= d - k2_end; k2 += 2) {
+            int64 k2_offset = offset + k2;
+            int64 x2;
+            if (k2 == -d || (k2 != d && v2[k2_offset - 1] < v2[k2_offset + 1])) {
+                x2 = v2[k2_offset + 1];
+            } else {
+                x2 = v2[k2_offset - 1] + 1;
+            }
+            int64 y2 = x2 - k2;
+            while (x2 < n && y2 < m && a[n - x2 - 1] == b[m - y2 - 1]) {
+                x2++;
+                y2++;
+            }
+            v2[k2_offset] = x2;
+            if (x2 > n) {
+                k2_end += 2;
+            } else if (y2 > m) {
+                k2_start += 2;
+            } else if (!front) {
+                int64 k1_offset = offset + delta - k2;
+                if (k1_offset >= 0 && k1_offset < length && v1[k1_offset] != -1) {
+                    int64 x1 = v1[k1_offset];
+                    int64 y1 = offset + x1 - k1_offset;
+                    if (x1 >= n - x2) {
+                        split_x = x1;
+                        split_y = y1;
+                        break;
+                    }
+                }
+            }
+        }
+    }
+
+    if (split_x < 0 && max_d < (n + m + 1) / 2) {
+        // Too costly, split where either search got furthest instead. The
+        // result is still a valid diff, just not always the shortest.
+        int64 best = 0;
+        for (int64 i = 0; i < length; i++) {
+            int64 x1 = v1[i];
+            int64 y1 = x1 - (i - offset);
+            if (x1 >= 0 && x1 <= n && y1 >= 0 && y1 <= m && x1 + y1 > best) {
+                best = x1 + y1;
+                split_x = x1;
+                split_y = y1;
+            }
+            int64 x2 = v2[i];
+            int64 y2 = x2 - (i - offset);
+            if (x2 >= 0 && x2 <= n && y2 >= 0 && y2 <= m && x2 + y2 > best) {
+                best = x2 + y2;
+                split_x = n - x2;
+                split_y = m - y2;
+            }
+        }
+    }
+    if (split_x < 0) return false;
+    if ((split_x == 0 && split_y == 0) || (split_x == n && split_y == m)) return false;
+    Diff_Region before = { r.a0, r.a0 + split_x, r.b0, r.b0 + split_y, true };
+    Diff_Region after = { r.a0 + split_x, r.a1, r.b0 + split_y, r.b1, true };
+    w->stack.push(after);
+    w->stack.push(before);
+    return true;
+}
+
+// Marks the lines of both sides that aren't part of the common subsequence
+static void diff_lines(Diff_Work *w, int64 a_count, int64 b_count) {
+    Diff_Region whole = { 0, a_count, 0, b_count, false };
+    w->stack.push(whole);
+    while (w->stack.count > 0) {
+        Diff_Region r = w->stack.back();
+        w->stack.pop();
+        while (r.a0 < r.a1 && r.b0 < r.b1 && w->a[r.a0] == w->b[r.b0]) {
+            r.a0++;
+            r.b0++;
+        }
+        while (r.a0 < r.a1 && r.b0 < r.b1 && w->a[r.a1 - 1] == w->b[r.b1 - 1]) {
+            r.a1--;
+            r.b1--;
+        }
+        if (r.a0 == r.a1 || r.b0 == r.b1) {
+            diff_mark_region(w, r);
+            continue;
+        }
+        bool split = r.myers ? diff_myers_split(w, r) : diff_histogram_split(w, r);
+        if (!split) diff_mark_region(w, r);
+    }
+    w->stack.clear();
+}
+
+// Unchanged lines pair up in order, every run of changed lines between them is a hunk
+static void diff_build_hunks(Diff *diff, Diff_Side *old_side, Diff_Side *new_side) {
+    diff->hunks.reset_count();
+    int64 i = 0, j = 0;
+    while (i < old_side->line_count || j < new_side->line_count) {
+        if (i < old_side->line_count && j < new_side->line_count && !old_side->changed[i] && !new_side->changed[j]) {
+            i++;
+            j++;
+            continue;
+        }
+        Diff_Hunk hunk = { i, 0, j, 0, 0 };
+        while (i < old_side->line_count && old_side->changed[i]) i++;
+        while (j < new_side->line_count && new_side->changed[j]) j++;
+        hunk.old_count = i - hunk.old_line;
+        hunk.new_count = j - hunk.new_line;
+        assert(hunk.old_count > 0 || hunk.new_count > 0);
+        if (hunk.old_count == 0 && hunk.new_count == 0) break;
+        diff->hunks.push(hunk);
+    }
+}
+
+static void diff_side_init(Diff_Side *side, Buffer *buffer) {
+    buffer_index_finish(buffer);
+    side->buffer = buffer;
+    side->chunk_count = buffer_get_chunks(buffer, side->chunks);
+    side->line_count = buffer_get_line_count(buffer);
+    side->starts = (int64 *)malloc((side->line_count + 1) * sizeof(int64));
+    buffer->line_starts.decode(0, side->line_count + 1, side->starts);
+    side->ids = (int32 *)malloc(MAX(side->line_count, 1) * sizeof(int32));
+    side->changed = (uint8 *)calloc(MAX(side->line_count, 1), 1);
+}
+
+static void diff_side_free(Diff_Side *side) {
+    free(side->starts);
+    free(side->ids);
+    free(side->changed);
+    side->scratch.clear();
+}
+
+static void diff_compute(Diff *diff) {
+    Diff_Side sides[2] = {};
+    diff_side_init(&sides[0], diff->old_buffer);
+    diff_side_init(&sides[1], diff->new_buffer);
+    int32 id_count = diff_assign_ids(sides);
+
+    Diff_Work w = {};
+    w.a = sides[0].ids;
+    w.b = sides[1].ids;
+    w.a_changed = sides[0].changed;
+    w.b_changed = sides[1].changed;
+    w.counts = (int32 *)calloc(MAX(id_count, 1), sizeof(int32));
+    w.heads = (int64 *)malloc(MAX(id_count, 1) * sizeof(int64));
+    w.next = (int64 *)malloc(MAX(sides[0].line_count, 1) * sizeof(int64));
+    w.forward = (int64 *)malloc((2 * DIFF_MAX_COST + 2) * sizeof(int64));
+    w.backward = (int64 *)malloc((2 * DIFF_MAX_COST + 2) * sizeof(int64));
+    diff_lines(&w, sides[0].line_count, sides[1].line_count);
+    diff_build_hunks(diff, &sides[0], &sides[1]);
+
+    free(w.counts);
+    free(w.heads);
+    free(w.next);
+    free(w.forward);
+    free(w.backward);
+    diff_side_free(&sides[0]);
+    diff_side_free(&sides[1]);
+
+    diff->old_version = diff->old_buffer->version;
+    diff->new_version = diff->new_buffer->version;
+    diff_set_unified(diff, diff->unified);
+}
+
+Diff *make_diff(Buffer *old_buffer, Buffer *new_buffer) {
+    Diff *diff = new Diff();
+    diff->old_buffer = old_buffer;
+    diff->new_buffer = new_buffer;
+    diff_compute(diff);
+    return diff;
+}
+
+// The file is read into a buffer of its own the way it would be opened, but
+// indexed right away so no job ever holds it and the diff can free it
+Diff *make_diff_with_file(Buffer *buffer, const char *file_name) {
+    File_Attributes attributes = get_file_attributes(file_name);
+    if (!attributes.last_write_time) return nullptr;
+
+    size_t name_length = strlen(file_name);
+    char *name = (char *)malloc(name_length + 1);
+    memcpy(name, file_name, name_length + 1);
+    Buffer *file_buffer = make_buffer(name);
+
+    // Empty files can't be mapped, they have no text either
+    Mapped_File file = map_file(file_name);
+    if (file.data) {
+        String text = text_from_file_data(file.data, file.count, nullptr, nullptr);
+        buffer_insert_text(file_buffer, 0, text);
+        if (text.data != file.data) free(text.data);
+        unmap_file(&file);
+    }
+
+    Diff *diff = make_diff(file_buffer, buffer);
+    diff->owns_old_buffer = true;
+    return diff;
+}
+
+void diff_free(Diff *diff) {
+    if (diff->owns_old_buffer) {
+        char *name = (char *)diff->old_buffer->file_name;
+        buffer_free(diff->old_buffer);
+        free(name);
+    }
+    diff->hunks.clear();
+    delete diff;
+}
+
+// Diffs again after either buffer was edited
+void diff_update(Diff *diff) {
+    if (diff->old_buffer->version == diff->old_version && diff->new_buffer->version == diff->new_version) return;
+    diff_compute(diff);
+}
+
+static int64 diff_hunk_rows(Diff *diff, Diff_Hunk *hunk) {
+    if (diff->unified) return hunk->old_count + hunk->new_count;
+    return MAX(hunk->old_count, hunk->new_count);
+}
+
+void diff_set_unified(Diff *diff, bool unified) {
+    diff->unified = unified;
+    int64 row = 0;
+    int64 old_line = 0;
+    for (size_t i = 0; i < diff->hunks.count; i++) {
+        Diff_Hunk *hunk = &diff->hunks[i];
+        row += hunk->old_line - old_line;
+        hunk->row = row;
+        row += diff_hunk_rows(diff, hunk);
+        old_line = hunk->old_line + hunk->old_count;
+    }
+    diff->row_count = row + buffer_get_line_count(diff->old_buffer) - old_line;
+}
+
+// Index of the first hunk starting after row
+static size_t diff_hunk_after(Diff *diff, int64 row) {
+    size_t lo = 0;
+    size_t hi = diff->hunks.count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (diff->hunks[mid].row <= row) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+Diff_Row diff_get_row(Diff *diff, int64 row) {
+    Diff_Row result = { DIFF_ROW_SAME, row, row };
+    size_t index = diff_hunk_after(diff, row);
+    if (index == 0) return result;
+
+    Diff_Hunk *hunk = &diff->hunks[index - 1];
+    int64 k = row - hunk->row;
+    int64 rows = diff_hunk_rows(diff, hunk);
+    if (k >= rows) {
+        result.old_line = hunk->old_line + hunk->old_count + k - rows;
+        result.new_line = hunk->new_line + hunk->new_count + k - rows;
+        return result;
+    }
+
+    if (diff->unified) {
+        if (k < hunk->old_count) {
+            result.type = DIFF_ROW_DELETED;
+            result.old_line = hunk->old_line + k;
+            result.new_line = k < hunk->new_count ? hunk->new_line + k : -1;
+        } else {
+            k -= hunk->old_count;
+            result.type = DIFF_ROW_INSERTED;
+            result.old_line = k < hunk->old_count ? hunk->old_line + k : -1;
+            result.new_line = hunk->new_line + k;
+        }
+    } else {
+        result.old_line = k < hunk->old_count ? hunk->old_line + k : -1;
+        result.new_line = k < hunk->new_count ? hunk->new_line + k : -1;
+        if (result.old_line < 0) {
+            result.type = DIFF_ROW_INSERTED;
+        } else if (result.new_line < 0) {
+            result.type = DIFF_ROW_DELETED;
+        } else {
+            result.type = DIFF_ROW_CHANGED;
+        }
+    }
+    return result;
+}
+
+// First row showing the line of the old or the new buffer
+int64 diff_find_row(Diff *diff, int64 line, bool old_side) {
+    size_t lo = 0;
+    size_t hi = diff->hunks.count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        int64 start = old_side ? diff->hunks[mid].old_line : diff->hunks[mid].new_line;
+        if (start <= line) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (lo == 0) return line;
+
+    Diff_Hunk *hunk = &diff->hunks[lo - 1];
+    int64 start = old_side ? hunk->old_line : hunk->new_line;
+    int64 count = old_side ? hunk->old_count : hunk->new_count;
+    if (line < start + count) {
+        int64 k = line - start;
+        if (diff->unified && !old_side) k += hunk->old_count;
+        return hunk->row + k;
+    }
+    return hunk->row + diff_hunk_rows(diff, hunk) + line - start - count;
+}
+
+// First row of the next hunk after row, -1 if there is none
+int64 diff_next_hunk_row(Diff *diff, int64 row) {
+    size_t index = diff_hunk_after(diff, row);
+    if (index == diff->hunks.count) return -1;
+    return diff->hunks[index].row;
+}
+
+int64 diff_previous_hunk_row(Diff *diff, int64 row) {
+    size_t index = diff_hunk_after(diff, row - 1);
+    if (index == 0) return -1;
+    return diff->hunks[index - 1].row;
+}
+
+static inline bool diff_is_continuation(String text, int64 i) {
+    return i > 0 && i < text.count && ((uint8)text.data[i] & 0xC0) == 0x80;
+}
+
+// The bytes of a changed line and of the line paired with it that differ,
+// between their common prefix and suffix. Only done for rows on screen.
+bool diff_refine_row(Diff *diff, Diff_Row row, Span *old_span, Span *new_span) {
+    *old_span = {};
+    *new_span = {};
+    if (row.type == DIFF_ROW_SAME || row.old_line < 0 || row.new_line < 0) return false;
+
+    int64 old_start = get_position_from_line(diff->old_buffer, row.old_line);
+    int64 new_start = get_position_from_line(diff->new_buffer, row.new_line);
+    String old_text = buffer_to_string_span(diff->old_buffer, { old_start, old_start + buffer_get_line_length(diff->old_buffer, row.old_line) });
+    String new_text = buffer_to_string_span(diff->new_buffer, { new_start, new_start + buffer_get_line_length(diff->new_buffer, row.new_line) });
+
+    int64 shorter = MIN(old_text.count, new_text.count);
+    int64 prefix = 0;
+    while (prefix < shorter && old_text.data[prefix] == new_text.data[prefix]) prefix++;
+    // Both ends stay on codepoints, the differing part only ever grows
+    while (diff_is_continuation(old_text, prefix)) prefix--;
+    int64 suffix = 0;
+    while (suffix < shorter - prefix && old_text.data[old_text.count - suffix - 1] == new_text.data[new_text.count - suffix - 1]) suffix++;
+    while (suffix > 0 && diff_is_continuation(old_text, old_text.count - suffix)) suffix--;
+
+    *old_span = { prefix, old_text.count - suffix };
+    *new_span = { prefix, new_text.count - suffix };
+    free(old_text.data);
+    free(new_text.data);
+    return old_span->start < old_span->end || new_span->start < new_span->end;
+}
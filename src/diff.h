@@ -0,0 +1,56 @@
+#pragma once
+
+#include "types.h"
+#include "array.h"
+#include "buffer.h"
+
+// Compares two buffers line by line. Every line is hashed once and lines with
+// the same text share an id, so the diff itself only compares integers. Like
+// git's histogram diff each region is split at its rarest common lines, and
+// a region whose common lines are all frequent falls back to Myers.
+enum Diff_Row_Type {
+    DIFF_ROW_SAME,
+    DIFF_ROW_DELETED,
+    DIFF_ROW_INSERTED,
+    DIFF_ROW_CHANGED, // side by side only, an old line beside the new line replacing it
+};
+
+struct Diff_Hunk {
+    int64 old_line;
+    int64 old_count;
+    int64 new_line;
+    int64 new_count;
+    int64 row; // first row of the hunk in the current layout
+};
+
+// A row is worked out from the hunks when it is drawn, nothing is kept per line.
+// A deleted or inserted row of a hunk that replaced lines has the line it is
+// paired with on the other side, otherwise that side is -1.
+struct Diff_Row {
+    Diff_Row_Type type;
+    int64 old_line;
+    int64 new_line;
+};
+
+struct Diff {
+    Buffer *old_buffer;
+    Buffer *new_buffer;
+    bool owns_old_buffer;
+    int64 old_version;
+    int64 new_version;
+    bool unified;
+    Array<Diff_Hunk> hunks;
+    int64 row_count;
+};
+
+Diff *make_diff(Buffer *old_buffer, Buffer *new_buffer);
+Diff *make_diff_with_file(Buffer *buffer, const char *file_name);
+void diff_free(Diff *diff);
+void diff_update(Diff *diff);
+void diff_set_unified(Diff *diff, bool unified);
+
+Diff_Row diff_get_row(Diff *diff, int64 row);
+int64 diff_find_row(Diff *diff, int64 line, bool old_side);
+int64 diff_next_hunk_row(Diff *diff, int64 row);
+int64 diff_previous_hunk_row(Diff *diff, int64 row);
+bool diff_refine_row(Diff *diff, Diff_Row row, Span *old_span, Span *new_span);
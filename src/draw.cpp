@@ -1,20 +1,55 @@
 #include "draw.h"
 #include "types.h"
 #include "qed.h"
+#include "filter.h"
+#include "diff.h"
+#include "utf8.h"
+#include "simple_math.h"
+
+// The atlas only holds the first 256 codepoints
+Glyph *face_get_glyph(Face *face, uint32 codepoint) {
+    if (codepoint >= 256) codepoint = '?';
+    return &face->glyphs[codepoint];
+}
 
 float get_string_width(Face *face, char *str, int64 count) {
     float result = 0.0f;
-    for (int64 i = 0; i < count; i++) {
-        char c = str[i];
-        Glyph *glyph = &face->glyphs[c];
+    for (int64 i = 0; i < count; ) {
+        uint32 codepoint = (uint8)str[i];
+        if (codepoint < 0x80) {
+            i++;
+        } else {
+            i += utf8_decode(str + i, count - i, &codepoint);
+        }
+        Glyph *glyph = face_get_glyph(face, codepoint);
         result += glyph->ax;
     }
     return result;
 }
 
+float buffer_get_span_width(Face *face, Buffer *buffer, int64 start, int64 end) {
+    float result = 0.0f;
+    for (int64 position = start; position < end; ) {
+        int length = 0;
+        uint32 codepoint = buffer_codepoint_at(buffer, position, &length);
+        if (length == 0) break;
+        result += face_get_glyph(face, codepoint)->ax;
+        position += length;
+    }
+    return result;
+}
+
 void draw__begin_group(Render_Target *t) {
-    Render_Group g{};
-    t->groups.push(g);
+    if (t->groups.count < t->group_slots) {
+        Render_Group *group = &t->groups.data[t->groups.count++];
+        group->texture = nullptr;
+        group->vertices.reset_count();
+        group->clip_box = {};
+    } else {
+        Render_Group g{};
+        t->groups.push(g);
+        t->group_slots = t->groups.count;
+    }
     t->current = &t->groups[t->groups.count - 1];
 }
 
@@ -57,9 +92,9 @@ void draw_rectangle(Render_Target *t, Rect rect, v4 color) {
     draw_vertex(t, rect.x1, rect.y0, 0.0f, 0.0f, color);
 }
 
-void draw_glyph(Render_Target *t, Face *face, v2 position, char c, v4 color) {
+void draw_glyph(Render_Target *t, Face *face, v2 position, uint32 codepoint, v4 color) {
     draw__set_texture(t, face->texture);
-    Glyph *glyph = face->glyphs + c;
+    Glyph *glyph = face_get_glyph(face, codepoint);
     float x0 = position.x + glyph->bl;
     float x1 = x0 + glyph->bx;
     float y0 = position.y - glyph->bt + face->ascend;
@@ -81,15 +116,20 @@ void draw_glyph(Render_Target *t, Face *face, v2 position, char c, v4 color) {
 void draw_string(Render_Target *t, Face *face, v2 offset, char *string, int64 count, v4 text_color) {
     draw__set_texture(t, face->texture);
     v2 cursor = V2(0.0f, 0.0f);
-    for (int64 i = 0; i < count; i++) {
-        char c = string[i];
+    for (int64 i = 0; i < count; ) {
+        uint32 c = (uint8)string[i];
+        if (c < 0x80) {
+            i++;
+        } else {
+            i += utf8_decode(string + i, count - i, &c);
+        }
         if (c == '\n') {
             cursor.x = 0.0f;
             cursor.y += face->glyph_height;
             continue;
         }
 
-        Glyph *glyph = face->glyphs + c;
+        Glyph *glyph = face_get_glyph(face, c);
         float x0 = offset.x + cursor.x + glyph->bl;
         float x1 = x0 + glyph->bx;
         float y0 = cursor.y - glyph->bt + face->ascend - offset.y;
@@ -125,91 +165,216 @@ inline v4 theme_color(Theme *theme, Theme_Color color) {
     return result;
 }
 
-void draw_view(Render_Target *t, View *view) {
-    draw__set_texture(t, view->face->texture);
-    draw_rectangle(t, view->rect, theme_color(view->theme, THEME_COLOR_BACKGROUND));
+// Nothing scrolls horizontally, so the rest of a longer line is never on screen
+#define MAX_DRAWN_LINE_LENGTH 4096
 
-    if (view->mark_active) {
-        Cursor start = view->mark;
-        Cursor end = view->cursor;
-        if (start.position > end.position) {
-            Cursor temp = start;
-            start = end;
-            end = temp;
-        }
+// Lines past the end of the line index are found by scanning from the estimated position
+void draw_estimated_view(Render_Target *t, View *view) {
+    Buffer *buffer = view->buffer;
+    float line_height = view->face->glyph_height;
+    int64 row_count = (int64)((view->rect.y1 - view->rect.y0) / line_height) + 1;
+    int64 length = buffer_get_length(buffer);
+    int64 position = view->estimated_position;
+    for (int64 row = 0; row < row_count && position < length; row++) {
+        int64 next = buffer_next_line_start(buffer, position);
+        int64 end = next;
+        while (end > position && (buffer_at(buffer, end - 1) == '\n' || buffer_at(buffer, end - 1) == '\r')) end--;
+        end = MIN(end, position + MAX_DRAWN_LINE_LENGTH);
+        String text = buffer_to_string_span(buffer, { position, end });
+        float y = row * line_height;
+        draw_string(t, view->face, V2(view->rect.x0, -view->rect.y0 - y), text.data, text.count, theme_color(view->theme, THEME_COLOR_DEFAULT));
+        free(text.data);
+        position = next;
+    }
+}
 
-        float line_height = view->face->glyph_height;
+// Bytes of the string that fit in width
+int64 get_string_fit(Face *face, char *str, int64 count, float width) {
+    float x = 0.0f;
+    for (int64 i = 0; i < count; ) {
+        uint32 codepoint = (uint8)str[i];
+        int length = 1;
+        if (codepoint >= 0x80) length = utf8_decode(str + i, count - i, &codepoint);
+        x += face_get_glyph(face, codepoint)->ax;
+        if (x > width) return i;
+        i += length;
+    }
+    return count;
+}
 
-        float line_x = 0.0f;
-        float line_y = line_height * start.line - view->y_off;
+// One side of a diff row, the part of the line that changed gets a stronger
+// color. Lines are cut off at the edge of their column.
+void draw_diff_line(Render_Target *t, View *view, Buffer *buffer, int64 line, Span change, Rect rect, Theme_Color line_color, Theme_Color change_color) {
+    Face *face = view->face;
+    if (line_color != THEME_COLOR_NONE) {
+        draw_rectangle(t, rect, theme_color(view->theme, line_color));
+    }
+    if (line < 0) return;
 
-        // draw first line
-        int64 line_end = view->buffer->line_starts[start.line + 1];
-        float line_width = 0.0f;
-        for (int64 p = view->buffer->line_starts[start.line]; p < start.position; p++) {
-            char c = buffer_at(view->buffer, p);
-            Glyph *g = &view->face->glyphs[c];
-            line_x += g->ax;
-        }
-        if (start.line < end.line) {
-            for (int64 position = start.position ; position < line_end; position++) {
-                char c = buffer_at(view->buffer, position);
-                Glyph *g = &view->face->glyphs[c];
-                line_width += g->ax;
-            }
-            Rect line_rect = { line_x, line_y, line_x + line_width, line_y + line_height };
-            draw_rectangle(t, line_rect, theme_color(view->theme, THEME_COLOR_REGION));
-        }
+    int64 start = get_position_from_line(buffer, line);
+    int64 line_length = MIN(buffer_get_line_length(buffer, line), MAX_DRAWN_LINE_LENGTH);
+    String text = buffer_to_string_span(buffer, { start, start + line_length });
+    int64 count = get_string_fit(face, text.data, text.count, rect.x1 - rect.x0);
+    int64 change_end = MIN(change.end, count);
+    if (change_color != THEME_COLOR_NONE && change.start < change_end) {
+        float x0 = rect.x0 + get_string_width(face, text.data, change.start);
+        float x1 = x0 + get_string_width(face, text.data + change.start, change_end - change.start);
+        Rect change_rect = { x0, rect.y0, x1, rect.y1 };
+        draw_rectangle(t, change_rect, theme_color(view->theme, change_color));
+    }
+    draw_string(t, face, V2(rect.x0, -rect.y0), text.data, count, theme_color(view->theme, THEME_COLOR_DEFAULT));
+    free(text.data);
+}
+
+// Side by side the old buffer is on the left and the new one on the right,
+// unified shows one column with the deleted lines of a hunk above the inserted
+// ones. Both halves are drawn from the same rows, so they scroll together.
+void draw_diff_view(Render_Target *t, View *view) {
+    Diff *diff = view->diff;
+    Face *face = view->face;
+    float line_height = face->glyph_height;
+    int64 first_row = MAX(view->scroll_row, 0);
+    int64 last_row = first_row + (int64)((view->rect.y1 - view->rect.y0) / line_height) + 1;
+    if (last_row > diff->row_count) last_row = diff->row_count;
+    float middle = 0.5f * (view->rect.x0 + view->rect.x1);
+    float gutter = face->glyph_width;
+
+    for (int64 row = first_row; row < last_row; row++) {
+        Diff_Row r = diff_get_row(diff, row);
+        float y = view->rect.y0 + (row - first_row) * line_height;
+        Span old_change, new_change;
+        diff_refine_row(diff, r, &old_change, &new_change);
 
-        // draw whole lines
-        for (int64 line = start.line + 1; line < end.line; line++) {
-            line_width = 0.0f;
-            line_y = line_height * line - view->y_off;
-            line_end = view->buffer->line_starts[line + 1];
-            for (int64 position = view->buffer->line_starts[line]; position < line_end; position++) {
-                char c = buffer_at(view->buffer, position);
-                Glyph *g = &view->face->glyphs[c];
-                line_width += g->ax;
+        if (diff->unified) {
+            Rect rect = { view->rect.x0 + gutter, y, view->rect.x1, y + line_height };
+            uint32 marker = ' ';
+            if (r.type == DIFF_ROW_DELETED) {
+                marker = '-';
+                draw_diff_line(t, view, diff->old_buffer, r.old_line, old_change, rect, THEME_COLOR_DIFF_DELETED, THEME_COLOR_DIFF_DELETED_CHANGE);
+            } else if (r.type == DIFF_ROW_INSERTED) {
+                marker = '+';
+                draw_diff_line(t, view, diff->new_buffer, r.new_line, new_change, rect, THEME_COLOR_DIFF_INSERTED, THEME_COLOR_DIFF_INSERTED_CHANGE);
+            } else {
+                draw_diff_line(t, view, diff->new_buffer, r.new_line, new_change, rect, THEME_COLOR_NONE, THEME_COLOR_NONE);
             }
-            Rect line_rect = { 0.0f, line_y, line_width, line_y + line_height };
-            draw_rectangle(t, line_rect, theme_color(view->theme, THEME_COLOR_REGION));
+            draw_glyph(t, face, V2(view->rect.x0, y), marker, theme_color(view->theme, THEME_COLOR_DEFAULT));
+            continue;
         }
 
-        // draw remainder line
-        line_width = 0.0f;
-        line_y = line_height * end.line - view->y_off;
-        for (int64 position = view->buffer->line_starts[end.line]; position < end.position; position++) {
-            char c = buffer_at(view->buffer, position);
-            Glyph *g = &view->face->glyphs[c];
-            line_width += g->ax;
-        }
-        Rect line_rect = { 0.0f, line_y, line_width, line_y + line_height };
-        draw_rectangle(t, line_rect, theme_color(view->theme, THEME_COLOR_REGION));
+        bool same = r.type == DIFF_ROW_SAME;
+        Rect old_rect = { view->rect.x0, y, middle - 0.5f * gutter, y + line_height };
+        Rect new_rect = { middle + 0.5f * gutter, y, view->rect.x1, y + line_height };
+        draw_diff_line(t, view, diff->old_buffer, r.old_line, old_change, old_rect,
+            same || r.old_line < 0 ? THEME_COLOR_NONE : THEME_COLOR_DIFF_DELETED,
+            same ? THEME_COLOR_NONE : THEME_COLOR_DIFF_DELETED_CHANGE);
+        draw_diff_line(t, view, diff->new_buffer, r.new_line, new_change, new_rect,
+            same || r.new_line < 0 ? THEME_COLOR_NONE : THEME_COLOR_DIFF_INSERTED,
+            same ? THEME_COLOR_NONE : THEME_COLOR_DIFF_INSERTED_CHANGE);
+    }
+
+    if (!diff->unified) {
+        Rect divider = { middle - 1.0f, view->rect.y0, middle + 1.0f, view->rect.y1 };
+        draw_rectangle(t, divider, theme_color(view->theme, THEME_COLOR_UI_BACKGROUND));
+    }
+}
+
+// Only the rows on screen are drawn, each copied from its source line
+void draw_view(Render_Target *t, View *view) {
+    draw__set_texture(t, view->face->texture);
+    draw_rectangle(t, view->rect, theme_color(view->theme, THEME_COLOR_BACKGROUND));
+
+    if (view->diff) {
+        draw_diff_view(t, view);
+        return;
+    }
+
+    if (view->estimated_position >= 0) {
+        draw_estimated_view(t, view);
+        return;
     }
 
-    String buffer_string = buffer_to_string(view->buffer);
+    Buffer *buffer = view->buffer;
+    float line_height = view->face->glyph_height;
+    int64 row_count = view_get_row_count(view);
+    int64 first_row = view->scroll_row;
+    if (first_row < 0) first_row = 0;
+    int64 last_row = first_row + (int64)((view->rect.y1 - view->rect.y0) / line_height) + 1;
+    if (last_row > row_count) last_row = row_count;
 
-    draw_string(t, view->face, V2(view->rect.x0, -view->rect.y0 + (float)view->y_off), buffer_string.data, buffer_string.count, theme_color(view->theme, THEME_COLOR_DEFAULT));
+    Span region = {};
+    if (view->mark_active) {
+        region.start = MIN(view->mark.position, view->cursor.position);
+        region.end = MAX(view->mark.position, view->cursor.position);
+    }
 
-    float cw = get_string_width(view->face, buffer_string.data + view->cursor.position, 1);
-    if (cw == 0) cw = view->face->glyph_width;
-    float cx = get_string_width(view->face, buffer_string.data + view->buffer->line_starts[view->cursor.line], view->cursor.col);
-    float cy = view->cursor.line * view->face->glyph_height - view->y_off;
-    Rect rc = { cx, cy, cx + cw, cy + view->face->glyph_height };
-    draw_rectangle(t, rc, theme_color(view->theme, THEME_COLOR_CURSOR));
+    for (int64 row = first_row; row < last_row; row++) {
+        int64 line = view_get_line(view, row);
+        int64 start = get_position_from_line(buffer, line);
+        int64 line_length = MIN(buffer_get_line_length(buffer, line), MAX_DRAWN_LINE_LENGTH);
+        float y = (row - first_row) * line_height;
 
-    char cursor_char = buffer_at(view->buffer, view->cursor.position);
-    if (cursor_char == '\n') cursor_char = ' ';
-    draw_glyph(t, view->face, V2(cx, cy), cursor_char, theme_color(view->theme, THEME_COLOR_CURSOR_CHAR));
+        // The region covers the line break as well, like the text it selects
+        int64 region_start = MAX(region.start, start);
+        int64 region_end = MIN(region.end, buffer->line_starts[line + 1]);
+        if (region_start < region_end) {
+            float x0 = buffer_get_span_width(view->face, buffer, start, region_start);
+            float x1 = x0 + buffer_get_span_width(view->face, buffer, region_start, region_end);
+            Rect line_rect = { x0, y, x1, y + line_height };
+            draw_rectangle(t, line_rect, theme_color(view->theme, THEME_COLOR_REGION));
+        }
 
-    free(buffer_string.data);
+        String text = buffer_to_string_span(buffer, { start, start + line_length });
+        draw_string(t, view->face, V2(view->rect.x0, -view->rect.y0 - y), text.data, text.count, theme_color(view->theme, THEME_COLOR_DEFAULT));
+
+        if (line == view->cursor.line) {
+            int64 col = view->cursor.col < text.count ? view->cursor.col : text.count;
+            float cx = get_string_width(view->face, text.data, col);
+            uint32 cursor_char = ' ';
+            float cw = 0.0f;
+            if (col < text.count) {
+                int length = utf8_decode(text.data + col, text.count - col, &cursor_char);
+                cw = get_string_width(view->face, text.data + col, length);
+            }
+            if (cw == 0) cw = view->face->glyph_width;
+            Rect rc = { cx, y, cx + cw, y + line_height };
+            draw_rectangle(t, rc, theme_color(view->theme, THEME_COLOR_CURSOR));
+            draw_glyph(t, view->face, V2(cx, y), cursor_char, theme_color(view->theme, THEME_COLOR_CURSOR_CHAR));
+        }
+        free(text.data);
+    }
 }
 
 void draw_find_file_dialog(Render_Target *t, Find_File_Dialog *dialog) {
     if (!dialog->is_active) return;
 
-    String file_name = buffer_to_string(dialog->view->buffer);
-    Rect rc = { 0.25f * t->width, 0.1f * t->height, 0.75f * t->width, 0.25f * t->height };
-    draw_rectangle(t, rc, theme_color(dialog->view->theme, THEME_COLOR_UI_BACKGROUND));
-    draw_string(t, dialog->view->face, V2(rc.x0, -rc.y0), file_name.data, file_name.count, theme_color(dialog->view->theme, THEME_COLOR_UI_DEFAULT));
+    View *view = dialog->view;
+    float line_height = view->face->glyph_height;
+    String file_name = buffer_to_string(view->buffer);
+    Rect rc = { 0.25f * t->width, 0.1f * t->height, 0.75f * t->width, 0.1f * t->height + (dialog->match_count + 1) * line_height };
+    draw_rectangle(t, rc, theme_color(view->theme, THEME_COLOR_UI_BACKGROUND));
+    draw_string(t, view->face, V2(rc.x0, -rc.y0), file_name.data, file_name.count, theme_color(view->theme, THEME_COLOR_UI_DEFAULT));
+    free(file_name.data);
+
+    for (int64 i = 0; i < dialog->match_count; i++) {
+        float y = rc.y0 + (i + 1) * line_height;
+        if (i == dialog->selected) {
+            Rect selection = { rc.x0, y, rc.x1, y + line_height };
+            draw_rectangle(t, selection, theme_color(view->theme, THEME_COLOR_REGION));
+        }
+        const char *path = file_index_path(dialog->index, dialog->matches[i].index);
+        draw_string(t, view->face, V2(rc.x0, -y), (char *)path, strlen(path), theme_color(view->theme, THEME_COLOR_DEFAULT));
+    }
+}
+
+void draw_prompt(Render_Target *t, Prompt *prompt) {
+    if (!prompt->is_active) return;
+
+    View *view = prompt->view;
+    String text = buffer_to_string(view->buffer);
+    Rect rc = { 0.25f * t->width, 0.1f * t->height, 0.75f * t->width, 0.1f * t->height + 2.0f * view->face->glyph_height };
+    draw_rectangle(t, rc, theme_color(view->theme, THEME_COLOR_UI_BACKGROUND));
+    float label_width = get_string_width(view->face, (char *)prompt->label, strlen(prompt->label));
+    draw_string(t, view->face, V2(rc.x0, -rc.y0), (char *)prompt->label, strlen(prompt->label), theme_color(view->theme, THEME_COLOR_UI_DEFAULT));
+    draw_string(t, view->face, V2(rc.x0 + label_width, -rc.y0), text.data, text.count, theme_color(view->theme, THEME_COLOR_DEFAULT));
+    free(text.data);
 }
@@ -24,7 +24,12 @@ struct Render_Target {
 
     Render_Group *current;
     Array<Render_Group> groups;
+    size_t group_slots; // groups from earlier frames whose vertex storage is kept
 };
 
+Glyph *face_get_glyph(Face *face, uint32 codepoint);
+float get_string_width(Face *face, char *str, int64 count);
+
 void draw_view(Render_Target *t, View *view);
 void draw_find_file_dialog(Render_Target *t, Find_File_Dialog *dialog);
+void draw_prompt(Render_Target *t, Prompt *prompt);
@@ -0,0 +1,302 @@
+#include "encoding.h"
+#include "utf8.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#include <emmintrin.h>
+#define ENCODING_SSE2 1
+#endif
+
+#define REPLACEMENT_CHARACTER 0xFFFD
+// UTF-8 with at most one bad byte per this many valid multi-byte sequences is still UTF-8
+#define ENCODING_UTF8_INVALID_RATIO 8
+
+// Windows-1252 0x80-0x9F, the rest of the code page is the same as Latin-1.
+// The five unassigned bytes map to the C1 control with the same value.
+static const uint16 windows_1252_high[32] = {
+    0x20AC, 0x0081, 0x201A, 0x0192, 0x201E, 0x2026, 0x2020, 0x2021,
+    0x02C6, 0x2030, 0x0160, 0x2039, 0x0152, 0x008D, 0x017D, 0x008F,
+    0x0090, 0x2018, 0x2019, 0x201C, 0x201D, 0x2022, 0x2013, 0x2014,
+    0x02DC, 0x2122, 0x0161, 0x203A, 0x0153, 0x009D, 0x017E, 0x0178,
+};
+
+const char *encoding_name(Text_Encoding encoding) {
+    switch (encoding) {
+    case TEXT_ENCODING_UTF8: return "UTF-8";
+    case TEXT_ENCODING_UTF8_BOM: return "UTF-8 with BOM";
+    case TEXT_ENCODING_UTF16LE: return "UTF-16LE";
+    case TEXT_ENCODING_UTF16LE_BOM: return "UTF-16LE with BOM";
+    case TEXT_ENCODING_UTF16BE: return "UTF-16BE";
+    case TEXT_ENCODING_UTF16BE_BOM: return "UTF-16BE with BOM";
+    case TEXT_ENCODING_WINDOWS_1252: return "Windows-1252";
+    }
+    return "unknown";
+}
+
+// For bytes past the start of the file, where there's no BOM to skip
+Text_Encoding encoding_without_bom(Text_Encoding encoding) {
+    switch (encoding) {
+    case TEXT_ENCODING_UTF8_BOM: return TEXT_ENCODING_UTF8;
+    case TEXT_ENCODING_UTF16LE_BOM: return TEXT_ENCODING_UTF16LE;
+    case TEXT_ENCODING_UTF16BE_BOM: return TEXT_ENCODING_UTF16BE;
+    default: return encoding;
+    }
+}
+
+bool encoding_is_utf16(Text_Encoding encoding, bool *big_endian) {
+    encoding = encoding_without_bom(encoding);
+    if (big_endian) *big_endian = encoding == TEXT_ENCODING_UTF16BE;
+    return encoding == TEXT_ENCODING_UTF16LE || encoding == TEXT_ENCODING_UTF16BE;
+}
+
+// Without a BOM, UTF-16 shows up as zero bytes on one side of most code units
+Text_Encoding detect_encoding(const char *data, int64 count) {
+    const uint8 *s = (const uint8 *)data;
+    if (count >= 3 && s[0] == 0xEF && s[1] == 0xBB && s[2] == 0xBF) return TEXT_ENCODING_UTF8_BOM;
+    if (count >= 2 && s[0] == 0xFF && s[1] == 0xFE) return TEXT_ENCODING_UTF16LE_BOM;
+    if (count >= 2 && s[0] == 0xFE && s[1] == 0xFF) return TEXT_ENCODING_UTF16BE_BOM;
+
+    int64 sample = count < 4096 ? count : 4096;
+    sample &= ~1;
+    int64 even_zeros = 0;
+    int64 odd_zeros = 0;
+    for (int64 i = 0; i < sample; i += 2) {
+        if (s[i] == 0) even_zeros++;
+        if (s[i + 1] == 0) odd_zeros++;
+    }
+    int64 pairs = sample / 2;
+    if (pairs > 0) {
+        if (odd_zeros > pairs / 4 && even_zeros < odd_zeros / 8) return TEXT_ENCODING_UTF16LE;
+        if (even_zeros > pairs / 4 && odd_zeros < even_zeros / 8) return TEXT_ENCODING_UTF16BE;
+    }
+
+    // A few bad bytes, like a sequence cut short by a truncated write, don't
+    // make the file Windows-1252, they show as themselves. Bad bytes without
+    // any valid multi-byte sequences do.
+    int64 multibyte, invalid;
+    utf8_count_sequences(data, count, &multibyte, &invalid);
+    if (invalid == 0 || invalid * ENCODING_UTF8_INVALID_RATIO <= multibyte) return TEXT_ENCODING_UTF8;
+    return TEXT_ENCODING_WINDOWS_1252;
+}
+
+static inline uint32 read_utf16_unit(const uint8 *s, int64 i, bool big_endian) {
+    if (big_endian) return (uint32)s[2 * i] << 8 | s[2 * i + 1];
+    return (uint32)s[2 * i] | (uint32)s[2 * i + 1] << 8;
+}
+
+// Returns the number of code units used, unpaired surrogates become U+FFFD
+static int utf16_decode(const uint8 *s, int64 i, int64 units, bool big_endian, uint32 *codepoint) {
+    uint32 unit = read_utf16_unit(s, i, big_endian);
+    *codepoint = unit;
+    if (unit < 0xD800 || unit > 0xDFFF) return 1;
+    *codepoint = REPLACEMENT_CHARACTER;
+    if (unit > 0xDBFF || i + 1 >= units) return 1;
+    uint32 low = read_utf16_unit(s, i + 1, big_endian);
+    if (low < 0xDC00 || low > 0xDFFF) return 1;
+    *codepoint = 0x10000 + ((unit - 0xD800) << 10) + (low - 0xDC00);
+    return 2;
+}
+
+static char *utf16_to_utf8(const uint8 *s, int64 units, bool big_endian, char *dest) {
+    int64 i = 0;
+    while (i < units) {
+        int64 end = units;
+#ifdef ENCODING_SSE2
+        // 16 ASCII code units at a time narrow straight to 16 bytes
+        if (i + 16 <= units) {
+            __m128i a = _mm_loadu_si128((const __m128i *)(s + 2 * i));
+            __m128i b = _mm_loadu_si128((const __m128i *)(s + 2 * i + 16));
+            if (big_endian) {
+                a = _mm_or_si128(_mm_slli_epi16(a, 8), _mm_srli_epi16(a, 8));
+                b = _mm_or_si128(_mm_slli_epi16(b, 8), _mm_srli_epi16(b, 8));
+            }
+            __m128i high = _mm_and_si128(_mm_or_si128(a, b), _mm_set1_epi16((short)0xFF80));
+            if (_mm_movemask_epi8(_mm_cmpeq_epi16(high, _mm_setzero_si128())) == 0xFFFF) {
+                _mm_storeu_si128((__m128i *)dest, _mm_packus_epi16(a, b));
+                dest += 16;
+                i += 16;
+                continue;
+            }
+            end = i + 16;
+        }
+#endif
+        while (i < end) {
+            uint32 codepoint;
+            i += utf16_decode(s, i, units, big_endian, &codepoint);
+            dest += utf8_encode(codepoint, dest);
+        }
+    }
+    return dest;
+}
+
+static char *utf8_to_utf16(const char *text, int64 count, bool big_endian, char *dest) {
+    int64 i = 0;
+    while (i < count) {
+        int64 end = count;
+#ifdef ENCODING_SSE2
+        // 16 ASCII bytes at a time widen straight to 16 code units
+        if (i + 16 <= count) {
+            __m128i block = _mm_loadu_si128((const __m128i *)(text + i));
+            if (_mm_movemask_epi8(block) == 0) {
+                __m128i zero = _mm_setzero_si128();
+                __m128i lo = big_endian ? _mm_unpacklo_epi8(zero, block) : _mm_unpacklo_epi8(block, zero);
+                __m128i hi = big_endian ? _mm_unpackhi_epi8(zero, block) : _mm_unpackhi_epi8(block, zero);
+                _mm_storeu_si128((__m128i *)dest, lo);
+                _mm_storeu_si128((__m128i *)(dest + 16), hi);
+                dest += 32;
+                i += 16;
+                continue;
+            }
+            end = i + 16;
+        }
+#endif
+        while (i < end) {
+            uint32 codepoint;
+            i += utf8_decode(text + i, count - i, &codepoint);
+            uint16 units[2];
+            int unit_count = 1;
+            units[0] = (uint16)codepoint;
+            if (codepoint >= 0x10000) {
+                codepoint -= 0x10000;
+                units[0] = (uint16)(0xD800 + (codepoint >> 10));
+                units[1] = (uint16)(0xDC00 + (codepoint & 0x3FF));
+                unit_count = 2;
+            }
+            for (int u = 0; u < unit_count; u++) {
+                uint8 first = (uint8)(units[u] & 0xFF);
+                uint8 second = (uint8)(units[u] >> 8);
+                *dest++ = (char)(big_endian ? second : first);
+                *dest++ = (char)(big_endian ? first : second);
+            }
+        }
+    }
+    return dest;
+}
+
+static char *windows_1252_to_utf8(const char *text, int64 count, char *dest) {
+    int64 i = 0;
+    while (i < count) {
+        int64 ascii = utf8_ascii_prefix(text + i, count - i);
+        memcpy(dest, text + i, ascii);
+        dest += ascii;
+        i += ascii;
+        if (i >= count) break;
+        uint8 c = (uint8)text[i++];
+        uint32 codepoint = (c >= 0x80 && c < 0xA0) ? windows_1252_high[c - 0x80] : c;
+        dest += utf8_encode(codepoint, dest);
+    }
+    return dest;
+}
+
+static char *utf8_to_windows_1252(const char *text, int64 count, char *dest) {
+    int64 i = 0;
+    while (i < count) {
+        int64 ascii = utf8_ascii_prefix(text + i, count - i);
+        memcpy(dest, text + i, ascii);
+        dest += ascii;
+        i += ascii;
+        if (i >= count) break;
+        uint32 codepoint;
+        i += utf8_decode(text + i, count - i, &codepoint);
+        char c = '?';
+        if (codepoint >= 0xA0 && codepoint <= 0xFF) {
+            c = (char)codepoint;
+        } else {
+            for (int j = 0; j < 32; j++) {
+                if (windows_1252_high[j] == codepoint) {
+                    c = (char)(0x80 + j);
+                    break;
+                }
+            }
+        }
+        *dest++ = c;
+    }
+    return dest;
+}
+
+// The result is always UTF-8 without a BOM
+String decode_text(Text_Encoding encoding, const char *data, int64 count) {
+    String result;
+    char *dest = nullptr;
+    switch (encoding) {
+    case TEXT_ENCODING_UTF8:
+    case TEXT_ENCODING_UTF8_BOM:
+    {
+        int64 skip = (encoding == TEXT_ENCODING_UTF8_BOM && count >= 3) ? 3 : 0;
+        result.data = (char *)malloc(count - skip + 1);
+        memcpy(result.data, data + skip, count - skip);
+        dest = result.data + count - skip;
+        break;
+    }
+    case TEXT_ENCODING_UTF16LE:
+    case TEXT_ENCODING_UTF16LE_BOM:
+    case TEXT_ENCODING_UTF16BE:
+    case TEXT_ENCODING_UTF16BE_BOM:
+    {
+        bool big_endian;
+        encoding_is_utf16(encoding, &big_endian);
+        const uint8 *s = (const uint8 *)data;
+        int64 skip = 0;
+        bool bom = encoding == TEXT_ENCODING_UTF16LE_BOM || encoding == TEXT_ENCODING_UTF16BE_BOM;
+        if (bom && count >= 2 && read_utf16_unit(s, 0, big_endian) == 0xFEFF) skip = 2;
+        int64 units = (count - skip) / 2;
+        // 3 bytes covers every unit, a surrogate pair takes 4 bytes for 2 units
+        result.data = (char *)malloc(units * 3 + 4);
+        dest = utf16_to_utf8(s + skip, units, big_endian, result.data);
+        if ((count - skip) & 1) dest += utf8_encode(REPLACEMENT_CHARACTER, dest);
+        break;
+    }
+    case TEXT_ENCODING_WINDOWS_1252:
+        result.data = (char *)malloc(count * 3 + 1);
+        dest = windows_1252_to_utf8(data, count, result.data);
+        break;
+    }
+    *dest = 0;
+    result.count = dest - result.data;
+    return result;
+}
+
+// Codepoints the encoding can't represent are written as '?'
+String encode_text(Text_Encoding encoding, const char *data, int64 count) {
+    String result;
+    char *dest = nullptr;
+    switch (encoding) {
+    case TEXT_ENCODING_UTF8:
+    case TEXT_ENCODING_UTF8_BOM:
+        result.data = (char *)malloc(count + 4);
+        dest = result.data;
+        if (encoding == TEXT_ENCODING_UTF8_BOM) {
+            *dest++ = (char)0xEF;
+            *dest++ = (char)0xBB;
+            *dest++ = (char)0xBF;
+        }
+        memcpy(dest, data, count);
+        dest += count;
+        break;
+    case TEXT_ENCODING_UTF16LE:
+    case TEXT_ENCODING_UTF16LE_BOM:
+    case TEXT_ENCODING_UTF16BE:
+    case TEXT_ENCODING_UTF16BE_BOM:
+    {
+        bool big_endian;
+        encoding_is_utf16(encoding, &big_endian);
+        result.data = (char *)malloc(count * 2 + 3);
+        dest = result.data;
+        if (encoding == TEXT_ENCODING_UTF16LE_BOM || encoding == TEXT_ENCODING_UTF16BE_BOM) {
+            *dest++ = (char)(big_endian ? 0xFE : 0xFF);
+            *dest++ = (char)(big_endian ? 0xFF : 0xFE);
+        }
+        dest = utf8_to_utf16(data, count, big_endian, dest);
+        break;
+    }
+    case TEXT_ENCODING_WINDOWS_1252:
+        result.data = (char *)malloc(count + 1);
+        dest = utf8_to_windows_1252(data, count, result.data);
+        break;
+    }
+    *dest = 0;
+    result.count = dest - result.data;
+    return result;
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include "types.h"
+#include "custom_string.h"
+
+// Buffers always hold UTF-8. A file in any other encoding is transcoded on
+// load and back to the same encoding (and BOM) on save.
+enum Text_Encoding {
+    TEXT_ENCODING_UTF8,
+    TEXT_ENCODING_UTF8_BOM,
+    TEXT_ENCODING_UTF16LE,
+    TEXT_ENCODING_UTF16LE_BOM,
+    TEXT_ENCODING_UTF16BE,
+    TEXT_ENCODING_UTF16BE_BOM,
+    TEXT_ENCODING_WINDOWS_1252,
+};
+
+const char *encoding_name(Text_Encoding encoding);
+Text_Encoding encoding_without_bom(Text_Encoding encoding);
+bool encoding_is_utf16(Text_Encoding encoding, bool *big_endian);
+Text_Encoding detect_encoding(const char *data, int64 count);
+String decode_text(Text_Encoding encoding, const char *data, int64 count);
+String encode_text(Text_Encoding encoding, const char *data, int64 count);
@@ -0,0 +1,431 @@
+#include "file_index.h"
+#include "find_in_files.h"
+#include "path.h"
+#include "thread_pool.h"
+#include "simple_math.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define FILE_INDEX_MAGIC 0x4C494651 // "QFIL"
+#define FILE_INDEX_VERSION 1
+
+struct File_Index_Header {
+    uint32 magic;
+    uint32 version;
+    uint64 file_count;
+    uint64 names_bytes;
+};
+
+// One crawl of the whole tree, or of a directory the watch saw appear. Jobs
+// gather a directory's files and append them under the mutex in one go.
+struct File_Crawl {
+    File_Index *index;
+    bool replace; // a crawl of the whole tree, its list replaces the index
+    Job_Token jobs;
+    Platform_Handle mutex;
+    Array<char> names;
+};
+
+struct File_Crawl_Job {
+    File_Crawl *crawl;
+    char *dir; // relative to the root, empty for the root itself
+};
+
+struct File_Crawl_Visit {
+    File_Crawl *crawl;
+    const char *dir;
+    Array<char> names;
+};
+
+static uint32 file_index_hash(const char *path) {
+    uint32 hash = 2166136261u;
+    for (const char *c = path; *c; c++) {
+        hash = (hash ^ (uint8)*c) * 16777619u;
+    }
+    return hash;
+}
+
+static char *file_crawl_make_path(const char *dir, const char *name) {
+    size_t dir_length = strlen(dir);
+    size_t name_length = strlen(name);
+    char *result = (char *)malloc(dir_length + name_length + 2);
+    memcpy(result, dir, dir_length);
+    result[dir_length] = '/';
+    memcpy(result + dir_length + 1, name, name_length + 1);
+    return result;
+}
+
+const char *file_index_path(File_Index *index, uint32 file) {
+    return index->names.data + index->files[file];
+}
+
+static int64 file_index_find_slot(File_Index *index, const char *path) {
+    if (index->slots.count == 0) return -1;
+    uint32 mask = (uint32)index->slots.count - 1;
+    for (uint32 slot = file_index_hash(path) & mask;; slot = (slot + 1) & mask) {
+        uint32 value = index->slots[slot];
+        if (!value) return -1;
+        if (strcmp(file_index_path(index, value - 1), path) == 0) return slot;
+    }
+}
+
+static void file_index_place(File_Index *index, uint32 file) {
+    uint32 mask = (uint32)index->slots.count - 1;
+    uint32 slot = file_index_hash(file_index_path(index, file)) & mask;
+    while (index->slots[slot]) {
+        slot = (slot + 1) & mask;
+    }
+    index->slots[slot] = file + 1;
+}
+
+static void file_index_rehash(File_Index *index, size_t capacity) {
+    index->slots.clear();
+    index->slots.reserve(capacity);
+    memset(index->slots.data, 0, capacity * sizeof(uint32));
+    index->slots.count = capacity;
+    for (uint32 file = 0; file < index->files.count; file++) {
+        file_index_place(index, file);
+    }
+}
+
+static void file_index_insert(File_Index *index, const char *path) {
+    if (file_index_find_slot(index, path) >= 0) return;
+    if ((index->files.count + 1) * 2 > index->slots.count) {
+        file_index_rehash(index, MAX(index->slots.count * 2, (size_t)1024));
+    }
+    index->files.push((uint32)index->names.count);
+    index->masks.push(fuzzy_mask(path));
+    index->names.append((char *)path, strlen(path) + 1);
+    file_index_place(index, (uint32)index->files.count - 1);
+}
+
+// Linear probing, so the entries after the hole shift back instead of leaving tombstones
+static void file_index_unplace(File_Index *index, uint32 slot) {
+    uint32 mask = (uint32)index->slots.count - 1;
+    uint32 hole = slot;
+    for (uint32 next = (hole + 1) & mask; index->slots[next]; next = (next + 1) & mask) {
+        uint32 home = file_index_hash(file_index_path(index, index->slots[next] - 1)) & mask;
+        if (((next - home) & mask) >= ((next - hole) & mask)) {
+            index->slots[hole] = index->slots[next];
+            hole = next;
+        }
+    }
+    index->slots[hole] = 0;
+}
+
+// The last file takes the removed one's place, its path stays in the arena until compaction
+static void file_index_remove(File_Index *index, uint32 file) {
+    const char *path = file_index_path(index, file);
+    file_index_unplace(index, (uint32)file_index_find_slot(index, path));
+    index->garbage += strlen(path) + 1;
+    uint32 last = (uint32)index->files.count - 1;
+    if (file != last) {
+        int64 moved = file_index_find_slot(index, file_index_path(index, last));
+        index->slots[moved] = file + 1;
+        index->files[file] = index->files[last];
+        index->masks[file] = index->masks[last];
+    }
+    index->files.pop();
+    index->masks.pop();
+}
+
+static void file_index_compact(File_Index *index) {
+    Array<char> names;
+    names.reserve(index->names.count - index->garbage);
+    for (size_t i = 0; i < index->files.count; i++) {
+        const char *path = file_index_path(index, (uint32)i);
+        index->files[i] = (uint32)names.count;
+        names.append((char *)path, strlen(path) + 1);
+    }
+    index->names.clear();
+    index->names.swap(names);
+    index->garbage = 0;
+}
+
+// A path that isn't a file is taken for a directory and everything under it goes
+static void file_index_remove_path(File_Index *index, const char *path) {
+    int64 slot = file_index_find_slot(index, path);
+    if (slot >= 0) {
+        file_index_remove(index, index->slots[slot] - 1);
+    } else {
+        size_t length = strlen(path);
+        for (size_t i = index->files.count; i-- > 0; ) {
+            const char *file = file_index_path(index, (uint32)i);
+            if (strncmp(file, path, length) == 0 && file[length] == '/') file_index_remove(index, (uint32)i);
+        }
+    }
+    if (index->garbage > (int64)index->names.count / 2) file_index_compact(index);
+}
+
+static void file_index_reset(File_Index *index) {
+    index->names.reset_count();
+    index->files.reset_count();
+    index->masks.reset_count();
+    if (index->slots.data) memset(index->slots.data, 0, index->slots.count * sizeof(uint32));
+    index->garbage = 0;
+}
+
+// Every directory on the way is checked too, a change inside an ignored tree is still ignored
+static bool file_index_ignored(File_Index *index, const char *path, bool is_directory) {
+    char segment[260];
+    const char *start = path;
+    while (*start) {
+        const char *end = strchr(start, '/');
+        size_t length = end ? end - start : strlen(start);
+        length = MIN(length, sizeof(segment) - 1);
+        memcpy(segment, start, length);
+        segment[length] = 0;
+        if (ignore_patterns_match(&index->ignore_patterns, segment, end ? true : is_directory)) return true;
+        if (!end) break;
+        start = end + 1;
+    }
+    return false;
+}
+
+static void file_crawl_job_proc(void *data);
+
+static void file_crawl_push(File_Crawl *crawl, char *dir) {
+    File_Crawl_Job *job = (File_Crawl_Job *)malloc(sizeof(File_Crawl_Job));
+    job->crawl = crawl;
+    job->dir = dir;
+    thread_pool_push(file_crawl_job_proc, job, JOB_PRIORITY_BACKGROUND, &crawl->jobs);
+}
+
+static void file_crawl_visit_entry(const char *name, bool is_directory, void *data) {
+    File_Crawl_Visit *visit = (File_Crawl_Visit *)data;
+    if (ignore_patterns_match(&visit->crawl->index->ignore_patterns, name, is_directory)) return;
+    if (is_directory) {
+        file_crawl_push(visit->crawl, visit->dir[0] ? file_crawl_make_path(visit->dir, name) : string_copy(name).data);
+        return;
+    }
+    size_t dir_length = strlen(visit->dir);
+    if (dir_length > 0) {
+        visit->names.append((char *)visit->dir, dir_length);
+        visit->names.push('/');
+    }
+    visit->names.append((char *)name, strlen(name) + 1);
+}
+
+static void file_crawl_job_proc(void *data) {
+    File_Crawl_Job *job = (File_Crawl_Job *)data;
+    File_Crawl *crawl = job->crawl;
+    if (!crawl->jobs.cancelled) {
+        char path[PATH_MAX_LENGTH];
+        if (path_join_into(path, sizeof(path), STRZ(crawl->index->root), STRZ(job->dir)) < 0) path[0] = 0;
+        File_Crawl_Visit visit{};
+        visit.crawl = crawl;
+        visit.dir = job->dir;
+        visit_directory(path, file_crawl_visit_entry, &visit);
+        if (visit.names.count > 0) {
+            mutex_lock(crawl->mutex);
+            crawl->names.append(visit.names.data, visit.names.count);
+            mutex_unlock(crawl->mutex);
+        }
+        visit.names.clear();
+    }
+    free(job->dir);
+    free(job);
+}
+
+static void file_index_crawl(File_Index *index, const char *dir, bool replace) {
+    File_Crawl *crawl = new File_Crawl();
+    crawl->index = index;
+    crawl->replace = replace;
+    crawl->mutex = create_mutex();
+    index->crawls.push(crawl);
+    file_crawl_push(crawl, string_copy(dir).data);
+}
+
+static void file_index_change(const char *name, bool added, bool is_directory, void *data) {
+    File_Index *index = (File_Index *)data;
+    if (file_index_ignored(index, name, is_directory)) return;
+    if (!added) {
+        file_index_remove_path(index, name);
+    } else if (is_directory) {
+        // A directory moved in arrives as one name, what's inside has to be read
+        file_index_crawl(index, name, false);
+    } else {
+        file_index_insert(index, name);
+    }
+    index->version++;
+}
+
+static char *file_index_cache_name(File_Index *index) {
+    return file_crawl_make_path(index->root, FILE_INDEX_CACHE_NAME);
+}
+
+static bool file_index_load(File_Index *index) {
+    char *file_name = file_index_cache_name(index);
+    Mapped_File file = map_file(file_name);
+    free(file_name);
+    if (!file.data) return false;
+
+    File_Index_Header *header = (File_Index_Header *)file.data;
+    bool valid = file.count >= (int64)sizeof(File_Index_Header) && header->magic == FILE_INDEX_MAGIC && header->version == FILE_INDEX_VERSION;
+    valid = valid && header->names_bytes == (uint64)file.count - sizeof(File_Index_Header);
+    valid = valid && (header->names_bytes == 0 || file.data[file.count - 1] == 0);
+    if (valid) {
+        // The cache was written from the index, so the paths are known to be distinct
+        index->names.append(file.data + sizeof(File_Index_Header), header->names_bytes);
+        index->files.reserve(header->file_count);
+        index->masks.reserve(header->file_count);
+        for (char *path = index->names.data; path < index->names.data + index->names.count; path += strlen(path) + 1) {
+            index->files.push((uint32)(path - index->names.data));
+            index->masks.push(fuzzy_mask(path));
+        }
+        size_t capacity = 1024;
+        while (capacity < index->files.count * 2) capacity *= 2;
+        file_index_rehash(index, capacity);
+    }
+    unmap_file(&file);
+    return valid;
+}
+
+// The paths to write, NUL-terminated one after another. The list can be tens
+// of MB, so after a crawl it's written by a job.
+struct File_Index_Write {
+    File_Index *index;
+    int64 sequence;
+    int64 file_count;
+    Array<char> names;
+};
+
+static void file_index_write(File_Index_Write *write) {
+    File_Index *index = write->index;
+    mutex_lock(index->save_mutex);
+    if (write->sequence > index->saved_sequence) {
+        File_Index_Header header{};
+        header.magic = FILE_INDEX_MAGIC;
+        header.version = FILE_INDEX_VERSION;
+        header.file_count = write->file_count;
+        header.names_bytes = write->names.count;
+
+        char *file_name = file_index_cache_name(index);
+        Platform_Handle file = open_file_for_writing(file_name);
+        if (file) {
+            write_file(file, &header, sizeof(header));
+            write_file(file, write->names.data, write->names.count);
+            close_file(file);
+        }
+        free(file_name);
+        index->saved_sequence = write->sequence;
+    }
+    mutex_unlock(index->save_mutex);
+    write->names.clear();
+    delete write;
+}
+
+static void file_index_write_job(void *data) {
+    file_index_write((File_Index_Write *)data);
+}
+
+// Takes the names of a crawl of the whole tree, which are the list as it now is
+static void file_index_save_async(File_Index *index, Array<char> *names) {
+    File_Index_Write *write = new File_Index_Write();
+    write->index = index;
+    write->sequence = ++index->save_sequence;
+    write->file_count = index->files.count;
+    write->names.swap(*names);
+    thread_pool_push(file_index_write_job, write, JOB_PRIORITY_BACKGROUND, &index->saves);
+}
+
+// Writes the list now, for exit
+void file_index_save(File_Index *index) {
+    File_Index_Write *write = new File_Index_Write();
+    write->index = index;
+    write->sequence = ++index->save_sequence;
+    write->file_count = index->files.count;
+    write->names.reserve(index->names.count - index->garbage);
+    for (size_t i = 0; i < index->files.count; i++) {
+        const char *path = file_index_path(index, (uint32)i);
+        write->names.append((char *)path, strlen(path) + 1);
+    }
+    file_index_write(write);
+}
+
+// The cached list is there at once, the crawl that checks it finishes later
+File_Index *file_index_open(const char *root) {
+    File_Index *index = new File_Index();
+    index->root = string_copy(root).data;
+    index->save_mutex = create_mutex();
+    ignore_patterns_load(&index->ignore_patterns, root);
+    if (file_index_load(index)) index->version++;
+    index->watch = watch_directory_tree(root);
+    file_index_crawl(index, "", true);
+    return index;
+}
+
+void file_index_free(File_Index *index) {
+    for (size_t i = 0; i < index->crawls.count; i++) {
+        File_Crawl *crawl = index->crawls[i];
+        job_token_cancel(&crawl->jobs);
+        while (crawl->jobs.pending > 0) {
+            yield_thread();
+        }
+        crawl->names.clear();
+        destroy_mutex(crawl->mutex);
+        delete crawl;
+    }
+    index->crawls.clear();
+    while (index->saves.pending > 0) {
+        yield_thread();
+    }
+    destroy_mutex(index->save_mutex);
+    if (index->watch) unwatch_directory_tree(index->watch);
+    ignore_patterns_free(&index->ignore_patterns);
+    index->names.clear();
+    index->files.clear();
+    index->masks.clear();
+    index->slots.clear();
+    free(index->root);
+    delete index;
+}
+
+// Called every frame. Takes in finished crawls and what the watch saw change,
+// returns true when the list changed.
+bool file_index_update(File_Index *index) {
+    int64 version = index->version;
+    bool crawling = false;
+    for (size_t i = 0; i < index->crawls.count; ) {
+        File_Crawl *crawl = index->crawls[i];
+        if (crawl->jobs.pending > 0) {
+            crawling = crawling || crawl->replace;
+            i++;
+            continue;
+        }
+        if (crawl->replace) file_index_reset(index);
+        for (char *path = crawl->names.data; path < crawl->names.data + crawl->names.count; path += strlen(path) + 1) {
+            file_index_insert(index, path);
+        }
+        if (crawl->replace) file_index_save_async(index, &crawl->names);
+        index->version++;
+        crawl->names.clear();
+        destroy_mutex(crawl->mutex);
+        delete crawl;
+        index->crawls[i] = index->crawls.back();
+        index->crawls.pop();
+    }
+
+    // Changes wait in the watch while the whole tree is read, they may already be in the new list
+    if (index->watch && !crawling) {
+        if (!read_directory_changes(index->watch, file_index_change, index)) {
+            printf("%s: lost track of changes, reading the tree again\n", index->root);
+            file_index_crawl(index, "", true);
+        }
+    }
+    return index->version != version;
+}
+
+// The best matches for the query, best first
+int64 file_index_query(File_Index *index, Fuzzy_Matcher *matcher, String query, Fuzzy_Match *results, int64 max_results) {
+    Fuzzy_List list{};
+    list.names = index->names.data;
+    list.offsets = index->files.data;
+    list.masks = index->masks.data;
+    list.count = index->files.count;
+    list.version = index->version;
+    return fuzzy_match(matcher, &list, query, results, max_results);
+}
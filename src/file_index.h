@@ -0,0 +1,43 @@
+#pragma once
+
+#include "types.h"
+#include "array.h"
+#include "custom_string.h"
+#include "platform.h"
+#include "fuzzy.h"
+#include "thread_pool.h"
+
+// Every file under a project root, for the find-file dialog. Paths relative to
+// the root are packed one after another in a single arena, with an open
+// addressing table to find one by name. A crawl on the thread pool, one job per
+// directory, fills it. The list is cached in the root so the next start has it
+// at once while a fresh crawl runs, and a watch on the tree then adds and
+// removes only what changed.
+#define FILE_INDEX_CACHE_NAME ".qed-files"
+#define FILE_INDEX_MAX_RESULTS 64
+
+struct File_Crawl;
+
+struct File_Index {
+    char *root;
+    Array<char> names; // NUL-terminated relative paths
+    Array<uint32> files; // offset of each path in names
+    Array<uint64> masks; // fuzzy_mask of each path
+    Array<uint32> slots; // file + 1 by path hash, 0 when empty
+    int64 garbage; // bytes of names left by removed files
+    Array<char *> ignore_patterns;
+    Array<File_Crawl *> crawls;
+    Platform_Handle watch;
+    int64 version; // bumped whenever the list changes
+    Job_Token saves; // cache writes on the thread pool
+    Platform_Handle save_mutex;
+    int64 save_sequence; // of the last write started
+    int64 saved_sequence; // of the last write done, an older one that runs late is skipped
+};
+
+File_Index *file_index_open(const char *root);
+void file_index_free(File_Index *index);
+bool file_index_update(File_Index *index);
+void file_index_save(File_Index *index);
+const char *file_index_path(File_Index *index, uint32 file);
+int64 file_index_query(File_Index *index, Fuzzy_Matcher *matcher, String query, Fuzzy_Match *results, int64 max_results);
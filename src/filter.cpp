@@ -0,0 +1,165 @@
+#include "filter.h"
+#include "qed.h"
+#include "diff.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+// First row whose source line is at or after line
+int64 line_filter_lower_bound(Line_Filter *filter, int64 line) {
+    int64 lo = 0;
+    int64 hi = (int64)filter->lines.count;
+    while (lo < hi) {
+        int64 mid = lo + (hi - lo) / 2;
+        if (filter->lines.data[mid] < line) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+// Replaces the rows of lines first_line up to end_line with count new ones
+static void line_filter_splice(Line_Filter *filter, int64 first_line, int64 end_line, int64 *rows, size_t count) {
+    size_t first = line_filter_lower_bound(filter, first_line);
+    size_t last = line_filter_lower_bound(filter, end_line);
+    size_t tail = filter->lines.count - last;
+    size_t new_count = first + count + tail;
+    if (new_count > filter->lines.capacity) filter->lines.grow(new_count - filter->lines.capacity);
+    memmove(filter->lines.data + first + count, filter->lines.data + last, tail * sizeof(int64));
+    if (count > 0) memcpy(filter->lines.data + first, rows, count * sizeof(int64));
+    filter->lines.count = new_count;
+}
+
+// Rows of the rescanned lines go now and the rows after them shift, so an
+// edit near the top of a long buffer costs a move of the rows, not a search.
+// Pending ranges merge into one that covers them all.
+void line_filter_lines_changed(Buffer *, int64 first_line, int64 end_line, int64 line_delta, void *data) {
+    Line_Filter *filter = (Line_Filter *)data;
+    int64 old_end = end_line - line_delta;
+    line_filter_splice(filter, first_line, old_end, nullptr, 0);
+    if (line_delta != 0) {
+        for (size_t i = line_filter_lower_bound(filter, first_line); i < filter->lines.count; i++) {
+            filter->lines.data[i] += line_delta;
+        }
+    }
+
+    if (filter->dirty_start < 0) {
+        filter->dirty_start = first_line;
+        filter->dirty_end = end_line;
+        return;
+    }
+    int64 dirty_end = filter->dirty_end;
+    if (dirty_end >= old_end) {
+        dirty_end += line_delta;
+    } else if (dirty_end > first_line) {
+        dirty_end = end_line;
+    }
+    filter->dirty_start = MIN(filter->dirty_start, first_line);
+    filter->dirty_end = MAX(dirty_end, end_line);
+}
+
+// Classifies the lines from first_line up to end_line. The regex runs over
+// the range once and skips to the next line after each match, a match has to
+// start and end inside the range.
+void line_filter_scan(Line_Filter *filter, int64 first_line, int64 end_line, Array<int64> *rows) {
+    Buffer *buffer = filter->buffer;
+    int64 end = end_line < buffer_get_line_count(buffer) ? buffer->line_starts[end_line] : buffer_get_length(buffer);
+    Regex_Input input = regex_input_from_buffer(buffer, get_position_from_line(buffer, first_line), end);
+
+    int64 next_line = first_line;
+    Regex_Match match;
+    while (next_line < end_line) {
+        int64 matched_line = end_line;
+        if (input.start <= input.end && regex_search_input(filter->regex, &input, &match)) {
+            matched_line = get_line_from_position(buffer, match.span.start);
+        }
+
+        if (filter->invert) {
+            for (int64 line = next_line; line < matched_line; line++) {
+                rows->push(line);
+            }
+        } else if (matched_line < end_line) {
+            rows->push(matched_line);
+        }
+
+        next_line = matched_line + 1;
+        if (next_line < end_line) {
+            input.start = buffer->line_starts[next_line];
+        }
+    }
+}
+
+Line_Filter *make_line_filter(Buffer *buffer, const char *pattern, bool invert, const char **error) {
+    Regex *regex = regex_compile(pattern, REGEX_FLAG_NONE, error);
+    if (!regex) return nullptr;
+
+    Line_Filter *filter = new Line_Filter();
+    filter->buffer = buffer;
+    filter->regex = regex;
+    filter->invert = invert;
+    filter->dirty_start = 0;
+    filter->dirty_end = buffer_get_line_count(buffer);
+    buffer_add_listener(buffer, line_filter_lines_changed, filter);
+    line_filter_update(filter);
+    return filter;
+}
+
+void line_filter_free(Line_Filter *filter) {
+    buffer_remove_listener(filter->buffer, filter);
+    regex_free(filter->regex);
+    filter->lines.clear();
+    delete filter;
+}
+
+// Runs the first time the rows are asked for after an edit, so a burst of
+// edits costs one rescan of the lines they touched
+void line_filter_update(Line_Filter *filter) {
+    if (filter->dirty_start < 0) return;
+    int64 end_line = MIN(filter->dirty_end, buffer_get_line_count(filter->buffer));
+    Array<int64> rows;
+    line_filter_scan(filter, filter->dirty_start, end_line, &rows);
+    line_filter_splice(filter, filter->dirty_start, end_line, rows.data, rows.count);
+    rows.clear();
+    filter->dirty_start = -1;
+}
+
+// A filter left behind when the view switched buffers is kept but ignored
+Line_Filter *view_get_filter(View *view) {
+    Line_Filter *filter = view->filter;
+    if (!filter || filter->buffer != view->buffer) return nullptr;
+    line_filter_update(filter);
+    return filter;
+}
+
+int64 view_get_row_count(View *view) {
+    if (view->diff) return view->diff->row_count;
+    Line_Filter *filter = view_get_filter(view);
+    if (!filter) return buffer_get_line_count(view->buffer);
+    return (int64)filter->lines.count;
+}
+
+// Row of the line, or of the first shown line after it when the line is hidden
+int64 view_get_row(View *view, int64 line) {
+    Line_Filter *filter = view_get_filter(view);
+    if (!filter) return line;
+    return line_filter_lower_bound(filter, line);
+}
+
+int64 view_get_line(View *view, int64 row) {
+    Line_Filter *filter = view_get_filter(view);
+    if (!filter) return row;
+    assert(filter->lines.count > 0);
+    if (row < 0) row = 0;
+    if (row >= (int64)filter->lines.count) row = filter->lines.count - 1;
+    return filter->lines[row];
+}
+
+bool view_line_is_visible(View *view, int64 line) {
+    Line_Filter *filter = view_get_filter(view);
+    if (!filter) return true;
+    int64 row = line_filter_lower_bound(filter, line);
+    return row < (int64)filter->lines.count && filter->lines[row] == line;
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include "types.h"
+#include "array.h"
+#include "buffer.h"
+#include "regex.h"
+
+struct View;
+
+// Narrows a view to the lines of its buffer that match (or, inverted, don't
+// match) a pattern. Only the source line of every shown row is kept, never the
+// text. Edits drop the rows of the lines they rescanned and shift the rows
+// after them, the next update classifies only the rescanned lines.
+struct Line_Filter {
+    Buffer *buffer;
+    Regex *regex;
+    bool invert;
+    Array<int64> lines;
+    int64 dirty_start; // -1 when every line is classified
+    int64 dirty_end;
+};
+
+Line_Filter *make_line_filter(Buffer *buffer, const char *pattern, bool invert, const char **error);
+void line_filter_free(Line_Filter *filter);
+void line_filter_update(Line_Filter *filter);
+
+Line_Filter *view_get_filter(View *view);
+int64 view_get_row_count(View *view);
+int64 view_get_row(View *view, int64 line);
+int64 view_get_line(View *view, int64 row);
+bool view_line_is_visible(View *view, int64 line);
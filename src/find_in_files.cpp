@@ -0,0 +1,359 @@
+#include "find_in_files.h"
+#include "thread_pool.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Files with a NUL in their first block are treated as binary
+#define SEARCH_BINARY_PROBE_SIZE 8192
+#define SEARCH_MAX_LINE_LENGTH 512
+// Files of a directory are searched this many to a job
+#define SEARCH_FILE_BATCH 64
+
+static const char *default_ignore_patterns[] = {
+    "bin/", "obj/", "node_modules/",
+    "*.exe", "*.dll", "*.lib", "*.obj", "*.pdb", "*.ilk", "*.idb", "*.ttf",
+};
+
+// Searches whose jobs or completions were still pending when cancelled, freed once they drain
+static Array<Project_Search *> retired_searches;
+
+// A directory job names one subdirectory (none for the root), a file job a
+// batch of the files in dir. The names are held inline, each NUL-terminated.
+struct Search_Job {
+    Project_Search *search;
+    Path_Id dir;
+    bool is_directory;
+    int32 count;
+    char names[1];
+};
+
+void search_job_proc(void *data);
+
+void search_push_job(Project_Search *search, Path_Id dir, const char *names, size_t size, int32 count, bool is_directory) {
+    Search_Job *job = (Search_Job *)malloc(sizeof(Search_Job) + size);
+    job->search = search;
+    job->dir = dir;
+    job->is_directory = is_directory;
+    job->count = count;
+    memcpy(job->names, names, size);
+    job->names[size] = 0;
+    thread_pool_push(search_job_proc, job, JOB_PRIORITY_INTERACTIVE, &search->jobs);
+}
+
+bool ignore_patterns_match(Array<char *> *patterns, const char *name, bool is_directory) {
+    if (name[0] == '.') return true;
+    size_t name_len = strlen(name);
+    for (size_t i = 0; i < patterns->count; i++) {
+        char *pattern = (*patterns)[i];
+        size_t len = strlen(pattern);
+        if (pattern[0] == '*') {
+            if (name_len >= len - 1 && strcmp(name + name_len - (len - 1), pattern + 1) == 0) return true;
+        } else if (pattern[len - 1] == '/') {
+            if (is_directory && name_len == len - 1 && strncmp(name, pattern, len - 1) == 0) return true;
+        } else if (strcmp(name, pattern) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool search_is_ignored(Project_Search *search, const char *name, bool is_directory) {
+    return ignore_patterns_match(&search->ignore_patterns, name, is_directory);
+}
+
+// The defaults plus the simple forms of .gitignore: names, dir/ and *.ext
+void ignore_patterns_load(Array<char *> *patterns, const char *root) {
+    for (size_t i = 0; i < sizeof(default_ignore_patterns) / sizeof(default_ignore_patterns[0]); i++) {
+        patterns->push(string_copy(default_ignore_patterns[i]).data);
+    }
+
+    char file_name[PATH_MAX_LENGTH];
+    if (path_join_into(file_name, sizeof(file_name), STRZ((char *)root), STRZ((char *)".gitignore")) < 0) return;
+    Mapped_File file = map_file(file_name);
+    if (!file.data) return;
+
+    char *stream = file.data;
+    char *end = file.data + file.count;
+    while (stream < end) {
+        char *line = stream;
+        while (stream < end && *stream != '\n' && *stream != '\r') stream++;
+        char *line_end = stream;
+        while (stream < end && (*stream == '\n' || *stream == '\r')) stream++;
+
+        while (line < line_end && (*line == ' ' || *line == '\t')) line++;
+        while (line_end > line && (line_end[-1] == ' ' || line_end[-1] == '\t')) line_end--;
+        if (line < line_end && *line == '/') line++;
+        if (line == line_end || *line == '#' || *line == '!') continue;
+
+        bool simple = true;
+        for (char *c = line; c < line_end; c++) {
+            if ((*c == '/' && c != line_end - 1) || (*c == '*' && c != line) || *c == '?' || *c == '[') simple = false;
+        }
+        if (!simple) continue;
+
+        int64 len = line_end - line;
+        char *pattern = (char *)malloc(len + 1);
+        memcpy(pattern, line, len);
+        pattern[len] = 0;
+        patterns->push(pattern);
+    }
+    unmap_file(&file);
+}
+
+void ignore_patterns_free(Array<char *> *patterns) {
+    for (size_t i = 0; i < patterns->count; i++) {
+        free((*patterns)[i]);
+    }
+    patterns->clear();
+}
+
+Regex *search_get_regex(Project_Search *search) {
+    int32 index = thread_pool_worker_index();
+    assert(index >= 0);
+    if (!search->worker_regexes[index]) {
+        search->worker_regexes[index] = regex_copy(search->regex);
+    }
+    return search->worker_regexes[index];
+}
+
+int64 count_newlines(char *text, int64 count) {
+    int64 result = 0;
+    char *end = text + count;
+    while (text < end) {
+        char *newline = (char *)memchr(text, '\n', end - text);
+        if (!newline) break;
+        result++;
+        text = newline + 1;
+    }
+    return result;
+}
+
+struct Search_Results {
+    Project_Search *search;
+    Array<char> text;
+};
+
+// On the main thread, a cancelled search drops what its files found
+static void search_results_done(void *data) {
+    Search_Results *results = (Search_Results *)data;
+    Project_Search *search = results->search;
+    if (!search->jobs.cancelled) search->results.append(results->text.data, results->text.count);
+    results->text.clear();
+    delete results;
+}
+
+void search_file(Project_Search *search, char *path) {
+    Mapped_File file = map_file(path);
+    if (!file.data) return;
+
+    int64 probe = file.count < SEARCH_BINARY_PROBE_SIZE ? file.count : SEARCH_BINARY_PROBE_SIZE;
+    if (memchr(file.data, 0, probe)) {
+        unmap_file(&file);
+        return;
+    }
+
+    Regex *regex = search_get_regex(search);
+    Regex_Input input = regex_input_from_text(file.data, file.count);
+    Array<char> out;
+    int64 matches = 0;
+    int64 line = 0;
+    int64 counted = 0;
+    char prefix[64];
+
+    Regex_Match match;
+    while (input.start <= input.end && regex_search_input(regex, &input, &match)) {
+        if (search->jobs.cancelled) break;
+
+        int64 position = match.span.start;
+        line += count_newlines(file.data + counted, position - counted);
+        counted = position;
+
+        int64 line_start = position;
+        while (line_start > 0 && file.data[line_start - 1] != '\n') line_start--;
+        char *newline = (char *)memchr(file.data + position, '\n', file.count - position);
+        int64 line_end = newline ? newline - file.data : file.count;
+
+        int64 text_end = line_end;
+        if (text_end > line_start && file.data[text_end - 1] == '\r') text_end--;
+        if (text_end - line_start > SEARCH_MAX_LINE_LENGTH) text_end = line_start + SEARCH_MAX_LINE_LENGTH;
+
+        out.append(path, strlen(path));
+        int len = snprintf(prefix, sizeof(prefix), ":%lld:", (long long)(line + 1));
+        out.append(prefix, len);
+        out.append(file.data + line_start, text_end - line_start);
+        out.push('\n');
+        matches++;
+
+        // One result per line, continue on the next one
+        if (!newline) break;
+        line++;
+        counted = line_end + 1;
+        input.start = line_end + 1;
+    }
+    unmap_file(&file);
+
+    atomic_add64(&search->files_searched, 1);
+    if (matches) {
+        atomic_add64(&search->match_count, matches);
+        Search_Results *results = new Search_Results();
+        results->search = search;
+        results->text.swap(out);
+        thread_pool_complete(search_results_done, results, &search->jobs);
+    } else {
+        out.clear();
+    }
+}
+
+struct Search_Crawl {
+    Project_Search *search;
+    Path_Id dir;
+    Array<char> files;
+    int32 file_count;
+};
+
+static void search_crawl_flush(Search_Crawl *crawl) {
+    if (crawl->file_count == 0) return;
+    search_push_job(crawl->search, crawl->dir, crawl->files.data, crawl->files.count, crawl->file_count, false);
+    crawl->files.reset_count();
+    crawl->file_count = 0;
+}
+
+void search_visit_entry(const char *name, bool is_directory, void *data) {
+    Search_Crawl *crawl = (Search_Crawl *)data;
+    if (search_is_ignored(crawl->search, name, is_directory)) return;
+    if (is_directory) {
+        search_push_job(crawl->search, crawl->dir, name, strlen(name), 1, true);
+        return;
+    }
+    crawl->files.append((char *)name, strlen(name) + 1);
+    if (++crawl->file_count == SEARCH_FILE_BATCH) search_crawl_flush(crawl);
+}
+
+// Paths are put together on the stack, only a directory adds to the arena
+void search_job_proc(void *data) {
+    Search_Job *job = (Search_Job *)data;
+    Project_Search *search = job->search;
+    if (!search->jobs.cancelled) {
+        char path[PATH_MAX_LENGTH];
+        Path_Id dir = job->dir;
+        mutex_lock(search->paths_mutex);
+        if (job->is_directory && job->count) dir = path_intern(&search->paths, dir, STRZ(job->names));
+        int64 dir_len = path_arena_write(&search->paths, dir, path, sizeof(path));
+        mutex_unlock(search->paths_mutex);
+        if (dir_len < 0) {
+            // Too long to open
+        } else if (job->is_directory) {
+            Search_Crawl crawl = {};
+            crawl.search = search;
+            crawl.dir = dir;
+            visit_directory(path, search_visit_entry, &crawl);
+            search_crawl_flush(&crawl);
+            crawl.files.clear();
+        } else {
+            char *name = job->names;
+            for (int32 i = 0; i < job->count && !search->jobs.cancelled; i++) {
+                String dir_name = { path, dir_len };
+                String file_name = STRZ(name);
+                if (path_join_into(path, sizeof(path), dir_name, file_name) >= 0) search_file(search, path);
+                path[dir_len] = 0;
+                name += file_name.count + 1;
+            }
+        }
+    }
+    free(job);
+}
+
+Project_Search *project_search_start(const char *root, const char *pattern, const char **error) {
+    Regex *regex = regex_compile(pattern, REGEX_FLAG_NONE, error);
+    if (!regex) return nullptr;
+
+    Project_Search *search = new Project_Search();
+    search->root = string_copy(root).data;
+    search->regex = regex;
+    search->worker_regexes = (Regex **)calloc(thread_pool_worker_count(), sizeof(Regex *));
+    search->paths_mutex = create_mutex();
+    ignore_patterns_load(&search->ignore_patterns, root);
+
+    Path_Id dir = path_intern_path(&search->paths, STRZ((char *)root));
+    search_push_job(search, dir, "", 0, 0, true);
+    return search;
+}
+
+void project_search_free(Project_Search *search) {
+    assert(search->jobs.pending == 0);
+    for (int32 i = 0; i < thread_pool_worker_count(); i++) {
+        regex_free(search->worker_regexes[i]);
+    }
+    ignore_patterns_free(&search->ignore_patterns);
+    path_arena_free(&search->paths);
+    destroy_mutex(search->paths_mutex);
+    search->results.clear();
+    free(search->worker_regexes);
+    regex_free(search->regex);
+    free(search->root);
+    delete search;
+}
+
+void project_search_cancel(Project_Search *search) {
+    job_token_cancel(&search->jobs);
+    retired_searches.push(search);
+}
+
+// Called every frame. Moves finished results into the buffer and returns true when anything was added.
+bool project_search_update(Project_Search *search, Buffer *results_buffer) {
+    for (size_t i = 0; i < retired_searches.count; ) {
+        if (retired_searches[i]->jobs.pending == 0) {
+            project_search_free(retired_searches[i]);
+            retired_searches[i] = retired_searches.back();
+            retired_searches.pop();
+        } else {
+            i++;
+        }
+    }
+
+    if (!search || search->finished) return false;
+
+    bool done = search->jobs.pending == 0;
+    Array<char> results;
+    results.swap(search->results);
+
+    if (done) {
+        char summary[128];
+        int len = snprintf(summary, sizeof(summary), "-- %lld matches in %lld files --\n", (long long)search->match_count, (long long)search->files_searched);
+        results.append(summary, len);
+        search->finished = true;
+    }
+
+    bool changed = results.count > 0;
+    if (changed) {
+        String text = { results.data, (int64)results.count };
+        buffer_insert_text(results_buffer, buffer_get_length(results_buffer), text);
+    }
+    results.clear();
+    return changed;
+}
+
+// Splits "path:line:text". The path may contain a drive colon, so look for the first colon followed by digits and a colon.
+bool parse_search_result(String line, char **file_name, int64 *line_number) {
+    for (int64 i = 1; i < line.count; i++) {
+        if (line.data[i] != ':') continue;
+        int64 j = i + 1;
+        int64 number = 0;
+        while (j < line.count && line.data[j] >= '0' && line.data[j] <= '9') {
+            number = number * 10 + (line.data[j] - '0');
+            j++;
+        }
+        if (j > i + 1 && j < line.count && line.data[j] == ':') {
+            char *name = (char *)malloc(i + 1);
+            memcpy(name, line.data, i);
+            name[i] = 0;
+            *file_name = name;
+            *line_number = number;
+            return true;
+        }
+    }
+    return false;
+}
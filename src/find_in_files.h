@@ -0,0 +1,38 @@
+#pragma once
+
+#include "types.h"
+#include "array.h"
+#include "buffer.h"
+#include "platform.h"
+#include "regex.h"
+#include "path.h"
+#include "thread_pool.h"
+
+// Grep over a directory tree. The crawl and every file are jobs on the thread pool,
+// finished files hand their "path:line:text" lines to the main thread as completions.
+// Jobs name their directory by its id in the search's path arena.
+struct Project_Search {
+    char *root;
+    Path_Arena paths;
+    Platform_Handle paths_mutex;
+    Regex *regex;
+    Regex **worker_regexes;
+    Array<char *> ignore_patterns;
+
+    Job_Token jobs;
+    volatile int64 files_searched;
+    volatile int64 match_count;
+
+    Array<char> results; // main thread only
+    bool finished;
+};
+
+Project_Search *project_search_start(const char *root, const char *pattern, const char **error);
+void project_search_cancel(Project_Search *search);
+bool project_search_update(Project_Search *search, Buffer *results_buffer);
+bool parse_search_result(String line, char **file_name, int64 *line_number);
+
+// Names skipped by crawls of a project: dot files, build output and what .gitignore lists
+void ignore_patterns_load(Array<char *> *patterns, const char *root);
+bool ignore_patterns_match(Array<char *> *patterns, const char *name, bool is_directory);
+void ignore_patterns_free(Array<char *> *patterns);
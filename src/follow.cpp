@@ -0,0 +1,152 @@
+#include "follow.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// NTFS doesn't always report a file growing while the writer holds it open,
+// so the size is checked this often even without a notification
+#define FOLLOW_POLL_FRAMES 30
+// A burst bigger than this is taken in pieces over several frames
+#define FOLLOW_MAX_READ (16LL * 1024 * 1024)
+
+Follow *follow_start(Buffer *buffer) {
+    Platform_Handle watch = watch_file(buffer->file_name);
+    if (!watch) return nullptr;
+    Follow *follow = (Follow *)calloc(1, sizeof(Follow));
+    follow->buffer = buffer;
+    follow->watch = watch;
+    follow->file_id = get_file_id(buffer->file_name);
+    follow->file_offset = buffer->file_size;
+    return follow;
+}
+
+void follow_stop(Follow *follow) {
+    if (!follow) return;
+    unwatch_file(follow->watch);
+    free(follow);
+}
+
+// Turns file bytes into buffer text the way loading the file did. Returns how
+// many of the bytes were used, the rest are left for when more arrive.
+static int64 follow_decode(Follow *follow, char *data, int64 count, String *text) {
+    Buffer *buffer = follow->buffer;
+    int64 used = count;
+    switch (buffer->encoding) {
+    case TEXT_ENCODING_UTF8:
+    case TEXT_ENCODING_UTF8_BOM:
+        // Only the start of the file has a BOM to skip
+        if (follow->file_offset > 0) {
+            text->data = (char *)malloc(count + 1);
+            memcpy(text->data, data, count);
+            text->count = count;
+            break;
+        }
+        *text = decode_text(buffer->encoding, data, count);
+        break;
+    case TEXT_ENCODING_UTF16LE:
+    case TEXT_ENCODING_UTF16LE_BOM:
+    case TEXT_ENCODING_UTF16BE:
+    case TEXT_ENCODING_UTF16BE_BOM:
+    {
+        // Whole code units only, and never half of a surrogate pair
+        bool big_endian;
+        encoding_is_utf16(buffer->encoding, &big_endian);
+        used = count & ~1;
+        if (used >= 2) {
+            uint8 *last = (uint8 *)data + used - 2;
+            uint32 unit = big_endian ? (last[0] << 8 | last[1]) : (last[0] | last[1] << 8);
+            if (unit >= 0xD800 && unit <= 0xDBFF) used -= 2;
+        }
+        // Only the start of the file has a BOM to skip
+        Text_Encoding encoding = follow->file_offset > 0 ? encoding_without_bom(buffer->encoding) : buffer->encoding;
+        *text = decode_text(encoding, data, used);
+        break;
+    }
+    case TEXT_ENCODING_WINDOWS_1252:
+        *text = decode_text(buffer->encoding, data, count);
+        break;
+    }
+
+    if (buffer->line_ending != LINE_ENDING_LF) {
+        // A CR at the end may be the first half of a CRLF
+        String joined = *text;
+        if (follow->held_back) {
+            joined.data = (char *)malloc(text->count + 1);
+            joined.data[0] = follow->held_back;
+            memcpy(joined.data + 1, text->data, text->count);
+            joined.count = text->count + 1;
+            free(text->data);
+            follow->held_back = 0;
+        }
+        if (joined.count > 0 && joined.data[joined.count - 1] == '\r') {
+            follow->held_back = '\r';
+            joined.count--;
+        }
+        String adjusted{};
+        if (joined.count > 0) {
+            remove_crlf(joined.data, joined.count, &adjusted.data, &adjusted.count);
+        }
+        free(joined.data);
+        *text = adjusted;
+    }
+    return used;
+}
+
+// Returns true when the buffer changed
+bool follow_update(Follow *follow) {
+    Buffer *buffer = follow->buffer;
+    // Appending would wait for the whole index, the file is read once it's done
+    if (buffer->indexer) return false;
+    bool notified = file_changed(follow->watch);
+    if (!notified && ++follow->frames_since_poll < FOLLOW_POLL_FRAMES) return false;
+    follow->frames_since_poll = 0;
+
+    File_Attributes attributes = get_file_attributes(buffer->file_name);
+    uint64 file_id = get_file_id(buffer->file_name);
+    // Between a rotation moving the old file away and creating the new one
+    if (!file_id) return false;
+
+    // Appending keeps a buffer that matched the file matching it, it doesn't
+    // make one with unsaved edits clean
+    bool matches_file = buffer->version == buffer->saved_version;
+    bool changed = false;
+    if (file_id != follow->file_id || (int64)attributes.file_size < follow->file_offset) {
+        printf("%s: %s, reading it again\n", buffer->file_name, file_id != follow->file_id ? "file was replaced" : "file was truncated");
+        buffer_clear(buffer);
+        // The text it described is gone, so is undoing it
+        buffer_clear_history(buffer);
+        follow->file_id = file_id;
+        follow->file_offset = 0;
+        follow->held_back = 0;
+        matches_file = true;
+        changed = true;
+    }
+
+    int64 count = (int64)attributes.file_size - follow->file_offset;
+    if (count > FOLLOW_MAX_READ) {
+        count = FOLLOW_MAX_READ;
+        follow->frames_since_poll = FOLLOW_POLL_FRAMES; // the rest next frame
+    }
+    if (count > 0) {
+        char *data = (char *)malloc(count);
+        count = read_file_range(buffer->file_name, follow->file_offset, data, count);
+        if (count > 0) {
+            String text{};
+            int64 used = follow_decode(follow, data, count, &text);
+            if (text.count > 0) {
+                buffer_insert_text(buffer, buffer_get_length(buffer), text);
+                changed = true;
+            }
+            free(text.data);
+            follow->file_offset += used;
+        }
+        free(data);
+    }
+    buffer->file_size = follow->file_offset;
+    if (follow->file_offset == (int64)attributes.file_size) {
+        buffer->last_write_time = attributes.last_write_time;
+    }
+    if (changed && matches_file) buffer->saved_version = buffer->version;
+    return changed;
+}
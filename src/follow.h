@@ -0,0 +1,22 @@
+#pragma once
+
+#include "types.h"
+#include "platform.h"
+#include "buffer.h"
+
+// Keeps a buffer in step with a file that is only ever appended to, like a log.
+// Only the bytes past the end already read are loaded and inserted at the end
+// of the buffer, so the line index is extended rather than rebuilt. A file that
+// shrank or was replaced by a new one (log rotation) is read again from the start.
+struct Follow {
+    Buffer *buffer;
+    Platform_Handle watch;
+    uint64 file_id;
+    int64 file_offset; // bytes of the file already in the buffer
+    char held_back; // a line break that may pair with the next byte, 0 if none
+    int32 frames_since_poll;
+};
+
+Follow *follow_start(Buffer *buffer);
+void follow_stop(Follow *follow);
+bool follow_update(Follow *follow);
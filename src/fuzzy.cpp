@@ -0,0 +1,363 @@
+#include "fuzzy.h"
+#include "platform.h"
+#include "thread_pool.h"
+#include "simple_math.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#include <emmintrin.h>
+#define FUZZY_SSE2 1
+#endif
+
+#define FUZZY_SCORE_MATCH 16
+#define FUZZY_BONUS_SEGMENT 10 // first character of a path segment
+#define FUZZY_BONUS_WORD 8 // after _ - . or a space
+#define FUZZY_BONUS_CAMEL 7 // an upper case letter after a lower case one
+#define FUZZY_BONUS_CONSECUTIVE 8
+#define FUZZY_BONUS_NAME 16 // the match ends in the last path segment
+#define FUZZY_NONE (-(1 << 28))
+// Names a runner scores before taking the next chunk
+#define FUZZY_CHUNK_SIZE 8192
+
+// The best matches a runner found, kept as a heap with the worst on top, and
+// every name it matched for the matcher to narrow from next time
+struct Fuzzy_Runner {
+    Fuzzy_Match matches[FUZZY_MAX_RESULTS];
+    int64 count;
+    Array<uint32> hits;
+};
+
+// A helper that starts once every chunk is claimed leaves at once, so only
+// the ones working are waited on. It still reads the job, which is freed by
+// whoever lets go of it last.
+struct Fuzzy_Job {
+    Fuzzy_List *list;
+    const uint32 *candidates; // nullptr for the whole list
+    int64 candidate_count;
+    const char *query;
+    int64 query_length;
+    uint64 query_mask;
+    int64 max_results;
+    Fuzzy_Runner *runners;
+    volatile int64 next_runner;
+    volatile int64 next_chunk;
+    volatile int64 working;
+    volatile int64 references;
+};
+
+static char fuzzy_lower(char c) {
+    return (c >= 'A' && c <= 'Z') ? c - 'A' + 'a' : c;
+}
+
+static uint64 fuzzy_char_bit(char c) {
+    c = fuzzy_lower(c);
+    if (c >= 'a' && c <= 'z') return 1ULL << (c - 'a');
+    if (c >= '0' && c <= '9') return 1ULL << (26 + c - '0');
+    return 1ULL << (36 + (uint8)c % 28);
+}
+
+// A bit for each letter and digit in the name, the other characters share the rest
+uint64 fuzzy_mask(const char *name) {
+    uint64 result = 0;
+    for (const char *c = name; *c; c++) {
+        result |= fuzzy_char_bit(*c);
+    }
+    return result;
+}
+
+// Where c first occurs at or after from, -1 if it doesn't. The query is lower
+// case, so or-ing 0x20 into the name folds exactly the upper case letters.
+static int64 fuzzy_find(const char *name, int64 length, int64 from, char c) {
+#ifdef FUZZY_SSE2
+    __m128i fold = _mm_set1_epi8((c >= 'a' && c <= 'z') ? 0x20 : 0);
+    __m128i target = _mm_set1_epi8(c);
+    while (from + 16 <= length) {
+        __m128i block = _mm_or_si128(_mm_loadu_si128((const __m128i *)(name + from)), fold);
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(block, target))) break;
+        from += 16;
+    }
+#endif
+    for (; from < length; from++) {
+        if (fuzzy_lower(name[from]) == c) return from;
+    }
+    return -1;
+}
+
+static uint8 fuzzy_bonus(char prev, char c) {
+    if (prev == '/' || prev == '\\') return FUZZY_BONUS_SEGMENT;
+    if (prev == '_' || prev == '-' || prev == '.' || prev == ' ') return FUZZY_BONUS_WORD;
+    if (c >= 'A' && c <= 'Z' && prev >= 'a' && prev <= 'z') return FUZZY_BONUS_CAMEL;
+    return 0;
+}
+
+// Lower cases the window of the name from start and works out the bonus each
+// character would get, 16 at a time
+static void fuzzy_classify(const char *name, int64 start, int64 count, char *lowered, uint8 *bonus) {
+    int64 i = 0;
+    if (start == 0 && count > 0) {
+        lowered[0] = fuzzy_lower(name[0]);
+        bonus[0] = FUZZY_BONUS_SEGMENT;
+        i = 1;
+    }
+#ifdef FUZZY_SSE2
+    for (; i + 16 <= count; i += 16) {
+        __m128i c = _mm_loadu_si128((const __m128i *)(name + start + i));
+        __m128i prev = _mm_loadu_si128((const __m128i *)(name + start + i - 1));
+        __m128i upper = _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8('A' - 1)), _mm_cmplt_epi8(c, _mm_set1_epi8('Z' + 1)));
+        __m128i prev_lower = _mm_and_si128(_mm_cmpgt_epi8(prev, _mm_set1_epi8('a' - 1)), _mm_cmplt_epi8(prev, _mm_set1_epi8('z' + 1)));
+        __m128i segment = _mm_or_si128(_mm_cmpeq_epi8(prev, _mm_set1_epi8('/')), _mm_cmpeq_epi8(prev, _mm_set1_epi8('\\')));
+        __m128i word = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(prev, _mm_set1_epi8('_')), _mm_cmpeq_epi8(prev, _mm_set1_epi8('-'))),
+                                    _mm_or_si128(_mm_cmpeq_epi8(prev, _mm_set1_epi8('.')), _mm_cmpeq_epi8(prev, _mm_set1_epi8(' '))));
+        __m128i camel = _mm_and_si128(upper, prev_lower);
+        word = _mm_andnot_si128(segment, word);
+        camel = _mm_andnot_si128(_mm_or_si128(segment, word), camel);
+        __m128i value = _mm_or_si128(_mm_and_si128(segment, _mm_set1_epi8(FUZZY_BONUS_SEGMENT)),
+                                     _mm_or_si128(_mm_and_si128(word, _mm_set1_epi8(FUZZY_BONUS_WORD)), _mm_and_si128(camel, _mm_set1_epi8(FUZZY_BONUS_CAMEL))));
+        _mm_storeu_si128((__m128i *)(bonus + i), value);
+        _mm_storeu_si128((__m128i *)(lowered + i), _mm_add_epi8(c, _mm_and_si128(upper, _mm_set1_epi8(0x20))));
+    }
+#endif
+    for (; i < count; i++) {
+        char c = name[start + i];
+        lowered[i] = fuzzy_lower(c);
+        bonus[i] = fuzzy_bonus(name[start + i - 1], c);
+    }
+}
+
+// Best placement of the query in the window. Row i holds the best score with
+// query character i matched at each position, and a running best that pays a
+// point for every character skipped since, so a gap of any length is one step.
+static int32 fuzzy_score_window(const char *lowered, const uint8 *bonus, int64 count, const char *query, int64 query_length, int64 *out_last) {
+    int32 rows[4][FUZZY_MAX_WINDOW];
+    int32 *prev_match = rows[0];
+    int32 *prev_run = rows[1];
+    int32 *match = rows[2];
+    int32 *run = rows[3];
+
+    int32 best = FUZZY_NONE;
+    for (int64 j = 0; j < count; j++) {
+        match[j] = lowered[j] == query[0] ? FUZZY_SCORE_MATCH + 2 * bonus[j] : FUZZY_NONE;
+        best = MAX(best - 1, match[j]);
+        run[j] = best;
+    }
+    for (int64 i = 1; i < query_length; i++) {
+        int32 *swap = prev_match; prev_match = match; match = swap;
+        swap = prev_run; prev_run = run; run = swap;
+        char c = query[i];
+        best = FUZZY_NONE;
+        match[0] = FUZZY_NONE;
+        run[0] = FUZZY_NONE;
+        for (int64 j = 1; j < count; j++) {
+            int32 score = FUZZY_NONE;
+            if (lowered[j] == c) {
+                int32 from = MAX(prev_match[j - 1] + FUZZY_BONUS_CONSECUTIVE, prev_run[j - 1]);
+                if (from > FUZZY_NONE / 2) score = from + FUZZY_SCORE_MATCH + bonus[j];
+            }
+            match[j] = score;
+            best = MAX(best - 1, score);
+            run[j] = best;
+        }
+    }
+
+    int32 result = FUZZY_NONE;
+    for (int64 j = 0; j < count; j++) {
+        if (match[j] > result) {
+            result = match[j];
+            *out_last = j;
+        }
+    }
+    return result;
+}
+
+static bool fuzzy_score_lowered(const char *name, const char *query, int64 query_length, int32 *out_score) {
+    int64 length = strlen(name);
+    int64 first = fuzzy_find(name, length, 0, query[0]);
+    if (first < 0) return false;
+    int64 end = first;
+    for (int64 i = 1; i < query_length; i++) {
+        end = fuzzy_find(name, length, end + 1, query[i]);
+        if (end < 0) return false;
+    }
+
+    int32 score;
+    int64 last;
+    if (end - first >= FUZZY_MAX_WINDOW) {
+        score = (int32)(query_length * FUZZY_SCORE_MATCH - (end - first));
+        last = end;
+    } else {
+        char lowered[FUZZY_MAX_WINDOW];
+        uint8 bonus[FUZZY_MAX_WINDOW];
+        int64 count = MIN(length - first, FUZZY_MAX_WINDOW);
+        fuzzy_classify(name, first, count, lowered, bonus);
+        score = fuzzy_score_window(lowered, bonus, count, query, query_length, &last);
+        last += first;
+    }
+
+    const char *slash = strrchr(name, '/');
+    if (last >= (slash ? slash - name + 1 : 0)) score += FUZZY_BONUS_NAME;
+    *out_score = score - (int32)(length / 16);
+    return true;
+}
+
+// For one-off lists too short to keep masks for
+bool fuzzy_score(const char *name, String query, int32 *out_score) {
+    char lowered[256];
+    int64 query_length = MIN(query.count, (int64)sizeof(lowered));
+    if (query_length == 0) {
+        *out_score = 0;
+        return true;
+    }
+    for (int64 i = 0; i < query_length; i++) {
+        lowered[i] = fuzzy_lower(query.data[i]);
+    }
+    return fuzzy_score_lowered(name, lowered, query_length, out_score);
+}
+
+static bool fuzzy_better(Fuzzy_Match a, Fuzzy_Match b) {
+    return a.score > b.score || (a.score == b.score && a.index < b.index);
+}
+
+// A heap of the best max_results with the worst on top, so most names are
+// turned away after a single comparison
+static void fuzzy_keep(Fuzzy_Match *heap, int64 *count, int64 max_results, Fuzzy_Match match) {
+    int64 i;
+    if (*count < max_results) {
+        i = (*count)++;
+        while (i > 0 && fuzzy_better(heap[(i - 1) / 2], match)) {
+            heap[i] = heap[(i - 1) / 2];
+            i = (i - 1) / 2;
+        }
+        heap[i] = match;
+        return;
+    }
+    if (!fuzzy_better(match, heap[0])) return;
+    i = 0;
+    for (;;) {
+        int64 child = 2 * i + 1;
+        if (child >= *count) break;
+        if (child + 1 < *count && fuzzy_better(heap[child], heap[child + 1])) child++;
+        if (!fuzzy_better(match, heap[child])) break;
+        heap[i] = heap[child];
+        i = child;
+    }
+    heap[i] = match;
+}
+
+// Counted as working before it claims a chunk, and takes a runner only once
+// it has one, so nothing but the job is touched after the last chunk is done
+static void fuzzy_run(Fuzzy_Job *job) {
+    atomic_add64(&job->working, 1);
+    Fuzzy_List *list = job->list;
+    Fuzzy_Runner *runner = nullptr;
+    for (;;) {
+        int64 start = (atomic_add64(&job->next_chunk, 1) - 1) * FUZZY_CHUNK_SIZE;
+        if (start >= job->candidate_count) break;
+        if (!runner) runner = &job->runners[atomic_add64(&job->next_runner, 1) - 1];
+        int64 end = MIN(start + FUZZY_CHUNK_SIZE, job->candidate_count);
+        for (int64 i = start; i < end; i++) {
+            uint32 index = job->candidates ? job->candidates[i] : (uint32)i;
+            if (job->query_mask & ~list->masks[index]) continue;
+            int32 score;
+            if (!fuzzy_score_lowered(list->names + list->offsets[index], job->query, job->query_length, &score)) continue;
+            runner->hits.push(index);
+            Fuzzy_Match match = { index, score };
+            fuzzy_keep(runner->matches, &runner->count, job->max_results, match);
+        }
+    }
+    atomic_add64(&job->working, -1);
+}
+
+static void fuzzy_job_release(Fuzzy_Job *job) {
+    if (atomic_add64(&job->references, -1) == 0) free(job);
+}
+
+static void fuzzy_job_proc(void *data) {
+    Fuzzy_Job *job = (Fuzzy_Job *)data;
+    fuzzy_run(job);
+    fuzzy_job_release(job);
+}
+
+static int fuzzy_match_compare(const void *a, const void *b) {
+    Fuzzy_Match *left = (Fuzzy_Match *)a;
+    Fuzzy_Match *right = (Fuzzy_Match *)b;
+    if (fuzzy_better(*left, *right)) return -1;
+    if (fuzzy_better(*right, *left)) return 1;
+    return 0;
+}
+
+// The best matches in the list, best first. An empty query gives the first
+// names in list order. Long lists are scored by the workers and this thread together.
+int64 fuzzy_match(Fuzzy_Matcher *matcher, Fuzzy_List *list, String query, Fuzzy_Match *results, int64 max_results) {
+    max_results = MIN(max_results, FUZZY_MAX_RESULTS);
+    if (max_results <= 0) return 0;
+    char lowered[sizeof(matcher->query)];
+    int64 query_length = MIN(query.count, (int64)sizeof(lowered));
+    uint64 query_mask = 0;
+    for (int64 i = 0; i < query_length; i++) {
+        lowered[i] = fuzzy_lower(query.data[i]);
+        query_mask |= fuzzy_char_bit(lowered[i]);
+    }
+    if (query_length == 0) {
+        matcher->query_length = -1;
+        int64 count = MIN(list->count, max_results);
+        for (int64 i = 0; i < count; i++) {
+            results[i] = { (uint32)i, 0 };
+        }
+        return count;
+    }
+
+    bool narrow = matcher->query_length > 0 && query_length >= matcher->query_length && memcmp(lowered, matcher->query, matcher->query_length) == 0;
+    narrow = narrow && matcher->list_version == list->version && matcher->list_count == list->count;
+
+    Fuzzy_Job *job = (Fuzzy_Job *)calloc(1, sizeof(Fuzzy_Job));
+    job->list = list;
+    job->candidates = narrow ? matcher->hits.data : nullptr;
+    job->candidate_count = narrow ? (int64)matcher->hits.count : list->count;
+    job->query = lowered;
+    job->query_length = query_length;
+    job->query_mask = query_mask;
+    job->max_results = max_results;
+    int64 chunk_count = (job->candidate_count + FUZZY_CHUNK_SIZE - 1) / FUZZY_CHUNK_SIZE;
+    int32 helpers = 0;
+    if (job->candidate_count >= FUZZY_PARALLEL_MIN) helpers = (int32)MIN((int64)thread_pool_worker_count(), chunk_count - 1);
+    Fuzzy_Runner *runners = (Fuzzy_Runner *)calloc(helpers + 1, sizeof(Fuzzy_Runner));
+    job->runners = runners;
+    job->references = helpers + 1;
+    for (int32 i = 0; i < helpers; i++) {
+        thread_pool_push(fuzzy_job_proc, job, JOB_PRIORITY_INTERACTIVE);
+    }
+    fuzzy_run(job);
+    while (job->working > 0) {
+        yield_thread();
+    }
+    int64 runner_count = job->next_runner;
+    fuzzy_job_release(job);
+
+    Array<uint32> hits;
+    int64 count = 0;
+    for (int64 i = 0; i < runner_count; i++) {
+        Fuzzy_Runner *runner = &runners[i];
+        hits.append(runner->hits.data, runner->hits.count);
+        runner->hits.clear();
+        for (int64 j = 0; j < runner->count; j++) {
+            fuzzy_keep(results, &count, max_results, runner->matches[j]);
+        }
+    }
+    free(runners);
+    qsort(results, count, sizeof(Fuzzy_Match), fuzzy_match_compare);
+
+    matcher->hits.clear();
+    matcher->hits.swap(hits);
+    memcpy(matcher->query, lowered, query_length);
+    matcher->query_length = query_length;
+    matcher->list_version = list->version;
+    matcher->list_count = list->count;
+    return count;
+}
+
+void fuzzy_matcher_free(Fuzzy_Matcher *matcher) {
+    matcher->hits.clear();
+    matcher->query_length = -1;
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include "types.h"
+#include "array.h"
+#include "custom_string.h"
+
+// Fuzzy matching of a query against a list of names: the query's characters
+// in order, case-insensitive, scored by where they land. Each name carries a
+// mask of the characters in it, so most names that can't match are dropped
+// without being read. The rest are scored by a dynamic program over the part
+// of the name from the first possible match, which finds the best placement
+// rather than the first one.
+#define FUZZY_MAX_RESULTS 256
+// Names longer than this past their first possible match are scored greedily
+#define FUZZY_MAX_WINDOW 1024
+// Lists shorter than this are scored on the calling thread alone
+#define FUZZY_PARALLEL_MIN 32768
+
+// Names are NUL-terminated strings at offsets into one block of text. The
+// version changes whenever the list does.
+struct Fuzzy_List {
+    const char *names;
+    const uint32 *offsets;
+    const uint64 *masks;
+    int64 count;
+    int64 version;
+};
+
+struct Fuzzy_Match {
+    uint32 index;
+    int32 score;
+};
+
+// Remembers the names that matched the last query. A query that extends it
+// only needs those scored again.
+struct Fuzzy_Matcher {
+    char query[256];
+    int64 query_length = -1;
+    int64 list_version;
+    int64 list_count;
+    Array<uint32> hits;
+};
+
+uint64 fuzzy_mask(const char *name);
+bool fuzzy_score(const char *name, String query, int32 *out_score);
+int64 fuzzy_match(Fuzzy_Matcher *matcher, Fuzzy_List *list, String query, Fuzzy_Match *results, int64 max_results);
+void fuzzy_matcher_free(Fuzzy_Matcher *matcher);
@@ -0,0 +1,232 @@
+#include "index_cache.h"
+#include "platform.h"
+#include "thread_pool.h"
+#include "simple_math.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define INDEX_CACHE_MAGIC 0x58444951 // QIDX
+#define INDEX_CACHE_VERSION 2
+#define INDEX_CACHE_SAMPLES 64
+#define INDEX_CACHE_SAMPLE_SIZE 4096
+
+struct Index_Cache_Header {
+    uint32 magic;
+    uint32 version;
+    uint64 file_size;
+    uint64 last_write_time;
+    uint64 sample_hash;
+    int64 text_size; // buffer bytes the index covers, after decoding and line endings
+    int64 line_count; // line starts stored, the sentinel isn't
+    int64 last_line_start;
+    int64 block_count;
+    int64 delta_bytes;
+    int64 utf8_count;
+    int32 extendable; // text is the file unchanged, so appended bytes can be scanned on their own
+    int32 pad;
+};
+
+struct Index_Cache_Write {
+    Buffer *buffer;
+    int64 version;
+    char *path;
+    Index_Cache_Header header;
+};
+
+// Hashes evenly spaced samples instead of the whole text, the size, write
+// time and sample positions together catch everything but deliberate forgery
+static uint64 index_cache_hash(const char *text, int64 count) {
+    uint64 hash = 14695981039346656037ull ^ (uint64)count;
+    int64 sample_size = MIN(count, INDEX_CACHE_SAMPLE_SIZE);
+    for (int64 i = 0; i < INDEX_CACHE_SAMPLES; i++) {
+        int64 offset = (count - sample_size) * i / (INDEX_CACHE_SAMPLES - 1);
+        const uint8 *s = (const uint8 *)text + offset;
+        for (int64 j = 0; j < sample_size; j++) {
+            hash = (hash ^ s[j]) * 1099511628211ull;
+        }
+    }
+    return hash;
+}
+
+static char *index_cache_path(const char *file_name) {
+    size_t length = strlen(file_name);
+    char *path = (char *)malloc(length + sizeof(INDEX_CACHE_EXTENSION));
+    memcpy(path, file_name, length);
+    memcpy(path + length, INDEX_CACHE_EXTENSION, sizeof(INDEX_CACHE_EXTENSION));
+    return path;
+}
+
+// The sidecar may be truncated, stale or left half written, so the header
+// and every block are checked against the file size before anything is read
+// through them. Blocks are laid out the way Line_Index::push leaves them.
+static bool index_cache_valid(Index_Cache_Header *header, int64 file_size) {
+    int64 size = sizeof(Index_Cache_Header);
+    if (file_size < size || header->magic != INDEX_CACHE_MAGIC || header->version != INDEX_CACHE_VERSION) return false;
+    if (header->line_count < 1 || header->line_count > file_size * LINE_INDEX_BLOCK_LINES || header->text_size < 0 || header->last_line_start < 0 ||
+        header->last_line_start > header->text_size || header->delta_bytes < 0 || header->delta_bytes > file_size ||
+        header->utf8_count < 0 || header->utf8_count > header->line_count) {
+        return false;
+    }
+    if (header->block_count != (header->line_count + LINE_INDEX_BLOCK_LINES - 1) >> LINE_INDEX_BLOCK_SHIFT) return false;
+    size += header->block_count * sizeof(Line_Index_Block) + header->delta_bytes + header->utf8_count * sizeof(int64);
+    if (file_size != size) return false;
+
+    Line_Index_Block *blocks = (Line_Index_Block *)(header + 1);
+    int64 offset = 0;
+    for (int64 i = 0; i < header->block_count; i++) {
+        Line_Index_Block *block = &blocks[i];
+        int64 count = i < header->block_count - 1 ? LINE_INDEX_BLOCK_LINES : header->line_count - (i << LINE_INDEX_BLOCK_SHIFT);
+        int width = block->width;
+        if (block->count != count || (width != 1 && width != 2 && width != 4 && width != 8) || block->offset != offset) return false;
+        offset += (count - 1) * width;
+        if (offset > header->delta_bytes) return false;
+    }
+    if (offset != header->delta_bytes) return false;
+
+    int64 *utf8_lines = (int64 *)((uint8 *)(blocks + header->block_count) + header->delta_bytes);
+    for (int64 i = 0; i < header->utf8_count; i++) {
+        if (utf8_lines[i] < 0 || utf8_lines[i] >= header->line_count || (i > 0 && utf8_lines[i] < utf8_lines[i - 1])) return false;
+    }
+    return true;
+}
+
+// The decoded starts have to ascend from 0 and stay inside the text the
+// index was written for, the buffer indexes its text with them
+static bool index_cache_valid_starts(Line_Index *index, int64 text_size) {
+    int64 positions[LINE_INDEX_BLOCK_LINES];
+    int64 previous = 0;
+    for (size_t from = 0; from < index->count; from += LINE_INDEX_BLOCK_LINES) {
+        size_t n = MIN(index->count - from, (size_t)LINE_INDEX_BLOCK_LINES);
+        index->decode(from, n, positions);
+        for (size_t i = 0; i < n; i++) {
+            if (positions[i] < previous || positions[i] > text_size) return false;
+            previous = positions[i];
+        }
+    }
+    return index->count > 0 && index->blocks[0].base == 0 && previous == index->last;
+}
+
+// Fills the buffer's line index from the sidecar and returns how much of the
+// text it covers, -1 without a usable cache. When the file only grew the
+// index stops at the start of its last line, which gets rescanned since it
+// may continue into the new bytes.
+int64 index_cache_load(Buffer *buffer, File_Attributes attributes, bool extendable) {
+    char *path = index_cache_path(buffer->file_name);
+    Mapped_File file = map_file(path);
+    if (!file.data) {
+        free(path);
+        return -1;
+    }
+
+    int64 result = -1;
+    Index_Cache_Header *header = (Index_Cache_Header *)file.data;
+    if (!index_cache_valid(header, file.count)) {
+        unmap_file(&file);
+        delete_file(path);
+        free(path);
+        return -1;
+    }
+
+    int64 size = buffer_get_length(buffer);
+    bool same = header->file_size == attributes.file_size && header->last_write_time == attributes.last_write_time && header->text_size == size;
+    bool grown = extendable && header->extendable && header->file_size < attributes.file_size && header->text_size < size;
+    if ((same || grown) && index_cache_hash(buffer->text, header->text_size) == header->sample_hash) {
+        // The compressed index is stored as is, loading it is two copies
+        Line_Index_Block *blocks = (Line_Index_Block *)(header + 1);
+        uint8 *deltas = (uint8 *)(blocks + header->block_count);
+        int64 *utf8_lines = (int64 *)(deltas + header->delta_bytes);
+        Line_Index *index = &buffer->line_starts;
+        index->clear();
+        index->blocks.append(blocks, header->block_count);
+        index->deltas.grow(header->delta_bytes + 16); // the index keeps slack for its vector loads
+        index->deltas.append(deltas, header->delta_bytes);
+        index->count = header->line_count;
+        index->last = header->last_line_start;
+        buffer->utf8_lines.reset_count();
+        buffer->utf8_lines.append(utf8_lines, header->utf8_count);
+        if (!index_cache_valid_starts(index, header->text_size)) {
+            // The caller starts the index over, the write after the rescan replaces the sidecar
+            index->clear();
+            buffer->utf8_lines.reset_count();
+            unmap_file(&file);
+            delete_file(path);
+            free(path);
+            return -1;
+        }
+        if (same) {
+            buffer->line_starts.push(size + 1);
+            result = size;
+        } else {
+            int64 line = header->line_count - 1;
+            if (line > 0) {
+                // The line break before the last line may pair with the first new byte
+                buffer->line_starts.pop();
+                line--;
+            }
+            while (buffer->utf8_lines.count > 0 && buffer->utf8_lines[buffer->utf8_lines.count - 1] >= line) {
+                buffer->utf8_lines.pop();
+            }
+            result = buffer->line_starts[line];
+        }
+    }
+    unmap_file(&file);
+    free(path);
+    return result;
+}
+
+// Runs as a reader of the buffer, so an edit waits for it instead of changing the index under it
+static void index_cache_write_job(void *data) {
+    Index_Cache_Write *write = (Index_Cache_Write *)data;
+    Buffer *buffer = write->buffer;
+    if (buffer_begin_read(buffer, write->version)) {
+        write->header.sample_hash = index_cache_hash(buffer->text, write->header.text_size);
+        // Everything but the sentinel, which is the last start. The buffer's
+        // index is shared with readers so the trimmed last block is a copy.
+        Line_Index *index = &buffer->line_starts;
+        size_t line_count = index->count - 1;
+        int64 block_count = (line_count + LINE_INDEX_BLOCK_LINES - 1) >> LINE_INDEX_BLOCK_SHIFT;
+        Line_Index_Block tail = {};
+        if (block_count > 0) {
+            tail = index->blocks[block_count - 1];
+            tail.count = (int32)(line_count - ((block_count - 1) << LINE_INDEX_BLOCK_SHIFT));
+        }
+        write->header.line_count = line_count;
+        write->header.last_line_start = line_count > 0 ? (*index)[line_count - 1] : 0;
+        write->header.block_count = block_count;
+        write->header.delta_bytes = block_count > 0 ? tail.offset + (tail.count - 1) * tail.width : 0;
+        write->header.utf8_count = buffer->utf8_lines.count;
+        Platform_Handle file = open_file_for_writing(write->path);
+        if (file) {
+            write_file(file, &write->header, sizeof(write->header));
+            if (block_count > 0) {
+                write_file(file, index->blocks.data, (block_count - 1) * sizeof(Line_Index_Block));
+                write_file(file, &tail, sizeof(tail));
+                write_file(file, index->deltas.data, write->header.delta_bytes);
+            }
+            write_file(file, buffer->utf8_lines.data, write->header.utf8_count * sizeof(int64));
+            close_file(file);
+        }
+        buffer_end_read(buffer);
+    }
+    free(write->path);
+    free(write);
+    atomic_add64(&buffer->jobs, -1);
+}
+
+// The index must be complete and the buffer unedited since it was loaded
+void index_cache_save(Buffer *buffer, File_Attributes attributes, bool extendable) {
+    Index_Cache_Write *write = (Index_Cache_Write *)calloc(1, sizeof(Index_Cache_Write));
+    write->buffer = buffer;
+    write->version = buffer->version;
+    write->path = index_cache_path(buffer->file_name);
+    write->header.magic = INDEX_CACHE_MAGIC;
+    write->header.version = INDEX_CACHE_VERSION;
+    write->header.file_size = attributes.file_size;
+    write->header.last_write_time = attributes.last_write_time;
+    write->header.text_size = buffer_get_length(buffer);
+    write->header.extendable = extendable;
+    atomic_add64(&buffer->jobs, 1);
+    thread_pool_push(index_cache_write_job, write);
+}
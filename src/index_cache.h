@@ -0,0 +1,12 @@
+#pragma once
+
+#include "types.h"
+#include "buffer.h"
+
+// Sidecar file next to a large file holding its line index, so reopening it
+// doesn't rescan. It is keyed on the file's size, write time and a hash of
+// samples of its text. A file that only grew keeps the cached part.
+#define INDEX_CACHE_EXTENSION ".qed-index"
+
+int64 index_cache_load(Buffer *buffer, File_Attributes attributes, bool extendable);
+void index_cache_save(Buffer *buffer, File_Attributes attributes, bool extendable);
@@ -0,0 +1,24 @@
+#include "input.h"
+#include "platform.h"
+
+// The record is written before the interlocked add publishes it, and read
+// before the one that hands its slot back
+bool input_ring_push(Input_Ring *ring, System_Event *event) {
+    int64 write = ring->write;
+    if (write - ring->read == INPUT_RING_CAPACITY) return false;
+    ring->events[write & (INPUT_RING_CAPACITY - 1)] = *event;
+    atomic_add64(&ring->write, 1);
+    return true;
+}
+
+bool input_ring_pop(Input_Ring *ring, System_Event *event) {
+    int64 read = ring->read;
+    if (read == ring->write) return false;
+    *event = ring->events[read & (INPUT_RING_CAPACITY - 1)];
+    atomic_add64(&ring->read, 1);
+    return true;
+}
+
+bool input_ring_is_empty(Input_Ring *ring) {
+    return ring->read == ring->write;
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include "types.h"
+#include "qed.h"
+
+// Events from the window's thread to the editor's, one writer and one reader.
+// The records live in the ring, so nothing is allocated per event, and the
+// editor takes every one of them in order at the start of its frame.
+#define INPUT_RING_CAPACITY 1024
+
+struct Input_Ring {
+    System_Event events[INPUT_RING_CAPACITY];
+    volatile int64 read; // advanced by the reader only
+    volatile int64 write; // advanced by the writer only
+};
+
+bool input_ring_push(Input_Ring *ring, System_Event *event);
+bool input_ring_pop(Input_Ring *ring, System_Event *event);
+bool input_ring_is_empty(Input_Ring *ring);
@@ -0,0 +1,269 @@
+#include "journal.h"
+#include "platform.h"
+#include "thread_pool.h"
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define JOURNAL_MAGIC 0x4E524A51 // QJRN
+#define JOURNAL_VERSION 1
+
+struct Journal_Header {
+    uint32 magic;
+    uint32 version;
+    uint64 file_size; // of the file the records apply to
+    uint64 last_write_time;
+    uint64 check;
+};
+
+// Followed by the inserted bytes. Applying it removes removed bytes at
+// position and puts the inserted ones there.
+struct Journal_Record {
+    uint64 check; // covers the rest of the record and the check of the one before
+    int64 position;
+    int64 removed;
+    int64 inserted;
+};
+
+struct Journal_Write {
+    Journal *journal;
+    Array<char> records;
+    bool reset;
+    uint64 file_size;
+    uint64 last_write_time;
+};
+
+static uint64 journal_hash(uint64 hash, const void *data, int64 count) {
+    const uint8 *s = (const uint8 *)data;
+    for (int64 i = 0; i < count; i++) {
+        hash = (hash ^ s[i]) * 1099511628211ull;
+    }
+    return hash;
+}
+
+static char *journal_path(const char *file_name) {
+    size_t length = strlen(file_name);
+    char *path = (char *)malloc(length + sizeof(JOURNAL_EXTENSION));
+    memcpy(path, file_name, length);
+    memcpy(path + length, JOURNAL_EXTENSION, sizeof(JOURNAL_EXTENSION));
+    return path;
+}
+
+// Runs on a worker while writing is set, or on the main thread once no write is running
+static void journal_write(Journal_Write *write) {
+    Journal *journal = write->journal;
+    if (write->reset) {
+        if (journal->file) close_file(journal->file);
+        journal->file = 0;
+        if (write->records.count == 0) {
+            delete_file(journal->path);
+        } else {
+            journal->file = open_file_for_writing(journal->path);
+            if (journal->file) {
+                Journal_Header header{};
+                header.magic = JOURNAL_MAGIC;
+                header.version = JOURNAL_VERSION;
+                header.file_size = write->file_size;
+                header.last_write_time = write->last_write_time;
+                header.check = journal_hash(14695981039346656037ull, &header, offsetof(Journal_Header, check));
+                write_file(journal->file, &header, sizeof(header));
+                journal->check = header.check;
+            }
+        }
+    }
+
+    if (journal->file && write->records.count > 0) {
+        size_t offset = 0;
+        while (offset < write->records.count) {
+            Journal_Record record;
+            memcpy(&record, write->records.data + offset, sizeof(record));
+            const char *inserted = write->records.data + offset + sizeof(record);
+            record.check = journal_hash(journal->check, &record.position, sizeof(record) - offsetof(Journal_Record, position));
+            record.check = journal_hash(record.check, inserted, record.inserted);
+            memcpy(write->records.data + offset, &record, sizeof(record));
+            journal->check = record.check;
+            offset += sizeof(record) + record.inserted;
+        }
+        write_file(journal->file, write->records.data, write->records.count);
+        flush_file(journal->file);
+    }
+    write->records.clear();
+}
+
+static void journal_write_job(void *data) {
+    Journal_Write *write = (Journal_Write *)data;
+    Journal *journal = write->journal;
+    journal_write(write);
+    free(write);
+    atomic_add64(&journal->writing, -1);
+}
+
+static Journal_Write *journal_take_write(Journal *journal) {
+    Journal_Write *write = (Journal_Write *)calloc(1, sizeof(Journal_Write));
+    write->journal = journal;
+    write->records.swap(journal->pending);
+    write->reset = journal->reset;
+    write->file_size = journal->base_file_size;
+    write->last_write_time = journal->base_write_time;
+    journal->reset = false;
+    journal->saved = false;
+    journal->last_record = -1;
+    return write;
+}
+
+// Hands the pending records to a job, unless the last write is still running
+static void journal_flush(Journal *journal) {
+    if (journal->writing) return;
+    if (journal->pending.count == 0 && !journal->saved) return;
+    Journal_Write *write = journal_take_write(journal);
+    atomic_add64(&journal->writing, 1);
+    thread_pool_push(journal_write_job, write);
+}
+
+// Replays what a journal left behind against the freshly loaded buffer. The
+// edits go through the buffer like any other, so they can be undone and land
+// in the new journal file. A record torn by the crash ends the replay.
+static void journal_recover(Journal *journal) {
+    Buffer *buffer = journal->buffer;
+    Mapped_File file = map_file(journal->path);
+    if (!file.data) return;
+
+    int64 recovered = 0;
+    Journal_Header header{};
+    if (file.count >= (int64)sizeof(header)) memcpy(&header, file.data, sizeof(header));
+    if (header.magic != JOURNAL_MAGIC || header.version != JOURNAL_VERSION ||
+        header.check != journal_hash(14695981039346656037ull, &header, offsetof(Journal_Header, check))) {
+        printf("%s: journal is damaged, ignoring it\n", journal->path);
+    } else if (header.file_size != (uint64)buffer->file_size || header.last_write_time != (uint64)buffer->last_write_time) {
+        printf("%s: file changed since its journal was written, the journal is replaced on the next edit\n", buffer->file_name);
+    } else {
+        uint64 check = header.check;
+        int64 offset = sizeof(header);
+        while (offset + (int64)sizeof(Journal_Record) <= file.count) {
+            Journal_Record record;
+            memcpy(&record, file.data + offset, sizeof(record));
+            const char *inserted = file.data + offset + sizeof(record);
+            if (record.inserted < 0 || record.inserted > file.count - offset - (int64)sizeof(record)) break;
+            uint64 expected = journal_hash(check, &record.position, sizeof(record) - offsetof(Journal_Record, position));
+            expected = journal_hash(expected, inserted, record.inserted);
+            if (expected != record.check) break;
+            if (record.position < 0 || record.removed < 0 || record.position + record.removed > buffer_get_length(buffer)) break;
+
+            if (record.removed > 0) {
+                buffer_record_delete(buffer, record.position, record.position + record.removed);
+                buffer_delete_region(buffer, record.position, record.position + record.removed);
+            }
+            if (record.inserted > 0) {
+                String text;
+                text.data = (char *)malloc(record.inserted + 1);
+                text.count = record.inserted;
+                memcpy(text.data, inserted, record.inserted);
+                text.data[text.count] = 0;
+                buffer_insert_text(buffer, record.position, text);
+                buffer_record_insert(buffer, record.position, text);
+            }
+            check = record.check;
+            offset += sizeof(record) + record.inserted;
+            recovered++;
+        }
+        if (offset < file.count) {
+            printf("%s: journal ends in a damaged record, the edits before it are kept\n", buffer->file_name);
+        }
+    }
+    unmap_file(&file);
+
+    if (recovered > 0) {
+        printf("%s: recovered %lld unsaved edits\n", buffer->file_name, (long long)recovered);
+    }
+}
+
+// Attaches a journal to a buffer just loaded from its file, after replaying
+// the one a previous session left
+Journal *journal_open(Buffer *buffer) {
+    Journal *journal = (Journal *)calloc(1, sizeof(Journal));
+    journal->buffer = buffer;
+    journal->path = journal_path(buffer->file_name);
+    journal->last_record = -1;
+    journal->reset = true;
+    journal->base_file_size = buffer->file_size;
+    journal->base_write_time = buffer->last_write_time;
+    buffer->journal = journal;
+    journal_recover(journal);
+    return journal;
+}
+
+// Writes what is pending and waits for it, the journal file stays behind
+// when the buffer has unsaved edits
+void journal_close(Journal *journal) {
+    if (!journal) return;
+    while (journal->writing) {
+        yield_thread();
+    }
+    if (journal->pending.count > 0 || journal->saved) {
+        Journal_Write *write = journal_take_write(journal);
+        journal_write(write);
+        free(write);
+    }
+    if (journal->file) close_file(journal->file);
+    if (journal->buffer->journal == journal) journal->buffer->journal = nullptr;
+    journal->pending.clear();
+    free(journal->path);
+    free(journal);
+}
+
+// Called by the buffer for every edit, on the keystroke path. Only copies the
+// edit, and typing or deleting next to the last edit extends its record.
+void journal_record(Journal *journal, int64 position, int64 removed, const char *inserted, int64 inserted_count) {
+    if (journal->last_record >= 0) {
+        Journal_Record last;
+        memcpy(&last, journal->pending.data + journal->last_record, sizeof(last));
+        bool extended = true;
+        if (removed == 0 && position == last.position + last.inserted) {
+            journal->pending.append((char *)inserted, inserted_count);
+            last.inserted += inserted_count;
+        } else if (inserted_count == 0 && position >= last.position && position + removed == last.position + last.inserted) {
+            // Deleting what the record inserted
+            journal->pending.count -= removed;
+            last.inserted -= removed;
+        } else if (inserted_count == 0 && last.inserted == 0 && (position + removed == last.position || position == last.position)) {
+            last.position = position;
+            last.removed += removed;
+        } else {
+            extended = false;
+        }
+        if (extended) {
+            // The append may have moved the array
+            memcpy(journal->pending.data + journal->last_record, &last, sizeof(last));
+            return;
+        }
+    }
+
+    Journal_Record record{};
+    record.position = position;
+    record.removed = removed;
+    record.inserted = inserted_count;
+    journal->last_record = journal->pending.count;
+    journal->pending.append((char *)&record, sizeof(record));
+    if (inserted_count > 0) journal->pending.append((char *)inserted, inserted_count);
+}
+
+// Called every frame
+void journal_update(Journal *journal) {
+    if (++journal->frames_since_flush < JOURNAL_FLUSH_FRAMES) return;
+    if (journal->writing) return;
+    journal->frames_since_flush = 0;
+    journal_flush(journal);
+}
+
+// The buffer matches its file again, the journal starts over against it
+void journal_saved(Journal *journal) {
+    Buffer *buffer = journal->buffer;
+    journal->pending.reset_count();
+    journal->last_record = -1;
+    journal->reset = true;
+    journal->saved = true;
+    journal->base_file_size = buffer->file_size;
+    journal->base_write_time = buffer->last_write_time;
+}
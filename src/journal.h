@@ -0,0 +1,36 @@
+#pragma once
+
+#include "types.h"
+#include "array.h"
+#include "platform.h"
+#include "buffer.h"
+
+// Unsaved edits of a buffer are appended to a file next to its file, so they
+// survive the editor or the machine dying. Each record is one edit (position,
+// bytes removed, bytes inserted) with a checksum chained from the one before,
+// against the file as it was when the buffer last matched it. Edits are only
+// copied into memory as they happen, a job writes and syncs them every
+// JOURNAL_FLUSH_FRAMES, so the cost follows the edits and never the file.
+#define JOURNAL_EXTENSION ".qed-journal"
+#define JOURNAL_FLUSH_FRAMES 60
+
+struct Journal {
+    Buffer *buffer;
+    char *path;
+    Platform_Handle file; // only touched by the write job while one is running
+    uint64 check; // of the last record written
+    Array<char> pending; // records not handed to a write yet
+    int64 last_record; // offset in pending of the record typing may extend, -1 if none
+    bool reset; // the next write starts the file over against the base below
+    bool saved; // the buffer matches its file, so the journal file goes
+    uint64 base_file_size;
+    uint64 base_write_time;
+    int32 frames_since_flush;
+    volatile int64 writing;
+};
+
+Journal *journal_open(Buffer *buffer);
+void journal_close(Journal *journal);
+void journal_record(Journal *journal, int64 position, int64 removed, const char *inserted, int64 inserted_count);
+void journal_update(Journal *journal);
+void journal_saved(Journal *journal);
@@ -0,0 +1,316 @@
+#include "line_index.h"
+
+#include <string.h>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#include <emmintrin.h>
+#define LINE_INDEX_SSE2 1
+#endif
+
+// Deltas always have this much slack so a 16 byte load never runs off the end
+#define LINE_INDEX_PADDING 16
+
+static int line_index_width(uint64 delta) {
+    if (delta < (1ull << 8)) return 1;
+    if (delta < (1ull << 16)) return 2;
+    if (delta < (1ull << 32)) return 4;
+    return 8;
+}
+
+static inline uint64 line_index_load(uint8 *p, int width) {
+    uint64 value = 0;
+    memcpy(&value, p, width); // little endian
+    return value;
+}
+
+static void line_index_reserve(Line_Index *index, int64 bytes) {
+    if (index->deltas.count + bytes + LINE_INDEX_PADDING > index->deltas.capacity) {
+        index->deltas.grow(bytes + LINE_INDEX_PADDING);
+    }
+}
+
+#ifdef LINE_INDEX_SSE2
+// The first n bytes set, for summing part of a vector
+static __m128i line_index_mask(int n) {
+    static const uint8 ones[32] = {
+        0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    };
+    return _mm_loadu_si128((const __m128i *)(ones + 16 - n));
+}
+#endif
+
+// Sum of the first n deltas, which is the offset of start n from the base
+static uint64 line_index_sum(uint8 *p, int width, int n) {
+    uint64 sum = 0;
+    int i = 0;
+#ifdef LINE_INDEX_SSE2
+    if (width == 1) {
+        // psadbw adds up 8 bytes into each 64-bit half
+        __m128i zero = _mm_setzero_si128();
+        __m128i acc = zero;
+        for (; i + 16 <= n; i += 16) {
+            acc = _mm_add_epi64(acc, _mm_sad_epu8(_mm_loadu_si128((const __m128i *)(p + i)), zero));
+        }
+        if (i < n) {
+            __m128i v = _mm_and_si128(_mm_loadu_si128((const __m128i *)(p + i)), line_index_mask(n - i));
+            acc = _mm_add_epi64(acc, _mm_sad_epu8(v, zero));
+        }
+        acc = _mm_add_epi64(acc, _mm_srli_si128(acc, 8));
+        return (uint64)_mm_cvtsi128_si32(acc);
+    } else if (width == 2) {
+        // 127 deltas under 2^16 can't overflow 32-bit lanes
+        __m128i zero = _mm_setzero_si128();
+        __m128i acc = zero;
+        for (; i + 8 <= n; i += 8) {
+            __m128i v = _mm_loadu_si128((const __m128i *)(p + 2 * i));
+            acc = _mm_add_epi32(acc, _mm_add_epi32(_mm_unpacklo_epi16(v, zero), _mm_unpackhi_epi16(v, zero)));
+        }
+        if (i < n) {
+            __m128i v = _mm_and_si128(_mm_loadu_si128((const __m128i *)(p + 2 * i)), line_index_mask(2 * (n - i)));
+            acc = _mm_add_epi32(acc, _mm_add_epi32(_mm_unpacklo_epi16(v, zero), _mm_unpackhi_epi16(v, zero)));
+        }
+        acc = _mm_add_epi32(acc, _mm_srli_si128(acc, 8));
+        acc = _mm_add_epi32(acc, _mm_srli_si128(acc, 4));
+        return (uint64)(uint32)_mm_cvtsi128_si32(acc);
+    }
+#endif
+    for (; i < n; i++) {
+        sum += line_index_load(p + i * width, width);
+    }
+    return sum;
+}
+
+// Turns count deltas into positions after positions[0]
+static void line_index_decode(uint8 *p, int width, int count, int64 *positions) {
+    switch (width) {
+    case 1:
+        for (int i = 0; i < count; i++) positions[i + 1] = positions[i] + p[i];
+        break;
+    case 2:
+        for (int i = 0; i < count; i++) positions[i + 1] = positions[i] + ((uint16 *)p)[i];
+        break;
+    default:
+        for (int i = 0; i < count; i++) positions[i + 1] = positions[i] + (int64)line_index_load(p + i * width, width);
+        break;
+    }
+}
+
+// Rewrites the open block with wider deltas, it is always the last one
+static void line_index_widen(Line_Index *index, Line_Index_Block *block, int width) {
+    uint64 values[LINE_INDEX_BLOCK_LINES];
+    uint8 *p = index->deltas.data + block->offset;
+    int n = block->count - 1;
+    for (int i = 0; i < n; i++) {
+        values[i] = line_index_load(p + i * block->width, block->width);
+    }
+    index->deltas.count = block->offset;
+    line_index_reserve(index, n * width);
+    p = index->deltas.data + block->offset;
+    for (int i = 0; i < n; i++) {
+        memcpy(p + i * width, &values[i], width);
+    }
+    index->deltas.count += n * width;
+    block->width = width;
+}
+
+int64 Line_Index::operator[](size_t index) {
+    assert(index < count);
+    Line_Index_Block *block = &blocks.data[index >> LINE_INDEX_BLOCK_SHIFT];
+    int n = (int)(index & (LINE_INDEX_BLOCK_LINES - 1));
+    if (n == 0) return block->base;
+    return block->base + (int64)line_index_sum(deltas.data + block->offset, block->width, n);
+}
+
+void Line_Index::push(int64 position) {
+    if ((count & (LINE_INDEX_BLOCK_LINES - 1)) == 0) {
+        Line_Index_Block block = { position, (int64)deltas.count, 1, 1 };
+        blocks.push(block);
+    } else {
+        Line_Index_Block *block = &blocks.data[blocks.count - 1];
+        assert(position >= last);
+        uint64 delta = (uint64)(position - last);
+        int width = line_index_width(delta);
+        if (width > block->width) line_index_widen(this, block, width);
+        line_index_reserve(this, block->width);
+        memcpy(deltas.data + deltas.count, &delta, block->width);
+        deltas.count += block->width;
+        block->count++;
+    }
+    last = position;
+    count++;
+}
+
+// Fills the open block a run at a time, sized once for the widest delta
+void Line_Index::push_many(int64 *positions, int64 n) {
+    int64 i = 0;
+    while (i < n) {
+        if ((count & (LINE_INDEX_BLOCK_LINES - 1)) == 0) {
+            push(positions[i++]);
+            continue;
+        }
+        Line_Index_Block *block = &blocks.data[blocks.count - 1];
+        int64 m = LINE_INDEX_BLOCK_LINES - (int64)(count & (LINE_INDEX_BLOCK_LINES - 1));
+        if (m > n - i) m = n - i;
+        uint64 all_bits = 0;
+        int64 previous = last;
+        for (int64 k = 0; k < m; k++) {
+            assert(positions[i + k] >= previous);
+            all_bits |= (uint64)(positions[i + k] - previous);
+            previous = positions[i + k];
+        }
+        int width = line_index_width(all_bits);
+        if (width > block->width) line_index_widen(this, block, width);
+        width = block->width;
+        line_index_reserve(this, m * width);
+        uint8 *p = deltas.data + deltas.count;
+        previous = last;
+        int64 *run = positions + i;
+        switch (width) {
+        case 1:
+            for (int64 k = 0; k < m; k++) p[k] = (uint8)(run[k] - (k ? run[k - 1] : previous));
+            break;
+        case 2:
+            for (int64 k = 0; k < m; k++) ((uint16 *)p)[k] = (uint16)(run[k] - (k ? run[k - 1] : previous));
+            break;
+        default:
+            for (int64 k = 0; k < m; k++) {
+                uint64 delta = (uint64)(run[k] - (k ? run[k - 1] : previous));
+                memcpy(p + k * width, &delta, width);
+            }
+            break;
+        }
+        previous = run[m - 1];
+        deltas.count += m * width;
+        block->count += (int32)m;
+        count += m;
+        last = previous;
+        i += m;
+    }
+}
+
+void Line_Index::truncate(size_t new_count) {
+    if (new_count >= count) return;
+    count = new_count;
+    blocks.count = (new_count + LINE_INDEX_BLOCK_LINES - 1) >> LINE_INDEX_BLOCK_SHIFT;
+    if (blocks.count == 0) {
+        deltas.count = 0;
+        last = 0;
+        return;
+    }
+    Line_Index_Block *block = &blocks.data[blocks.count - 1];
+    block->count = (int32)(new_count - ((blocks.count - 1) << LINE_INDEX_BLOCK_SHIFT));
+    deltas.count = block->offset + (block->count - 1) * block->width;
+    last = (*this)[count - 1];
+}
+
+void Line_Index::pop() {
+    assert(count > 0);
+    truncate(count - 1);
+}
+
+void Line_Index::reset_count() {
+    truncate(0);
+}
+
+void Line_Index::clear() {
+    blocks.clear();
+    deltas.clear();
+    count = 0;
+    last = 0;
+}
+
+// Appends other's starts from index from on, each moved by shift. When both
+// indexes are at a block boundary whole blocks are copied with a new base,
+// otherwise other is decoded a block at a time.
+void Line_Index::append(Line_Index *other, size_t from, int64 shift) {
+    size_t i = from;
+    while (i < other->count) {
+        Line_Index_Block *block = &other->blocks.data[i >> LINE_INDEX_BLOCK_SHIFT];
+        int n = (int)(i & (LINE_INDEX_BLOCK_LINES - 1));
+        if (n == 0 && (count & (LINE_INDEX_BLOCK_LINES - 1)) == 0) {
+            int64 bytes = (block->count - 1) * block->width;
+            line_index_reserve(this, bytes);
+            Line_Index_Block copy = *block;
+            copy.base += shift;
+            copy.offset = deltas.count;
+            blocks.push(copy);
+            memcpy(deltas.data + deltas.count, other->deltas.data + block->offset, bytes);
+            deltas.count += bytes;
+            count += block->count;
+            last = copy.base + (int64)line_index_sum(deltas.data + copy.offset, copy.width, copy.count - 1);
+            i += block->count;
+            continue;
+        }
+        int64 positions[LINE_INDEX_BLOCK_LINES];
+        uint8 *p = other->deltas.data + block->offset;
+        positions[0] = block->base + shift + (int64)line_index_sum(p, block->width, n);
+        int m = block->count - n;
+        line_index_decode(p + n * block->width, block->width, m - 1, positions);
+        push_many(positions, m);
+        i += m;
+    }
+}
+
+// Copies the block holding from and every block after it into tail, so this
+// index can be truncated and rebuilt while the old tail is still around.
+// Returns the index of from in tail.
+size_t Line_Index::copy_tail(size_t from, Line_Index *tail) {
+    assert(from < count);
+    size_t first_block = from >> LINE_INDEX_BLOCK_SHIFT;
+    int64 first_offset = blocks.data[first_block].offset;
+    tail->clear();
+    tail->blocks.append(blocks.data + first_block, blocks.count - first_block);
+    for (size_t b = 0; b < tail->blocks.count; b++) {
+        tail->blocks.data[b].offset -= first_offset;
+    }
+    line_index_reserve(tail, deltas.count - first_offset);
+    tail->deltas.append(deltas.data + first_offset, deltas.count - first_offset);
+    tail->count = count - (first_block << LINE_INDEX_BLOCK_SHIFT);
+    tail->last = last;
+    return from - (first_block << LINE_INDEX_BLOCK_SHIFT);
+}
+
+// Writes the n starts from index from on to positions, a block at a time
+void Line_Index::decode(size_t from, size_t n, int64 *positions) {
+    assert(from + n <= count);
+    while (n > 0) {
+        Line_Index_Block *block = &blocks.data[from >> LINE_INDEX_BLOCK_SHIFT];
+        int k = (int)(from & (LINE_INDEX_BLOCK_LINES - 1));
+        int m = block->count - k;
+        if ((size_t)m > n) m = (int)n;
+        uint8 *p = deltas.data + block->offset;
+        positions[0] = block->base + (int64)line_index_sum(p, block->width, k);
+        line_index_decode(p + k * block->width, block->width, m - 1, positions);
+        positions += m;
+        from += m;
+        n -= m;
+    }
+}
+
+// Index of the last start at or before position, 0 if there is none
+int64 Line_Index::find(int64 position) {
+    if (count == 0) return 0;
+    int64 lo = 0;
+    int64 hi = (int64)blocks.count - 1;
+    while (lo < hi) {
+        int64 mid = lo + (hi - lo + 1) / 2;
+        if (blocks.data[mid].base <= position) {
+            lo = mid;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    Line_Index_Block *block = &blocks.data[lo];
+    uint8 *p = deltas.data + block->offset;
+    int64 start = block->base;
+    int i = 0;
+    for (; i < block->count - 1; i++) {
+        start += (int64)line_index_load(p + i * block->width, block->width);
+        if (start > position) break;
+    }
+    return (lo << LINE_INDEX_BLOCK_SHIFT) + i;
+}
+
+int64 Line_Index::memory_size() {
+    return (int64)(blocks.capacity * sizeof(Line_Index_Block) + deltas.capacity);
+}
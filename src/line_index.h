@@ -0,0 +1,38 @@
+#pragma once
+
+#include "types.h"
+#include "array.h"
+
+#define LINE_INDEX_BLOCK_SHIFT 7
+#define LINE_INDEX_BLOCK_LINES (1 << LINE_INDEX_BLOCK_SHIFT)
+
+// Every 128 line starts share a block with one absolute offset, the rest are
+// deltas from the previous start stored as 1, 2, 4 or 8 bytes, as wide as the
+// longest line in the block needs. Lines under 256 bytes cost about one byte.
+struct Line_Index_Block {
+    int64 base;
+    int64 offset; // of the block's first delta in deltas
+    int32 count; // starts in the block, base included
+    int32 width;
+};
+
+// Ascending positions that only grow at the end, like the Array<int64> it replaces
+struct Line_Index {
+    Array<Line_Index_Block> blocks;
+    Array<uint8> deltas;
+    size_t count = 0;
+    int64 last = 0;
+
+    int64 operator[](size_t index);
+    void push(int64 position);
+    void push_many(int64 *positions, int64 n);
+    void pop();
+    void truncate(size_t new_count);
+    void reset_count();
+    void clear();
+    void append(Line_Index *other, size_t from = 0, int64 shift = 0);
+    size_t copy_tail(size_t from, Line_Index *tail);
+    void decode(size_t from, size_t n, int64 *positions);
+    int64 find(int64 position);
+    int64 memory_size();
+};
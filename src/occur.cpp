@@ -0,0 +1,207 @@
+#include "occur.h"
+#include "thread_pool.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define OCCUR_CHUNK_SIZE (1 << 20)
+#define OCCUR_MAX_LINE_LENGTH 512
+
+// Occurs whose jobs were still running when cancelled, freed once they drain
+static Array<Occur *> retired_occurs;
+
+Regex *occur_get_regex(Occur *occur) {
+    int32 index = thread_pool_worker_index();
+    assert(index >= 0);
+    if (!occur->worker_regexes[index]) {
+        occur->worker_regexes[index] = regex_copy(occur->regex);
+    }
+    return occur->worker_regexes[index];
+}
+
+// Returns false when the buffer was edited since the occur started
+bool occur_search_chunk(Occur *occur, Occur_Chunk *chunk) {
+    Buffer *buffer = occur->source;
+    if (!buffer_begin_read(buffer, occur->version)) return false;
+
+    Regex *regex = occur_get_regex(occur);
+    int64 length = buffer_get_length(buffer);
+    Regex_Input input = regex_input_from_buffer(buffer, chunk->start, chunk->end);
+    Regex_Match match;
+    while (input.start <= input.end && regex_search_input(regex, &input, &match)) {
+        if (occur->cancelled) break;
+        // An empty match at the end belongs to the next chunk's first line
+        if (match.span.start == chunk->end && chunk->end < length) break;
+
+        int64 line = get_line_from_position(buffer, match.span.start);
+        chunk->lines.push(line);
+
+        // One result per line, continue on the next one
+        input.start = buffer->line_starts[line + 1];
+    }
+
+    buffer_end_read(buffer);
+    return true;
+}
+
+// Every job claims chunks in order until none are left, so results finish roughly front to back
+void occur_job_proc(void *data) {
+    Occur *occur = (Occur *)data;
+    while (!occur->cancelled) {
+        int64 index = atomic_add64(&occur->next_chunk, 1) - 1;
+        if (index >= occur->chunk_count) break;
+
+        Occur_Chunk *chunk = &occur->chunks[index];
+        if (!occur_search_chunk(occur, chunk)) {
+            atomic_add64(&occur->cancelled, 1);
+            break;
+        }
+        atomic_add64(&chunk->done, 1);
+    }
+    atomic_add64(&occur->pending, -1);
+}
+
+Occur *occur_start(Buffer *source, const char *pattern, const char **error) {
+    Regex *regex = regex_compile(pattern, REGEX_FLAG_NONE, error);
+    if (!regex) return nullptr;
+
+    // Jobs look lines up in the index, it can't be growing under them
+    buffer_index_finish(source);
+
+    Occur *occur = new Occur();
+    occur->source = source;
+    occur->version = source->version;
+    occur->regex = regex;
+    occur->worker_regexes = (Regex **)calloc(thread_pool_worker_count(), sizeof(Regex *));
+
+    // Chunks end on line starts, so a match never has to be stitched across two
+    int64 length = buffer_get_length(source);
+    occur->chunks = (Occur_Chunk *)calloc(length / OCCUR_CHUNK_SIZE + 1, sizeof(Occur_Chunk));
+    int64 start = 0;
+    do {
+        int64 end = length;
+        if (start + OCCUR_CHUNK_SIZE < length) {
+            int64 line = get_line_from_position(source, start + OCCUR_CHUNK_SIZE);
+            end = get_position_from_line(source, line + 1);
+            if (end > length) end = length;
+        }
+        Occur_Chunk *chunk = &occur->chunks[occur->chunk_count++];
+        chunk->start = start;
+        chunk->end = end;
+        start = end;
+    } while (start < length);
+
+    int32 job_count = thread_pool_worker_count();
+    if (job_count > occur->chunk_count) job_count = (int32)occur->chunk_count;
+    occur->pending = job_count;
+    for (int32 i = 0; i < job_count; i++) {
+        thread_pool_push(occur_job_proc, occur, JOB_PRIORITY_INTERACTIVE);
+    }
+    return occur;
+}
+
+void occur_free(Occur *occur) {
+    assert(occur->pending == 0);
+    for (int32 i = 0; i < thread_pool_worker_count(); i++) {
+        regex_free(occur->worker_regexes[i]);
+    }
+    for (int64 i = 0; i < occur->chunk_count; i++) {
+        occur->chunks[i].lines.clear();
+    }
+    free(occur->chunks);
+    free(occur->worker_regexes);
+    regex_free(occur->regex);
+    delete occur;
+}
+
+void occur_cancel(Occur *occur) {
+    atomic_add64(&occur->cancelled, 1);
+    retired_occurs.push(occur);
+}
+
+void occur_append_line(Array<char> *out, Buffer *source, int64 line) {
+    char prefix[32];
+    int len = snprintf(prefix, sizeof(prefix), "%lld: ", (long long)(line + 1));
+    out->append(prefix, len);
+
+    int64 start = get_position_from_line(source, line);
+    int64 count = buffer_get_line_length(source, line);
+    if (count > OCCUR_MAX_LINE_LENGTH) count = OCCUR_MAX_LINE_LENGTH;
+    if (count > 0) {
+        if (out->count + count > out->capacity) {
+            out->grow(count);
+        }
+        buffer_copy_span(source, { start, start + count }, out->data + out->count);
+        out->count += count;
+    }
+    out->push('\n');
+}
+
+// Called every frame. Publishes the finished prefix of chunks and returns true when anything was added.
+bool occur_update(Occur *occur, Buffer *results_buffer) {
+    for (size_t i = 0; i < retired_occurs.count; ) {
+        if (retired_occurs[i]->pending == 0) {
+            occur_free(retired_occurs[i]);
+            retired_occurs[i] = retired_occurs.back();
+            retired_occurs.pop();
+        } else {
+            i++;
+        }
+    }
+
+    if (!occur || occur->finished) return false;
+
+    // Line numbers are stale once the source changes, stop instead of publishing them
+    bool stale = occur->source->version != occur->version;
+    if (stale && !occur->cancelled) {
+        atomic_add64(&occur->cancelled, 1);
+    }
+
+    bool done = occur->pending == 0;
+    Array<char> results;
+    while (!stale && occur->published_chunks < occur->chunk_count) {
+        Occur_Chunk *chunk = &occur->chunks[occur->published_chunks];
+        if (!chunk->done) break;
+        for (size_t i = 0; i < chunk->lines.count; i++) {
+            occur_append_line(&results, occur->source, chunk->lines[i]);
+        }
+        occur->match_count += chunk->lines.count;
+        chunk->lines.clear();
+        occur->published_chunks++;
+    }
+
+    if (done) {
+        char summary[128];
+        int len;
+        if (occur->published_chunks == occur->chunk_count) {
+            len = snprintf(summary, sizeof(summary), "-- %lld matching lines --\n", (long long)occur->match_count);
+        } else {
+            len = snprintf(summary, sizeof(summary), "-- stopped, %s changed --\n", occur->source->file_name);
+        }
+        results.append(summary, len);
+        occur->finished = true;
+    }
+
+    bool changed = results.count > 0;
+    if (changed) {
+        String text = { results.data, (int64)results.count };
+        buffer_insert_text(results_buffer, buffer_get_length(results_buffer), text);
+    }
+    results.clear();
+    return changed;
+}
+
+// Splits "line: text"
+bool parse_occur_result(String line, int64 *line_number) {
+    int64 i = 0;
+    int64 number = 0;
+    while (i < line.count && line.data[i] >= '0' && line.data[i] <= '9') {
+        number = number * 10 + (line.data[i] - '0');
+        i++;
+    }
+    if (i == 0 || i == line.count || line.data[i] != ':') return false;
+    *line_number = number;
+    return true;
+}
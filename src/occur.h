@@ -0,0 +1,39 @@
+#pragma once
+
+#include "types.h"
+#include "array.h"
+#include "buffer.h"
+#include "regex.h"
+
+// Lists the lines of one buffer that match a pattern. The buffer is cut into
+// line aligned chunks that workers claim in order and search in place, so the
+// main thread can publish every finished prefix of chunks while the rest are
+// still being scanned.
+struct Occur_Chunk {
+    int64 start;
+    int64 end;
+    Array<int64> lines;
+    volatile int64 done;
+};
+
+struct Occur {
+    Buffer *source;
+    int64 version;
+    Regex *regex;
+    Regex **worker_regexes;
+
+    Occur_Chunk *chunks;
+    int64 chunk_count;
+    volatile int64 next_chunk;
+    int64 published_chunks;
+
+    volatile int64 pending;
+    volatile int64 cancelled;
+    int64 match_count;
+    bool finished;
+};
+
+Occur *occur_start(Buffer *source, const char *pattern, const char **error);
+void occur_cancel(Occur *occur);
+bool occur_update(Occur *occur, Buffer *results_buffer);
+bool parse_occur_result(String line, int64 *line_number);
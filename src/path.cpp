@@ -10,6 +10,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <ctype.h>
 
 #include "path.h" 
 #define IS_SLASH(C) ((C) == '/' || (C) == '\\')
@@ -24,44 +25,58 @@ char *path_join(char *left, char *right) {
     return result;
 }
 
-char *path_strip_extension(char *path) {
-    char *result = NULL;
-    assert(path);
-    for (char *ptr = path + strlen(path) - 1; ptr != path; ptr--) {
-        switch (*ptr) {
-        case '.':
-        {
-            result = (char *)malloc(path + strlen(path) - ptr + 1);
-            strcpy(result, path);
+String path_file_name(String path) {
+    int64 start = path.count;
+    while (start > 0 && !IS_SLASH(path.data[start - 1])) {
+        start--;
+    }
+    String result = { path.data + start, path.count - start };
+    return result;
+}
+
+String path_dir_name(String path) {
+    int64 end = path.count;
+    while (end > 0 && !IS_SLASH(path.data[end - 1])) {
+        end--;
+    }
+    if (end > 0) end--;
+    String result = { path.data, end };
+    return result;
+}
+
+// Without the dot, empty for names with none or only a leading one
+String path_extension(String path) {
+    String name = path_file_name(path);
+    for (int64 i = name.count - 1; i > 0; i--) {
+        if (name.data[i] == '.') {
+            String result = { name.data + i + 1, name.count - i - 1 };
             return result;
         }
-        case '/':
-        case '\'':
-            // No extension for this file
-            return NULL;
-        }
     }
-    return NULL;
+    String result = { name.data + name.count, 0 };
+    return result;
 }
 
-char *path_strip_dir_name(char *path) {
+// The path without its extension, NULL when it has none
+char *path_strip_extension(char *path) {
     assert(path);
-    char *ptr = path + strlen(path) - 1;
-    while (ptr != path) {
-        if (IS_SLASH(*ptr)) {
-            break;
-        }
-        ptr--;
-    }
+    String extension = path_extension(STRZ(path));
+    if (extension.data == path + strlen(path)) return NULL;
+    int64 len = extension.data - 1 - path;
+    char *result = (char *)malloc(len + 1);
+    memcpy(result, path, len);
+    result[len] = 0;
+    return result;
+}
 
-    char *dir_name = NULL;
-    size_t len = ptr - path;
-    if (len) {
-        dir_name = (char *)malloc(len + 1);
-        dir_name[len] = 0;
-        strncpy(dir_name, path, len);
-    }
-    return dir_name;
+char *path_strip_dir_name(char *path) {
+    assert(path);
+    String dir_name = path_dir_name(STRZ(path));
+    if (!dir_name.count) return NULL;
+    char *result = (char *)malloc(dir_name.count + 1);
+    memcpy(result, dir_name.data, dir_name.count);
+    result[dir_name.count] = 0;
+    return result;
 }
 
 char *path_strip_file_name(char *path) {
@@ -80,58 +95,79 @@ char *path_strip_file_name(char *path) {
     return NULL;
 }
 
-char *path_normalize(char *path) {
-    // @todo should we append current directory if the path is relative?
-    // might help with dot2 being clamped to root of path
-    assert(path);
-    uintptr_t len = 0;
-    char *buffer = (char *)malloc(strlen(path) + 1);
-    char *stream = path;
+// One separator between them, none when either is empty or the directory already ends in one
+int64 path_join_into(char *out, int64 capacity, String dir, String name) {
+    bool slash = dir.count > 0 && name.count > 0 && !IS_SLASH(dir.data[dir.count - 1]);
+    int64 len = dir.count + slash + name.count;
+    if (len + 1 > capacity) return -1;
+    memmove(out, dir.data, dir.count);
+    if (slash) out[dir.count] = '/';
+    memmove(out + dir.count + slash, name.data, name.count);
+    out[len] = 0;
+    return len;
+}
 
-    while (*stream) {
-        if (IS_SLASH(*stream)) {
+// Resolves '.' and '..' and turns every run of separators into one '/'. A
+// drive, a leading slash or a UNC prefix is kept as the root that '..' stops at,
+// a relative path keeps its leading '..'.
+int64 path_normalize_into(char *out, int64 capacity, String path) {
+    if (path.count + 1 > capacity) return -1;
+    const char *stream = path.data;
+    const char *stream_end = path.data + path.count;
+    int64 len = 0;
+
+    if (path.count >= 2 && isalpha(stream[0]) && stream[1] == ':') {
+        out[len++] = *stream++;
+        out[len++] = *stream++;
+    }
+    if (stream < stream_end && IS_SLASH(stream[0])) {
+        out[len++] = '/';
+        stream++;
+        if (len == 1 && stream < stream_end && IS_SLASH(stream[0])) {
+            out[len++] = '/';
             stream++;
-            char *start = stream;
-            bool dot = false;
-            bool dot2 = false;
-            if (*stream == '.') {
-                stream++;
-                if (*stream == '.') {
-                    dot2 = true;
-                    stream++;
-                } else {
-                    dot = true;
-                }
-            }
+        }
+    }
+    int64 root = len;
 
-            // Check if the current dirname is actually '..' or '.' rather than some file like '.foo' or '..foo'
-            if (*stream && !IS_SLASH(*stream)) {
-                dot = false;
-                dot2 = false;
+    while (stream < stream_end) {
+        while (stream < stream_end && IS_SLASH(*stream)) {
+            stream++;
+        }
+        if (stream == stream_end) break;
+        const char *start = stream;
+        while (stream < stream_end && !IS_SLASH(*stream)) {
+            stream++;
+        }
+        int64 count = stream - start;
+        if (count == 1 && start[0] == '.') continue;
+        if (count == 2 && start[0] == '.' && start[1] == '.') {
+            // Walk back a directory, never past the root
+            int64 last = len;
+            while (last > root && out[last - 1] != '/') {
+                last--;
             }
-
-            // If not a dot dirname then just continue on like normal, reset stream to after the seperator
-            if (!dot && !dot2) {
-                // buffer[len++] = '/';
-                stream = start;
-            } else if (dot2) {
-                // Walk back directory, go until seperator or beginning of stream
-                // @todo probably want to just clamp to root
-                char *prev = buffer + len - 1;
-                while (prev != buffer && !IS_SLASH(*prev)) {
-                    prev--;
-                }
-                len = prev - buffer;
+            bool parent = len - last == 2 && out[last] == '.' && out[last + 1] == '.';
+            if (len > root && !parent) {
+                len = last > root ? last - 1 : last;
+                continue;
             }
-        } else {
-            buffer[len++] = *stream++;
+            if (root > 0 && out[root - 1] == '/') continue;
         }
+        if (len > root) out[len++] = '/';
+        // Writing in place never overtakes the reading
+        memmove(out + len, start, count);
+        len += count;
     }
+    out[len] = 0;
+    return len;
+}
 
-    char *normal = (char *)malloc(len + 1);
-    strncpy(normal, buffer, len);
-    normal[len] = 0;
-    free(buffer);
+char *path_normalize(char *path) {
+    assert(path);
+    String string = STRZ(path);
+    char *normal = (char *)malloc(string.count + 1);
+    path_normalize_into(normal, string.count + 1, string);
     return normal;
 }
 
@@ -167,6 +203,19 @@ char *path_current_dir() {
 }
 #endif
 
+#ifdef _WIN32
+int64 path_current_dir_into(char *out, int64 capacity) {
+    DWORD length = GetCurrentDirectoryA((DWORD)capacity, out);
+    if (length == 0 || length >= capacity) return -1;
+    return length;
+}
+#elif defined(__linux__)
+int64 path_current_dir_into(char *out, int64 capacity) {
+    if (!getcwd(out, capacity)) return -1;
+    return (int64)strlen(out);
+}
+#endif
+
 #ifdef _WIN32
 bool path_file_exists(char *path) {
     return PathFileExistsA(path);
@@ -196,6 +245,131 @@ bool path_is_relative(const char *path) {
     return !path_is_absolute(path);
 }
 
+static uint32 path_hash(Path_Id parent, String name) {
+    uint32 hash = 2166136261u ^ parent;
+    for (int64 i = 0; i < name.count; i++) {
+        hash = (hash ^ (uint8)name.data[i]) * 16777619u;
+    }
+    return hash;
+}
+
+static void path_arena_rehash(Path_Arena *arena, size_t capacity) {
+    arena->slots.clear();
+    arena->slots.reserve(capacity);
+    memset(arena->slots.data, 0, capacity * sizeof(uint32));
+    arena->slots.count = capacity;
+    uint32 mask = (uint32)capacity - 1;
+    for (uint32 id = 1; id < arena->nodes.count; id++) {
+        Path_Node *node = &arena->nodes[id];
+        String name = { arena->names.data + node->name, node->name_length };
+        uint32 slot = path_hash(node->parent, name) & mask;
+        while (arena->slots[slot]) {
+            slot = (slot + 1) & mask;
+        }
+        arena->slots[slot] = id;
+    }
+}
+
+// A root ("/", "//" or "C:/") ends in its separator, its children need none
+static bool path_node_is_root(Path_Arena *arena, Path_Node *node) {
+    return node->name_length > 0 && arena->names[node->name + node->name_length - 1] == '/';
+}
+
+// The id of name under parent, added the first time it's seen
+Path_Id path_intern(Path_Arena *arena, Path_Id parent, String name) {
+    if (arena->nodes.count == 0) {
+        Path_Node empty = {};
+        arena->nodes.push(empty);
+    }
+    if ((arena->nodes.count + 1) * 2 > arena->slots.count) {
+        path_arena_rehash(arena, arena->slots.count ? arena->slots.count * 2 : 256);
+    }
+    uint32 mask = (uint32)arena->slots.count - 1;
+    uint32 slot = path_hash(parent, name) & mask;
+    for (; arena->slots[slot]; slot = (slot + 1) & mask) {
+        Path_Node *node = &arena->nodes[arena->slots[slot]];
+        if (node->parent == parent && node->name_length == name.count && memcmp(arena->names.data + node->name, name.data, name.count) == 0) {
+            return arena->slots[slot];
+        }
+    }
+
+    Path_Node node;
+    node.parent = parent;
+    node.name = (uint32)arena->names.count;
+    node.name_length = (uint32)name.count;
+    node.length = (uint32)name.count;
+    if (parent) node.length += arena->nodes[parent].length + !path_node_is_root(arena, &arena->nodes[parent]);
+    arena->names.append(name.data, name.count);
+    arena->names.push(0);
+    Path_Id id = (Path_Id)arena->nodes.count;
+    arena->nodes.push(node);
+    arena->slots[slot] = id;
+    return id;
+}
+
+// Each component of the normalized path in turn, the root as the first one
+Path_Id path_intern_path(Path_Arena *arena, String path) {
+    char normal[PATH_MAX_LENGTH];
+    int64 len = path_normalize_into(normal, sizeof(normal), path);
+    if (len <= 0) return 0;
+    int64 root = (len >= 2 && normal[1] == ':') ? 2 : 0;
+    while (root < len && root < 3 && normal[root] == '/') {
+        root++;
+    }
+    // A drive without a slash stays part of the first name
+    if (root > 0 && normal[root - 1] != '/') root = 0;
+
+    Path_Id id = 0;
+    if (root > 0) {
+        String name = { normal, root };
+        id = path_intern(arena, 0, name);
+    }
+    int64 start = root;
+    for (int64 i = root; i <= len; i++) {
+        if (i == len || normal[i] == '/') {
+            if (i > start) {
+                String name = { normal + start, i - start };
+                id = path_intern(arena, id, name);
+            }
+            start = i + 1;
+        }
+    }
+    return id;
+}
+
+String path_arena_name(Path_Arena *arena, Path_Id id) {
+    Path_Node *node = &arena->nodes[id];
+    String result = { arena->names.data + node->name, node->name_length };
+    return result;
+}
+
+// Written from the end back, each name in front of the one after it
+int64 path_arena_write(Path_Arena *arena, Path_Id id, char *out, int64 capacity) {
+    if (id == 0) {
+        if (capacity < 1) return -1;
+        out[0] = 0;
+        return 0;
+    }
+    int64 len = arena->nodes[id].length;
+    if (len + 1 > capacity) return -1;
+    out[len] = 0;
+    int64 end = len;
+    while (id) {
+        Path_Node *node = &arena->nodes[id];
+        end -= node->name_length;
+        memcpy(out + end, arena->names.data + node->name, node->name_length);
+        id = node->parent;
+        if (id && !path_node_is_root(arena, &arena->nodes[id])) out[--end] = '/';
+    }
+    return len;
+}
+
+void path_arena_free(Path_Arena *arena) {
+    arena->names.clear();
+    arena->nodes.clear();
+    arena->slots.clear();
+}
+
 void find_first_file() {
 //     HANDLE FindFirstFileA(
 //   [in]  LPCSTR             lpFileName,
@@ -1,3 +1,11 @@
+#pragma once
+
+#include "types.h"
+#include "array.h"
+#include "custom_string.h"
+
+// Big enough for any path the ANSI file APIs accept, with room to spare
+#define PATH_MAX_LENGTH 1024
 
 char *path_join(char *left, char *right);
 char *path_strip_extension(char *path);
@@ -9,3 +17,39 @@ char *path_current_dir();
 bool path_file_exists(char *path);
 bool path_is_absolute(const char *path);
 bool path_is_relative(const char *path);
+
+// Views into the path, nothing is copied
+String path_file_name(String path);
+String path_dir_name(String path);
+String path_extension(String path);
+
+// Write into the caller's storage and NUL-terminate, returning the length or
+// -1 when it doesn't fit. A normalized path is never longer, so out may be path.data.
+int64 path_join_into(char *out, int64 capacity, String dir, String name);
+int64 path_normalize_into(char *out, int64 capacity, String path);
+int64 path_current_dir_into(char *out, int64 capacity);
+
+// Interned paths. Each directory is stored once, as its parent's id and its
+// own name, so a path costs a few bytes past the first file in its directory
+// and two paths are the same exactly when their ids are. Not thread-safe, the
+// owner locks around it when jobs share one.
+typedef uint32 Path_Id; // 0 is the empty path
+
+struct Path_Node {
+    Path_Id parent;
+    uint32 name; // offset in names
+    uint32 name_length;
+    uint32 length; // of the whole path as written
+};
+
+struct Path_Arena {
+    Array<char> names;
+    Array<Path_Node> nodes;
+    Array<uint32> slots; // node id by hash of parent and name, 0 when empty
+};
+
+Path_Id path_intern(Path_Arena *arena, Path_Id parent, String name);
+Path_Id path_intern_path(Path_Arena *arena, String path);
+String path_arena_name(Path_Arena *arena, Path_Id id);
+int64 path_arena_write(Path_Arena *arena, Path_Id id, char *out, int64 capacity);
+void path_arena_free(Path_Arena *arena);
@@ -3,6 +3,9 @@
 #include "types.h"
 #include "custom_string.h"
 typedef int64 Platform_Handle;
+typedef void (*Platform_Thread_Proc)(void *data);
+typedef void (*Visit_Directory_Proc)(const char *name, bool is_directory, void *data);
+typedef void (*Directory_Change_Proc)(const char *name, bool added, bool is_directory, void *data);
 
 struct Read_File {
     void *data;
@@ -10,6 +13,13 @@ struct Read_File {
     Platform_Handle handle;
 };
 
+struct Mapped_File {
+    char *data;
+    int64 count;
+    Platform_Handle file;
+    Platform_Handle mapping;
+};
+
 struct File_Attributes {
     uint64 creation_time;
     uint64 last_access_time;
@@ -21,3 +31,43 @@ String read_file_string(const char *file_name);
 Read_File read_entire_file(const char *file_name);
 Read_File open_entire_file(const char *file_name);
 File_Attributes get_file_attributes(const char *file_name);
+
+Platform_Handle open_file_for_writing(const char *file_name);
+bool write_file(Platform_Handle file, const void *data, int64 count);
+void close_file(Platform_Handle file);
+bool flush_file(Platform_Handle file);
+bool delete_file(const char *file_name);
+int64 read_file_range(const char *file_name, int64 offset, void *dest, int64 count);
+uint64 get_file_id(const char *file_name);
+
+// Signals when the file may have changed, file_changed never blocks
+Platform_Handle watch_file(const char *file_name);
+bool file_changed(Platform_Handle watch);
+void unwatch_file(Platform_Handle watch);
+
+// Names added or removed anywhere under a directory, relative to it with forward
+// slashes. Renames come as a removal and an addition, is_directory is only known
+// for additions. read_directory_changes never blocks and returns false when
+// changes were lost, after which the tree has to be read again.
+Platform_Handle watch_directory_tree(const char *path);
+bool read_directory_changes(Platform_Handle watch, Directory_Change_Proc proc, void *data);
+void unwatch_directory_tree(Platform_Handle watch);
+
+Mapped_File map_file(const char *file_name);
+void unmap_file(Mapped_File *file);
+bool visit_directory(const char *path, Visit_Directory_Proc proc, void *data);
+
+int get_processor_count();
+void create_thread(Platform_Thread_Proc proc, void *data);
+Platform_Handle create_semaphore(int32 initial_count);
+void semaphore_signal(Platform_Handle semaphore, int32 count);
+void semaphore_wait(Platform_Handle semaphore);
+Platform_Handle create_mutex();
+void mutex_lock(Platform_Handle mutex);
+void mutex_unlock(Platform_Handle mutex);
+void destroy_mutex(Platform_Handle mutex);
+void yield_thread();
+int64 get_time_microseconds();
+
+int64 atomic_add64(volatile int64 *addend, int64 value);
+int64 atomic_compare_exchange64(volatile int64 *dest, int64 exchange, int64 comparand);
@@ -0,0 +1,132 @@
+#include "preload.h"
+#include "platform.h"
+#include "thread_pool.h"
+#include "path.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static void preload_job(void *data) {
+    Preload *preload = (Preload *)data;
+    // Opening a file that's gone would create it
+    if (!preload->cancelled && path_file_exists(preload->path)) {
+        preload->buffer = make_buffer_from_file(preload->path);
+    }
+    atomic_add64(&preload->done, 1);
+}
+
+static int64 preload_memory_size(Preload *preload) {
+    if (preload->done) return preload->buffer ? buffer_memory_size(preload->buffer) : 0;
+    return preload->file_size;
+}
+
+static void preload_free(Preload *preload) {
+    if (preload->buffer) buffer_free(preload->buffer);
+    free(preload->path);
+    delete preload;
+}
+
+static int64 preload_find(Preloader *preloader, const char *path) {
+    for (size_t i = 0; i < preloader->preloads.count; i++) {
+        if (strcmp(preloader->preloads[i]->path, path) == 0) return (int64)i;
+    }
+    return -1;
+}
+
+static Preload *preload_remove(Preloader *preloader, int64 index) {
+    Preload *preload = preloader->preloads[index];
+    memmove(preloader->preloads.data + index, preloader->preloads.data + index + 1, (preloader->preloads.count - index - 1) * sizeof(Preload *));
+    preloader->preloads.count--;
+    return preload;
+}
+
+// A job that hasn't started returns at once, one that's reading is left to
+// finish and freed by preload_update
+static void preload_drop(Preloader *preloader, int64 index) {
+    Preload *preload = preload_remove(preloader, index);
+    atomic_add64(&preload->cancelled, 1);
+    preloader->dropped.push(preload);
+}
+
+// Paths are the registry's, so a file has one preload however it was named
+void preload_request(Preloader *preloader, const char *path) {
+    int64 existing = preload_find(preloader, path);
+    if (existing >= 0) {
+        // Asked for again, now the newest
+        preloader->preloads.push(preload_remove(preloader, existing));
+        return;
+    }
+    File_Attributes attributes = get_file_attributes(path);
+    int64 file_size = (int64)attributes.file_size;
+    if (file_size > preloader->budget) return;
+
+    int64 total = file_size;
+    for (size_t i = 0; i < preloader->preloads.count; i++) {
+        total += preload_memory_size(preloader->preloads[i]);
+    }
+    while (preloader->preloads.count > 0 && total > preloader->budget) {
+        total -= preload_memory_size(preloader->preloads[0]);
+        preload_drop(preloader, 0);
+    }
+
+    Preload *preload = new Preload();
+    preload->path = string_copy(path).data;
+    preload->file_size = file_size;
+    preloader->preloads.push(preload);
+    thread_pool_push(preload_job, preload);
+}
+
+// The preloaded buffer for the path, waited for if it's still being read. A
+// file written since it was read isn't handed out, the caller reads it again.
+// The buffer's file_name is the caller's path.
+Buffer *preload_take(Preloader *preloader, const char *path) {
+    int64 index = preload_find(preloader, path);
+    if (index < 0) return nullptr;
+    Preload *preload = preload_remove(preloader, index);
+    while (!preload->done) {
+        yield_thread();
+    }
+    Buffer *buffer = preload->buffer;
+    if (buffer) {
+        File_Attributes attributes = get_file_attributes(path);
+        if ((int64)attributes.last_write_time != buffer->last_write_time || (int64)attributes.file_size != buffer->file_size) {
+            buffer_free(buffer);
+            buffer = nullptr;
+        } else {
+            buffer->file_name = path;
+        }
+    }
+    preload->buffer = nullptr;
+    preload_free(preload);
+    return buffer;
+}
+
+// Frees the dropped preloads whose jobs have finished, called once a frame
+void preload_update(Preloader *preloader) {
+    for (size_t i = 0; i < preloader->dropped.count; ) {
+        Preload *preload = preloader->dropped[i];
+        if (preload->done) {
+            preload_free(preload);
+            preloader->dropped[i] = preloader->dropped.back();
+            preloader->dropped.pop();
+        } else {
+            i++;
+        }
+    }
+}
+
+// Waits out every job so nothing is still reading at exit
+void preload_cancel_all(Preloader *preloader) {
+    while (preloader->preloads.count > 0) {
+        preload_drop(preloader, (int64)preloader->preloads.count - 1);
+    }
+    for (size_t i = 0; i < preloader->dropped.count; i++) {
+        Preload *preload = preloader->dropped[i];
+        while (!preload->done) {
+            yield_thread();
+        }
+        preload_free(preload);
+    }
+    preloader->preloads.clear();
+    preloader->dropped.clear();
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include "types.h"
+#include "array.h"
+#include "buffer.h"
+
+// Files read into buffers on the thread pool before they're asked for, so
+// opening the file the find-file dialog points at finds its buffer ready.
+// Preloads past the budget, oldest first, are dropped: a queued one never
+// starts and a running one is freed when it finishes.
+#define PRELOAD_DEFAULT_BUDGET (256LL * 1024 * 1024)
+// Frames the dialog has to rest on a candidate before it's preloaded, a quarter second at 60 fps
+#define PRELOAD_DELAY_FRAMES 15
+
+struct Preload {
+    char *path;
+    int64 file_size; // when requested, the buffer's own size once it's read
+    Buffer *buffer; // set by the job
+    volatile int64 cancelled;
+    volatile int64 done;
+};
+
+struct Preloader {
+    Array<Preload *> preloads; // oldest first
+    Array<Preload *> dropped; // cancelled while their job was running
+    int64 budget = PRELOAD_DEFAULT_BUDGET;
+};
+
+void preload_request(Preloader *preloader, const char *path);
+Buffer *preload_take(Preloader *preloader, const char *path);
+void preload_update(Preloader *preloader);
+void preload_cancel_all(Preloader *preloader);
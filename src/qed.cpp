@@ -1,6 +1,7 @@
 #include "qed.h"
 #include "buffer.h"
 #include "draw.h"
+#include "render.h"
 
 #include <ft2build.h>
 #include FT_FREETYPE_H
@@ -93,7 +94,6 @@ Face *load_font_face(const char *font_name, int font_height) {
         atlas_x += ft_face->glyph->bitmap.width;
     }
 
-    void *d3d11_create_face_texture(uint8 *bitmap, int width, int height);
     face->width = atlas_width;
     face->height = atlas_height;
     face->max_bmp_height = max_bmp_height;
@@ -102,7 +102,7 @@ Face *load_font_face(const char *font_name, int font_height) {
     face->bbox_height = height;
     face->glyph_width = glyph_width;
     face->glyph_height = glyph_height;
-    face->texture = d3d11_create_face_texture(bitmap, atlas_width, atlas_height);
+    face->texture = render_backend->create_texture(render_backend, bitmap, atlas_width, atlas_height);
 
     FT_Done_Face(ft_face);
     FT_Done_FreeType(ft_lib);
@@ -144,6 +144,14 @@ Theme_Color theme_name_to_color(char *name) {
         return THEME_COLOR_UI_DEFAULT;
     } else if (strcmp(name, "ui_background") == 0) {
         return THEME_COLOR_UI_BACKGROUND;
+    } else if (strcmp(name, "diff_deleted") == 0) {
+        return THEME_COLOR_DIFF_DELETED;
+    } else if (strcmp(name, "diff_inserted") == 0) {
+        return THEME_COLOR_DIFF_INSERTED;
+    } else if (strcmp(name, "diff_deleted_change") == 0) {
+        return THEME_COLOR_DIFF_DELETED_CHANGE;
+    } else if (strcmp(name, "diff_inserted_change") == 0) {
+        return THEME_COLOR_DIFF_INSERTED_CHANGE;
     } else {
         assert(0);
         return THEME_COLOR_NONE;
@@ -4,6 +4,7 @@
 #include "array.h"
 #include "types.h"
 #include "buffer.h" 
+#include "file_index.h"
 
 enum Theme_Color {
     THEME_COLOR_NONE = -1,
@@ -17,6 +18,11 @@ enum Theme_Color {
     THEME_COLOR_UI_DEFAULT,
     THEME_COLOR_UI_BACKGROUND,
 
+    THEME_COLOR_DIFF_DELETED,
+    THEME_COLOR_DIFF_INSERTED,
+    THEME_COLOR_DIFF_DELETED_CHANGE,
+    THEME_COLOR_DIFF_INSERTED_CHANGE,
+
     THEME_COLOR_MAX,
 };
 
@@ -155,6 +161,9 @@ struct Face {
     void *texture;
 };
 
+struct Line_Filter;
+struct Diff;
+
 struct View {
     Face *face;
     Rect rect;
@@ -165,10 +174,13 @@ struct View {
     bool mark_active;
     Cursor mark;
 
-    int y_off;
+    int64 scroll_row; // first row on screen, a line unless a filter is set
+    int64 estimated_position = -1; // goto_line target past the end of a partial line index
 
     Theme *theme;
     Key_Map *key_map;
+    Line_Filter *filter = nullptr;
+    Diff *diff = nullptr; // shown instead of the buffer, scroll_row is a row of the diff
 };
 
 struct Input {
@@ -186,22 +198,8 @@ enum System_Event_Type {
     SYSTEM_EVENT_TEXT_INPUT,
     SYSTEM_EVENT_MOUSEMOVE,
     SYSTEM_EVENT_MOUSECLICK,
-};
-
-struct System_Event {
-    System_Event_Type type;
-};
-
-struct Window_Resize : System_Event {
-    Window_Resize() { type = SYSTEM_EVENT_WINDOW_RESIZE; }
-    int width;
-    int height;
-};
-
-struct Text_Input : System_Event {
-    Text_Input() { type = SYSTEM_EVENT_TEXT_INPUT; }
-    char *text;
-    int64 count;
+    SYSTEM_EVENT_MOUSEWHEEL,
+    SYSTEM_EVENT_QUIT,
 };
 
 enum Key_Modifiers {
@@ -212,20 +210,52 @@ enum Key_Modifiers {
     KEY_MODIFIER_META = 0x8,
 };
 
-struct Key_Stroke : System_Event {
-    Key_Stroke() { type = SYSTEM_EVENT_KEY_STROKE; }
+struct Key_Stroke {
     Key_Code code;
     Key_Modifiers modifiers;
 };
 
+struct Text_Input {
+    char *text;
+    int64 count;
+};
+
+// Events are copied whole through the input ring, nothing hangs off them. A
+// key stroke carries the text it typed, if any.
+struct System_Event {
+    System_Event_Type type;
+    int64 time; // get_time_microseconds when it arrived
+    Key_Stroke key;
+    char text[4]; // UTF-8
+    int32 text_count;
+    int32 x, y; // mouse position, the size for a resize, the delta in y for the wheel
+};
+
 
 Face *load_font_face(const char *font_name, int font_height);
 
 
+// Fuzzy finds files under the current directory as the query is typed
 struct Find_File_Dialog {
-    char *current_path;
-    Array<char*> files;
+    File_Index *index;
+    Fuzzy_Matcher matcher;
+    Fuzzy_Match matches[FILE_INDEX_MAX_RESULTS];
+    int64 match_count;
+    int64 selected;
+    int64 query_version; // of the query buffer and the index when the matches were found
+    int64 index_version;
+    int64 rest_frames; // since the selection last moved, the selected file is preloaded once it rests
+    View *view;
+    View *last_active;
+    bool is_active;
+};
+
+typedef void (*Prompt_Proc)(String text);
+
+struct Prompt {
+    const char *label;
     View *view;
     View *last_active;
+    Prompt_Proc on_enter;
     bool is_active;
 };
@@ -0,0 +1,1322 @@
+#include "regex.h"
+#include "array.h"
+
+#include <assert.h>
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define REGEX_MAX_PATTERN_LENGTH 4096
+#define REGEX_MAX_PROGRAM_SIZE 20000
+#define REGEX_MAX_REPEAT 1000
+
+// Each DFA keeps at most this many bytes of states before the cache is flushed
+#define REGEX_DFA_MEMORY_BUDGET (2 * 1024 * 1024)
+// Give up on the DFA when it keeps flushing without making progress
+#define REGEX_DFA_MAX_FLUSHES 8
+#define REGEX_DFA_MIN_BYTES_PER_STATE 10
+
+struct Regex_Class {
+    uint32 bits[8];
+};
+
+inline void regex_class_add(Regex_Class *c, uint8 b) {
+    c->bits[b >> 5] |= (1u << (b & 31));
+}
+
+inline bool regex_class_has(Regex_Class *c, uint8 b) {
+    return (c->bits[b >> 5] >> (b & 31)) & 1;
+}
+
+void regex_class_add_range(Regex_Class *c, uint8 lo, uint8 hi) {
+    for (int b = lo; b <= hi; b++) {
+        regex_class_add(c, (uint8)b);
+    }
+}
+
+void regex_class_negate(Regex_Class *c) {
+    for (int i = 0; i < 8; i++) {
+        c->bits[i] = ~c->bits[i];
+    }
+}
+
+void regex_class_fold_case(Regex_Class *c) {
+    for (int b = 'a'; b <= 'z'; b++) {
+        if (regex_class_has(c, (uint8)b) || regex_class_has(c, (uint8)toupper(b))) {
+            regex_class_add(c, (uint8)b);
+            regex_class_add(c, (uint8)toupper(b));
+        }
+    }
+}
+
+enum Regex_Node_Type {
+    REGEX_NODE_EMPTY,
+    REGEX_NODE_CLASS,
+    REGEX_NODE_CONCAT,
+    REGEX_NODE_ALTERNATE,
+    REGEX_NODE_REPEAT,
+    REGEX_NODE_GROUP,
+    REGEX_NODE_BOL,
+    REGEX_NODE_EOL,
+};
+
+struct Regex_Node {
+    Regex_Node_Type type;
+    int32 left;
+    int32 right;
+    int32 class_index;
+    int32 min;
+    int32 max; // -1 is unbounded
+    bool greedy;
+    int32 capture; // -1 is non-capturing
+};
+
+enum Regex_Op {
+    REGEX_OP_CLASS,
+    REGEX_OP_SPLIT,
+    REGEX_OP_JUMP,
+    REGEX_OP_SAVE,
+    REGEX_OP_BOL,
+    REGEX_OP_EOL,
+    REGEX_OP_MATCH,
+};
+
+// CLASS: x is the class index. SPLIT: x is preferred over y. JUMP: x. SAVE: x is the slot.
+// Everything else continues at pc + 1.
+struct Regex_Inst {
+    Regex_Op op;
+    int32 x;
+    int32 y;
+};
+
+struct Regex_Program {
+    Array<Regex_Inst> insts;
+    int32 start;
+    int32 unanchored_start;
+    int32 idle_pc; // only the .*? prefix is running, -1 without a prefix
+};
+
+#define REGEX_DFA_STATE_PREV_NEWLINE 0x1
+#define REGEX_DFA_STATE_MATCH        0x2
+#define REGEX_DFA_STATE_DEAD         0x4
+#define REGEX_DFA_STATE_IDLE         0x8
+
+// The match flag is delayed by one byte: it means a match ended just before the
+// byte that led into this state.
+struct Regex_Dfa_State {
+    Regex_Dfa_State *hash_next;
+    uint64 hash;
+    uint32 flags;
+    int32 inst_count;
+    int32 *insts;
+    Regex_Dfa_State *next[1]; // end_class + 1 transitions, allocated with the state
+};
+
+struct Regex_Sparse_Set {
+    int32 *dense;
+    int32 *sparse;
+    int32 count;
+};
+
+struct Regex_Dfa {
+    Regex *regex;
+    Regex_Program *program;
+    bool longest;
+
+    Regex_Dfa_State **table;
+    int64 table_size;
+    Array<Regex_Dfa_State *> states;
+    int64 memory_used;
+    int64 memory_budget;
+    int flush_count;
+    Regex_Dfa_State *dead;
+
+    Regex_Sparse_Set set;
+    int32 *stack;
+    int32 *list;
+    int32 *seeds;
+};
+
+struct Regex_Pike {
+    Regex_Sparse_Set set;
+    int64 *list_caps;
+    int32 *seed_pcs;
+    int64 *seed_caps;
+    int32 *next_seed_pcs;
+    int64 *next_seed_caps;
+    int64 *scratch;
+    struct Entry {
+        int32 pc; // -1 restores slot to value
+        int32 slot;
+        int64 value;
+    } *stack;
+};
+
+struct Regex {
+    char *pattern;
+    int flags;
+    int capture_count;
+
+    Array<Regex_Class> classes;
+    Regex_Program forward;
+    Regex_Program reverse;
+
+    int32 byte_class[256];
+    uint8 class_rep[257];
+    int32 end_class;
+    int32 newline_class;
+    int32 first_byte; // every match starts with this byte, -1 if unknown
+
+    Regex_Dfa *forward_dfa;
+    Regex_Dfa *reverse_dfa;
+    Regex_Pike *pike;
+};
+
+//
+// Parser
+//
+
+struct Regex_Parser {
+    const char *stream;
+    int flags;
+    Regex *regex;
+    Array<Regex_Node> nodes;
+    int capture_count;
+    const char *error;
+};
+
+int32 regex_push_node(Regex_Parser *p, Regex_Node_Type type, int32 left, int32 right) {
+    Regex_Node node{};
+    node.type = type;
+    node.left = left;
+    node.right = right;
+    node.class_index = -1;
+    node.capture = -1;
+    p->nodes.push(node);
+    return (int32)p->nodes.count - 1;
+}
+
+int32 regex_push_class_node(Regex_Parser *p, Regex_Class c) {
+    if (p->flags & REGEX_FLAG_IGNORE_CASE) {
+        regex_class_fold_case(&c);
+    }
+    p->regex->classes.push(c);
+    int32 node = regex_push_node(p, REGEX_NODE_CLASS, -1, -1);
+    p->nodes[node].class_index = (int32)p->regex->classes.count - 1;
+    return node;
+}
+
+int32 regex_push_literal(Regex_Parser *p, uint8 c) {
+    Regex_Class cls{};
+    regex_class_add(&cls, c);
+    return regex_push_class_node(p, cls);
+}
+
+int hex_digit_value(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+// Parses the escape after a backslash into a class, returns false on error
+bool regex_parse_escape(Regex_Parser *p, Regex_Class *cls) {
+    char c = *p->stream++;
+    switch (c) {
+    case 0:
+        p->stream--;
+        p->error = "trailing backslash";
+        return false;
+    case 'd': case 'D':
+        regex_class_add_range(cls, '0', '9');
+        if (c == 'D') regex_class_negate(cls);
+        break;
+    case 'w': case 'W':
+        regex_class_add_range(cls, 'a', 'z');
+        regex_class_add_range(cls, 'A', 'Z');
+        regex_class_add_range(cls, '0', '9');
+        regex_class_add(cls, '_');
+        if (c == 'W') regex_class_negate(cls);
+        break;
+    case 's': case 'S':
+        regex_class_add(cls, ' ');
+        regex_class_add_range(cls, '\t', '\r');
+        if (c == 'S') regex_class_negate(cls);
+        break;
+    case 'n': regex_class_add(cls, '\n'); break;
+    case 't': regex_class_add(cls, '\t'); break;
+    case 'r': regex_class_add(cls, '\r'); break;
+    case 'f': regex_class_add(cls, '\f'); break;
+    case 'v': regex_class_add(cls, '\v'); break;
+    case '0': regex_class_add(cls, 0); break;
+    case 'x':
+    {
+        int hi = hex_digit_value(p->stream[0]);
+        int lo = hi >= 0 ? hex_digit_value(p->stream[1]) : -1;
+        if (lo < 0) {
+            p->error = "invalid \\x escape";
+            return false;
+        }
+        p->stream += 2;
+        regex_class_add(cls, (uint8)(hi * 16 + lo));
+        break;
+    }
+    case 'b': case 'B':
+        p->error = "word boundaries are not supported";
+        return false;
+    default:
+        regex_class_add(cls, (uint8)c);
+        break;
+    }
+    return true;
+}
+
+int32 regex_parse_class(Regex_Parser *p) {
+    Regex_Class cls{};
+    bool negate = false;
+    if (*p->stream == '^') {
+        negate = true;
+        p->stream++;
+    }
+
+    bool first = true;
+    for (;;) {
+        char c = *p->stream;
+        if (c == 0) {
+            p->error = "missing ]";
+            return -1;
+        }
+        if (c == ']' && !first) {
+            p->stream++;
+            break;
+        }
+        first = false;
+
+        if (c == '\\') {
+            p->stream++;
+            Regex_Class escape{};
+            if (!regex_parse_escape(p, &escape)) return -1;
+            for (int i = 0; i < 8; i++) cls.bits[i] |= escape.bits[i];
+            continue;
+        }
+
+        p->stream++;
+        uint8 lo = (uint8)c;
+        uint8 hi = lo;
+        if (p->stream[0] == '-' && p->stream[1] && p->stream[1] != ']') {
+            hi = (uint8)p->stream[1];
+            p->stream += 2;
+            if (hi < lo) {
+                p->error = "invalid class range";
+                return -1;
+            }
+        }
+        regex_class_add_range(&cls, lo, hi);
+    }
+
+    // Fold before negating so [^a] excludes both cases
+    if (p->flags & REGEX_FLAG_IGNORE_CASE) {
+        regex_class_fold_case(&cls);
+    }
+    if (negate) {
+        regex_class_negate(&cls);
+    }
+    p->regex->classes.push(cls);
+    int32 node = regex_push_node(p, REGEX_NODE_CLASS, -1, -1);
+    p->nodes[node].class_index = (int32)p->regex->classes.count - 1;
+    return node;
+}
+
+int32 regex_parse_alternate(Regex_Parser *p);
+
+int32 regex_parse_atom(Regex_Parser *p) {
+    char c = *p->stream++;
+    switch (c) {
+    case '(':
+    {
+        int32 capture = -1;
+        if (p->stream[0] == '?' && p->stream[1] == ':') {
+            p->stream += 2;
+        } else if (p->capture_count < REGEX_MAX_CAPTURES) {
+            capture = p->capture_count++;
+        }
+        int32 inner = regex_parse_alternate(p);
+        if (inner < 0) return -1;
+        if (*p->stream != ')') {
+            p->error = "missing )";
+            return -1;
+        }
+        p->stream++;
+        int32 node = regex_push_node(p, REGEX_NODE_GROUP, inner, -1);
+        p->nodes[node].capture = capture;
+        return node;
+    }
+    case '[':
+        return regex_parse_class(p);
+    case '.':
+    {
+        Regex_Class cls{};
+        regex_class_add(&cls, '\n');
+        regex_class_negate(&cls);
+        return regex_push_class_node(p, cls);
+    }
+    case '^':
+        return regex_push_node(p, REGEX_NODE_BOL, -1, -1);
+    case '$':
+        return regex_push_node(p, REGEX_NODE_EOL, -1, -1);
+    case '\\':
+    {
+        Regex_Class cls{};
+        if (!regex_parse_escape(p, &cls)) return -1;
+        return regex_push_class_node(p, cls);
+    }
+    case '*': case '+': case '?':
+        p->error = "nothing to repeat";
+        return -1;
+    default:
+        return regex_push_literal(p, (uint8)c);
+    }
+}
+
+// Parses {m}, {m,} or {m,n}. Anything else is left for the caller to treat as a literal brace.
+bool regex_parse_counts(Regex_Parser *p, int32 *min, int32 *max) {
+    const char *s = p->stream + 1;
+    if (!isdigit(*s)) return false;
+    int32 lo = 0;
+    while (isdigit(*s)) {
+        lo = lo * 10 + (*s++ - '0');
+        if (lo > REGEX_MAX_REPEAT) return false;
+    }
+    int32 hi = lo;
+    if (*s == ',') {
+        s++;
+        if (isdigit(*s)) {
+            hi = 0;
+            while (isdigit(*s)) {
+                hi = hi * 10 + (*s++ - '0');
+                if (hi > REGEX_MAX_REPEAT) return false;
+            }
+        } else {
+            hi = -1;
+        }
+    }
+    if (*s != '}') return false;
+    if (hi != -1 && hi < lo) return false;
+    p->stream = s + 1;
+    *min = lo;
+    *max = hi;
+    return true;
+}
+
+int32 regex_parse_repeat(Regex_Parser *p) {
+    int32 atom = regex_parse_atom(p);
+    if (atom < 0) return -1;
+    for (;;) {
+        int32 min, max;
+        switch (*p->stream) {
+        case '*': min = 0; max = -1; p->stream++; break;
+        case '+': min = 1; max = -1; p->stream++; break;
+        case '?': min = 0; max = 1; p->stream++; break;
+        case '{':
+            if (regex_parse_counts(p, &min, &max)) break;
+            return atom;
+        default:
+            return atom;
+        }
+        bool greedy = true;
+        if (*p->stream == '?') {
+            greedy = false;
+            p->stream++;
+        }
+        int32 node = regex_push_node(p, REGEX_NODE_REPEAT, atom, -1);
+        p->nodes[node].min = min;
+        p->nodes[node].max = max;
+        p->nodes[node].greedy = greedy;
+        atom = node;
+    }
+}
+
+int32 regex_parse_concat(Regex_Parser *p) {
+    int32 result = -1;
+    while (*p->stream && *p->stream != '|' && *p->stream != ')') {
+        int32 node = regex_parse_repeat(p);
+        if (node < 0) return -1;
+        result = result < 0 ? node : regex_push_node(p, REGEX_NODE_CONCAT, result, node);
+    }
+    if (result < 0) {
+        result = regex_push_node(p, REGEX_NODE_EMPTY, -1, -1);
+    }
+    return result;
+}
+
+int32 regex_parse_alternate(Regex_Parser *p) {
+    int32 left = regex_parse_concat(p);
+    if (left < 0) return -1;
+    while (*p->stream == '|') {
+        p->stream++;
+        int32 right = regex_parse_concat(p);
+        if (right < 0) return -1;
+        left = regex_push_node(p, REGEX_NODE_ALTERNATE, left, right);
+    }
+    return left;
+}
+
+int32 regex_parse_literal(Regex_Parser *p) {
+    int32 result = -1;
+    while (*p->stream) {
+        int32 node = regex_push_literal(p, (uint8)*p->stream++);
+        result = result < 0 ? node : regex_push_node(p, REGEX_NODE_CONCAT, result, node);
+    }
+    if (result < 0) {
+        result = regex_push_node(p, REGEX_NODE_EMPTY, -1, -1);
+    }
+    return result;
+}
+
+//
+// Compiler
+//
+
+struct Regex_Compiler {
+    Array<Regex_Node> *nodes;
+    Regex_Program *program;
+    bool reverse;
+};
+
+int32 regex_emit(Regex_Compiler *c, Regex_Op op, int32 x, int32 y) {
+    Regex_Inst inst = { op, x, y };
+    c->program->insts.push(inst);
+    return (int32)c->program->insts.count - 1;
+}
+
+int32 regex_pc(Regex_Compiler *c) {
+    return (int32)c->program->insts.count;
+}
+
+bool regex_compile_node(Regex_Compiler *c, int32 index) {
+    if (c->program->insts.count > REGEX_MAX_PROGRAM_SIZE) return false;
+
+    Regex_Node node = (*c->nodes)[index];
+    switch (node.type) {
+    case REGEX_NODE_EMPTY:
+        break;
+    case REGEX_NODE_CLASS:
+        regex_emit(c, REGEX_OP_CLASS, node.class_index, 0);
+        break;
+    case REGEX_NODE_BOL:
+        regex_emit(c, c->reverse ? REGEX_OP_EOL : REGEX_OP_BOL, 0, 0);
+        break;
+    case REGEX_NODE_EOL:
+        regex_emit(c, c->reverse ? REGEX_OP_BOL : REGEX_OP_EOL, 0, 0);
+        break;
+    case REGEX_NODE_CONCAT:
+        if (c->reverse) {
+            if (!regex_compile_node(c, node.right)) return false;
+            if (!regex_compile_node(c, node.left)) return false;
+        } else {
+            if (!regex_compile_node(c, node.left)) return false;
+            if (!regex_compile_node(c, node.right)) return false;
+        }
+        break;
+    case REGEX_NODE_ALTERNATE:
+    {
+        int32 split = regex_emit(c, REGEX_OP_SPLIT, 0, 0);
+        c->program->insts[split].x = regex_pc(c);
+        if (!regex_compile_node(c, node.left)) return false;
+        int32 jump = regex_emit(c, REGEX_OP_JUMP, 0, 0);
+        c->program->insts[split].y = regex_pc(c);
+        if (!regex_compile_node(c, node.right)) return false;
+        c->program->insts[jump].x = regex_pc(c);
+        break;
+    }
+    case REGEX_NODE_GROUP:
+        if (!c->reverse && node.capture >= 0) regex_emit(c, REGEX_OP_SAVE, 2 * node.capture, 0);
+        if (!regex_compile_node(c, node.left)) return false;
+        if (!c->reverse && node.capture >= 0) regex_emit(c, REGEX_OP_SAVE, 2 * node.capture + 1, 0);
+        break;
+    case REGEX_NODE_REPEAT:
+    {
+        for (int32 i = 0; i < node.min; i++) {
+            if (!regex_compile_node(c, node.left)) return false;
+        }
+        if (node.max == -1) {
+            // L0: split L1, L2; L1: e; jump L0; L2:
+            int32 split = regex_emit(c, REGEX_OP_SPLIT, 0, 0);
+            int32 body = regex_pc(c);
+            if (!regex_compile_node(c, node.left)) return false;
+            regex_emit(c, REGEX_OP_JUMP, split, 0);
+            int32 out = regex_pc(c);
+            c->program->insts[split].x = node.greedy ? body : out;
+            c->program->insts[split].y = node.greedy ? out : body;
+        } else {
+            // Each optional copy skips straight to the end: (e(e(e)?)?)?
+            Array<int32> splits;
+            for (int32 i = node.min; i < node.max; i++) {
+                splits.push(regex_emit(c, REGEX_OP_SPLIT, 0, 0));
+                if (!regex_compile_node(c, node.left)) {
+                    splits.clear();
+                    return false;
+                }
+            }
+            int32 out = regex_pc(c);
+            for (size_t i = 0; i < splits.count; i++) {
+                int32 split = splits[i];
+                c->program->insts[split].x = node.greedy ? split + 1 : out;
+                c->program->insts[split].y = node.greedy ? out : split + 1;
+            }
+            splits.clear();
+        }
+        break;
+    }
+    }
+    return c->program->insts.count <= REGEX_MAX_PROGRAM_SIZE;
+}
+
+bool regex_compile_program(Regex_Parser *p, int32 root, Regex_Program *program, bool reverse) {
+    Regex_Compiler c{};
+    c.nodes = &p->nodes;
+    c.program = program;
+    c.reverse = reverse;
+
+    program->unanchored_start = 0;
+    program->idle_pc = -1;
+    if (!reverse) {
+        // Non-greedy .*? prefix so one pass finds the leftmost match
+        regex_emit(&c, REGEX_OP_SPLIT, 3, 1);
+        Regex_Class any;
+        memset(&any, 0xFF, sizeof(any));
+        p->regex->classes.push(any);
+        regex_emit(&c, REGEX_OP_CLASS, (int32)p->regex->classes.count - 1, 0);
+        program->idle_pc = regex_emit(&c, REGEX_OP_JUMP, 0, 0);
+        program->start = regex_pc(&c);
+        regex_emit(&c, REGEX_OP_SAVE, 0, 0);
+    } else {
+        program->start = 0;
+        program->unanchored_start = 0;
+    }
+
+    if (!regex_compile_node(&c, root)) return false;
+
+    if (!reverse) regex_emit(&c, REGEX_OP_SAVE, 1, 0);
+    regex_emit(&c, REGEX_OP_MATCH, 0, 0);
+    return true;
+}
+
+int32 regex_first_byte(Regex_Parser *p, int32 index) {
+    Regex_Node *node = &p->nodes[index];
+    switch (node->type) {
+    case REGEX_NODE_CLASS:
+    {
+        Regex_Class *cls = &p->regex->classes[node->class_index];
+        int32 result = -1;
+        for (int b = 0; b < 256; b++) {
+            if (regex_class_has(cls, (uint8)b)) {
+                if (result >= 0) return -1;
+                result = b;
+            }
+        }
+        return result;
+    }
+    case REGEX_NODE_CONCAT:
+    case REGEX_NODE_GROUP:
+        return regex_first_byte(p, node->left);
+    case REGEX_NODE_REPEAT:
+        return node->min > 0 ? regex_first_byte(p, node->left) : -1;
+    default:
+        return -1;
+    }
+}
+
+// Bytes that no class tells apart share a column in the DFA transition tables
+void regex_compute_byte_classes(Regex *regex) {
+    bool boundary[257] = {};
+    boundary[0] = true;
+    boundary['\n'] = true;
+    boundary['\n' + 1] = true;
+    for (size_t i = 0; i < regex->classes.count; i++) {
+        Regex_Class *cls = &regex->classes[i];
+        for (int b = 1; b < 256; b++) {
+            if (regex_class_has(cls, (uint8)b) != regex_class_has(cls, (uint8)(b - 1))) {
+                boundary[b] = true;
+            }
+        }
+    }
+
+    int32 id = -1;
+    for (int b = 0; b < 256; b++) {
+        if (boundary[b]) {
+            id++;
+            regex->class_rep[id] = (uint8)b;
+        }
+        regex->byte_class[b] = id;
+    }
+    regex->end_class = id + 1;
+    regex->newline_class = regex->byte_class['\n'];
+}
+
+//
+// Lazy DFA
+//
+
+void regex_sparse_set_init(Regex_Sparse_Set *set, int32 size) {
+    set->dense = (int32 *)calloc(size, sizeof(int32));
+    set->sparse = (int32 *)calloc(size, sizeof(int32));
+    set->count = 0;
+}
+
+void regex_sparse_set_free(Regex_Sparse_Set *set) {
+    free(set->dense);
+    free(set->sparse);
+}
+
+inline bool regex_sparse_set_contains(Regex_Sparse_Set *set, int32 value) {
+    int32 index = set->sparse[value];
+    return index < set->count && set->dense[index] == value;
+}
+
+inline void regex_sparse_set_insert(Regex_Sparse_Set *set, int32 value) {
+    set->sparse[value] = set->count;
+    set->dense[set->count++] = value;
+}
+
+Regex_Dfa_State *regex_dfa_alloc_state(Regex_Dfa *dfa, int32 inst_count) {
+    int64 next_count = dfa->regex->end_class + 1;
+    int64 size = sizeof(Regex_Dfa_State) + (next_count - 1) * sizeof(Regex_Dfa_State *) + inst_count * sizeof(int32);
+    Regex_Dfa_State *state = (Regex_Dfa_State *)calloc(1, size);
+    state->insts = (int32 *)(state->next + next_count);
+    state->inst_count = inst_count;
+    dfa->memory_used += size;
+    return state;
+}
+
+Regex_Dfa *regex_dfa_create(Regex *regex, Regex_Program *program, bool longest) {
+    Regex_Dfa *dfa = new Regex_Dfa();
+    dfa->regex = regex;
+    dfa->program = program;
+    dfa->longest = longest;
+    dfa->memory_budget = REGEX_DFA_MEMORY_BUDGET;
+    dfa->table_size = 1024;
+    dfa->table = (Regex_Dfa_State **)calloc(dfa->table_size, sizeof(Regex_Dfa_State *));
+
+    int32 inst_count = (int32)program->insts.count;
+    regex_sparse_set_init(&dfa->set, inst_count);
+    dfa->stack = (int32 *)malloc((3 * inst_count + 1) * sizeof(int32));
+    dfa->list = (int32 *)malloc(inst_count * sizeof(int32));
+    dfa->seeds = (int32 *)malloc(inst_count * sizeof(int32));
+
+    dfa->dead = regex_dfa_alloc_state(dfa, 0);
+    dfa->dead->flags = REGEX_DFA_STATE_DEAD;
+    for (int32 i = 0; i <= regex->end_class; i++) {
+        dfa->dead->next[i] = dfa->dead;
+    }
+    dfa->memory_used = 0;
+    return dfa;
+}
+
+void regex_dfa_flush(Regex_Dfa *dfa) {
+    for (size_t i = 0; i < dfa->states.count; i++) {
+        free(dfa->states[i]);
+    }
+    dfa->states.reset_count();
+    memset(dfa->table, 0, dfa->table_size * sizeof(Regex_Dfa_State *));
+    dfa->memory_used = 0;
+    dfa->flush_count++;
+}
+
+void regex_dfa_free(Regex_Dfa *dfa) {
+    if (!dfa) return;
+    regex_dfa_flush(dfa);
+    dfa->states.clear();
+    free(dfa->table);
+    free(dfa->dead);
+    regex_sparse_set_free(&dfa->set);
+    free(dfa->stack);
+    free(dfa->list);
+    free(dfa->seeds);
+    delete dfa;
+}
+
+uint64 regex_dfa_hash(int32 *insts, int32 count, uint32 flags) {
+    uint64 hash = 14695981039346656037ull ^ flags;
+    for (int32 i = 0; i < count; i++) {
+        hash = (hash ^ (uint32)insts[i]) * 1099511628211ull;
+    }
+    return hash;
+}
+
+void regex_dfa_grow_table(Regex_Dfa *dfa) {
+    int64 new_size = dfa->table_size * 2;
+    Regex_Dfa_State **table = (Regex_Dfa_State **)calloc(new_size, sizeof(Regex_Dfa_State *));
+    for (size_t i = 0; i < dfa->states.count; i++) {
+        Regex_Dfa_State *state = dfa->states[i];
+        int64 slot = state->hash & (new_size - 1);
+        state->hash_next = table[slot];
+        table[slot] = state;
+    }
+    free(dfa->table);
+    dfa->table = table;
+    dfa->table_size = new_size;
+}
+
+Regex_Dfa_State *regex_dfa_intern(Regex_Dfa *dfa, int32 *insts, int32 count, uint32 flags) {
+    if (count == 1 && insts[0] == dfa->program->idle_pc) {
+        flags |= REGEX_DFA_STATE_IDLE;
+    }
+
+    uint64 hash = regex_dfa_hash(insts, count, flags);
+    int64 slot = hash & (dfa->table_size - 1);
+    for (Regex_Dfa_State *state = dfa->table[slot]; state; state = state->hash_next) {
+        if (state->hash == hash && state->flags == flags && state->inst_count == count &&
+            memcmp(state->insts, insts, count * sizeof(int32)) == 0) {
+            return state;
+        }
+    }
+
+    if (dfa->memory_used > dfa->memory_budget) {
+        regex_dfa_flush(dfa);
+        slot = hash & (dfa->table_size - 1);
+    }
+    if ((int64)dfa->states.count >= dfa->table_size) {
+        regex_dfa_grow_table(dfa);
+        slot = hash & (dfa->table_size - 1);
+    }
+
+    Regex_Dfa_State *state = regex_dfa_alloc_state(dfa, count);
+    memcpy(state->insts, insts, count * sizeof(int32));
+    state->flags = flags;
+    state->hash = hash;
+    state->hash_next = dfa->table[slot];
+    dfa->table[slot] = state;
+    dfa->states.push(state);
+    return state;
+}
+
+// Follows empty transitions from the seeds in priority order, leaving the class
+// instructions in dfa->list. Leftmost-first drops everything below a match.
+int32 regex_dfa_closure(Regex_Dfa *dfa, int32 *seeds, int32 seed_count, bool bol, bool eol, bool *matched) {
+    Regex_Inst *insts = dfa->program->insts.data;
+    int32 top = 0;
+    int32 count = 0;
+    dfa->set.count = 0;
+    *matched = false;
+
+    for (int32 i = seed_count - 1; i >= 0; i--) {
+        dfa->stack[top++] = seeds[i];
+    }
+
+    while (top > 0) {
+        int32 pc = dfa->stack[--top];
+        if (regex_sparse_set_contains(&dfa->set, pc)) continue;
+        regex_sparse_set_insert(&dfa->set, pc);
+
+        Regex_Inst *inst = &insts[pc];
+        switch (inst->op) {
+        case REGEX_OP_CLASS:
+            dfa->list[count++] = pc;
+            break;
+        case REGEX_OP_SPLIT:
+            dfa->stack[top++] = inst->y;
+            dfa->stack[top++] = inst->x;
+            break;
+        case REGEX_OP_JUMP:
+            dfa->stack[top++] = inst->x;
+            break;
+        case REGEX_OP_SAVE:
+            dfa->stack[top++] = pc + 1;
+            break;
+        case REGEX_OP_BOL:
+            if (bol) dfa->stack[top++] = pc + 1;
+            break;
+        case REGEX_OP_EOL:
+            if (eol) dfa->stack[top++] = pc + 1;
+            break;
+        case REGEX_OP_MATCH:
+            *matched = true;
+            if (!dfa->longest) return count;
+            break;
+        }
+    }
+    return count;
+}
+
+Regex_Dfa_State *regex_dfa_next_state(Regex_Dfa *dfa, Regex_Dfa_State *state, int32 byte_class) {
+    Regex *regex = dfa->regex;
+    bool end = byte_class == regex->end_class;
+    bool newline = byte_class == regex->newline_class;
+    bool bol = (state->flags & REGEX_DFA_STATE_PREV_NEWLINE) != 0;
+
+    bool matched;
+    int32 count = regex_dfa_closure(dfa, state->insts, state->inst_count, bol, end || newline, &matched);
+
+    int32 seed_count = 0;
+    if (!end) {
+        uint8 c = regex->class_rep[byte_class];
+        Regex_Inst *insts = dfa->program->insts.data;
+        for (int32 i = 0; i < count; i++) {
+            int32 pc = dfa->list[i];
+            if (regex_class_has(&regex->classes[insts[pc].x], c)) {
+                dfa->seeds[seed_count++] = pc + 1;
+            }
+        }
+    }
+
+    uint32 flags = (newline ? REGEX_DFA_STATE_PREV_NEWLINE : 0) | (matched ? REGEX_DFA_STATE_MATCH : 0);
+    Regex_Dfa_State *next = dfa->dead;
+    if (seed_count > 0 || matched) {
+        int flush_count = dfa->flush_count;
+        next = regex_dfa_intern(dfa, dfa->seeds, seed_count, flags);
+        // A flush freed the current state, the transition can't be cached on it
+        if (flush_count != dfa->flush_count) return next;
+    }
+    state->next[byte_class] = next;
+    return next;
+}
+
+Regex_Dfa_State *regex_dfa_start_state(Regex_Dfa *dfa, bool prev_newline) {
+    int32 start = dfa->program->unanchored_start;
+    return regex_dfa_intern(dfa, &start, 1, prev_newline ? REGEX_DFA_STATE_PREV_NEWLINE : 0);
+}
+
+enum Regex_Dfa_Result {
+    REGEX_DFA_NO_MATCH,
+    REGEX_DFA_MATCH,
+    REGEX_DFA_FAILED,
+};
+
+uint8 regex_input_byte(Regex_Input *input, int64 position) {
+    for (int i = 0; i < input->chunk_count; i++) {
+        Buffer_Chunk *chunk = &input->chunks[i];
+        if (position >= chunk->position && position < chunk->position + chunk->count) {
+            return (uint8)chunk->data[position - chunk->position];
+        }
+    }
+    return 0;
+}
+
+// Class of the byte at position, or the end class past the end of the text
+int32 regex_input_class(Regex *regex, Regex_Input *input, int64 position) {
+    if (position < 0 || position >= input->length) return regex->end_class;
+    return regex->byte_class[regex_input_byte(input, position)];
+}
+
+bool regex_dfa_should_fail(Regex_Dfa *dfa, int flushes, int64 scanned) {
+    if (flushes < REGEX_DFA_MAX_FLUSHES) return false;
+    int64 states_per_flush = dfa->memory_budget / (int64)(sizeof(Regex_Dfa_State) + dfa->regex->end_class * sizeof(void *));
+    return scanned < flushes * states_per_flush * REGEX_DFA_MIN_BYTES_PER_STATE;
+}
+
+Regex_Dfa_Result regex_dfa_search_forward(Regex_Dfa *dfa, Regex_Input *input, bool earliest, int64 *out_end) {
+    Regex *regex = dfa->regex;
+    int32 *byte_class = regex->byte_class;
+    int64 start = input->start;
+    bool prev_newline = start == 0 || regex_input_byte(input, start - 1) == '\n';
+    int flush_start = dfa->flush_count;
+    Regex_Dfa_State *state = regex_dfa_start_state(dfa, prev_newline);
+    Regex_Dfa_State *dead = dfa->dead;
+    int64 last_end = -1;
+    int32 first_byte = regex->first_byte;
+    uint32 special = REGEX_DFA_STATE_MATCH | REGEX_DFA_STATE_DEAD | (first_byte >= 0 ? REGEX_DFA_STATE_IDLE : 0);
+
+    for (int i = 0; i < input->chunk_count; i++) {
+        Buffer_Chunk *chunk = &input->chunks[i];
+        int64 chunk_end = chunk->position + chunk->count;
+        int64 lo = start > chunk->position ? start : chunk->position;
+        int64 hi = input->end < chunk_end ? input->end : chunk_end;
+        if (lo >= hi) continue;
+
+        uint8 *base = (uint8 *)chunk->data - chunk->position;
+        uint8 *p = base + lo;
+        uint8 *e = base + hi;
+        for (; p < e; p++) {
+            int32 k = byte_class[*p];
+            Regex_Dfa_State *next = state->next[k];
+            if (!next) {
+                int flushes = dfa->flush_count;
+                next = regex_dfa_next_state(dfa, state, k);
+                if (flushes != dfa->flush_count &&
+                    regex_dfa_should_fail(dfa, dfa->flush_count - flush_start, (p - base) - start)) {
+                    return REGEX_DFA_FAILED;
+                }
+            }
+            state = next;
+            if (state->flags & special) {
+                if (state == dead) goto done;
+                if (state->flags & REGEX_DFA_STATE_IDLE) {
+                    // Nothing can start before the next first byte
+                    uint8 *q = (uint8 *)memchr(p + 1, first_byte, e - (p + 1));
+                    p = (q ? q : e) - 1;
+                    continue;
+                }
+                last_end = p - base;
+                if (earliest) {
+                    *out_end = last_end;
+                    return REGEX_DFA_MATCH;
+                }
+            }
+        }
+    }
+
+    // The byte after the range decides $ for a match ending right at the end
+    {
+        int32 k = regex_input_class(regex, input, input->end);
+        Regex_Dfa_State *next = state->next[k];
+        if (!next) next = regex_dfa_next_state(dfa, state, k);
+        if (next->flags & REGEX_DFA_STATE_MATCH) {
+            last_end = input->end;
+        }
+    }
+
+done:
+    if (last_end < 0) return REGEX_DFA_NO_MATCH;
+    *out_end = last_end;
+    return REGEX_DFA_MATCH;
+}
+
+// Walks the reversed program back from end to find the leftmost start of a match ending there
+Regex_Dfa_Result regex_dfa_search_reverse(Regex_Dfa *dfa, Regex_Input *input, int64 end, int64 *out_start) {
+    Regex *regex = dfa->regex;
+    int32 *byte_class = regex->byte_class;
+    int64 start = input->start;
+    bool prev_newline = end >= input->length || regex_input_byte(input, end) == '\n';
+    int flush_start = dfa->flush_count;
+    Regex_Dfa_State *state = regex_dfa_start_state(dfa, prev_newline);
+    Regex_Dfa_State *dead = dfa->dead;
+    int64 best = -1;
+
+    for (int i = input->chunk_count - 1; i >= 0; i--) {
+        Buffer_Chunk *chunk = &input->chunks[i];
+        int64 chunk_end = chunk->position + chunk->count;
+        int64 lo = start > chunk->position ? start : chunk->position;
+        int64 hi = end < chunk_end ? end : chunk_end;
+        if (lo >= hi) continue;
+
+        uint8 *base = (uint8 *)chunk->data - chunk->position;
+        uint8 *p = base + hi;
+        uint8 *e = base + lo;
+        while (p > e) {
+            p--;
+            int32 k = byte_class[*p];
+            Regex_Dfa_State *next = state->next[k];
+            if (!next) {
+                int flushes = dfa->flush_count;
+                next = regex_dfa_next_state(dfa, state, k);
+                if (flushes != dfa->flush_count &&
+                    regex_dfa_should_fail(dfa, dfa->flush_count - flush_start, end - (p - base))) {
+                    return REGEX_DFA_FAILED;
+                }
+            }
+            state = next;
+            if (state->flags & (REGEX_DFA_STATE_MATCH | REGEX_DFA_STATE_DEAD)) {
+                if (state == dead) goto done;
+                best = (p - base) + 1;
+            }
+        }
+    }
+
+    {
+        int32 k = regex_input_class(regex, input, start - 1);
+        Regex_Dfa_State *next = state->next[k];
+        if (!next) next = regex_dfa_next_state(dfa, state, k);
+        if (next->flags & REGEX_DFA_STATE_MATCH) {
+            best = start;
+        }
+    }
+
+done:
+    if (best < 0) return REGEX_DFA_NO_MATCH;
+    *out_start = best;
+    return REGEX_DFA_MATCH;
+}
+
+//
+// Pike VM
+//
+
+Regex_Pike *regex_pike_create(Regex *regex) {
+    int32 inst_count = (int32)regex->forward.insts.count;
+    int32 cap_count = 2 * regex->capture_count;
+    Regex_Pike *pike = new Regex_Pike();
+    regex_sparse_set_init(&pike->set, inst_count);
+    pike->list_caps = (int64 *)malloc(inst_count * cap_count * sizeof(int64));
+    pike->seed_pcs = (int32 *)malloc(inst_count * sizeof(int32));
+    pike->seed_caps = (int64 *)malloc(inst_count * cap_count * sizeof(int64));
+    pike->next_seed_pcs = (int32 *)malloc(inst_count * sizeof(int32));
+    pike->next_seed_caps = (int64 *)malloc(inst_count * cap_count * sizeof(int64));
+    pike->scratch = (int64 *)malloc(cap_count * sizeof(int64));
+    pike->stack = (Regex_Pike::Entry *)malloc((3 * inst_count + 1) * sizeof(Regex_Pike::Entry));
+    return pike;
+}
+
+void regex_pike_free(Regex_Pike *pike) {
+    if (!pike) return;
+    regex_sparse_set_free(&pike->set);
+    free(pike->list_caps);
+    free(pike->seed_pcs);
+    free(pike->seed_caps);
+    free(pike->next_seed_pcs);
+    free(pike->next_seed_caps);
+    free(pike->scratch);
+    free(pike->stack);
+    delete pike;
+}
+
+void regex_pike_add(Regex *regex, Regex_Pike *pike, int32 start_pc, int64 position, bool bol, bool eol) {
+    Regex_Inst *insts = regex->forward.insts.data;
+    int32 cap_count = 2 * regex->capture_count;
+    int32 top = 0;
+    pike->stack[top++] = { start_pc, 0, 0 };
+
+    while (top > 0) {
+        Regex_Pike::Entry entry = pike->stack[--top];
+        if (entry.pc < 0) {
+            pike->scratch[entry.slot] = entry.value;
+            continue;
+        }
+
+        int32 pc = entry.pc;
+        if (regex_sparse_set_contains(&pike->set, pc)) continue;
+        regex_sparse_set_insert(&pike->set, pc);
+
+        Regex_Inst *inst = &insts[pc];
+        switch (inst->op) {
+        case REGEX_OP_CLASS:
+        case REGEX_OP_MATCH:
+            memcpy(pike->list_caps + pc * cap_count, pike->scratch, cap_count * sizeof(int64));
+            break;
+        case REGEX_OP_SPLIT:
+            pike->stack[top++] = { inst->y, 0, 0 };
+            pike->stack[top++] = { inst->x, 0, 0 };
+            break;
+        case REGEX_OP_JUMP:
+            pike->stack[top++] = { inst->x, 0, 0 };
+            break;
+        case REGEX_OP_SAVE:
+            if (inst->x < cap_count) {
+                pike->stack[top++] = { -1, inst->x, pike->scratch[inst->x] };
+                pike->scratch[inst->x] = position;
+            }
+            pike->stack[top++] = { pc + 1, 0, 0 };
+            break;
+        case REGEX_OP_BOL:
+            if (bol) pike->stack[top++] = { pc + 1, 0, 0 };
+            break;
+        case REGEX_OP_EOL:
+            if (eol) pike->stack[top++] = { pc + 1, 0, 0 };
+            break;
+        }
+    }
+}
+
+// Leftmost-first search that tracks captures, O(input * program)
+bool regex_pike_search(Regex *regex, Regex_Input *input, bool anchored, Regex_Match *match) {
+    if (!regex->pike) regex->pike = regex_pike_create(regex);
+    Regex_Pike *pike = regex->pike;
+    Regex_Inst *insts = regex->forward.insts.data;
+    int32 cap_count = 2 * regex->capture_count;
+    bool matched = false;
+
+    int32 seed_count = 1;
+    pike->seed_pcs[0] = anchored ? regex->forward.start : regex->forward.unanchored_start;
+    for (int32 i = 0; i < cap_count; i++) pike->seed_caps[i] = -1;
+
+    for (int64 position = input->start; ; position++) {
+        bool at_end = position >= input->end;
+        bool bol = position == 0 || regex_input_byte(input, position - 1) == '\n';
+        bool eol = position >= input->length || regex_input_byte(input, position) == '\n';
+        uint8 c = at_end ? 0 : regex_input_byte(input, position);
+
+        pike->set.count = 0;
+        for (int32 i = 0; i < seed_count; i++) {
+            memcpy(pike->scratch, pike->seed_caps + i * cap_count, cap_count * sizeof(int64));
+            regex_pike_add(regex, pike, pike->seed_pcs[i], position, bol, eol);
+        }
+
+        int32 next_count = 0;
+        for (int32 i = 0; i < pike->set.count; i++) {
+            int32 pc = pike->set.dense[i];
+            Regex_Inst *inst = &insts[pc];
+            int64 *caps = pike->list_caps + pc * cap_count;
+            if (inst->op == REGEX_OP_MATCH) {
+                matched = true;
+                match->capture_count = regex->capture_count;
+                for (int32 k = 0; k < regex->capture_count; k++) {
+                    match->captures[k] = { caps[2 * k], caps[2 * k + 1] };
+                }
+                match->span = match->captures[0];
+                break;
+            }
+            if (inst->op != REGEX_OP_CLASS) continue;
+            if (!at_end && regex_class_has(&regex->classes[inst->x], c)) {
+                pike->next_seed_pcs[next_count] = pc + 1;
+                memcpy(pike->next_seed_caps + next_count * cap_count, caps, cap_count * sizeof(int64));
+                next_count++;
+            }
+        }
+
+        if (at_end || next_count == 0) break;
+
+        int32 *pcs = pike->seed_pcs;
+        pike->seed_pcs = pike->next_seed_pcs;
+        pike->next_seed_pcs = pcs;
+        int64 *caps = pike->seed_caps;
+        pike->seed_caps = pike->next_seed_caps;
+        pike->next_seed_caps = caps;
+        seed_count = next_count;
+    }
+    return matched;
+}
+
+//
+// Interface
+//
+
+Regex *regex_compile(const char *pattern, int flags, const char **error) {
+    if (error) *error = nullptr;
+    if (strlen(pattern) > REGEX_MAX_PATTERN_LENGTH) {
+        if (error) *error = "pattern too long";
+        return nullptr;
+    }
+
+    Regex *regex = new Regex();
+    Regex_Parser parser{};
+    parser.stream = pattern;
+    parser.flags = flags;
+    parser.regex = regex;
+    parser.capture_count = 1;
+
+    int32 root;
+    if (flags & REGEX_FLAG_LITERAL) {
+        root = regex_parse_literal(&parser);
+    } else {
+        root = regex_parse_alternate(&parser);
+        if (root >= 0 && *parser.stream == ')') {
+            parser.error = "unmatched )";
+            root = -1;
+        }
+    }
+
+    if (root >= 0) {
+        regex->capture_count = parser.capture_count;
+        regex->first_byte = regex_first_byte(&parser, root);
+        if (!regex_compile_program(&parser, root, &regex->forward, false) ||
+            !regex_compile_program(&parser, root, &regex->reverse, true)) {
+            parser.error = "pattern too large";
+            root = -1;
+        }
+    }
+    parser.nodes.clear();
+
+    if (root < 0) {
+        if (error) *error = parser.error;
+        regex->forward.insts.clear();
+        regex->reverse.insts.clear();
+        regex->classes.clear();
+        delete regex;
+        return nullptr;
+    }
+
+    regex_compute_byte_classes(regex);
+    regex->pattern = string_copy(pattern).data;
+    regex->flags = flags;
+    regex->forward_dfa = regex_dfa_create(regex, &regex->forward, false);
+    regex->reverse_dfa = regex_dfa_create(regex, &regex->reverse, true);
+    return regex;
+}
+
+// The DFA caches are not shared, each searching thread wants its own copy
+Regex *regex_copy(Regex *regex) {
+    return regex_compile(regex->pattern, regex->flags, nullptr);
+}
+
+void regex_free(Regex *regex) {
+    if (!regex) return;
+    regex_dfa_free(regex->forward_dfa);
+    regex_dfa_free(regex->reverse_dfa);
+    regex_pike_free(regex->pike);
+    regex->forward.insts.clear();
+    regex->reverse.insts.clear();
+    regex->classes.clear();
+    free(regex->pattern);
+    delete regex;
+}
+
+int regex_capture_count(Regex *regex) {
+    return regex->capture_count;
+}
+
+Regex_Input regex_input_from_buffer(Buffer *buffer, int64 start, int64 end) {
+    Regex_Input input{};
+    input.chunk_count = buffer_get_chunks(buffer, input.chunks);
+    input.length = buffer_get_length(buffer);
+    input.start = start;
+    input.end = end;
+    return input;
+}
+
+Regex_Input regex_input_from_text(char *text, int64 count) {
+    Regex_Input input{};
+    if (count > 0) {
+        input.chunks[0] = { text, count, 0 };
+        input.chunk_count = 1;
+    }
+    input.length = count;
+    input.start = 0;
+    input.end = count;
+    return input;
+}
+
+bool regex_search_input(Regex *regex, Regex_Input *input, Regex_Match *match) {
+    Regex_Match result{};
+    int64 end = 0;
+    Regex_Dfa_Result found = regex_dfa_search_forward(regex->forward_dfa, input, false, &end);
+    if (found == REGEX_DFA_NO_MATCH) return false;
+
+    int64 start = 0;
+    if (found == REGEX_DFA_MATCH) {
+        Regex_Input reverse = *input;
+        found = regex_dfa_search_reverse(regex->reverse_dfa, &reverse, end, &start);
+        assert(found != REGEX_DFA_NO_MATCH);
+    }
+
+    if (found == REGEX_DFA_FAILED) {
+        if (!regex_pike_search(regex, input, false, &result)) return false;
+    } else if (regex->capture_count > 1) {
+        Regex_Input anchored = *input;
+        anchored.start = start;
+        bool ok = regex_pike_search(regex, &anchored, true, &result);
+        assert(ok && result.span.end == end);
+    } else {
+        result.span = { start, end };
+        result.captures[0] = result.span;
+        result.capture_count = 1;
+    }
+
+    if (match) *match = result;
+    return true;
+}
+
+bool regex_contains_input(Regex *regex, Regex_Input *input) {
+    int64 end;
+    Regex_Dfa_Result found = regex_dfa_search_forward(regex->forward_dfa, input, true, &end);
+    if (found == REGEX_DFA_FAILED) {
+        Regex_Match match;
+        return regex_pike_search(regex, input, false, &match);
+    }
+    return found == REGEX_DFA_MATCH;
+}
+
+bool regex_search(Regex *regex, Buffer *buffer, int64 start, int64 end, Regex_Match *match) {
+    Regex_Input input = regex_input_from_buffer(buffer, start, end);
+    return regex_search_input(regex, &input, match);
+}
+
+bool regex_search_text(Regex *regex, char *text, int64 count, int64 start, Regex_Match *match) {
+    Regex_Input input = regex_input_from_text(text, count);
+    input.start = start;
+    return regex_search_input(regex, &input, match);
+}
+
+bool regex_contains_text(Regex *regex, char *text, int64 count) {
+    Regex_Input input = regex_input_from_text(text, count);
+    return regex_contains_input(regex, &input);
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include "types.h"
+#include "buffer.h"
+
+// Thompson NFA compiled lazily into a DFA. The DFA finds the end of the leftmost-first
+// match and a reversed DFA walks back to its start. Captures and pathological
+// patterns that thrash the DFA state cache fall back to a pike VM. Every engine is
+// linear in the input.
+
+enum Regex_Flags {
+    REGEX_FLAG_NONE = 0x0,
+    REGEX_FLAG_IGNORE_CASE = 0x1,
+    REGEX_FLAG_LITERAL = 0x2,
+};
+
+#define REGEX_MAX_CAPTURES 10
+
+struct Regex;
+
+struct Regex_Match {
+    Span span;
+    Span captures[REGEX_MAX_CAPTURES];
+    int capture_count;
+};
+
+// Text is read through at most two chunks, so a gap buffer is searched in place.
+// Chunks cover [0, length); searches are limited to [start, end) but assertions
+// look at the bytes around the range.
+struct Regex_Input {
+    Buffer_Chunk chunks[2];
+    int chunk_count;
+    int64 length;
+    int64 start;
+    int64 end;
+};
+
+Regex *regex_compile(const char *pattern, int flags, const char **error);
+Regex *regex_copy(Regex *regex);
+void regex_free(Regex *regex);
+int regex_capture_count(Regex *regex);
+
+Regex_Input regex_input_from_buffer(Buffer *buffer, int64 start, int64 end);
+Regex_Input regex_input_from_text(char *text, int64 count);
+
+bool regex_search_input(Regex *regex, Regex_Input *input, Regex_Match *match);
+bool regex_contains_input(Regex *regex, Regex_Input *input);
+
+bool regex_search(Regex *regex, Buffer *buffer, int64 start, int64 end, Regex_Match *match);
+bool regex_search_text(Regex *regex, char *text, int64 count, int64 start, Regex_Match *match);
+bool regex_contains_text(Regex *regex, char *text, int64 count);
@@ -0,0 +1,104 @@
+#include "registry.h"
+#include "journal.h"
+#include "compress.h"
+#include "path.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+bool registry_path_equal(const char *a, const char *b) {
+#ifdef _WIN32
+    // NTFS names don't care about case
+    return _stricmp(a, b) == 0;
+#else
+    return strcmp(a, b) == 0;
+#endif
+}
+
+// Relative names are taken from the current directory, so a file has one path however it was named
+char *registry_path(const char *file_name) {
+    if (path_is_absolute(file_name)) return path_normalize((char *)file_name);
+    char path[PATH_MAX_LENGTH];
+    int64 len = path_current_dir_into(path, sizeof(path));
+    String dir = { path, len };
+    if (len >= 0) len = path_join_into(path, sizeof(path), dir, STRZ((char *)file_name));
+    // Too long to open anyway
+    if (len < 0) return path_normalize((char *)file_name);
+    String joined = { path, len };
+    path_normalize_into(path, sizeof(path), joined);
+    return string_copy(path).data;
+}
+
+Registry_Entry *registry_find(Buffer_Registry *registry, const char *path) {
+    for (size_t i = 0; i < registry->entries.count; i++) {
+        if (registry_path_equal(registry->entries[i].path, path)) return &registry->entries[i];
+    }
+    return nullptr;
+}
+
+Registry_Entry *registry_add(Buffer_Registry *registry, const char *path) {
+    Registry_Entry entry{};
+    size_t length = strlen(path);
+    entry.path = (char *)malloc(length + 1);
+    memcpy(entry.path, path, length + 1);
+    return registry->entries.push(entry);
+}
+
+void registry_shown(Buffer_Registry *registry, Registry_Entry *entry) {
+    entry->last_shown = ++registry->clock;
+    entry->shown_frame = registry->frame;
+}
+
+int64 registry_memory_size(Buffer_Registry *registry) {
+    int64 result = 0;
+    for (size_t i = 0; i < registry->entries.count; i++) {
+        if (registry->entries[i].buffer) result += buffer_memory_size(registry->entries[i].buffer);
+    }
+    return result;
+}
+
+// Frees the buffers shown least recently until the rest fit the budget. Only
+// buffers that match their file go, never one that's busy, still indexing or
+// held by a job. Returns how many were freed.
+int64 registry_evict(Buffer_Registry *registry, Buffer_Busy_Proc busy, void *data) {
+    int64 total = registry_memory_size(registry);
+    int64 evicted = 0;
+    while (total > registry->budget) {
+        Registry_Entry *oldest = nullptr;
+        for (size_t i = 0; i < registry->entries.count; i++) {
+            Registry_Entry *entry = &registry->entries[i];
+            Buffer *buffer = entry->buffer;
+            if (!buffer || buffer->version != buffer->saved_version || buffer->indexer || buffer->jobs > 0 || busy(buffer, data)) continue;
+            if (!oldest || entry->last_shown < oldest->last_shown) oldest = entry;
+        }
+        if (!oldest) break;
+
+        total -= buffer_memory_size(oldest->buffer);
+        journal_close(oldest->buffer->journal);
+        buffer_free(oldest->buffer);
+        oldest->buffer = nullptr;
+        evicted++;
+    }
+    return evicted;
+}
+
+// Called every frame. Buffers that haven't been shown or busy for a while
+// have their text compressed, which a job does without holding up the frame.
+void registry_update(Buffer_Registry *registry, Buffer_Busy_Proc busy, void *data) {
+    registry->frame++;
+    for (size_t i = 0; i < registry->entries.count; i++) {
+        Registry_Entry *entry = &registry->entries[i];
+        Buffer *buffer = entry->buffer;
+        if (!buffer) continue;
+        buffer_compress_update(buffer);
+        if (busy(buffer, data)) {
+            entry->shown_frame = registry->frame;
+            if (buffer->compressed || buffer->compression) buffer_decompress(buffer);
+            continue;
+        }
+        if (registry->frame - entry->shown_frame < REGISTRY_IDLE_FRAMES) continue;
+        if (buffer->compressed || buffer->compression || buffer->indexer || buffer->jobs > 0) continue;
+        buffer_compress(buffer);
+    }
+}
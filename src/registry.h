@@ -0,0 +1,39 @@
+#pragma once
+
+#include "types.h"
+#include "array.h"
+#include "buffer.h"
+
+// Every buffer read from a file, one per normalized path, so opening a file
+// that's already open shows the buffer it has. Loaded buffers are kept under
+// a memory budget: past it the unmodified ones shown least recently are freed
+// and read from their file again when they're next shown.
+#define REGISTRY_DEFAULT_BUDGET (1024LL * 1024 * 1024)
+
+// Frames a loaded buffer goes unshown before its text is compressed, half a minute at 60 fps
+#define REGISTRY_IDLE_FRAMES (30 * 60)
+
+typedef bool (*Buffer_Busy_Proc)(Buffer *buffer, void *data);
+
+struct Registry_Entry {
+    char *path; // normalized, the buffer's file_name
+    Buffer *buffer; // nullptr until read and after being evicted
+    int64 last_shown;
+    int64 shown_frame; // last frame the buffer was shown or busy
+};
+
+struct Buffer_Registry {
+    Array<Registry_Entry> entries;
+    int64 budget = REGISTRY_DEFAULT_BUDGET;
+    int64 clock = 0;
+    int64 frame = 0;
+};
+
+char *registry_path(const char *file_name);
+bool registry_path_equal(const char *a, const char *b);
+Registry_Entry *registry_find(Buffer_Registry *registry, const char *path);
+Registry_Entry *registry_add(Buffer_Registry *registry, const char *path);
+void registry_shown(Buffer_Registry *registry, Registry_Entry *entry);
+int64 registry_memory_size(Buffer_Registry *registry);
+int64 registry_evict(Buffer_Registry *registry, Buffer_Busy_Proc busy, void *data);
+void registry_update(Buffer_Registry *registry, Buffer_Busy_Proc busy, void *data);
@@ -0,0 +1,315 @@
+#include "reload.h"
+#include "platform.h"
+#include "simple_math.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#include <emmintrin.h>
+#define RELOAD_SSE2 1
+#endif
+
+// A chunk ends where the rolling hash has its low 12 bits clear, so chunks
+// are 4 KB on average and the cut points only depend on the last 64 bytes
+#define RELOAD_CHUNK_MASK ((1 << 12) - 1)
+#define RELOAD_MIN_CHUNK 512
+#define RELOAD_MAX_CHUNK (64 * 1024)
+// How many same hash chunks before the current one are skipped looking for a match
+#define RELOAD_MAX_PROBES 64
+
+#define RELOAD_PRIME1 0x9E3779B185EBCA87ULL
+#define RELOAD_PRIME2 0xC2B2AE3D27D4EB4FULL
+
+struct Reload_Chunk {
+    int64 start;
+    int64 count;
+    uint64 hash;
+};
+
+struct Reload_Slot {
+    uint64 hash;
+    int64 first; // old chunk, -1 if the slot is empty
+};
+
+static uint64 reload_gear[256];
+
+static void reload_init_gear() {
+    static bool initialized;
+    if (initialized) return;
+    uint64 state = RELOAD_PRIME1;
+    for (int i = 0; i < 256; i++) {
+        // splitmix64
+        state += 0x9E3779B97F4A7C15ULL;
+        uint64 z = state;
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        reload_gear[i] = z ^ (z >> 31);
+    }
+    initialized = true;
+}
+
+static int64 reload_common_prefix(const char *a, const char *b, int64 count) {
+    int64 i = 0;
+#ifdef RELOAD_SSE2
+    for (; i + 16 <= count; i += 16) {
+        __m128i x = _mm_loadu_si128((const __m128i *)(a + i));
+        __m128i y = _mm_loadu_si128((const __m128i *)(b + i));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(x, y)) != 0xFFFF) break;
+    }
+#endif
+    while (i < count && a[i] == b[i]) i++;
+    return i;
+}
+
+// a_end and b_end are one past the last bytes compared
+static int64 reload_common_suffix(const char *a_end, const char *b_end, int64 count) {
+    int64 i = 0;
+#ifdef RELOAD_SSE2
+    for (; i + 16 <= count; i += 16) {
+        __m128i x = _mm_loadu_si128((const __m128i *)(a_end - i - 16));
+        __m128i y = _mm_loadu_si128((const __m128i *)(b_end - i - 16));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(x, y)) != 0xFFFF) break;
+    }
+#endif
+    while (i < count && a_end[-i - 1] == b_end[-i - 1]) i++;
+    return i;
+}
+
+static int64 reload_buffer_prefix(Buffer *buffer, const char *text, int64 count) {
+    Buffer_Chunk chunks[2];
+    int chunk_count = buffer_get_chunks(buffer, chunks);
+    int64 result = 0;
+    for (int i = 0; i < chunk_count; i++) {
+        int64 n = MIN(chunks[i].count, count - chunks[i].position);
+        if (n <= 0) break;
+        int64 same = reload_common_prefix(chunks[i].data, text + chunks[i].position, n);
+        result += same;
+        if (same < chunks[i].count) break;
+    }
+    return result;
+}
+
+// Never more than limit, so the suffix doesn't overlap the prefix
+static int64 reload_buffer_suffix(Buffer *buffer, const char *text, int64 count, int64 limit) {
+    Buffer_Chunk chunks[2];
+    int chunk_count = buffer_get_chunks(buffer, chunks);
+    int64 result = 0;
+    for (int i = chunk_count - 1; i >= 0 && result < limit; i--) {
+        int64 n = MIN(chunks[i].count, limit - result);
+        int64 same = reload_common_suffix(chunks[i].data + chunks[i].count, text + count - result, n);
+        result += same;
+        if (same < chunks[i].count) break;
+    }
+    return result;
+}
+
+static inline uint64 reload_rotl(uint64 x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64 reload_load64(const char *p) {
+    uint64 value;
+    memcpy(&value, p, 8);
+    return value;
+}
+
+// Four independent lanes of 8 bytes like xxHash, so the multiplies overlap
+static uint64 reload_hash(const char *data, int64 count) {
+    uint64 acc[4] = { RELOAD_PRIME1 + RELOAD_PRIME2, RELOAD_PRIME2, 0, 0 - RELOAD_PRIME1 };
+    int64 i = 0;
+    for (; i + 32 <= count; i += 32) {
+        for (int lane = 0; lane < 4; lane++) {
+            acc[lane] = reload_rotl(acc[lane] + reload_load64(data + i + 8 * lane) * RELOAD_PRIME2, 31) * RELOAD_PRIME1;
+        }
+    }
+    uint64 h = reload_rotl(acc[0], 1) + reload_rotl(acc[1], 7) + reload_rotl(acc[2], 12) + reload_rotl(acc[3], 18) + (uint64)count;
+    for (; i < count; i++) {
+        h = reload_rotl(h ^ ((uint8)data[i] * RELOAD_PRIME1), 11) * RELOAD_PRIME2;
+    }
+    h ^= h >> 33;
+    h *= RELOAD_PRIME2;
+    h ^= h >> 29;
+    return h;
+}
+
+// The hash only sees the last 64 bytes, so each chunk starts hashing 64 bytes
+// before its minimum size instead of at its start
+static void reload_split(const char *text, int64 count, Array<Reload_Chunk> *chunks) {
+    int64 start = 0;
+    while (start < count) {
+        int64 limit = MIN(count, start + RELOAD_MAX_CHUNK);
+        int64 end = limit;
+        int64 i = MIN(start + RELOAD_MIN_CHUNK - 64, limit);
+        uint64 h = 0;
+        for (; i < start + RELOAD_MIN_CHUNK && i < limit; i++) {
+            h = (h << 1) + reload_gear[(uint8)text[i]];
+        }
+        for (; i < limit; i++) {
+            h = (h << 1) + reload_gear[(uint8)text[i]];
+            if ((h & RELOAD_CHUNK_MASK) == 0) {
+                end = i + 1;
+                break;
+            }
+        }
+        Reload_Chunk chunk = { start, end - start, reload_hash(text + start, end - start) };
+        chunks->push(chunk);
+        start = end;
+    }
+}
+
+// Narrows a pair of differing ranges to the bytes that really differ
+static void reload_add_change(Array<Reload_Change> *changes, const char *old_text, const char *new_text, int64 base, int64 old_start, int64 old_end, int64 new_start, int64 new_end) {
+    int64 n = MIN(old_end - old_start, new_end - new_start);
+    int64 prefix = reload_common_prefix(old_text + old_start, new_text + new_start, n);
+    int64 suffix = reload_common_suffix(old_text + old_end, new_text + new_end, n - prefix);
+    old_start += prefix;
+    new_start += prefix;
+    old_end -= suffix;
+    new_end -= suffix;
+    if (old_start == old_end && new_start == new_end) return;
+    Reload_Change change = { base + old_start, old_end - old_start, base + new_start, new_end - new_start };
+    changes->push(change);
+}
+
+// Matches the chunks of the new text to old chunks in order, every run of
+// chunks in between becomes a change
+static void reload_diff(Buffer *buffer, const char *text, int64 start, int64 old_end, int64 new_end, Array<Reload_Change> *changes) {
+    int64 old_count = old_end - start;
+    int64 new_count = new_end - start;
+    char *old_text = (char *)malloc(old_count + 1);
+    buffer_copy_span(buffer, { start, old_end }, old_text);
+    const char *new_text = text + start;
+
+    reload_init_gear();
+    Array<Reload_Chunk> old_chunks;
+    Array<Reload_Chunk> new_chunks;
+    reload_split(old_text, old_count, &old_chunks);
+    reload_split(new_text, new_count, &new_chunks);
+
+    // Old chunks by hash, each slot heads an ascending chain of equal hashes
+    size_t slot_count = 16;
+    while (slot_count < 2 * old_chunks.count) slot_count *= 2;
+    Reload_Slot *slots = (Reload_Slot *)malloc(slot_count * sizeof(Reload_Slot));
+    for (size_t i = 0; i < slot_count; i++) slots[i] = { 0, -1 };
+    int64 *next_same = (int64 *)malloc((old_chunks.count + 1) * sizeof(int64));
+    for (int64 k = (int64)old_chunks.count - 1; k >= 0; k--) {
+        uint64 hash = old_chunks[k].hash;
+        size_t slot = hash & (slot_count - 1);
+        while (slots[slot].first >= 0 && slots[slot].hash != hash) slot = (slot + 1) & (slot_count - 1);
+        next_same[k] = slots[slot].first;
+        slots[slot] = { hash, k };
+    }
+
+    int64 next_old = 0;
+    int64 old_pos = 0;
+    int64 new_pos = 0;
+    for (size_t j = 0; j < new_chunks.count; j++) {
+        Reload_Chunk *chunk = &new_chunks[j];
+        size_t slot = chunk->hash & (slot_count - 1);
+        while (slots[slot].first >= 0 && slots[slot].hash != chunk->hash) slot = (slot + 1) & (slot_count - 1);
+        int64 match = -1;
+        int probes = 0;
+        for (int64 k = slots[slot].first; k >= 0 && probes < RELOAD_MAX_PROBES; k = next_same[k], probes++) {
+            Reload_Chunk *old = &old_chunks[k];
+            if (k >= next_old && old->count == chunk->count && memcmp(old_text + old->start, new_text + chunk->start, chunk->count) == 0) {
+                match = k;
+                break;
+            }
+        }
+        if (match < 0) continue;
+
+        reload_add_change(changes, old_text, new_text, start, old_pos, old_chunks[match].start, new_pos, chunk->start);
+        old_pos = old_chunks[match].start + old_chunks[match].count;
+        new_pos = chunk->start + chunk->count;
+        next_old = match + 1;
+    }
+    reload_add_change(changes, old_text, new_text, start, old_pos, old_count, new_pos, new_count);
+
+    free(slots);
+    free(next_same);
+    old_chunks.clear();
+    new_chunks.clear();
+    free(old_text);
+}
+
+// Write time and size, a rewrite that keeps both goes unnoticed
+bool buffer_file_changed(Buffer *buffer) {
+    if (!buffer->last_write_time) return false;
+    File_Attributes attributes = get_file_attributes(buffer->file_name);
+    // Missing for now, maybe in the middle of being replaced
+    if (!attributes.last_write_time) return false;
+    return (int64)attributes.last_write_time != buffer->last_write_time || (int64)attributes.file_size != buffer->file_size;
+}
+
+// Returns true when the buffer changed, changes gets what was replaced in order
+bool buffer_reload(Buffer *buffer, Array<Reload_Change> *changes) {
+    changes->reset_count();
+    File_Attributes attributes = get_file_attributes(buffer->file_name);
+    if (!attributes.last_write_time) return false;
+
+    // Empty files can't be mapped, they have no text either
+    Mapped_File file = map_file(buffer->file_name);
+    Text_Encoding encoding = buffer->encoding;
+    Line_Ending line_ending = buffer->line_ending;
+    String text{};
+    if (file.data) {
+        text = text_from_file_data(file.data, file.count, &encoding, &line_ending);
+    }
+
+    int64 old_length = buffer_get_length(buffer);
+    int64 prefix = reload_buffer_prefix(buffer, text.data, text.count);
+    int64 suffix = reload_buffer_suffix(buffer, text.data, text.count, MIN(old_length, text.count) - prefix);
+    int64 old_end = old_length - suffix;
+    int64 new_end = text.count - suffix;
+    if (prefix < old_end || prefix < new_end) {
+        reload_diff(buffer, text.data, prefix, old_end, new_end, changes);
+    }
+
+    // Back to front, so the positions of the changes before stay put
+    for (size_t i = changes->count; i-- > 0;) {
+        Reload_Change *change = &changes->data[i];
+        if (change->old_count > 0) {
+            buffer_record_delete(buffer, change->position, change->position + change->old_count);
+            buffer_delete_region(buffer, change->position, change->position + change->old_count);
+        }
+        if (change->new_count > 0) {
+            String inserted;
+            inserted.data = (char *)malloc(change->new_count + 1);
+            inserted.count = change->new_count;
+            memcpy(inserted.data, text.data + change->new_position, change->new_count);
+            inserted.data[inserted.count] = 0;
+            buffer_insert_text(buffer, change->position, inserted);
+            buffer_record_insert(buffer, change->position, inserted);
+        }
+    }
+    if (changes->count > 0) {
+        printf("%s: reloaded %zu changed regions\n", buffer->file_name, changes->count);
+    }
+
+    buffer->encoding = encoding;
+    buffer->line_ending = line_ending;
+    buffer->file_size = file.count;
+    buffer->last_write_time = attributes.last_write_time;
+    buffer->saved_version = buffer->version;
+
+    if (text.data != file.data) free(text.data);
+    unmap_file(&file);
+    return changes->count > 0;
+}
+
+// Where a position before the reload ended up. One inside a replaced region
+// keeps its offset into the region, clamped to the new text.
+int64 reload_map_position(Array<Reload_Change> *changes, int64 position) {
+    int64 shift = 0;
+    for (size_t i = 0; i < changes->count; i++) {
+        Reload_Change *change = &changes->data[i];
+        if (position < change->position) break;
+        if (position < change->position + change->old_count) {
+            return change->new_position + MIN(position - change->position, change->new_count);
+        }
+        shift += change->new_count - change->old_count;
+    }
+    return position + shift;
+}
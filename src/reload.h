@@ -0,0 +1,24 @@
+#pragma once
+
+#include "types.h"
+#include "array.h"
+#include "buffer.h"
+
+// How often the file of the shown buffer is checked for outside changes
+#define RELOAD_POLL_FRAMES 30
+
+// Brings a buffer up to date with its file after another program rewrote it.
+// Only the regions that differ are replaced, as ordinary recorded edits, so
+// undo history and positions outside those regions survive. Both texts are
+// split into content defined chunks that are matched by hash, which keeps
+// the chunks after an insertion or deletion lined up.
+struct Reload_Change {
+    int64 position; // in the text before the reload
+    int64 old_count;
+    int64 new_position; // in the file's text
+    int64 new_count;
+};
+
+bool buffer_file_changed(Buffer *buffer);
+bool buffer_reload(Buffer *buffer, Array<Reload_Change> *changes);
+int64 reload_map_position(Array<Reload_Change> *changes, int64 position);
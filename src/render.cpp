@@ -0,0 +1,233 @@
+#include "render.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+Render_Backend *render_backend;
+
+// Keeps the groups' vertex storage for the next frame
+void render_target_reset(Render_Target *target, int32 width, int32 height) {
+    target->width = width;
+    target->height = height;
+    target->current = nullptr;
+    target->groups.reset_count();
+}
+
+static void render_thread(void *data) {
+    Renderer *renderer = (Renderer *)data;
+    for (;;) {
+        semaphore_wait(renderer->frame_ready);
+        mutex_lock(renderer->mutex);
+        if (renderer->quit) {
+            mutex_unlock(renderer->mutex);
+            break;
+        }
+        int32 index = renderer->ready;
+        renderer->ready = -1;
+        renderer->drawing = index;
+        mutex_unlock(renderer->mutex);
+        // Already taken back for a newer frame
+        if (index < 0) continue;
+
+        renderer_wake(renderer);
+        renderer->backend->render(renderer->backend, &renderer->targets[index]);
+
+        mutex_lock(renderer->mutex);
+        renderer->drawing = -1;
+        renderer->frames_drawn++;
+        mutex_unlock(renderer->mutex);
+    }
+    atomic_add64(&renderer->stopped, 1);
+}
+
+// The backend has to be set up, so fonts can make their textures, before the thread starts
+void renderer_start(Renderer *renderer, Render_Backend *backend) {
+    renderer->backend = backend;
+    renderer->mutex = create_mutex();
+    renderer->frame_ready = create_semaphore(0);
+    renderer->wake = create_semaphore(0);
+    create_thread(render_thread, renderer);
+}
+
+// Waits for the frame being drawn, the one handed over after it is dropped
+void renderer_stop(Renderer *renderer) {
+    mutex_lock(renderer->mutex);
+    renderer->quit = true;
+    mutex_unlock(renderer->mutex);
+    semaphore_signal(renderer->frame_ready, 1);
+    while (!renderer->stopped) {
+        yield_thread();
+    }
+}
+
+// The target not being drawn, never waited for. A frame handed over in it
+// and not taken yet is replaced.
+Render_Target *renderer_begin_frame(Renderer *renderer, int32 width, int32 height) {
+    assert(renderer->building < 0);
+    mutex_lock(renderer->mutex);
+    int32 index;
+    if (renderer->drawing >= 0) {
+        index = renderer->drawing ^ 1;
+    } else {
+        index = renderer->ready >= 0 ? renderer->ready ^ 1 : 0;
+    }
+    if (renderer->ready == index) {
+        renderer->ready = -1;
+        renderer->frames_replaced++;
+    }
+    renderer->building = index;
+    mutex_unlock(renderer->mutex);
+
+    Render_Target *target = &renderer->targets[index];
+    render_target_reset(target, width, height);
+    return target;
+}
+
+void renderer_end_frame(Renderer *renderer) {
+    assert(renderer->building >= 0);
+    mutex_lock(renderer->mutex);
+    if (renderer->ready >= 0) renderer->frames_replaced++;
+    renderer->ready = renderer->building;
+    renderer->building = -1;
+    mutex_unlock(renderer->mutex);
+    semaphore_signal(renderer->frame_ready, 1);
+}
+
+// Only the first wake after the editor starts waiting signals, so a burst of
+// input doesn't leave a count behind for the waits after it
+void renderer_wake(Renderer *renderer) {
+    if (atomic_compare_exchange64(&renderer->waiting, 0, 1) == 1) {
+        semaphore_signal(renderer->wake, 1);
+    }
+}
+
+// Paces the editor at the display's rate: returns once the render thread has
+// taken the last frame, or as soon as there's input to handle
+void renderer_wait(Renderer *renderer, Input_Ring *input) {
+    atomic_compare_exchange64(&renderer->waiting, 1, 0);
+    mutex_lock(renderer->mutex);
+    bool taken = renderer->ready < 0;
+    mutex_unlock(renderer->mutex);
+    if (taken || !input_ring_is_empty(input)) {
+        // Nothing to wait for, unless a wake got in first and signalled
+        if (atomic_compare_exchange64(&renderer->waiting, 0, 1) == 1) return;
+    }
+    semaphore_wait(renderer->wake);
+}
+
+struct Software_Texture {
+    uint8 *bitmap;
+    int width;
+    int height;
+};
+
+struct Software_Backend {
+    Render_Backend backend;
+    uint32 *pixels;
+    int32 width;
+    int32 height;
+    Software_Present_Proc present;
+    void *present_data;
+};
+
+static void *software_create_texture(Render_Backend *, uint8 *bitmap, int width, int height) {
+    Software_Texture *texture = new Software_Texture();
+    texture->bitmap = (uint8 *)malloc(width * height);
+    memcpy(texture->bitmap, bitmap, width * height);
+    texture->width = width;
+    texture->height = height;
+    return texture;
+}
+
+// Point sampled and wrapped like the d3d11 sampler, no texture reads as white
+static float software_sample(Software_Texture *texture, float u, float v) {
+    if (!texture || texture->width == 0 || texture->height == 0) return 1.0f;
+    int x = (int)floorf(u * texture->width) % texture->width;
+    int y = (int)floorf(v * texture->height) % texture->height;
+    if (x < 0) x += texture->width;
+    if (y < 0) y += texture->height;
+    return texture->bitmap[y * texture->width + x] / 255.0f;
+}
+
+static float edge_function(v2 a, v2 b, float x, float y) {
+    return (b.x - a.x) * (y - a.y) - (b.y - a.y) * (x - a.x);
+}
+
+// Fills pixels whose centers are inside the triangle, blended by the
+// texture's coverage with the color as the shader does
+static void software_draw_triangle(Software_Backend *software, Software_Texture *texture, Vertex *a, Vertex *b, Vertex *c) {
+    float area = edge_function(a->position, b->position, c->position.x, c->position.y);
+    if (area == 0.0f) return;
+    float min_x = fminf(a->position.x, fminf(b->position.x, c->position.x));
+    float max_x = fmaxf(a->position.x, fmaxf(b->position.x, c->position.x));
+    float min_y = fminf(a->position.y, fminf(b->position.y, c->position.y));
+    float max_y = fmaxf(a->position.y, fmaxf(b->position.y, c->position.y));
+    int32 x0 = (int32)fmaxf(floorf(min_x), 0.0f);
+    int32 y0 = (int32)fmaxf(floorf(min_y), 0.0f);
+    int32 x1 = (int32)fminf(ceilf(max_x), (float)software->width);
+    int32 y1 = (int32)fminf(ceilf(max_y), (float)software->height);
+
+    for (int32 y = y0; y < y1; y++) {
+        uint32 *row = software->pixels + (int64)y * software->width;
+        for (int32 x = x0; x < x1; x++) {
+            float px = x + 0.5f;
+            float py = y + 0.5f;
+            float w0 = edge_function(b->position, c->position, px, py) / area;
+            float w1 = edge_function(c->position, a->position, px, py) / area;
+            float w2 = 1.0f - w0 - w1;
+            if (w0 < 0.0f || w1 < 0.0f || w2 < 0.0f) continue;
+
+            float u = w0 * a->uv.x + w1 * b->uv.x + w2 * c->uv.x;
+            float v = w0 * a->uv.y + w1 * b->uv.y + w2 * c->uv.y;
+            float alpha = software_sample(texture, u, v);
+            if (alpha <= 0.0f) continue;
+            v4 color = a->color;
+
+            uint32 dest = row[x];
+            float r = ((dest >> 16) & 0xFF) / 255.0f;
+            float g = ((dest >> 8) & 0xFF) / 255.0f;
+            float bl = (dest & 0xFF) / 255.0f;
+            r += (color.x - r) * alpha;
+            g += (color.y - g) * alpha;
+            bl += (color.z - bl) * alpha;
+            row[x] = 0xFF000000 | ((uint32)(r * 255.0f + 0.5f) << 16) | ((uint32)(g * 255.0f + 0.5f) << 8) | (uint32)(bl * 255.0f + 0.5f);
+        }
+    }
+}
+
+static void software_render(Render_Backend *backend, Render_Target *target) {
+    Software_Backend *software = (Software_Backend *)backend->data;
+    if (target->width != software->width || target->height != software->height) {
+        free(software->pixels);
+        software->width = target->width;
+        software->height = target->height;
+        software->pixels = (uint32 *)malloc((int64)target->width * target->height * sizeof(uint32));
+    }
+    for (int64 i = 0; i < (int64)software->width * software->height; i++) {
+        software->pixels[i] = 0xFF000000;
+    }
+
+    for (size_t i = 0; i < target->groups.count; i++) {
+        Render_Group *group = &target->groups[i];
+        Software_Texture *texture = (Software_Texture *)group->texture;
+        for (size_t v = 0; v + 2 < group->vertices.count; v += 3) {
+            Vertex *vertices = group->vertices.data + v;
+            software_draw_triangle(software, texture, &vertices[0], &vertices[1], &vertices[2]);
+        }
+    }
+
+    if (software->present) software->present(software->pixels, software->width, software->height, software->present_data);
+}
+
+Render_Backend *make_software_backend(Software_Present_Proc present, void *data) {
+    Software_Backend *software = new Software_Backend();
+    software->present = present;
+    software->present_data = data;
+    software->backend.name = "software";
+    software->backend.create_texture = software_create_texture;
+    software->backend.render = software_render;
+    software->backend.data = software;
+    return &software->backend;
+}
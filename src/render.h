@@ -0,0 +1,54 @@
+#pragma once
+
+#include "types.h"
+#include "draw.h"
+#include "platform.h"
+#include "input.h"
+
+// Frames are drawn on a thread of their own. The editor fills one of two
+// Render_Targets and hands it over, the render thread draws and presents the
+// other, so a vsync wait never holds up a command and a slow command never
+// holds up a present. A frame handed over before the last one was taken
+// replaces it. The backend is whatever draws a target: d3d11 on Windows, or
+// the software rasterizer where there's no GPU API to hand.
+struct Render_Backend {
+    const char *name;
+    // Called from the editor's thread while fonts load
+    void *(*create_texture)(Render_Backend *backend, uint8 *bitmap, int width, int height);
+    // Draws the target and presents it, waiting on vsync if the backend does
+    void (*render)(Render_Backend *backend, Render_Target *target);
+    void *data;
+};
+
+struct Renderer {
+    Render_Backend *backend;
+    Render_Target targets[2];
+    int32 building = -1; // the editor's, between begin and end
+    int32 ready = -1; // handed over and not taken yet
+    int32 drawing = -1; // the render thread's
+    bool quit;
+    Platform_Handle mutex;
+    Platform_Handle frame_ready;
+    Platform_Handle wake; // the editor waits on it for the next frame
+    volatile int64 waiting;
+    volatile int64 stopped;
+    int64 frames_drawn;
+    int64 frames_replaced;
+};
+
+extern Render_Backend *render_backend; // fonts make their textures with it
+
+void render_target_reset(Render_Target *target, int32 width, int32 height);
+
+void renderer_start(Renderer *renderer, Render_Backend *backend);
+void renderer_stop(Renderer *renderer);
+Render_Target *renderer_begin_frame(Renderer *renderer, int32 width, int32 height);
+void renderer_end_frame(Renderer *renderer);
+void renderer_wait(Renderer *renderer, Input_Ring *input);
+void renderer_wake(Renderer *renderer);
+
+// The software backend draws into pixels in memory and calls present with
+// them, for a platform layer to blit to its window.
+typedef void (*Software_Present_Proc)(uint32 *pixels, int32 width, int32 height, void *data);
+
+Render_Backend *make_software_backend(Software_Present_Proc present, void *data);
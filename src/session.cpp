@@ -0,0 +1,208 @@
+#include "session.h"
+#include "qed.h"
+#include "filter.h"
+#include "registry.h"
+#include "platform.h"
+#include "simple_math.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SESSION_MAGIC 0x53534551 // QESS
+#define SESSION_VERSION 1
+#define SESSION_SAMPLES 64
+#define SESSION_SAMPLE_SIZE 4096
+
+struct Session_File_Header {
+    uint32 magic;
+    uint32 version;
+    int64 entry_count;
+    int64 active;
+    int64 names_bytes;
+};
+
+// Names follow the entries, each ends in a 0
+struct Session_File_Entry {
+    uint64 file_size;
+    uint64 last_write_time;
+    uint64 sample_hash;
+    int64 cursor_position;
+    int64 mark_position;
+    int64 scroll_position;
+    int64 name_offset;
+    int32 mark_active;
+    int32 pad;
+};
+
+// Evenly spaced samples of the text, like the index cache, so checking a
+// restored file costs the same for any size
+static uint64 session_sample_hash(Buffer *buffer) {
+    char sample[SESSION_SAMPLE_SIZE];
+    int64 count = buffer_get_length(buffer);
+    uint64 hash = 14695981039346656037ull ^ (uint64)count;
+    int64 sample_size = MIN(count, SESSION_SAMPLE_SIZE);
+    for (int64 i = 0; i < SESSION_SAMPLES; i++) {
+        int64 offset = (count - sample_size) * i / (SESSION_SAMPLES - 1);
+        buffer_copy_span(buffer, { offset, offset + sample_size }, sample);
+        for (int64 j = 0; j < sample_size; j++) {
+            hash = (hash ^ (uint8)sample[j]) * 1099511628211ull;
+        }
+    }
+    return hash;
+}
+
+static char *session_copy_name(const char *file_name, size_t length) {
+    char *name = (char *)malloc(length + 1);
+    memcpy(name, file_name, length);
+    name[length] = 0;
+    return name;
+}
+
+bool session_load(Session *session, const char *file_name) {
+    Mapped_File file = map_file(file_name);
+    if (!file.data) return false;
+
+    // The counts are bounded by the file size before they're multiplied, so a
+    // corrupt header can't wrap the size check
+    Session_File_Header *header = (Session_File_Header *)file.data;
+    int64 expected_size = sizeof(Session_File_Header);
+    if (file.count >= expected_size && header->entry_count >= 0 && header->entry_count <= file.count / (int64)sizeof(Session_File_Entry) &&
+        header->names_bytes >= 0 && header->names_bytes <= file.count) {
+        expected_size += header->entry_count * sizeof(Session_File_Entry) + header->names_bytes;
+    } else {
+        expected_size = -1;
+    }
+    if (file.count != expected_size || header->magic != SESSION_MAGIC || header->version != SESSION_VERSION ||
+        header->active >= header->entry_count) {
+        printf("%s: not a session file, ignoring it\n", file_name);
+        unmap_file(&file);
+        return false;
+    }
+
+    Session_File_Entry *file_entries = (Session_File_Entry *)(header + 1);
+    const char *names = (const char *)(file_entries + header->entry_count);
+    for (int64 i = 0; i < header->entry_count; i++) {
+        Session_File_Entry *file_entry = &file_entries[i];
+        if (file_entry->name_offset < 0 || file_entry->name_offset >= header->names_bytes) continue;
+        const char *name = names + file_entry->name_offset;
+        const char *end = (const char *)memchr(name, 0, header->names_bytes - file_entry->name_offset);
+        if (!end) continue;
+
+        Session_Entry entry{};
+        entry.file_name = session_copy_name(name, end - name);
+        entry.file_size = file_entry->file_size;
+        entry.last_write_time = file_entry->last_write_time;
+        entry.sample_hash = file_entry->sample_hash;
+        entry.cursor_position = file_entry->cursor_position;
+        entry.mark_position = file_entry->mark_position;
+        entry.scroll_position = file_entry->scroll_position;
+        entry.mark_active = file_entry->mark_active != 0;
+        if (i == header->active) session->active = session->entries.count;
+        session->entries.push(entry);
+    }
+    unmap_file(&file);
+    return true;
+}
+
+void session_save(Session *session, const char *file_name) {
+    Array<char> data;
+    Session_File_Header header{};
+    header.magic = SESSION_MAGIC;
+    header.version = SESSION_VERSION;
+    header.entry_count = session->entries.count;
+    header.active = session->active;
+    for (size_t i = 0; i < session->entries.count; i++) {
+        header.names_bytes += strlen(session->entries[i].file_name) + 1;
+    }
+    data.reserve(sizeof(header) + header.entry_count * sizeof(Session_File_Entry) + header.names_bytes);
+    data.append((char *)&header, sizeof(header));
+
+    int64 name_offset = 0;
+    for (size_t i = 0; i < session->entries.count; i++) {
+        Session_Entry *entry = &session->entries[i];
+        Session_File_Entry file_entry{};
+        file_entry.file_size = entry->file_size;
+        file_entry.last_write_time = entry->last_write_time;
+        file_entry.sample_hash = entry->sample_hash;
+        file_entry.cursor_position = entry->cursor_position;
+        file_entry.mark_position = entry->mark_position;
+        file_entry.scroll_position = entry->scroll_position;
+        file_entry.name_offset = name_offset;
+        file_entry.mark_active = entry->mark_active;
+        data.append((char *)&file_entry, sizeof(file_entry));
+        name_offset += strlen(entry->file_name) + 1;
+    }
+    for (size_t i = 0; i < session->entries.count; i++) {
+        data.append(session->entries[i].file_name, strlen(session->entries[i].file_name) + 1);
+    }
+
+    Platform_Handle file = open_file_for_writing(file_name);
+    if (file) {
+        write_file(file, data.data, data.count);
+        close_file(file);
+    }
+    data.clear();
+}
+
+// Names compare the way the registry's paths do, so one buffer has one entry
+Session_Entry *session_find(Session *session, const char *file_name) {
+    for (size_t i = 0; i < session->entries.count; i++) {
+        if (registry_path_equal(session->entries[i].file_name, file_name)) return &session->entries[i];
+    }
+    return nullptr;
+}
+
+Session_Entry *session_add(Session *session, const char *file_name) {
+    Session_Entry entry{};
+    entry.file_name = session_copy_name(file_name, strlen(file_name));
+    return session->entries.push(entry);
+}
+
+// Whether a buffer just read from its file has the text the entry's positions were taken in
+bool session_entry_matches(Session_Entry *entry, Buffer *buffer) {
+    if (entry->file_size != (uint64)buffer->file_size || entry->last_write_time != (uint64)buffer->last_write_time) return false;
+    return entry->sample_hash == 0 || entry->sample_hash == session_sample_hash(buffer);
+}
+
+void session_store_view(Session_Entry *entry, View *view) {
+    Buffer *buffer = view->buffer;
+    entry->file_size = buffer->file_size;
+    entry->last_write_time = buffer->last_write_time;
+    entry->sample_hash = buffer->version == buffer->saved_version ? session_sample_hash(buffer) : 0;
+    entry->cursor_position = view->cursor.position;
+    entry->mark_position = view->mark.position;
+    entry->mark_active = view->mark_active;
+    if (view->estimated_position >= 0) {
+        entry->cursor_position = view->estimated_position;
+        entry->scroll_position = view->estimated_position;
+        return;
+    }
+    int64 line = view->cursor.line;
+    if (!view->diff && (!view_get_filter(view) || view_get_row_count(view) > 0)) {
+        line = view_get_line(view, view->scroll_row);
+    }
+    line = CLAMP(line, 0, buffer_get_line_count(buffer) - 1);
+    entry->scroll_position = get_position_from_line(buffer, line);
+}
+
+// Positions past what a large file has indexed so far are shown the way
+// goto_line shows them, from a guess that settles once the indexer gets there
+void session_restore_view(Session_Entry *entry, View *view) {
+    Buffer *buffer = view->buffer;
+    int64 length = buffer_get_length(buffer);
+    int64 cursor = CLAMP(entry->cursor_position, 0, length);
+    int64 mark = CLAMP(entry->mark_position, 0, length);
+    int64 scroll = CLAMP(entry->scroll_position, 0, length);
+    if (buffer->indexer) {
+        int64 indexed = buffer_indexed_length(buffer);
+        if (cursor >= indexed || mark >= indexed || scroll >= indexed) {
+            view->estimated_position = scroll;
+            return;
+        }
+    }
+    view->cursor = get_cursor_from_position(buffer, cursor);
+    view->mark = get_cursor_from_position(buffer, mark);
+    view->mark_active = entry->mark_active;
+    view->scroll_row = view_get_row(view, get_line_from_position(buffer, scroll));
+}
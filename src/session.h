@@ -0,0 +1,37 @@
+#pragma once
+
+#include "types.h"
+#include "array.h"
+#include "buffer.h"
+
+struct View;
+
+// The files open at exit and where each was looked at, written as one flat
+// file that loads with a single map. Only positions come back, a file is read
+// into the buffer registry when it is first shown again.
+#define SESSION_FILE_NAME ".qed-session"
+
+struct Session_Entry {
+    char *file_name;
+    // The file the positions were taken in, the hash is 0 when the buffer had unsaved edits
+    uint64 file_size;
+    uint64 last_write_time;
+    uint64 sample_hash;
+    int64 cursor_position;
+    int64 mark_position;
+    int64 scroll_position; // start of the first line on screen
+    bool mark_active;
+};
+
+struct Session {
+    Array<Session_Entry> entries;
+    int64 active = -1;
+};
+
+bool session_load(Session *session, const char *file_name);
+void session_save(Session *session, const char *file_name);
+Session_Entry *session_find(Session *session, const char *file_name);
+Session_Entry *session_add(Session *session, const char *file_name);
+bool session_entry_matches(Session_Entry *entry, Buffer *buffer);
+void session_store_view(Session_Entry *entry, View *view);
+void session_restore_view(Session_Entry *entry, View *view);
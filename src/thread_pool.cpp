@@ -0,0 +1,175 @@
+#include "thread_pool.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#define JOB_DEQUE_INITIAL_CAPACITY 256
+
+static Thread_Pool thread_pool;
+static thread_local int32 thread_pool_index = -1;
+
+void job_deque_init(Job_Deque *deque) {
+    deque->mutex = create_mutex();
+    deque->capacity = JOB_DEQUE_INITIAL_CAPACITY;
+    deque->jobs = (Job *)malloc(deque->capacity * sizeof(Job));
+    deque->head = 0;
+    deque->tail = 0;
+}
+
+void job_deque_push_back(Job_Deque *deque, Job job) {
+    mutex_lock(deque->mutex);
+    if (deque->tail - deque->head == deque->capacity) {
+        int64 new_capacity = deque->capacity * 2;
+        Job *jobs = (Job *)malloc(new_capacity * sizeof(Job));
+        for (int64 i = deque->head; i < deque->tail; i++) {
+            jobs[i & (new_capacity - 1)] = deque->jobs[i & (deque->capacity - 1)];
+        }
+        free(deque->jobs);
+        deque->jobs = jobs;
+        deque->capacity = new_capacity;
+    }
+    deque->jobs[deque->tail & (deque->capacity - 1)] = job;
+    deque->tail++;
+    mutex_unlock(deque->mutex);
+}
+
+bool job_deque_pop_back(Job_Deque *deque, Job *job) {
+    bool result = false;
+    mutex_lock(deque->mutex);
+    if (deque->tail > deque->head) {
+        deque->tail--;
+        *job = deque->jobs[deque->tail & (deque->capacity - 1)];
+        result = true;
+    }
+    mutex_unlock(deque->mutex);
+    return result;
+}
+
+bool job_deque_pop_front(Job_Deque *deque, Job *job) {
+    bool result = false;
+    mutex_lock(deque->mutex);
+    if (deque->tail > deque->head) {
+        *job = deque->jobs[deque->head & (deque->capacity - 1)];
+        deque->head++;
+        result = true;
+    }
+    mutex_unlock(deque->mutex);
+    return result;
+}
+
+static Job_Deque *thread_pool_deque(int32 worker, int32 priority) {
+    return &thread_pool.deques[priority * thread_pool.worker_count + worker];
+}
+
+bool thread_pool_steal(int32 thief, int32 priority, uint32 *seed, Job *job) {
+    int32 count = thread_pool.worker_count;
+    *seed = *seed * 1664525 + 1013904223;
+    int32 first = (int32)((*seed >> 8) % (uint32)count);
+    for (int32 i = 0; i < count; i++) {
+        int32 victim = (first + i) % count;
+        if (victim == thief) continue;
+        if (job_deque_pop_front(thread_pool_deque(victim, priority), job)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// The worker's own jobs of a priority first, then stolen ones, before anything less urgent
+static bool thread_pool_take(int32 index, uint32 *seed, Job *job) {
+    for (int32 priority = 0; priority < JOB_PRIORITY_COUNT; priority++) {
+        if (job_deque_pop_back(thread_pool_deque(index, priority), job) || thread_pool_steal(index, priority, seed, job)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void thread_pool_worker(void *data) {
+    int32 index = (int32)(intptr_t)data;
+    thread_pool_index = index;
+    uint32 seed = (uint32)index * 2654435761u + 1;
+    for (;;) {
+        Job job;
+        if (thread_pool_take(index, &seed, &job)) {
+            job.proc(job.data);
+            if (job.token) atomic_add64(&job.token->pending, -1);
+        } else {
+            semaphore_wait(thread_pool.wake);
+        }
+    }
+}
+
+void thread_pool_start(int32 worker_count) {
+    assert(thread_pool.worker_count == 0);
+    if (worker_count < 1) worker_count = 1;
+    thread_pool.worker_count = worker_count;
+    int32 deque_count = worker_count * JOB_PRIORITY_COUNT;
+    thread_pool.deques = (Job_Deque *)calloc(deque_count, sizeof(Job_Deque));
+    thread_pool.wake = create_semaphore(0);
+    thread_pool.completions_mutex = create_mutex();
+    for (int32 i = 0; i < deque_count; i++) {
+        job_deque_init(&thread_pool.deques[i]);
+    }
+    for (int32 i = 0; i < worker_count; i++) {
+        create_thread(thread_pool_worker, (void *)(intptr_t)i);
+    }
+}
+
+// Jobs pushed from a worker stay on its own deque, everything else is spread round robin
+void thread_pool_push(Job_Proc proc, void *data, Job_Priority priority, Job_Token *token) {
+    assert(thread_pool.worker_count > 0);
+    Job job = { proc, data, token };
+    if (token) atomic_add64(&token->pending, 1);
+    int32 index = thread_pool_index;
+    if (index < 0) {
+        index = (int32)(atomic_add64(&thread_pool.next_deque, 1) % thread_pool.worker_count);
+    }
+    job_deque_push_back(thread_pool_deque(index, priority), job);
+    semaphore_signal(thread_pool.wake, 1);
+}
+
+// Queues proc to run on the main thread. The token stays pending until it has.
+void thread_pool_complete(Job_Proc proc, void *data, Job_Token *token) {
+    Job job = { proc, data, token };
+    if (token) atomic_add64(&token->pending, 1);
+    mutex_lock(thread_pool.completions_mutex);
+    thread_pool.completions.push(job);
+    mutex_unlock(thread_pool.completions_mutex);
+}
+
+// Main thread only, called once a frame. Runs completions in the order they
+// were posted until the budget is spent, at least one so none can starve.
+// Returns how many are left for the next call.
+int64 thread_pool_run_completions(int64 budget_microseconds) {
+    int64 start = get_time_microseconds();
+    if (thread_pool.ready_index == thread_pool.ready.count) {
+        thread_pool.ready.reset_count();
+        thread_pool.ready_index = 0;
+        mutex_lock(thread_pool.completions_mutex);
+        thread_pool.ready.swap(thread_pool.completions);
+        mutex_unlock(thread_pool.completions_mutex);
+    }
+    bool ran = false;
+    while (thread_pool.ready_index < thread_pool.ready.count) {
+        if (ran && get_time_microseconds() - start >= budget_microseconds) break;
+        Job job = thread_pool.ready[thread_pool.ready_index++];
+        job.proc(job.data);
+        if (job.token) atomic_add64(&job.token->pending, -1);
+        ran = true;
+    }
+    return (int64)(thread_pool.ready.count - thread_pool.ready_index);
+}
+
+int32 thread_pool_worker_count() {
+    return thread_pool.worker_count;
+}
+
+int32 thread_pool_worker_index() {
+    return thread_pool_index;
+}
+
+void job_token_cancel(Job_Token *token) {
+    atomic_add64(&token->cancelled, 1);
+}
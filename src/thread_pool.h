@@ -0,0 +1,61 @@
+#pragma once
+
+#include "types.h"
+#include "platform.h"
+#include "array.h"
+
+// Microseconds a frame spends running completions, when there are more they wait for the next one
+#define THREAD_POOL_COMPLETION_BUDGET 2000
+
+typedef void (*Job_Proc)(void *data);
+
+// Workers take interactive jobs, anywhere in the pool, before background ones
+enum Job_Priority {
+    JOB_PRIORITY_INTERACTIVE, // someone is waiting on the result
+    JOB_PRIORITY_BACKGROUND,
+    JOB_PRIORITY_COUNT,
+};
+
+// Ties a group of jobs together. Cancelled jobs still run, to free what they
+// hold, but return early. pending counts the jobs and completions of the group
+// that haven't run yet, what they share can be freed once it's zero.
+struct Job_Token {
+    volatile int64 cancelled;
+    volatile int64 pending;
+};
+
+struct Job {
+    Job_Proc proc;
+    void *data;
+    Job_Token *token;
+};
+
+// Each worker owns a deque. The owner pushes and pops at the back, idle workers steal from the front.
+struct Job_Deque {
+    Platform_Handle mutex;
+    Job *jobs;
+    int64 capacity;
+    int64 head;
+    int64 tail;
+};
+
+// Jobs hand results back to the main thread as completions, which the frame
+// loop runs between input and drawing
+struct Thread_Pool {
+    Job_Deque *deques; // a deque per worker for each priority, the most urgent first
+    int32 worker_count;
+    Platform_Handle wake;
+    volatile int64 next_deque;
+    Platform_Handle completions_mutex;
+    Array<Job> completions; // posted by jobs
+    Array<Job> ready; // taken by the main thread, run from ready_index on
+    size_t ready_index;
+};
+
+void thread_pool_start(int32 worker_count);
+void thread_pool_push(Job_Proc proc, void *data, Job_Priority priority = JOB_PRIORITY_BACKGROUND, Job_Token *token = nullptr);
+void thread_pool_complete(Job_Proc proc, void *data, Job_Token *token = nullptr);
+int64 thread_pool_run_completions(int64 budget_microseconds);
+int32 thread_pool_worker_count();
+int32 thread_pool_worker_index();
+void job_token_cancel(Job_Token *token);
@@ -0,0 +1,113 @@
+#include "utf8.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#include <emmintrin.h>
+#define UTF8_SSE2 1
+#endif
+
+int utf8_decode(const char *text, int64 count, uint32 *codepoint) {
+    const uint8 *s = (const uint8 *)text;
+    uint8 c = s[0];
+    *codepoint = c;
+    if (c < 0x80) return 1;
+
+    int length;
+    uint32 result;
+    uint8 lo = 0x80;
+    uint8 hi = 0xBF;
+    if (c >= 0xC2 && c <= 0xDF) {
+        length = 2;
+        result = c & 0x1F;
+    } else if (c >= 0xE0 && c <= 0xEF) {
+        length = 3;
+        result = c & 0x0F;
+        if (c == 0xE0) lo = 0xA0;
+        if (c == 0xED) hi = 0x9F; // surrogates
+    } else if (c >= 0xF0 && c <= 0xF4) {
+        length = 4;
+        result = c & 0x07;
+        if (c == 0xF0) lo = 0x90;
+        if (c == 0xF4) hi = 0x8F;
+    } else {
+        return 1;
+    }
+
+    if (count < length) return 1;
+    for (int i = 1; i < length; i++) {
+        uint8 b = s[i];
+        if (b < lo || b > hi) return 1;
+        lo = 0x80;
+        hi = 0xBF;
+        result = (result << 6) | (b & 0x3F);
+    }
+    *codepoint = result;
+    return length;
+}
+
+int utf8_encode(uint32 codepoint, char *dest) {
+    uint8 *d = (uint8 *)dest;
+    if (codepoint < 0x80) {
+        d[0] = (uint8)codepoint;
+        return 1;
+    } else if (codepoint < 0x800) {
+        d[0] = (uint8)(0xC0 | (codepoint >> 6));
+        d[1] = (uint8)(0x80 | (codepoint & 0x3F));
+        return 2;
+    } else if (codepoint < 0x10000) {
+        d[0] = (uint8)(0xE0 | (codepoint >> 12));
+        d[1] = (uint8)(0x80 | ((codepoint >> 6) & 0x3F));
+        d[2] = (uint8)(0x80 | (codepoint & 0x3F));
+        return 3;
+    } else {
+        d[0] = (uint8)(0xF0 | (codepoint >> 18));
+        d[1] = (uint8)(0x80 | ((codepoint >> 12) & 0x3F));
+        d[2] = (uint8)(0x80 | ((codepoint >> 6) & 0x3F));
+        d[3] = (uint8)(0x80 | (codepoint & 0x3F));
+        return 4;
+    }
+}
+
+// Length of the run of ASCII bytes at the start of text
+int64 utf8_ascii_prefix(const char *text, int64 count) {
+    int64 i = 0;
+#ifdef UTF8_SSE2
+    while (i + 16 <= count) {
+        __m128i block = _mm_loadu_si128((const __m128i *)(text + i));
+        int mask = _mm_movemask_epi8(block);
+        if (mask) {
+            while (!(mask & 1)) {
+                mask >>= 1;
+                i++;
+            }
+            return i;
+        }
+        i += 16;
+    }
+#endif
+    while (i < count && (uint8)text[i] < 0x80) i++;
+    return i;
+}
+
+// Counts the valid sequences of more than one byte and the bytes that start
+// no valid sequence. Pure ASCII blocks are skipped 16 bytes at a time.
+void utf8_count_sequences(const char *text, int64 count, int64 *multibyte, int64 *invalid) {
+    *multibyte = 0;
+    *invalid = 0;
+    int64 i = 0;
+    while (i < count) {
+        i += utf8_ascii_prefix(text + i, count - i);
+        if (i >= count) break;
+        uint32 codepoint;
+        int length = utf8_decode(text + i, count - i, &codepoint);
+        if (length == 1) {
+            (*invalid)++;
+        } else {
+            (*multibyte)++;
+        }
+        i += length;
+    }
+}
+
+bool utf8_is_ascii(const char *text, int64 count) {
+    return utf8_ascii_prefix(text, count) == count;
+}
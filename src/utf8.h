@@ -0,0 +1,16 @@
+#pragma once
+
+#include "types.h"
+
+// A byte that doesn't start a valid sequence decodes to itself as one
+// codepoint, the same as Latin-1, so every byte stays reachable and drawable.
+
+inline bool utf8_is_continuation(char c) {
+    return ((uint8)c & 0xC0) == 0x80;
+}
+
+int utf8_decode(const char *text, int64 count, uint32 *codepoint);
+int utf8_encode(uint32 codepoint, char *dest);
+void utf8_count_sequences(const char *text, int64 count, int64 *multibyte, int64 *invalid);
+bool utf8_is_ascii(const char *text, int64 count);
+int64 utf8_ascii_prefix(const char *text, int64 count);
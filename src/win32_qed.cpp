@@ -12,6 +12,23 @@
 #include "path.h"
 #include "qed.h"
 #include "draw.h"
+#include "thread_pool.h"
+#include "find_in_files.h"
+#include "occur.h"
+#include "filter.h"
+#include "follow.h"
+#include "reload.h"
+#include "diff.h"
+#include "journal.h"
+#include "session.h"
+#include "registry.h"
+#include "compress.h"
+#include "fuzzy.h"
+#include "preload.h"
+#include "input.h"
+#include "render.h"
+#include "regex.h"
+#include "utf8.h"
 
 #include <stdio.h>
 
@@ -20,16 +37,36 @@
 
 static bool window_should_close;
 
-Array<System_Event *> system_events;
+Input_Ring input_ring;
+Array<System_Event> frame_events; // taken from the ring each frame, kept to reuse its storage
 Key_Code keycode_lookup[256];
-Key_Stroke *active_key_stroke;
-Text_Input *active_text_input;
+Text_Input *active_text_input; // of the key stroke being handled
+int64 command_count = 1; // times a held key repeated the command this frame, for those that take a count
 
 View *active_view;
 
-Render_Target render_target;
+Renderer renderer;
 
 Find_File_Dialog find_file_dialog;
+Preloader preloader;
+Prompt prompt;
+
+Project_Search *project_search;
+char *replace_pattern;
+int replace_flags;
+Buffer *search_results_buffer;
+Key_Map *search_results_key_map;
+
+Array<Follow *> follows;
+Buffer_Registry registry;
+Session session;
+
+Key_Map *diff_key_map;
+
+Occur *current_occur;
+Buffer *occur_source;
+Buffer *occur_results_buffer;
+Key_Map *occur_results_key_map;
 
 float rect_width(Rect rect) {
     float result;
@@ -43,15 +80,19 @@ float rect_height(Rect rect) {
     return result;
 }
 
+int64 view_rows_on_screen(View *view) {
+    int64 rows = (int64)(rect_height(view->rect) / view->face->glyph_height);
+    return rows > 0 ? rows : 1;
+}
+
 // @todo add options for adjusting view focus (top, center, bottom)
 void ensure_cursor_in_view(View *view, Cursor cursor) {
-    float cursor_top = cursor.line * view->face->glyph_height - view->y_off;
-    float cursor_bottom = cursor_top + view->face->glyph_height;
-    if (cursor_top < 0) {
-        view->y_off += (int)cursor_top;
-    } else if (cursor_bottom >= rect_height(view->rect)) {
-        float d = cursor_bottom - rect_height(view->rect);
-        view->y_off += (int)d;
+    int64 row = view_get_row(view, cursor.line);
+    int64 rows = view_rows_on_screen(view);
+    if (row < view->scroll_row) {
+        view->scroll_row = row;
+    } else if (row >= view->scroll_row + rows) {
+        view->scroll_row = row - rows + 1;
     }
 }
 
@@ -81,19 +122,19 @@ COMMAND(newline) {
 
 COMMAND(self_insert) {
     View *view = active_view;
-    String insert_string = string_copy({active_text_input->text, 1});
     if (active_text_input) {
+        String insert_string = string_copy({active_text_input->text, active_text_input->count});
         if (view->mark_active) {
-            String string = { active_text_input->text, 1 };
+            String string = { active_text_input->text, active_text_input->count };
             int64 start = view->cursor.position < view->mark.position ? view->cursor.position : view->mark.position;
             int64 end = view->cursor.position < view->mark.position ? view->mark.position : view->cursor.position;
             buffer_replace_region(view->buffer, string, start, end);
             view->mark_active = false;
             view_set_cursor(view, get_cursor_from_position(view->buffer, start));
         } else {
-            buffer_insert_single(view->buffer, view->cursor.position, active_text_input->text[0]);
+            buffer_insert_text(view->buffer, view->cursor.position, insert_string);
             buffer_record_insert(view->buffer, view->cursor.position, insert_string);
-            view_set_cursor(view, get_cursor_from_position(view->buffer, view->cursor.position + 1));
+            view_set_cursor(view, get_cursor_from_position(view->buffer, view->cursor.position + insert_string.count));
         }
         if (view->buffer->post_self_insert_hook) view->buffer->post_self_insert_hook(active_text_input);
     } else {
@@ -103,18 +144,36 @@ COMMAND(self_insert) {
 
 COMMAND(backward_char) {
     View *view = active_view;
-    if (view->cursor.position > 0) {
-        Cursor cursor = get_cursor_from_position(view->buffer, view->cursor.position - 1);
-        view_set_cursor(view, cursor);
+    Cursor cursor = view->cursor;
+    for (int64 i = 0; i < command_count && cursor.position > 0; i++) {
+        Cursor prev = get_cursor_from_position(view->buffer, buffer_prev_codepoint(view->buffer, cursor.position));
+        if (!view_line_is_visible(view, prev.line)) {
+            // Skip to the end of the previous shown line
+            int64 row = view_get_row(view, prev.line) - 1;
+            if (row < 0) break;
+            int64 line = view_get_line(view, row);
+            prev = get_cursor_from_position(view->buffer, get_position_from_line(view->buffer, line) + buffer_get_line_length(view->buffer, line));
+        }
+        cursor = prev;
     }
+    if (cursor.position != view->cursor.position) view_set_cursor(view, cursor);
 }
 
 COMMAND(forward_char) {
     View *view = active_view;
-    if (view->cursor.position < buffer_get_length(view->buffer)) {
-        Cursor cursor = get_cursor_from_position(view->buffer, view->cursor.position + 1);
-        view_set_cursor(view, cursor);
+    int64 buffer_length = buffer_get_length(view->buffer);
+    Cursor cursor = view->cursor;
+    for (int64 i = 0; i < command_count && cursor.position < buffer_length; i++) {
+        Cursor next = get_cursor_from_position(view->buffer, buffer_next_codepoint(view->buffer, cursor.position));
+        if (!view_line_is_visible(view, next.line)) {
+            // Skip to the start of the next shown line
+            int64 row = view_get_row(view, next.line);
+            if (row >= view_get_row_count(view)) break;
+            next = get_cursor_from_line(view->buffer, view_get_line(view, row));
+        }
+        cursor = next;
     }
+    if (cursor.position != view->cursor.position) view_set_cursor(view, cursor);
 }
 
 COMMAND(forward_word) {
@@ -123,17 +182,17 @@ COMMAND(forward_word) {
     char first = buffer_at(view->buffer, view->cursor.position);
     int64 position = view->cursor.position;
     // eat whitespace
-    if (isspace(first)) {
+    if (isspace((unsigned char)first)) {
         for (; position < buffer_length; position++) {
             char c = buffer_at(view->buffer, position);
-            if (!isspace(c)) {
+            if (!isspace((unsigned char)c)) {
                 break;
             }
         }
     }
     for (; position < buffer_length; position++) {
         char c = buffer_at(view->buffer, position);
-        if (isspace(c)) {
+        if (isspace((unsigned char)c)) {
             break;
         }
     }
@@ -147,17 +206,17 @@ COMMAND(backward_word) {
     char first = buffer_at(view->buffer, view->cursor.position);
     int64 position = view->cursor.position;
     // eat whitespace
-    if (isspace(first)) {
+    if (isspace((unsigned char)first)) {
         for (; position >= 0; position--) {
             char c = buffer_at(view->buffer, position);
-            if (!isspace(c)) {
+            if (!isspace((unsigned char)c)) {
                 break;
             }
         }
     }
     for (position = position - 1; position >= 0; position--) {
         char c = buffer_at(view->buffer, position);
-        if (isspace(c)) {
+        if (isspace((unsigned char)c)) {
             break;
         }
     }
@@ -172,7 +231,7 @@ COMMAND(backward_paragraph) {
         bool blank_line = true;
         for (int64 position = start; position < end; position++) {
             char c = buffer_at(view->buffer, position);
-            if (!isspace(c)) {
+            if (!isspace((unsigned char)c)) {
                 blank_line = false;
                 break;
             }
@@ -192,7 +251,7 @@ COMMAND(forward_paragraph) {
         bool blank_line = true;
         for (int64 position = start; position < end; position++) {
             char c = buffer_at(view->buffer, position);
-            if (!isspace(c)) {
+            if (!isspace((unsigned char)c)) {
                 blank_line = false;
                 break;
             }
@@ -206,8 +265,11 @@ COMMAND(forward_paragraph) {
 
 COMMAND(previous_line) {
     View *view = active_view;
-    if (view->cursor.line > 0) {
-        int64 position = get_position_from_line(view->buffer, view->cursor.line - 1);
+    int64 row = view_get_row(view, view->cursor.line);
+    if (row > 0) {
+        row = row > command_count ? row - command_count : 0;
+        int64 column = buffer_get_column(view->buffer, view->cursor.line, view->cursor.position);
+        int64 position = buffer_get_position_from_column(view->buffer, view_get_line(view, row), column);
         Cursor cursor = get_cursor_from_position(view->buffer, position);
         view_set_cursor(view, cursor);
     }
@@ -215,8 +277,14 @@ COMMAND(previous_line) {
 
 COMMAND(next_line) {
     View *view = active_view;
-    if (view->cursor.line < buffer_get_line_count(view->buffer) - 1) {
-        int64 position = get_position_from_line(view->buffer, view->cursor.line + 1);
+    int64 row = view_get_row(view, view->cursor.line);
+    if (view_line_is_visible(view, view->cursor.line)) row++;
+    int64 row_count = view_get_row_count(view);
+    if (row < row_count) {
+        row += command_count - 1;
+        if (row >= row_count) row = row_count - 1;
+        int64 column = buffer_get_column(view->buffer, view->cursor.line, view->cursor.position);
+        int64 position = buffer_get_position_from_column(view->buffer, view_get_line(view, row), column);
         Cursor cursor = get_cursor_from_position(view->buffer, position);
         view_set_cursor(view, cursor);
     }
@@ -233,9 +301,10 @@ COMMAND(backward_delete_char) {
         }
         view->mark_active = false;
     } else if (view->cursor.position > 0) {
-        buffer_record_delete(view->buffer, view->cursor.position - 1, view->cursor.position);
-        buffer_delete_single(view->buffer, view->cursor.position);
-        Cursor cursor = get_cursor_from_position(view->buffer, view->cursor.position - 1);
+        int64 start = buffer_prev_codepoint(view->buffer, view->cursor.position);
+        buffer_record_delete(view->buffer, start, view->cursor.position);
+        buffer_delete_region(view->buffer, start, view->cursor.position);
+        Cursor cursor = get_cursor_from_position(view->buffer, start);
         view_set_cursor(view, cursor);
     }
 }
@@ -251,8 +320,9 @@ COMMAND(forward_delete_char) {
         }
         view->mark_active = false;
     } else if (view->cursor.position < buffer_get_length(view->buffer)) {
-        buffer_record_delete(view->buffer, view->cursor.position, view->cursor.position + 1);
-        buffer_delete_single(view->buffer, view->cursor.position + 1);
+        int64 end = buffer_next_codepoint(view->buffer, view->cursor.position);
+        buffer_record_delete(view->buffer, view->cursor.position, end);
+        buffer_delete_region(view->buffer, view->cursor.position, end);
         Cursor cursor = get_cursor_from_position(view->buffer, view->cursor.position);
         view_set_cursor(view, cursor);
     }
@@ -264,17 +334,17 @@ COMMAND(backward_delete_word) {
     char first = buffer_at(view->buffer, view->cursor.position);
     int64 position = view->cursor.position;
     // eat whitespace
-    if (isspace(first)) {
+    if (isspace((unsigned char)first)) {
         for (; position >= 0; position--) {
             char c = buffer_at(view->buffer, position);
-            if (!isspace(c)) {
+            if (!isspace((unsigned char)c)) {
                 break;
             }
         }
     }
     for (position = position - 1; position >= 0; position--) {
         char c = buffer_at(view->buffer, position);
-        if (isspace(c)) {
+        if (isspace((unsigned char)c)) {
             break;
         }
     }
@@ -292,17 +362,17 @@ COMMAND(forward_delete_word) {
     char first = buffer_at(view->buffer, view->cursor.position);
     int64 position = view->cursor.position;
     // eat whitespace
-    if (isspace(first)) {
+    if (isspace((unsigned char)first)) {
         for (; position < buffer_length; position++) {
             char c = buffer_at(view->buffer, position);
-            if (!isspace(c)) {
+            if (!isspace((unsigned char)c)) {
                 break;
             }
         }
     }
     for (; position < buffer_length; position++) {
         char c = buffer_at(view->buffer, position);
-        if (isspace(c)) {
+        if (isspace((unsigned char)c)) {
             break;
         }
     }
@@ -337,6 +407,7 @@ COMMAND(undo) {
     for (Edit_Record *edit = buffer->edit_history; edit; edit = edit->prev) {
         if (edit->type == EDIT_RECORD_INSERT) printf("INSERT ");
         else if (edit->type == EDIT_RECORD_DELETE) printf("DELETE ");
+        else if (edit->type == EDIT_RECORD_REPLACE_ALL) continue;
         printf("%lld,%lld ", edit->span.start, edit->span.end);
         printf(": %s\n", edit->text.data);
     }
@@ -352,58 +423,66 @@ COMMAND(undo) {
             buffer_insert_text(buffer, edit->span.start, edit->text);
             view_set_cursor(view, get_cursor_from_position(buffer, edit->span.end));
             break;
+        case EDIT_RECORD_REPLACE_ALL:
+        {
+            int64 position = view->cursor.position;
+            buffer_undo_replace_all(buffer, edit);
+            position = CLAMP(position, 0, buffer_get_length(buffer));
+            view_set_cursor(view, get_cursor_from_position(buffer, position));
+            break;
+        }
         }
 
         buffer->edit_history = edit->prev;
-        delete edit;
+        edit_record_free(edit);
     }
 }
 
 // @todo scroll ensure cursor keeps up
 COMMAND(wheel_scroll_up) {
     View *view = active_view;
-    float delta = -2.0f * view->face->glyph_height;
-    view->y_off += (int)delta;
+    view->scroll_row -= 2;
+    if (view->scroll_row < 0) view->scroll_row = 0;
 }
 
 COMMAND(wheel_scroll_down) {
     View *view = active_view;
-    float delta = 2.0f * view->face->glyph_height;
-    view->y_off += (int)delta;
+    view->scroll_row += 2;
+    if (view->scroll_row > view_get_row_count(view) - 1) view->scroll_row = MAX(view_get_row_count(view) - 1, 0);
 }
 
 COMMAND(scroll_page_up) {
     View *view = active_view;
-    int lines_per_page = (int)(rect_height(view->rect) / view->face->glyph_height);
-    int page_line = (int)(view->y_off / view->face->glyph_height);
-    float cursor_y = view->face->glyph_height * view->cursor.line - view->y_off;
-    int lines_from_top = (int)(cursor_y / view->face->glyph_height);
+    if (view_get_row_count(view) == 0) return;
+    int64 lines_per_page = view_rows_on_screen(view);
+    int64 row = CLAMP(view->scroll_row, 0, view_get_row_count(view) - 1);
 
-    int64 line = view->cursor.line - lines_from_top;
-    line = CLAMP(line, 0, buffer_get_line_count(view->buffer) - 1);
-
-    view->y_off = (int)((line - lines_per_page) * view->face->glyph_height);
-    view->y_off = view->y_off < 0 ? 0 : view->y_off;
-    view_set_cursor(view, get_cursor_from_line(view->buffer, line));
+    view->scroll_row = row - lines_per_page;
+    view->scroll_row = view->scroll_row < 0 ? 0 : view->scroll_row;
+    view_set_cursor(view, get_cursor_from_line(view->buffer, view_get_line(view, row)));
 }
 
 COMMAND(scroll_page_down) {
     View *view = active_view;
-    float cursor_y = view->face->glyph_height * view->cursor.line - view->y_off;
-
-    int lines_from_bottom = (int)((rect_height(view->rect) - cursor_y) / view->face->glyph_height);
-    int64 line = view->cursor.line + lines_from_bottom;
-    line = CLAMP(line, 0, buffer_get_line_count(view->buffer) - 1);
-
-    view->y_off = (int)(line * view->face->glyph_height);
-    int max_y_off = (int)((buffer_get_line_count(view->buffer) - 4) * view->face->glyph_height);
-    view->y_off = view->y_off > max_y_off ? max_y_off : view->y_off;
-    view_set_cursor(view, get_cursor_from_line(view->buffer, line));
+    if (view_get_row_count(view) == 0) return;
+    int64 row = view->scroll_row + view_rows_on_screen(view);
+    row = CLAMP(row, 0, view_get_row_count(view) - 1);
+
+    view->scroll_row = row;
+    int64 max_scroll_row = view_get_row_count(view) - 4;
+    view->scroll_row = view->scroll_row > max_scroll_row ? max_scroll_row : view->scroll_row;
+    view->scroll_row = view->scroll_row < 0 ? 0 : view->scroll_row;
+    view_set_cursor(view, get_cursor_from_line(view->buffer, view_get_line(view, row)));
 }
 
 void write_buffer(Buffer *buffer) {
     // String buffer_string = buffer_to_string(buffer);
     String buffer_string = buffer_to_string_apply_line_endings(buffer);
+    if (buffer->encoding != TEXT_ENCODING_UTF8) {
+        String encoded = encode_text(buffer->encoding, buffer_string.data, buffer_string.count);
+        free(buffer_string.data);
+        buffer_string = encoded;
+    }
     DWORD bytes_written = 0;
     HANDLE file_handle = CreateFileA((LPCSTR)buffer->file_name, GENERIC_WRITE, 0, NULL, TRUNCATE_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
     if (file_handle == INVALID_HANDLE_VALUE) {
@@ -421,6 +500,12 @@ void write_buffer(Buffer *buffer) {
         }
         CloseHandle(file_handle);
     }
+    // So the write doesn't look like another program changed the file
+    File_Attributes attributes = get_file_attributes(buffer->file_name);
+    buffer->last_write_time = attributes.last_write_time;
+    buffer->file_size = attributes.file_size;
+    buffer->saved_version = buffer->version;
+    if (buffer->journal) journal_saved(buffer->journal);
     free(buffer_string.data);
 }
 
@@ -448,11 +533,24 @@ COMMAND(goto_end_of_line) {
 
 COMMAND(goto_first_line) {
     View *view = active_view;
+    if (view_get_filter(view)) {
+        if (view_get_row_count(view) == 0) return;
+        view_set_cursor(view, get_cursor_from_line(view->buffer, view_get_line(view, 0)));
+        return;
+    }
     view_set_cursor(view, get_cursor_from_position(view->buffer, 0));
 }
 
 COMMAND(goto_last_line) {
     View *view = active_view;
+    buffer_index_finish(view->buffer);
+    if (view_get_filter(view)) {
+        if (view_get_row_count(view) == 0) return;
+        int64 line = view_get_line(view, view_get_row_count(view) - 1);
+        int64 position = get_position_from_line(view->buffer, line) + buffer_get_line_length(view->buffer, line);
+        view_set_cursor(view, get_cursor_from_position(view->buffer, position));
+        return;
+    }
     view_set_cursor(view, get_cursor_from_position(view->buffer, view->buffer->size - (view->buffer->gap_end - view->buffer->gap_start)));
 }
 
@@ -462,21 +560,121 @@ COMMAND(find_file) {
     active_view = find_file_dialog.view;
 }
 
+bool buffer_is_busy(Buffer *buffer, void *data);
+
+// Shows a file in the view. A file has one buffer in the registry, read when
+// it's first shown (or again after being evicted, or taken ready from the preloader) along with the journal of
+// its unsaved edits and decompressed if it sat idle, and the view goes back to where the file was left,
+// earlier or in the session saved at exit.
+bool view_open_file(View *view, const char *file_name) {
+    char *path = registry_path(file_name);
+    Registry_Entry *entry = registry_find(&registry, path);
+    if ((!entry || !entry->buffer) && !path_file_exists(path)) {
+        printf("%s: no such file\n", file_name);
+        free(path);
+        return false;
+    }
+    if (view->buffer) {
+        Session_Entry *current = session_find(&session, view->buffer->file_name);
+        if (current) session_store_view(current, view);
+    }
+    if (!entry) entry = registry_add(&registry, path);
+    Session_Entry *state = session_find(&session, path);
+    if (!state) state = session_add(&session, path);
+    free(path);
+
+    if (!entry->buffer) {
+        Buffer *buffer = preload_take(&preloader, entry->path);
+        if (!buffer) buffer = make_buffer_from_file(entry->path);
+        if (state->last_write_time && !session_entry_matches(state, buffer)) {
+            printf("%s: changed since it was last shown\n", entry->path);
+            state->cursor_position = state->mark_position = state->scroll_position = 0;
+            state->mark_active = false;
+        }
+        journal_open(buffer);
+        entry->buffer = buffer;
+    }
+    buffer_decompress(entry->buffer);
+    registry_shown(&registry, entry);
+
+    view->buffer = entry->buffer;
+    view->mark_active = false;
+    view->cursor = {};
+    view->mark = {};
+    view->scroll_row = 0;
+    view->estimated_position = -1;
+    session_restore_view(state, view);
+    session.active = state - session.entries.data;
+    // The buffer just left may be the one that has to go
+    registry_evict(&registry, buffer_is_busy, view);
+    return true;
+}
+
+static char *find_file_selected_path(Find_File_Dialog *dialog) {
+    String root = STRZ(dialog->index->root);
+    String match = STRZ((char *)file_index_path(dialog->index, dialog->matches[dialog->selected].index));
+    int64 capacity = root.count + match.count + 2;
+    char *path = (char *)malloc(capacity);
+    path_join_into(path, capacity, root, match);
+    return path;
+}
+
+// Opens the selected match, or what was typed when it names a file itself
 COMMAND(find_file_enter) {
     find_file_dialog.is_active = false;
 
     String file_name = buffer_to_string(find_file_dialog.view->buffer);
+    if (find_file_dialog.match_count > 0 && !path_file_exists(file_name.data)) {
+        char *path = find_file_selected_path(&find_file_dialog);
+        free(file_name.data);
+        file_name = STRZ(path);
+    }
     printf("Opening %s\n", file_name.data);
 
     View *view = find_file_dialog.last_active;
-    Buffer *buffer = make_buffer_from_file(file_name.data);
-    view->buffer = buffer;
-    view->mark_active = false;
-    view->cursor = {};
-    view->mark = {};
-    view->y_off = 0;
+    view_open_file(view, file_name.data);
+    free(file_name.data);
     active_view = view;
     buffer_clear(find_file_dialog.view->buffer);
+    find_file_dialog.view->cursor = {};
+}
+
+COMMAND(find_file_next) {
+    if (find_file_dialog.selected + 1 < find_file_dialog.match_count) find_file_dialog.selected++;
+    find_file_dialog.rest_frames = 0;
+}
+
+COMMAND(find_file_previous) {
+    if (find_file_dialog.selected > 0) find_file_dialog.selected--;
+    find_file_dialog.rest_frames = 0;
+}
+
+// Called every frame. The index follows the tree even while the dialog is
+// closed, the matches are found again when the query or the index changed.
+// A match the selection rests on is read ahead, so it opens without the wait.
+void find_file_update(Find_File_Dialog *dialog) {
+    file_index_update(dialog->index);
+    if (!dialog->is_active) return;
+    Buffer *buffer = dialog->view->buffer;
+    if (buffer->version != dialog->query_version || dialog->index->version != dialog->index_version) {
+        dialog->query_version = buffer->version;
+        dialog->index_version = dialog->index->version;
+
+        String query = buffer_to_string(buffer);
+        dialog->match_count = file_index_query(dialog->index, &dialog->matcher, query, dialog->matches, FILE_INDEX_MAX_RESULTS);
+        dialog->selected = 0;
+        dialog->rest_frames = 0;
+        free(query.data);
+    }
+
+    if (dialog->match_count > 0 && ++dialog->rest_frames == PRELOAD_DELAY_FRAMES) {
+        char *selected = find_file_selected_path(dialog);
+        char *path = registry_path(selected);
+        Registry_Entry *entry = registry_find(&registry, path);
+        if (!entry || !entry->buffer) preload_request(&preloader, path);
+        free(path);
+        free(selected);
+    }
 }
 
 COMMAND(find_file_escape) {
@@ -484,34 +682,541 @@ COMMAND(find_file_escape) {
     active_view = find_file_dialog.last_active;
 }
 
-void *allocate_system_event(size_t size) {
-    void *event = calloc(1, size); 
-    return event;
+void prompt_begin(const char *label, Prompt_Proc on_enter) {
+    prompt.label = label;
+    prompt.on_enter = on_enter;
+    prompt.last_active = active_view;
+    prompt.is_active = true;
+    buffer_clear(prompt.view->buffer);
+    prompt.view->cursor = {};
+    active_view = prompt.view;
+}
+
+COMMAND(prompt_enter) {
+    prompt.is_active = false;
+    active_view = prompt.last_active;
+    String text = buffer_to_string(prompt.view->buffer);
+    if (text.count > 0) {
+        prompt.on_enter(text);
+    }
+    free(text.data);
+}
+
+COMMAND(prompt_escape) {
+    prompt.is_active = false;
+    active_view = prompt.last_active;
+}
+
+// Goes to the buffer whose path fuzzy matches the text best, the one shown most recently on a tie
+void switch_buffer_enter(String text) {
+    View *view = active_view;
+    Registry_Entry *best = nullptr;
+    int32 best_score = 0;
+    for (size_t i = 0; i < registry.entries.count; i++) {
+        Registry_Entry *entry = &registry.entries[i];
+        if (entry->buffer && entry->buffer == view->buffer) continue;
+        int32 score;
+        if (!fuzzy_score(entry->path, text, &score)) continue;
+        if (!best || score > best_score || (score == best_score && entry->last_shown > best->last_shown)) {
+            best = entry;
+            best_score = score;
+        }
+    }
+    if (!best) {
+        printf("No buffer matches %s\n", text.data);
+        return;
+    }
+    view_open_file(view, best->path);
+}
+
+COMMAND(switch_buffer) {
+    prompt_begin("Switch to buffer: ", switch_buffer_enter);
+}
+
+// Runs the command of the view's key map whose name fuzzy matches the text best
+void execute_command_enter(String text) {
+    Key_Map *key_map = active_view->buffer->key_map ? active_view->buffer->key_map : active_view->key_map;
+    Key_Command *best = nullptr;
+    int32 best_score = 0;
+    for (int key = 0; key < MAX_KEY_COUNT; key++) {
+        Key_Command *command = &key_map->commands[key];
+        if (!command->procedure || !command->name) continue;
+        int32 score;
+        if (!fuzzy_score(command->name, text, &score)) continue;
+        if (!best || score > best_score) {
+            best = command;
+            best_score = score;
+        }
+    }
+    if (!best) {
+        printf("No command matches %s\n", text.data);
+        return;
+    }
+    printf("%s\n", best->name);
+    best->procedure();
+}
+
+COMMAND(execute_command) {
+    prompt_begin("Command: ", execute_command_enter);
+}
+
+// Back to the buffer shown before this one
+COMMAND(previous_buffer) {
+    View *view = active_view;
+    Registry_Entry *best = nullptr;
+    for (size_t i = 0; i < registry.entries.count; i++) {
+        Registry_Entry *entry = &registry.entries[i];
+        if (entry->buffer && entry->buffer == view->buffer) continue;
+        if (!best || entry->last_shown > best->last_shown) best = entry;
+    }
+    if (best) view_open_file(view, best->path);
+}
+
+void set_buffer_budget_enter(String text) {
+    char *end = nullptr;
+    int64 megabytes = strtoll(text.data, &end, 10);
+    if (end == text.data || megabytes < 0) return;
+    registry.budget = megabytes * 1024 * 1024;
+    int64 evicted = registry_evict(&registry, buffer_is_busy, active_view);
+    printf("Buffers: %lld MB loaded, %lld evicted\n", (long long)(registry_memory_size(&registry) >> 20), (long long)evicted);
+}
+
+COMMAND(set_buffer_budget) {
+    prompt_begin("Buffer memory budget (MB): ", set_buffer_budget_enter);
+}
+
+void search_project_enter(String pattern) {
+    if (project_search) {
+        project_search_cancel(project_search);
+        project_search = nullptr;
+    }
+
+    char *root = path_current_dir();
+    const char *error = nullptr;
+    Project_Search *search = project_search_start(root, pattern.data, &error);
+    free(root);
+    if (!search) {
+        printf("search_project: %s\n", error);
+        return;
+    }
+    project_search = search;
+
+    if (!search_results_buffer) {
+        search_results_buffer = make_buffer("*search*");
+        search_results_buffer->key_map = search_results_key_map;
+    }
+    buffer_clear(search_results_buffer);
+
+    View *view = active_view;
+    view->buffer = search_results_buffer;
+    view->mark_active = false;
+    view->cursor = {};
+    view->mark = {};
+    view->scroll_row = 0;
+}
+
+COMMAND(search_project) {
+    prompt_begin("Search project: ", search_project_enter);
+}
+
+void replace_all_enter(String replacement) {
+    const char *error = nullptr;
+    Regex *regex = regex_compile(replace_pattern, replace_flags, &error);
+    if (!regex) {
+        printf("replace_all: %s\n", error);
+        return;
+    }
+
+    View *view = active_view;
+    Buffer *buffer = view->buffer;
+    int64 position = view->cursor.position;
+    bool expand_captures = !(replace_flags & REGEX_FLAG_LITERAL);
+    int64 count = buffer_replace_all(buffer, regex, replacement, expand_captures);
+    regex_free(regex);
+    printf("replace_all: %lld replacements\n", count);
+
+    if (count > 0) {
+        view->mark_active = false;
+        position = CLAMP(position, 0, buffer_get_length(buffer));
+        view_set_cursor(view, get_cursor_from_position(buffer, position));
+    }
 }
 
-Window_Resize *make_window_resize_event(int width, int height) {
-    Window_Resize *event = (Window_Resize *)allocate_system_event(sizeof(Window_Resize));
-    *event = Window_Resize();
-    event->type = SYSTEM_EVENT_WINDOW_RESIZE;
-    event->width = width;
-    event->height = height;
-    return event;
+void replace_all_pattern_enter(String pattern) {
+    free(replace_pattern);
+    replace_pattern = (char *)malloc(pattern.count + 1);
+    memcpy(replace_pattern, pattern.data, pattern.count);
+    replace_pattern[pattern.count] = 0;
+    prompt_begin(replace_flags & REGEX_FLAG_LITERAL ? "Replace string with: " : "Replace regex with: ", replace_all_enter);
 }
 
-Key_Stroke *make_key_stroke_event(Key_Code code, Key_Modifiers modifiers) {
-    Key_Stroke *key_stroke = (Key_Stroke *)allocate_system_event(sizeof(Key_Stroke));
-    *key_stroke = Key_Stroke();
-    key_stroke->code = code;
-    key_stroke->modifiers = modifiers;
-    return key_stroke;
+COMMAND(replace_all) {
+    replace_flags = REGEX_FLAG_NONE;
+    prompt_begin("Replace regex: ", replace_all_pattern_enter);
+}
+
+COMMAND(replace_all_literal) {
+    replace_flags = REGEX_FLAG_LITERAL;
+    prompt_begin("Replace string: ", replace_all_pattern_enter);
+}
+
+void occur_enter(String pattern) {
+    View *view = active_view;
+    Buffer *source = view->buffer;
+    if (source == occur_results_buffer) {
+        if (!occur_source) return;
+        source = occur_source;
+    }
+
+    if (current_occur) {
+        occur_cancel(current_occur);
+        current_occur = nullptr;
+    }
+
+    const char *error = nullptr;
+    Occur *new_occur = occur_start(source, pattern.data, &error);
+    if (!new_occur) {
+        printf("occur: %s\n", error);
+        return;
+    }
+    current_occur = new_occur;
+    occur_source = source;
+
+    if (!occur_results_buffer) {
+        occur_results_buffer = make_buffer("*occur*");
+        occur_results_buffer->key_map = occur_results_key_map;
+    }
+    buffer_clear(occur_results_buffer);
+
+    view->buffer = occur_results_buffer;
+    view->mark_active = false;
+    view->cursor = {};
+    view->mark = {};
+    view->scroll_row = 0;
 }
 
-Text_Input *make_text_input(char *text, int64 count) {
-    Text_Input *text_input = (Text_Input *)allocate_system_event(sizeof(Text_Input));
-    *text_input = Text_Input();
-    text_input->text = text;
-    text_input->count = count;
-    return text_input; 
+COMMAND(occur) {
+    prompt_begin("Occur: ", occur_enter);
+}
+
+void goto_line_enter(String text) {
+    View *view = active_view;
+    Buffer *buffer = view->buffer;
+    char *end = nullptr;
+    int64 line = strtoll(text.data, &end, 10) - 1;
+    if (end == text.data) return;
+    if (line < 0) line = 0;
+    view->mark_active = false;
+
+    if (buffer->indexer && line > buffer_get_line_count(buffer) - 2) {
+        // Past the indexed lines, show a guess until the indexer gets there
+        view->estimated_position = buffer_estimate_position_from_line(buffer, line);
+        return;
+    }
+
+    line = CLAMP(line, 0, buffer_get_line_count(buffer) - 1);
+    if (view_get_filter(view)) {
+        if (view_get_row_count(view) == 0) return;
+        int64 row = MIN(view_get_row(view, line), view_get_row_count(view) - 1);
+        line = view_get_line(view, row);
+    }
+    view->scroll_row = MAX(view_get_row(view, line) - view_rows_on_screen(view) / 2, 0);
+    view_set_cursor(view, get_cursor_from_line(buffer, line));
+}
+
+COMMAND(goto_line) {
+    prompt_begin("Goto line: ", goto_line_enter);
+}
+
+// A view showing a guessed position settles on the real line once it's
+// indexed, or right away when a command needs the cursor
+void view_resolve_estimate(View *view, bool finish) {
+    if (view->estimated_position < 0) return;
+    Buffer *buffer = view->buffer;
+    if (finish) buffer_index_finish(buffer);
+    if (buffer->indexer && view->estimated_position >= buffer_indexed_length(buffer)) return;
+    int64 line = get_line_from_position(buffer, view->estimated_position);
+    view->estimated_position = -1;
+    view->scroll_row = view_get_row(view, line);
+    view->cursor = get_cursor_from_line(buffer, line);
+}
+
+COMMAND(goto_occur_result) {
+    View *view = active_view;
+    if (!occur_source) return;
+    int64 start = get_position_from_line(view->buffer, view->cursor.line);
+    int64 length = buffer_get_line_length(view->buffer, view->cursor.line);
+    String line = buffer_to_string_span(view->buffer, { start, start + length });
+    int64 line_number = 0;
+    if (line.data && parse_occur_result(line, &line_number)) {
+        view->buffer = occur_source;
+        view->mark_active = false;
+        view->mark = {};
+        view->scroll_row = 0;
+        int64 target = CLAMP(line_number - 1, 0, buffer_get_line_count(occur_source) - 1);
+        view_set_cursor(view, get_cursor_from_line(occur_source, target));
+    }
+    free(line.data);
+}
+
+void view_set_filter(View *view, Line_Filter *filter) {
+    if (view->filter) line_filter_free(view->filter);
+    view->filter = filter;
+    view->mark_active = false;
+    view->scroll_row = 0;
+
+    int64 row_count = view_get_row_count(view);
+    if (row_count == 0) return;
+    Cursor cursor = view->cursor;
+    if (!view_line_is_visible(view, cursor.line)) {
+        int64 row = view_get_row(view, cursor.line);
+        if (row >= row_count) row = row_count - 1;
+        cursor = get_cursor_from_line(view->buffer, view_get_line(view, row));
+    }
+    view_set_cursor(view, cursor);
+}
+
+void filter_lines_apply(String pattern, bool invert) {
+    View *view = active_view;
+    const char *error = nullptr;
+    Line_Filter *filter = make_line_filter(view->buffer, pattern.data, invert, &error);
+    if (!filter) {
+        printf("filter_lines: %s\n", error);
+        return;
+    }
+    view_set_filter(view, filter);
+}
+
+void filter_lines_enter(String pattern) {
+    filter_lines_apply(pattern, false);
+}
+
+void hide_lines_enter(String pattern) {
+    filter_lines_apply(pattern, true);
+}
+
+COMMAND(filter_lines) {
+    prompt_begin("Show lines matching: ", filter_lines_enter);
+}
+
+COMMAND(hide_lines) {
+    prompt_begin("Hide lines matching: ", hide_lines_enter);
+}
+
+COMMAND(clear_filter) {
+    View *view = active_view;
+    if (view->filter) view_set_filter(view, nullptr);
+}
+
+Follow *find_follow(Buffer *buffer) {
+    for (size_t i = 0; i < follows.count; i++) {
+        if (follows[i]->buffer == buffer) return follows[i];
+    }
+    return nullptr;
+}
+
+// Toggles tailing the file of the active buffer
+COMMAND(follow_mode) {
+    Buffer *buffer = active_view->buffer;
+    Follow *follow = find_follow(buffer);
+    if (follow) {
+        for (size_t i = 0; i < follows.count; i++) {
+            if (follows[i] == follow) {
+                follows[i] = follows.back();
+                follows.pop();
+                break;
+            }
+        }
+        follow_stop(follow);
+        if (!buffer->journal) journal_open(buffer);
+        return;
+    }
+    follow = follow_start(buffer);
+    if (!follow) return;
+    follows.push(follow);
+    // What a followed buffer gains comes from its file, there is nothing to journal
+    if (buffer->journal) {
+        journal_saved(buffer->journal);
+        journal_close(buffer->journal);
+    }
+}
+
+// Buffers something still points at stay loaded whatever the budget says
+bool buffer_is_busy(Buffer *buffer, void *data) {
+    View *view = (View *)data;
+    if (view->buffer == buffer || find_follow(buffer) || occur_source == buffer) return true;
+    if (current_occur && current_occur->source == buffer) return true;
+    if (view->filter && view->filter->buffer == buffer) return true;
+    if (view->diff && (view->diff->old_buffer == buffer || view->diff->new_buffer == buffer)) return true;
+    return false;
+}
+
+// Appends what the followed files gained. A cursor at the end of its buffer
+// stays at the end, which keeps the newest lines on screen.
+void follows_update(View *view) {
+    for (size_t i = 0; i < follows.count; i++) {
+        Follow *follow = follows[i];
+        Buffer *buffer = follow->buffer;
+        bool at_end = view->buffer == buffer && view->cursor.position == buffer_get_length(buffer);
+        if (!follow_update(follow) || view->buffer != buffer) continue;
+
+        int64 length = buffer_get_length(buffer);
+        if (at_end) {
+            view_set_cursor(view, get_cursor_from_position(buffer, length));
+        } else {
+            // A truncated file may have taken the cursor's line with it
+            view->cursor = get_cursor_from_position(buffer, MIN(view->cursor.position, length));
+            view->scroll_row = MIN(view->scroll_row, MAX(view_get_row_count(view) - 1, 0));
+        }
+        if (view->mark.position > length) view->mark = view->cursor;
+    }
+}
+
+// Picks up changes another program made to the file of the shown buffer. A
+// buffer with unsaved edits is left alone instead of merged with the file.
+void reload_update(View *view) {
+    static int32 frames_since_poll;
+    if (++frames_since_poll < RELOAD_POLL_FRAMES) return;
+    frames_since_poll = 0;
+
+    Buffer *buffer = view->buffer;
+    if (buffer->indexer || find_follow(buffer) || !buffer_file_changed(buffer)) return;
+    if (buffer->version != buffer->saved_version) {
+        printf("%s: changed on disk, keeping the unsaved edits\n", buffer->file_name);
+        File_Attributes attributes = get_file_attributes(buffer->file_name);
+        buffer->last_write_time = attributes.last_write_time;
+        buffer->file_size = attributes.file_size;
+        return;
+    }
+
+    static Array<Reload_Change> changes;
+    int64 cursor_position = view->cursor.position;
+    int64 mark_position = view->mark.position;
+    if (!buffer_reload(buffer, &changes)) return;
+    if (buffer->journal) journal_saved(buffer->journal);
+    view->cursor = get_cursor_from_position(buffer, reload_map_position(&changes, cursor_position));
+    view->mark = get_cursor_from_position(buffer, reload_map_position(&changes, mark_position));
+    view->scroll_row = MIN(view->scroll_row, MAX(view_get_row_count(view) - 1, 0));
+}
+
+void view_show_diff(View *view, Diff *diff) {
+    if (view->diff) diff_free(view->diff);
+    view->diff = diff;
+    view->mark_active = false;
+    view->scroll_row = 0;
+    if (!diff) return;
+
+    printf("diff: %zu hunks\n", diff->hunks.count);
+    int64 row = diff_next_hunk_row(diff, -1);
+    if (row >= 0) view->scroll_row = MAX(row - view_rows_on_screen(view) / 2, 0);
+}
+
+// Compares the active buffer with what its file holds now
+COMMAND(diff_buffer_with_file) {
+    View *view = active_view;
+    Diff *diff = make_diff_with_file(view->buffer, view->buffer->file_name);
+    if (!diff) {
+        printf("diff: can't read %s\n", view->buffer->file_name);
+        return;
+    }
+    view_show_diff(view, diff);
+}
+
+void diff_with_file_enter(String file_name) {
+    View *view = active_view;
+    Diff *diff = make_diff_with_file(view->buffer, file_name.data);
+    if (!diff) {
+        printf("diff: can't read %s\n", file_name.data);
+        return;
+    }
+    view_show_diff(view, diff);
+}
+
+COMMAND(diff_with_file) {
+    prompt_begin("Diff with file: ", diff_with_file_enter);
+}
+
+COMMAND(diff_quit) {
+    View *view = active_view;
+    view_show_diff(view, nullptr);
+    ensure_cursor_in_view(view, view->cursor);
+}
+
+COMMAND(diff_toggle_unified) {
+    View *view = active_view;
+    Diff *diff = view->diff;
+    // The line at the top of the view stays there
+    Diff_Row top = diff_get_row(diff, view->scroll_row);
+    bool old_side = top.type == DIFF_ROW_DELETED;
+    diff_set_unified(diff, !diff->unified);
+    view->scroll_row = diff_find_row(diff, old_side ? top.old_line : top.new_line, old_side);
+}
+
+void diff_scroll(View *view, int64 rows) {
+    view->scroll_row = CLAMP(view->scroll_row + rows, 0, MAX(view->diff->row_count - 1, 0));
+}
+
+COMMAND(diff_scroll_up) {
+    diff_scroll(active_view, -1);
+}
+
+COMMAND(diff_scroll_down) {
+    diff_scroll(active_view, 1);
+}
+
+COMMAND(diff_page_up) {
+    diff_scroll(active_view, -view_rows_on_screen(active_view));
+}
+
+COMMAND(diff_page_down) {
+    diff_scroll(active_view, view_rows_on_screen(active_view));
+}
+
+// Hunks are brought a few rows below the top so their context shows
+COMMAND(diff_next_hunk) {
+    View *view = active_view;
+    int64 row = diff_next_hunk_row(view->diff, view->scroll_row + 3);
+    if (row >= 0) view->scroll_row = MAX(row - 3, 0);
+}
+
+COMMAND(diff_previous_hunk) {
+    View *view = active_view;
+    int64 row = diff_previous_hunk_row(view->diff, view->scroll_row + 3);
+    if (row >= 0) view->scroll_row = MAX(row - 3, 0);
+}
+
+// Diffs again once either buffer changed, a reload for instance
+void diff_view_update(View *view) {
+    if (!view->diff) return;
+    diff_update(view->diff);
+    view->scroll_row = MIN(view->scroll_row, MAX(view->diff->row_count - 1, 0));
+}
+
+COMMAND(switch_to_search_results) {
+    if (!search_results_buffer) return;
+    View *view = active_view;
+    view->buffer = search_results_buffer;
+    view->mark_active = false;
+    view_set_cursor(view, get_cursor_from_position(view->buffer, 0));
+}
+
+COMMAND(goto_search_result) {
+    View *view = active_view;
+    int64 start = get_position_from_line(view->buffer, view->cursor.line);
+    int64 length = buffer_get_line_length(view->buffer, view->cursor.line);
+    String line = buffer_to_string_span(view->buffer, { start, start + length });
+    char *file_name = nullptr;
+    int64 line_number = 0;
+    if (line.data && parse_search_result(line, &file_name, &line_number)) {
+        if (view_open_file(view, file_name)) {
+            Buffer *buffer = view->buffer;
+            view->estimated_position = -1;
+            int64 target = CLAMP(line_number - 1, 0, buffer_get_line_count(buffer) - 1);
+            view_set_cursor(view, get_cursor_from_line(buffer, target));
+        }
+        free(file_name);
+    }
+    free(line.data);
 }
 
 void win32_keycodes_init() {
@@ -532,6 +1237,7 @@ void win32_keycodes_init() {
     keycode_lookup[VK_OEM_PERIOD] = KEY_PERIOD;
 
     keycode_lookup[VK_RETURN] = KEY_ENTER;
+    keycode_lookup[VK_TAB] = KEY_TAB;
     keycode_lookup[VK_BACK] = KEY_BACKSPACE;
     keycode_lookup[VK_DELETE] = KEY_DELETE;
 
@@ -638,11 +1344,17 @@ Read_File open_entire_file(const char *file_name) {
     if (file_handle != INVALID_HANDLE_VALUE) {
         uint64 bytes_to_read;
         if (GetFileSizeEx(file_handle, (PLARGE_INTEGER)&bytes_to_read)) {
-            assert(bytes_to_read <= UINT32_MAX);
             result.data = (char *)malloc(bytes_to_read);
-            DWORD bytes_read;
-            if (ReadFile(file_handle, result.data, (DWORD)bytes_to_read, &bytes_read, NULL) && (DWORD)bytes_to_read ==  bytes_read) {
-                result.count = bytes_read;
+            // ReadFile takes a 32-bit count, so files over 4 GB are read in pieces
+            uint64 total_read = 0;
+            DWORD bytes_read = 0;
+            while (total_read < bytes_to_read) {
+                DWORD chunk = (DWORD)MIN(bytes_to_read - total_read, (uint64)1 << 30);
+                if (!ReadFile(file_handle, (char *)result.data + total_read, chunk, &bytes_read, NULL) || bytes_read == 0) break;
+                total_read += bytes_read;
+            }
+            if (total_read == bytes_to_read) {
+                result.count = total_read;
                 //result.handle = (Platform_Handle)file_handle;
                 //if (SetFilePointer(file_handle, 0, 0, FILE_BEGIN) == INVALID_SET_FILE_POINTER) {
                 //    printf("SetFilePointer: error rewinding file, '%s'\n", file_name);
@@ -663,6 +1375,337 @@ Read_File open_entire_file(const char *file_name) {
     return result;
 }
 
+Mapped_File map_file(const char *file_name) {
+    Mapped_File result{};
+    HANDLE file_handle = CreateFileA((LPCSTR)file_name, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file_handle == INVALID_HANDLE_VALUE) {
+        return result;
+    }
+
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(file_handle, &file_size) || file_size.QuadPart == 0) {
+        // Empty files can't be mapped
+        CloseHandle(file_handle);
+        return result;
+    }
+
+    HANDLE mapping = CreateFileMappingA(file_handle, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (mapping) {
+        void *view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        if (view) {
+            result.data = (char *)view;
+            result.count = file_size.QuadPart;
+            result.file = (Platform_Handle)file_handle;
+            result.mapping = (Platform_Handle)mapping;
+            return result;
+        }
+        CloseHandle(mapping);
+    }
+    printf("MapViewOfFile: error mapping file: %s!\n", file_name);
+    CloseHandle(file_handle);
+    return result;
+}
+
+Platform_Handle open_file_for_writing(const char *file_name) {
+    HANDLE file_handle = CreateFileA((LPCSTR)file_name, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file_handle == INVALID_HANDLE_VALUE) {
+        printf("CreateFile: error opening file for writing: %s!\n", file_name);
+        return 0;
+    }
+    return (Platform_Handle)file_handle;
+}
+
+bool write_file(Platform_Handle file, const void *data, int64 count) {
+    const char *src = (const char *)data;
+    while (count > 0) {
+        DWORD chunk = (DWORD)MIN(count, (int64)1 << 30);
+        DWORD bytes_written = 0;
+        if (!WriteFile((HANDLE)file, src, chunk, &bytes_written, NULL)) {
+            printf("WriteFile: error writing file\n");
+            return false;
+        }
+        src += bytes_written;
+        count -= bytes_written;
+    }
+    return true;
+}
+
+void close_file(Platform_Handle file) {
+    CloseHandle((HANDLE)file);
+}
+
+// Returns once what was written is on the disk
+bool flush_file(Platform_Handle file) {
+    if (!FlushFileBuffers((HANDLE)file)) {
+        printf("FlushFileBuffers: error flushing file\n");
+        return false;
+    }
+    return true;
+}
+
+bool delete_file(const char *file_name) {
+    return DeleteFileA((LPCSTR)file_name) != 0;
+}
+
+// Returns the number of bytes read, which is short at the end of the file
+int64 read_file_range(const char *file_name, int64 offset, void *dest, int64 count) {
+    HANDLE file_handle = CreateFileA((LPCSTR)file_name, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file_handle == INVALID_HANDLE_VALUE) {
+        printf("CreateFile: error opening file: %s!\n", file_name);
+        return 0;
+    }
+    LARGE_INTEGER distance;
+    distance.QuadPart = offset;
+    int64 total_read = 0;
+    if (SetFilePointerEx(file_handle, distance, NULL, FILE_BEGIN)) {
+        DWORD bytes_read = 0;
+        while (total_read < count) {
+            DWORD chunk = (DWORD)MIN(count - total_read, (int64)1 << 30);
+            if (!ReadFile(file_handle, (char *)dest + total_read, chunk, &bytes_read, NULL) || bytes_read == 0) break;
+            total_read += bytes_read;
+        }
+    } else {
+        printf("SetFilePointerEx: error seeking in file: %s!\n", file_name);
+    }
+    CloseHandle(file_handle);
+    return total_read;
+}
+
+// The NTFS file index, which changes when the path is replaced by another file. 0 if there's no file.
+uint64 get_file_id(const char *file_name) {
+    HANDLE file_handle = CreateFileA((LPCSTR)file_name, 0, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file_handle == INVALID_HANDLE_VALUE) return 0;
+    uint64 result = 0;
+    BY_HANDLE_FILE_INFORMATION info;
+    if (GetFileInformationByHandle(file_handle, &info)) {
+        result = ((uint64)info.nFileIndexHigh << 32) | info.nFileIndexLow;
+    }
+    CloseHandle(file_handle);
+    return result;
+}
+
+// Change notifications only exist for directories, so this watches the file's
+// directory and the caller checks whether it was the file that changed
+Platform_Handle watch_file(const char *file_name) {
+    char *dir_name = path_strip_dir_name((char *)file_name);
+    HANDLE change = FindFirstChangeNotificationA(dir_name ? dir_name : ".", FALSE, FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_SIZE | FILE_NOTIFY_CHANGE_LAST_WRITE);
+    free(dir_name);
+    if (change == INVALID_HANDLE_VALUE) {
+        printf("FindFirstChangeNotification: error watching file: %s!\n", file_name);
+        return 0;
+    }
+    return (Platform_Handle)change;
+}
+
+bool file_changed(Platform_Handle watch) {
+    if (WaitForSingleObject((HANDLE)watch, 0) != WAIT_OBJECT_0) return false;
+    FindNextChangeNotification((HANDLE)watch);
+    return true;
+}
+
+void unwatch_file(Platform_Handle watch) {
+    FindCloseChangeNotification((HANDLE)watch);
+}
+
+#define DIRECTORY_WATCH_BUFFER_SIZE (64 * 1024)
+
+struct Win32_Directory_Watch {
+    HANDLE directory;
+    OVERLAPPED overlapped;
+    char *path;
+    bool pending; // a read is queued
+    DWORD buffer[DIRECTORY_WATCH_BUFFER_SIZE / sizeof(DWORD)];
+};
+
+static bool win32_directory_watch_issue(Win32_Directory_Watch *watch) {
+    ResetEvent(watch->overlapped.hEvent);
+    watch->pending = ReadDirectoryChangesW(watch->directory, watch->buffer, sizeof(watch->buffer), TRUE, FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_DIR_NAME, NULL, &watch->overlapped, NULL) != 0;
+    return watch->pending;
+}
+
+// One overlapped read is kept queued, the system fills its buffer between polls
+Platform_Handle watch_directory_tree(const char *path) {
+    HANDLE directory = CreateFileA((LPCSTR)path, FILE_LIST_DIRECTORY, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, NULL);
+    if (directory == INVALID_HANDLE_VALUE) {
+        printf("CreateFile: error watching directory: %s!\n", path);
+        return 0;
+    }
+    Win32_Directory_Watch *watch = (Win32_Directory_Watch *)calloc(1, sizeof(Win32_Directory_Watch));
+    watch->directory = directory;
+    watch->overlapped.hEvent = CreateEventA(NULL, TRUE, FALSE, NULL);
+    watch->path = string_copy(path).data;
+    if (!win32_directory_watch_issue(watch)) {
+        printf("ReadDirectoryChanges: error watching directory: %s!\n", path);
+        unwatch_directory_tree((Platform_Handle)watch);
+        return 0;
+    }
+    return (Platform_Handle)watch;
+}
+
+bool read_directory_changes(Platform_Handle handle, Directory_Change_Proc proc, void *data) {
+    Win32_Directory_Watch *watch = (Win32_Directory_Watch *)handle;
+    if (!watch->pending) {
+        win32_directory_watch_issue(watch);
+        return false;
+    }
+    DWORD bytes = 0;
+    if (!GetOverlappedResult(watch->directory, &watch->overlapped, &bytes, FALSE)) {
+        if (GetLastError() == ERROR_IO_INCOMPLETE) return true;
+        win32_directory_watch_issue(watch);
+        return false;
+    }
+    // No bytes means the buffer overflowed and the changes were dropped
+    bool complete = bytes > 0;
+    char name[MAX_PATH];
+    char full_path[MAX_PATH];
+    char *stream = (char *)watch->buffer;
+    while (complete) {
+        FILE_NOTIFY_INFORMATION *info = (FILE_NOTIFY_INFORMATION *)stream;
+        int length = WideCharToMultiByte(CP_ACP, 0, info->FileName, info->FileNameLength / sizeof(WCHAR), name, MAX_PATH - 1, NULL, NULL);
+        name[length] = 0;
+        for (char *c = name; *c; c++) {
+            if (*c == '\\') *c = '/';
+        }
+        bool added = info->Action == FILE_ACTION_ADDED || info->Action == FILE_ACTION_RENAMED_NEW_NAME;
+        bool removed = info->Action == FILE_ACTION_REMOVED || info->Action == FILE_ACTION_RENAMED_OLD_NAME;
+        if (length > 0 && (added || removed)) {
+            bool is_directory = false;
+            if (added) {
+                snprintf(full_path, MAX_PATH, "%s/%s", watch->path, name);
+                DWORD attributes = GetFileAttributesA(full_path);
+                is_directory = attributes != INVALID_FILE_ATTRIBUTES && (attributes & FILE_ATTRIBUTE_DIRECTORY);
+            }
+            proc(name, added, is_directory, data);
+        }
+        if (!info->NextEntryOffset) break;
+        stream += info->NextEntryOffset;
+    }
+    win32_directory_watch_issue(watch);
+    return complete;
+}
+
+void unwatch_directory_tree(Platform_Handle handle) {
+    Win32_Directory_Watch *watch = (Win32_Directory_Watch *)handle;
+    if (!watch) return;
+    // The system writes into the buffer until the cancelled read completes
+    DWORD bytes = 0;
+    if (watch->pending && CancelIo(watch->directory)) GetOverlappedResult(watch->directory, &watch->overlapped, &bytes, TRUE);
+    CloseHandle(watch->directory);
+    CloseHandle(watch->overlapped.hEvent);
+    free(watch->path);
+    free(watch);
+}
+
+void unmap_file(Mapped_File *file) {
+    if (file->data) {
+        UnmapViewOfFile(file->data);
+        CloseHandle((HANDLE)file->mapping);
+        CloseHandle((HANDLE)file->file);
+    }
+    *file = {};
+}
+
+bool visit_directory(const char *path, Visit_Directory_Proc proc, void *data) {
+    char pattern[MAX_PATH];
+    snprintf(pattern, MAX_PATH, "%s\\*", path);
+    WIN32_FIND_DATAA find_data;
+    HANDLE find_handle = FindFirstFileA(pattern, &find_data);
+    if (find_handle == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    do {
+        char *name = find_data.cFileName;
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) continue;
+        bool is_directory = (find_data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+        proc(name, is_directory, data);
+    } while (FindNextFileA(find_handle, &find_data));
+    FindClose(find_handle);
+    return true;
+}
+
+int get_processor_count() {
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return (int)info.dwNumberOfProcessors;
+}
+
+struct Win32_Thread_Start {
+    Platform_Thread_Proc proc;
+    void *data;
+};
+
+DWORD WINAPI win32_thread_proc(LPVOID param) {
+    Win32_Thread_Start start = *(Win32_Thread_Start *)param;
+    free(param);
+    start.proc(start.data);
+    return 0;
+}
+
+void create_thread(Platform_Thread_Proc proc, void *data) {
+    Win32_Thread_Start *start = (Win32_Thread_Start *)malloc(sizeof(Win32_Thread_Start));
+    start->proc = proc;
+    start->data = data;
+    HANDLE thread = CreateThread(NULL, 0, win32_thread_proc, start, 0, NULL);
+    if (thread) {
+        CloseHandle(thread);
+    } else {
+        printf("CreateThread: error creating thread: %d\n", GetLastError());
+        free(start);
+    }
+}
+
+Platform_Handle create_semaphore(int32 initial_count) {
+    HANDLE semaphore = CreateSemaphoreA(NULL, initial_count, LONG_MAX, NULL);
+    return (Platform_Handle)semaphore;
+}
+
+void semaphore_signal(Platform_Handle semaphore, int32 count) {
+    ReleaseSemaphore((HANDLE)semaphore, count, NULL);
+}
+
+void semaphore_wait(Platform_Handle semaphore) {
+    WaitForSingleObject((HANDLE)semaphore, INFINITE);
+}
+
+Platform_Handle create_mutex() {
+    SRWLOCK *lock = (SRWLOCK *)malloc(sizeof(SRWLOCK));
+    InitializeSRWLock(lock);
+    return (Platform_Handle)lock;
+}
+
+void mutex_lock(Platform_Handle mutex) {
+    AcquireSRWLockExclusive((SRWLOCK *)mutex);
+}
+
+void mutex_unlock(Platform_Handle mutex) {
+    ReleaseSRWLockExclusive((SRWLOCK *)mutex);
+}
+
+// An SRW lock holds no kernel object, only its memory is freed
+void destroy_mutex(Platform_Handle mutex) {
+    free((SRWLOCK *)mutex);
+}
+
+void yield_thread() {
+    SwitchToThread();
+}
+
+int64 get_time_microseconds() {
+    static LARGE_INTEGER frequency;
+    if (!frequency.QuadPart) QueryPerformanceFrequency(&frequency);
+    LARGE_INTEGER counter;
+    QueryPerformanceCounter(&counter);
+    return (int64)(counter.QuadPart / frequency.QuadPart * 1000000 + counter.QuadPart % frequency.QuadPart * 1000000 / frequency.QuadPart);
+}
+
+int64 atomic_add64(volatile int64 *addend, int64 value) {
+    return InterlockedExchangeAdd64((volatile LONG64 *)addend, value) + value;
+}
+
+int64 atomic_compare_exchange64(volatile int64 *dest, int64 exchange, int64 comparand) {
+    return InterlockedCompareExchange64((volatile LONG64 *)dest, exchange, comparand);
+}
+
 inline Key_Modifiers make_key_modifiers(bool shift, bool control, bool alt) {
     Key_Modifiers modifiers = KEY_MODIFIER_NONE;
     modifiers = (Key_Modifiers)((int)modifiers | (int)(shift ? (int)KEY_MODIFIER_SHIFT : 0));
@@ -671,6 +1714,50 @@ inline Key_Modifiers make_key_modifiers(bool shift, bool control, bool alt) {
     return modifiers;
 }
 
+// Everything below runs on the window's thread. Events that don't fit in the
+// ring wait here and go first once it has room, so none is dropped or reordered.
+static Array<System_Event> input_overflow;
+static System_Event pending_key; // waits for the character it types
+static bool key_pending;
+
+static void win32_flush_input() {
+    size_t sent = 0;
+    while (sent < input_overflow.count && input_ring_push(&input_ring, &input_overflow[sent])) {
+        sent++;
+    }
+    if (sent > 0) {
+        memmove(input_overflow.data, input_overflow.data + sent, (input_overflow.count - sent) * sizeof(System_Event));
+        input_overflow.count -= sent;
+        renderer_wake(&renderer);
+    }
+}
+
+static void win32_send_event(System_Event *event) {
+    win32_flush_input();
+    if (input_overflow.count > 0 || !input_ring_push(&input_ring, event)) {
+        input_overflow.push(*event);
+    } else {
+        renderer_wake(&renderer);
+    }
+}
+
+static void win32_flush_key() {
+    if (!key_pending) return;
+    key_pending = false;
+    win32_send_event(&pending_key);
+}
+
+// Sent after any key stroke still waiting, to keep the order they came in
+static void win32_push_event(System_Event_Type type, int32 x, int32 y) {
+    win32_flush_key();
+    System_Event event = {};
+    event.type = type;
+    event.time = get_time_microseconds();
+    event.x = x;
+    event.y = y;
+    win32_send_event(&event);
+}
+
 LRESULT CALLBACK window_proc(HWND hWnd, UINT Msg, WPARAM wParam, LPARAM lParam) {
     static bool shift_down = false;
     static bool control_down = false;
@@ -698,10 +1785,13 @@ LRESULT CALLBACK window_proc(HWND hWnd, UINT Msg, WPARAM wParam, LPARAM lParam)
         if (key_down) {
             Key_Code code = keycode_lookup[vk];
             if (code) {
-                Key_Modifiers modifiers = make_key_modifiers(shift_down, control_down, alt_down);
-                Key_Stroke *key_stroke = make_key_stroke_event(code, modifiers);
-                if (active_key_stroke) free(active_key_stroke);
-                active_key_stroke = key_stroke;
+                win32_flush_key();
+                pending_key = {};
+                pending_key.type = SYSTEM_EVENT_KEY_STROKE;
+                pending_key.time = get_time_microseconds();
+                pending_key.key.code = code;
+                pending_key.key.modifiers = make_key_modifiers(shift_down, control_down, alt_down);
+                key_pending = true;
             }
         }
         break;
@@ -710,75 +1800,60 @@ LRESULT CALLBACK window_proc(HWND hWnd, UINT Msg, WPARAM wParam, LPARAM lParam)
     // case WM_LBUTTONUP:
     case WM_LBUTTONDOWN:
     {
-        int x = GET_X_LPARAM(lParam); 
-        int y = GET_Y_LPARAM(lParam); 
-        y += active_view->y_off;
-        String string = buffer_to_string(active_view->buffer);
-        int line = (int)(y / active_view->face->glyph_height);
-
-        // get cursor position from mouse click
-        for (int64 line = 0; line < (int64)active_view->buffer->line_starts.count; line++) {
-            float y0 = line * active_view->face->glyph_height;
-            float y1 = y0 + active_view->face->glyph_height;
-            if (y0 <= y && y <= y1) {
-                float x0 = 0.0f;
-                for (int64 position = active_view->buffer->line_starts[line]; position < active_view->buffer->line_starts[line + 1] - 1; position++) {
-                    char c = string.data[position];
-                    Glyph *glyph = &active_view->face->glyphs[c];
-                    float x1 = x0 + glyph->ax;
-                    if (x0 <= x && x <= x1) {
-                        int64 col = position - active_view->buffer->line_starts[line];
-                        active_view->cursor = { position, line, col };
-                        break;
-                    }
-                    x0 += glyph->ax;
-                }
-                break;
-            }
-        }
-        free(string.data);
+        win32_push_event(SYSTEM_EVENT_MOUSECLICK, GET_X_LPARAM(lParam), GET_Y_LPARAM(lParam));
         break;
     }
 
     case WM_MOUSEWHEEL:
     {
-        float delta = GET_WHEEL_DELTA_WPARAM(wParam);
-        if (delta < 0) {
-            wheel_scroll_down();
-        } else {
-            wheel_scroll_up();
-        }
+        win32_push_event(SYSTEM_EVENT_MOUSEWHEEL, 0, GET_WHEEL_DELTA_WPARAM(wParam));
         break;
     }
 
     case WM_CHAR:
     {
+        // WM_CHAR delivers UTF-16, characters outside the BMP arrive as a surrogate pair
+        static uint16 high_surrogate;
         uint16 vk = wParam & 0x0000ffff;
-        uint8 c = (uint8)vk;
+        uint32 c = vk;
+        if (c >= 0xD800 && c <= 0xDBFF) {
+            high_surrogate = vk;
+            break;
+        }
+        if (c >= 0xDC00 && c <= 0xDFFF) {
+            if (!high_surrogate) break;
+            c = 0x10000 + ((high_surrogate - 0xD800) << 10) + (c - 0xDC00);
+        }
+        high_surrogate = 0;
         if (c == '\r') {
             c = '\n';
         }
         if (c < 127) {
-            char *text = (char *)malloc(1);
-            text[0] = c;
-            Text_Input *text_input = make_text_input(text, 1);
-            if (active_key_stroke) {
-                active_text_input = text_input;
+            if (key_pending) {
+                pending_key.text[0] = (char)c;
+                pending_key.text_count = 1;
+                win32_flush_key();
             }
+        } else if (c > 127) {
+            // No key binding produces these, insert them directly
+            key_pending = false;
+            System_Event event = {};
+            event.type = SYSTEM_EVENT_TEXT_INPUT;
+            event.time = get_time_microseconds();
+            event.text_count = utf8_encode(c, event.text);
+            win32_send_event(&event);
         }
         break;
     }
 
     case WM_SIZE:
     {
-        UINT width = LOWORD(lParam);
-        UINT height = HIWORD(lParam);
-        Window_Resize *resize = make_window_resize_event(width, height);
-        system_events.push(resize);
+        win32_push_event(SYSTEM_EVENT_WINDOW_RESIZE, LOWORD(lParam), HIWORD(lParam));
         break;
     }
 
     case WM_CLOSE:
+        win32_push_event(SYSTEM_EVENT_QUIT, 0, 0);
         PostQuitMessage(0);
         break;
     default:
@@ -787,6 +1862,80 @@ LRESULT CALLBACK window_proc(HWND hWnd, UINT Msg, WPARAM wParam, LPARAM lParam)
     return result;
 }
 
+struct Win32_Window_Start {
+    HWND window;
+    Platform_Handle ready;
+};
+
+// Owns the window and pumps its messages into the input ring, so keys are
+// taken in while the editor's thread is busy with a frame
+static void win32_window_thread(void *data) {
+    Win32_Window_Start *start = (Win32_Window_Start *)data;
+#define CLASSNAME L"QED_WINDOW_CLASS"
+    HINSTANCE hinstance = GetModuleHandle(NULL);
+    WNDCLASSW window_class{};
+    window_class.style = CS_HREDRAW | CS_VREDRAW;
+    window_class.lpfnWndProc = window_proc;
+    window_class.hbrBackground = (HBRUSH)(COLOR_WINDOW + 1);
+    window_class.lpszClassName = CLASSNAME;
+    window_class.hInstance = hinstance;
+    window_class.hCursor = LoadCursorW(NULL, IDC_ARROW);
+    if (!RegisterClassW(&window_class)) {
+        fprintf(stderr, "RegisterClassA failed, err:%d\n", GetLastError());
+    }
+
+    HWND window = CreateWindowW(CLASSNAME, L"Qed", WS_OVERLAPPEDWINDOW | WS_VISIBLE, CW_USEDEFAULT, CW_USEDEFAULT, WIDTH, HEIGHT, NULL, NULL, hinstance, NULL);
+    {
+        RECT rc = {0, 0, WIDTH, HEIGHT};
+        AdjustWindowRect(&rc, WS_OVERLAPPEDWINDOW, FALSE);
+        SetWindowPos(window, HWND_NOTOPMOST, 0, 0, rc.right - rc.left, rc.bottom - rc.top, SWP_NOMOVE|SWP_NOZORDER);
+    }
+    start->window = window;
+    semaphore_signal(start->ready, 1);
+
+    for (;;) {
+        MSG message;
+        if (input_overflow.count > 0 || key_pending) {
+            // Keep retrying what the ring had no room for
+            if (!PeekMessageW(&message, NULL, 0, 0, PM_REMOVE)) {
+                win32_flush_key();
+                win32_flush_input();
+                if (input_overflow.count > 0) Sleep(1);
+                continue;
+            }
+        } else if (GetMessageW(&message, NULL, 0, 0) <= 0) {
+            break;
+        }
+        if (message.message == WM_QUIT) break;
+        TranslateMessage(&message);
+        DispatchMessageW(&message);
+    }
+}
+
+// Sets the cursor to the character under a click
+static void view_click(View *view, int x, int y) {
+    if (view->estimated_position >= 0 || view->diff) return;
+    int64 row = view->scroll_row + (int64)(y / view->face->glyph_height);
+    if (row >= view_get_row_count(view)) return;
+    int64 line = view_get_line(view, row);
+    int64 line_start = view->buffer->line_starts[line];
+    String string = buffer_to_string_span(view->buffer, { line_start, line_start + buffer_get_line_length(view->buffer, line) });
+    float x0 = 0.0f;
+    for (int64 i = 0; i < string.count; ) {
+        uint32 c;
+        int length = utf8_decode(string.data + i, string.count - i, &c);
+        Glyph *glyph = face_get_glyph(view->face, c);
+        float x1 = x0 + glyph->ax;
+        if (x0 <= x && x <= x1) {
+            view->cursor = { line_start + i, line, i };
+            break;
+        }
+        x0 += glyph->ax;
+        i += length;
+    }
+    free(string.data);
+}
+
 uint16 key_stroke_to_key(Key_Stroke *key_stroke) {
     uint16 result = (uint8)key_stroke->code;
     if (key_stroke->modifiers & KEY_MODIFIER_SHIFT) result |= KEYMOD_SHIFT;
@@ -795,6 +1944,97 @@ uint16 key_stroke_to_key(Key_Stroke *key_stroke) {
     return result;
 }
 
+// The command the event runs in the active view, text input is a self_insert
+static Command_Proc event_command(System_Event *event) {
+    if (event->type == SYSTEM_EVENT_TEXT_INPUT) {
+        return active_view->diff ? nullptr : self_insert;
+    }
+    if (event->type != SYSTEM_EVENT_KEY_STROKE) return nullptr;
+    uint16 key = key_stroke_to_key(&event->key);
+    assert(key < MAX_KEY_COUNT);
+    Key_Map *key_map = active_view->buffer->key_map ? active_view->buffer->key_map : active_view->key_map;
+    if (active_view->diff) key_map = diff_key_map;
+    return key_map->commands[key].procedure;
+}
+
+static void run_command(Command_Proc procedure, char *text, int64 text_count) {
+    view_resolve_estimate(active_view, true);
+    Text_Input text_input = { text, text_count };
+    active_text_input = text_count > 0 ? &text_input : nullptr;
+    if (procedure) {
+        procedure();
+    }
+    active_text_input = nullptr;
+}
+
+// Runs the command bound to the key, with the text it typed for self_insert
+void handle_key_stroke(System_Event *event) {
+    run_command(event_command(event), event->text, event->text_count);
+}
+
+// Motions that move command_count times in one go
+static bool command_takes_count(Command_Proc procedure) {
+    return procedure == forward_char || procedure == backward_char || procedure == next_line || procedure == previous_line;
+}
+
+// Runs the frame's events. A burst of typed text is inserted at once, one edit
+// and one undo record, and a held motion key moves once by its repeat count,
+// so a frame costs the same however many events piled up in it.
+static void handle_events(Array<System_Event> *events) {
+    static Array<char> typed;
+    for (size_t i = 0; i < events->count && !window_should_close; ) {
+        System_Event *event = &(*events)[i];
+        Command_Proc procedure = event_command(event);
+        size_t end = i + 1;
+        if (procedure == self_insert && event->text_count > 0) {
+            typed.reset_count();
+            typed.append(event->text, event->text_count);
+            for (; end < events->count; end++) {
+                System_Event *next = &(*events)[end];
+                if (next->text_count == 0 || event_command(next) != self_insert) break;
+                typed.append(next->text, next->text_count);
+            }
+            run_command(self_insert, typed.data, (int64)typed.count);
+            i = end;
+            continue;
+        }
+        if (procedure && command_takes_count(procedure)) {
+            for (; end < events->count; end++) {
+                System_Event *next = &(*events)[end];
+                if (next->type != SYSTEM_EVENT_KEY_STROKE || next->key.code != event->key.code || next->key.modifiers != event->key.modifiers) break;
+            }
+            command_count = (int64)(end - i);
+            run_command(procedure, nullptr, 0);
+            command_count = 1;
+            i = end;
+            continue;
+        }
+
+        switch (event->type) {
+        case SYSTEM_EVENT_WINDOW_RESIZE:
+            //d3d11_resize_render_target(event->x, event->y);
+            break;
+        case SYSTEM_EVENT_KEY_STROKE:
+            handle_key_stroke(event);
+            break;
+        case SYSTEM_EVENT_MOUSECLICK:
+            view_click(active_view, event->x, event->y);
+            break;
+        case SYSTEM_EVENT_MOUSEWHEEL:
+            if (event->y < 0) {
+                wheel_scroll_down();
+            } else {
+                wheel_scroll_up();
+            }
+            break;
+        case SYSTEM_EVENT_QUIT:
+            window_should_close = true;
+            break;
+        }
+        i = end;
+    }
+}
+
 Key_Command make_key_command(const char *name, Command_Proc procedure) {
     Key_Command command;
     command.name = name;
@@ -846,6 +2086,7 @@ Key_Map *make_default_key_map() {
     set_key_command(key_map, KEY_END, make_key_command("goto_end_of_line", goto_end_of_line));
     set_key_command(key_map, KEYMOD_CONTROL | KEY_HOME, make_key_command("goto_first_line", goto_first_line));
     set_key_command(key_map, KEYMOD_CONTROL | KEY_END, make_key_command("goto_last_line", goto_last_line));
+    set_key_command(key_map, KEYMOD_ALT | KEY_G, make_key_command("goto_line", goto_line));
 
     set_key_command(key_map, KEY_ENTER, make_key_command("newline", newline));
 
@@ -853,9 +2094,25 @@ Key_Map *make_default_key_map() {
     set_key_command(key_map, KEY_PAGEDOWN, make_key_command("scroll_page_down", scroll_page_down));
 
     set_key_command(key_map, KEYMOD_CONTROL|KEY_O, make_key_command("find_file", find_file));
+    set_key_command(key_map, KEYMOD_CONTROL | KEY_B, make_key_command("switch_buffer", switch_buffer));
+    set_key_command(key_map, KEYMOD_CONTROL | KEY_TAB, make_key_command("previous_buffer", previous_buffer));
+    set_key_command(key_map, KEYMOD_CONTROL | KEYMOD_ALT | KEY_B, make_key_command("set_buffer_budget", set_buffer_budget));
+    set_key_command(key_map, KEYMOD_ALT | KEY_X, make_key_command("execute_command", execute_command));
 
     set_key_command(key_map, KEYMOD_CONTROL | KEY_Z, make_key_command("undo", undo));
 
+    set_key_command(key_map, KEYMOD_CONTROL | KEYMOD_SHIFT | KEY_F, make_key_command("search_project", search_project));
+    set_key_command(key_map, KEYMOD_CONTROL | KEYMOD_ALT | KEY_F, make_key_command("switch_to_search_results", switch_to_search_results));
+    set_key_command(key_map, KEYMOD_CONTROL | KEYMOD_SHIFT | KEY_O, make_key_command("occur", occur));
+    set_key_command(key_map, KEYMOD_CONTROL | KEY_L, make_key_command("filter_lines", filter_lines));
+    set_key_command(key_map, KEYMOD_CONTROL | KEYMOD_SHIFT | KEY_L, make_key_command("hide_lines", hide_lines));
+    set_key_command(key_map, KEYMOD_CONTROL | KEYMOD_ALT | KEY_L, make_key_command("clear_filter", clear_filter));
+    set_key_command(key_map, KEYMOD_CONTROL | KEYMOD_SHIFT | KEY_T, make_key_command("follow_mode", follow_mode));
+    set_key_command(key_map, KEYMOD_CONTROL | KEYMOD_SHIFT | KEY_D, make_key_command("diff_buffer_with_file", diff_buffer_with_file));
+    set_key_command(key_map, KEYMOD_CONTROL | KEYMOD_ALT | KEY_D, make_key_command("diff_with_file", diff_with_file));
+    set_key_command(key_map, KEYMOD_CONTROL | KEY_R, make_key_command("replace_all", replace_all));
+    set_key_command(key_map, KEYMOD_CONTROL | KEYMOD_SHIFT | KEY_R, make_key_command("replace_all_literal", replace_all_literal));
+
     // Emacs keybindings
     set_key_command(key_map, KEYMOD_CONTROL | KEY_A, make_key_command("goto_beginning_of_line", goto_beginning_of_line));
     set_key_command(key_map, KEYMOD_CONTROL | KEY_E, make_key_command("goto_end_of_line", goto_end_of_line));
@@ -882,155 +2139,213 @@ Key_Map *make_find_file_key_map() {
         }
     }
 
+    set_key_command(key_map, KEY_BACKSPACE, make_key_command("backward_delete_char", backward_delete_char));
+    set_key_command(key_map, KEY_DOWN, make_key_command("find_file_next", find_file_next));
+    set_key_command(key_map, KEY_UP, make_key_command("find_file_previous", find_file_previous));
+    set_key_command(key_map, KEYMOD_CONTROL | KEY_N, make_key_command("find_file_next", find_file_next));
+    set_key_command(key_map, KEYMOD_CONTROL | KEY_P, make_key_command("find_file_previous", find_file_previous));
     set_key_command(key_map, KEY_ENTER, make_key_command("find_file_enter", find_file_enter));
     set_key_command(key_map, KEY_ESCAPE, make_key_command("find_file_escape", find_file_escape));
     return key_map;
 }
 
-void find_file_post_self_insert_hook(Text_Input *input) {
-    WIN32_FIND_DATAA file_data;
-    char c = input->text[0];
-    if (c == '/' || c == '\\') {
-        // String string = buffer_to_string(find_file_dialog.view->buffer);
-        // find_file_dialog.current_path = string.data;
+Key_Map *make_prompt_key_map() {
+    Key_Map *key_map = (Key_Map *)calloc(sizeof(Key_Map), 1);
+    Key_Command self_insert_command = make_key_command("self_insert", self_insert);
+    for (unsigned char c = 0; c < 128; c++) {
+        uint16 vk = VkKeyScanA(c);
+        vk = vk & 0x00ff; // discard high byte
+        Key_Code key = keycode_lookup[vk];
+        if (isprint(c) && key) {
+            set_key_command(key_map, key, self_insert_command);
+            set_key_command(key_map, KEYMOD_SHIFT|key, self_insert_command);
+        }
     }
 
-    HANDLE file_handle = FindFirstFileA(find_file_dialog.current_path, &file_data);
-    if (file_handle != INVALID_HANDLE_VALUE) {
-        do {
-            printf("%s\n", file_data.cFileName);
-        } while (FindNextFileA(file_handle, &file_data));
-        FindClose(file_handle);
-    }
+    set_key_command(key_map, KEY_BACKSPACE, make_key_command("backward_delete_char", backward_delete_char));
+    set_key_command(key_map, KEY_LEFT, make_key_command("backward_char", backward_char));
+    set_key_command(key_map, KEY_RIGHT, make_key_command("forward_char", forward_char));
+    set_key_command(key_map, KEY_ENTER, make_key_command("prompt_enter", prompt_enter));
+    set_key_command(key_map, KEY_ESCAPE, make_key_command("prompt_escape", prompt_escape));
+    return key_map;
+}
+
+// Like the default key map but enter jumps to the result under the cursor
+Key_Map *make_search_results_key_map(Key_Map *default_key_map) {
+    Key_Map *key_map = (Key_Map *)calloc(sizeof(Key_Map), 1);
+    memcpy(key_map, default_key_map, sizeof(Key_Map));
+    set_key_command(key_map, KEY_ENTER, make_key_command("goto_search_result", goto_search_result));
+    return key_map;
+}
+
+// Like the default key map but enter jumps to the occurrence under the cursor
+Key_Map *make_occur_results_key_map(Key_Map *default_key_map) {
+    Key_Map *key_map = (Key_Map *)calloc(sizeof(Key_Map), 1);
+    memcpy(key_map, default_key_map, sizeof(Key_Map));
+    set_key_command(key_map, KEY_ENTER, make_key_command("goto_occur_result", goto_occur_result));
+    return key_map;
+}
+
+// Used instead of the buffer's key map while a view shows a diff, which can't be edited
+Key_Map *make_diff_key_map() {
+    Key_Map *key_map = (Key_Map *)calloc(sizeof(Key_Map), 1);
+    set_key_command(key_map, KEYMOD_ALT | KEY_F4, make_key_command("quit", quit_qed));
+    set_key_command(key_map, KEY_UP, make_key_command("diff_scroll_up", diff_scroll_up));
+    set_key_command(key_map, KEY_DOWN, make_key_command("diff_scroll_down", diff_scroll_down));
+    set_key_command(key_map, KEY_PAGEUP, make_key_command("diff_page_up", diff_page_up));
+    set_key_command(key_map, KEY_PAGEDOWN, make_key_command("diff_page_down", diff_page_down));
+    set_key_command(key_map, KEY_N, make_key_command("diff_next_hunk", diff_next_hunk));
+    set_key_command(key_map, KEY_P, make_key_command("diff_previous_hunk", diff_previous_hunk));
+    set_key_command(key_map, KEY_TAB, make_key_command("diff_toggle_unified", diff_toggle_unified));
+    set_key_command(key_map, KEY_Q, make_key_command("diff_quit", diff_quit));
+    set_key_command(key_map, KEY_ESCAPE, make_key_command("diff_quit", diff_quit));
+    return key_map;
 }
 
 void default_post_self_insert_hook(Text_Input *input) {
 }
 
+// The title doubles as the status line
+void win32_update_window_title(HWND window, View *view) {
+    static char last_title[512];
+    char title[512];
+    Buffer *buffer = view->buffer;
+    if (buffer->indexer) {
+        snprintf(title, sizeof(title), "Qed - %s (indexing %d%%)", buffer->file_name, (int)(100.0f * buffer_index_progress(buffer)));
+    } else if (view->diff) {
+        snprintf(title, sizeof(title), "Qed - %s (diff against %s)", buffer->file_name, view->diff->old_buffer->file_name);
+    } else if (find_follow(buffer)) {
+        snprintf(title, sizeof(title), "Qed - %s (following)", buffer->file_name);
+    } else {
+        snprintf(title, sizeof(title), "Qed - %s", buffer->file_name);
+    }
+    if (strcmp(title, last_title) != 0) {
+        SetWindowTextA(window, title);
+        strcpy(last_title, title);
+    }
+}
+
 int main(int argc, char **argv) {
     // UINT desired_scheduler_ms = 1;
     // timeBeginPeriod(desired_scheduler_ms);
     argc--;
     argv++;
-    if (argc == 0) {
+    // Without a file the session saved at exit is picked up, only its
+    // active file is read now and the others when they are opened again
+    session_load(&session, SESSION_FILE_NAME);
+    if (argc == 0 && session.active < 0) {
         puts("QED");
         puts("Usage: Qed [filename]");
         exit(0);
     }
 
-    char *file_name = argv[0];
+    char *file_name = argc > 0 ? argv[0] : session.entries[session.active].file_name;
 
     win32_keycodes_init();
 
     Key_Map *default_key_map = make_default_key_map();
+    search_results_key_map = make_search_results_key_map(default_key_map);
+    occur_results_key_map = make_occur_results_key_map(default_key_map);
+    diff_key_map = make_diff_key_map();
 
-#define CLASSNAME L"QED_WINDOW_CLASS"
-    HINSTANCE hinstance = GetModuleHandle(NULL);
-    WNDCLASSW window_class{};
-    window_class.style = CS_HREDRAW | CS_VREDRAW;
-    window_class.lpfnWndProc = window_proc;
-    window_class.hbrBackground = (HBRUSH)(COLOR_WINDOW + 1);
-    window_class.lpszClassName = CLASSNAME;
-    window_class.hInstance = hinstance;
-    window_class.hCursor = LoadCursorW(NULL, IDC_ARROW);
-    if (!RegisterClassW(&window_class)) {
-        fprintf(stderr, "RegisterClassA failed, err:%d\n", GetLastError());
-    }
+    thread_pool_start(get_processor_count());
 
-    HWND window = CreateWindowW(CLASSNAME, L"Qed", WS_OVERLAPPEDWINDOW | WS_VISIBLE, CW_USEDEFAULT, CW_USEDEFAULT, WIDTH, HEIGHT, NULL, NULL, hinstance, NULL);
-    {
-        RECT rc = {0, 0, WIDTH, HEIGHT};
-        AdjustWindowRect(&rc, WS_OVERLAPPEDWINDOW, FALSE);
-        SetWindowPos(window, HWND_NOTOPMOST, 0, 0, rc.right - rc.left, rc.bottom - rc.top, SWP_NOMOVE|SWP_NOZORDER);
-    }
+    Win32_Window_Start window_start = {};
+    window_start.ready = create_semaphore(0);
+    create_thread(win32_window_thread, &window_start);
+    semaphore_wait(window_start.ready);
+    HWND window = window_start.window;
 
     UINT dpi = GetDpiForWindow(window);
 
-    void d3d11_initialize_devices(uint32 width, uint32 height, HWND window_handle);
-    d3d11_initialize_devices(WIDTH, HEIGHT, window);
+    Render_Backend *make_d3d11_backend(uint32 width, uint32 height, HWND window_handle);
+    render_backend = make_d3d11_backend(WIDTH, HEIGHT, window);
+    renderer_start(&renderer, render_backend);
 
     Theme *load_theme(const char *file_name);
     Theme *theme = load_theme("themes/gruvbox.qed-theme");
 
     View *view = new View();
     view->rect = { 0.0f, 0.0f, (float)WIDTH, (float)HEIGHT };
-    view->buffer = make_buffer_from_file(file_name);
-    view->buffer->post_self_insert_hook = default_post_self_insert_hook;
-    view->cursor = {};
     view->face = load_font_face("fonts/consolas.ttf", 10);
-    view->y_off = 0;
     view->theme = theme;
     view->key_map = default_key_map;
+    if (!view_open_file(view, file_name)) exit(1);
+    view->buffer->post_self_insert_hook = default_post_self_insert_hook;
 
     View *find_file_view = new View();
     find_file_view->rect = { 0.15 * WIDTH, 0.1f * HEIGHT, 0.85f * WIDTH, 0.5f * HEIGHT };
     find_file_view->buffer = make_buffer("find_file");
-    String current_dir = STRZ(path_current_dir());
-    buffer_insert_text(find_file_view->buffer, 0, current_dir);
-    find_file_view->cursor = get_cursor_from_position(find_file_view->buffer, buffer_get_length(find_file_view->buffer));
-    find_file_view->buffer->post_self_insert_hook = find_file_post_self_insert_hook;
     find_file_view->face = load_font_face("fonts/SegUI.ttf", 12);
-    find_file_view->y_off = 0;
+    find_file_view->scroll_row = 0;
     find_file_view->theme = load_theme("themes/gruvbox.qed-theme");
     find_file_view->key_map = make_find_file_key_map();
     find_file_dialog.view = find_file_view;
+    char *current_dir = path_current_dir();
+    find_file_dialog.index = file_index_open(current_dir);
+    find_file_dialog.query_version = -1;
+    free(current_dir);
+
+    View *prompt_view = new View();
+    prompt_view->rect = find_file_view->rect;
+    prompt_view->buffer = make_buffer("prompt");
+    prompt_view->face = find_file_view->face;
+    prompt_view->theme = find_file_view->theme;
+    prompt_view->key_map = make_prompt_key_map();
+    prompt.view = prompt_view;
 
     active_view = view;
  
     while (!window_should_close) {
-        MSG message;
-        while (PeekMessageW(&message, NULL, 0, 0, PM_REMOVE)) {
-            if (message.message == WM_QUIT) {
-                window_should_close = true;
-            }
-            TranslateMessage(&message);
-            DispatchMessageW(&message);
+        buffer_index_update(view->buffer);
+        view_resolve_estimate(view, false);
+        follows_update(view);
+        reload_update(view);
+        diff_view_update(view);
+        registry_update(&registry, buffer_is_busy, view);
+        find_file_update(&find_file_dialog);
+        preload_update(&preloader);
+        for (size_t i = 0; i < registry.entries.count; i++) {
+            Buffer *buffer = registry.entries[i].buffer;
+            if (buffer && buffer->journal) journal_update(buffer->journal);
         }
+        win32_update_window_title(window, view);
 
-        for (int i = 0; i < system_events.count; i++) {
-            System_Event *event = system_events[i];
-            switch (event->type) {
-            case SYSTEM_EVENT_WINDOW_RESIZE:
-            {
-                Window_Resize *resize_event = static_cast<Window_Resize *>(event);
-                //d3d11_resize_render_target(resize_event->width, resize_event->height);
-                free(event);
-                break;
-            }
-            }
+        // Every event since the last frame, in the order it came
+        frame_events.reset_count();
+        System_Event event;
+        while (input_ring_pop(&input_ring, &event)) {
+            frame_events.push(event);
         }
-        system_events.reset_count();
-
-        if (active_key_stroke) {
-            uint16 key = key_stroke_to_key(active_key_stroke);
-            assert(key < MAX_KEY_COUNT);
-            Key_Command *command = &active_view->key_map->commands[key];
-            if (command->procedure) {
-                command->procedure();
-            }
+        handle_events(&frame_events);
 
-            free(active_key_stroke);
-            active_key_stroke = nullptr;
-
-            if (active_text_input) free(active_text_input);
-            active_text_input = nullptr;
-        }
+        thread_pool_run_completions(THREAD_POOL_COMPLETION_BUDGET);
+        project_search_update(project_search, search_results_buffer);
+        occur_update(current_occur, occur_results_buffer);
 
         int width, height;
         win32_get_window_size(window, &width, &height);
         v2 render_dim = V2((float)width, (float)height);
 
-        render_target.width = width;
-        render_target.height = height;
-        render_target.current = nullptr;
-        render_target.groups.reset_count();
+        // Drawn and presented on the render thread while the next frame runs
+        Render_Target *render_target = renderer_begin_frame(&renderer, width, height);
+        draw_view(render_target, view);
+        draw_find_file_dialog(render_target, &find_file_dialog);
+        draw_prompt(render_target, &prompt);
+        renderer_end_frame(&renderer);
 
-        draw_view(&render_target, view);
-        draw_find_file_dialog(&render_target, &find_file_dialog);
-
-        void d3d11_render(Render_Target *target);
-        d3d11_render(&render_target);
+        renderer_wait(&renderer, &input_ring);
+    }
+    renderer_stop(&renderer);
+
+    Session_Entry *entry = session_find(&session, view->buffer->file_name);
+    if (entry) session_store_view(entry, view);
+    session_save(&session, SESSION_FILE_NAME);
+    file_index_save(find_file_dialog.index);
+    preload_cancel_all(&preloader);
+    for (size_t i = 0; i < registry.entries.count; i++) {
+        Buffer *buffer = registry.entries[i].buffer;
+        if (buffer) journal_close(buffer->journal);
     }
-
     return 0;
 }